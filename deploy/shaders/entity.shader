@@ -4,10 +4,12 @@
     uniform mat4 worldviewproj;
     uniform mat4 worldview;
     uniform mat4 view_to_light;
+    uniform vec4 mesh_color;
 
     out vec2 tex;
     out vec4 light_pos;
     out float NdotL;
+    out vec4 color_in;
 
     layout (location = 0) in vec3 position;
     layout (location = 1) in vec3 normal;
@@ -19,21 +21,53 @@
       NdotL = dot(normal, vec3(0.485, 0.485, 0.727));
 
       tex = uv;
+      color_in = mesh_color;
 
       // transform the position to light projection space
       vec4 view_pos = worldview * vec4(position, 1);
       light_pos = view_to_light * view_pos;
     }
   ]]></source>
+  <source name="vertex-instanced"><![CDATA[
+    // worldviewproj and worldview don't include the world transform here, that comes from the instance.
+    uniform mat4 worldviewproj;
+    uniform mat4 worldview;
+    uniform mat4 view_to_light;
+
+    out vec2 tex;
+    out vec4 light_pos;
+    out float NdotL;
+    out vec4 color_in;
+
+    layout (location = 0) in vec3 position;
+    layout (location = 1) in vec3 normal;
+    layout (location = 2) in vec2 uv;
+    layout (location = 3) in mat4 instance_transform;
+    layout (location = 7) in vec4 instance_color;
+
+    void main() {
+      vec4 world_pos = instance_transform * vec4(position, 1);
+      gl_Position = worldviewproj * world_pos;
+
+      NdotL = dot(normal, vec3(0.485, 0.485, 0.727));
+
+      tex = uv;
+      color_in = instance_color;
+
+      // transform the position to light projection space
+      vec4 view_pos = worldview * world_pos;
+      light_pos = view_to_light * view_pos;
+    }
+  ]]></source>
   <source name="fragment"><![CDATA[
     in vec2 tex;
     in vec4 light_pos;
     in float NdotL;
+    in vec4 color_in;
 
     out vec4 color;
 
     uniform sampler2D entity_texture;
-    uniform vec4 mesh_color;
 
     void main() {
       // work out how much this pixel is being affected by shadow(s)
@@ -43,7 +77,7 @@
       vec4 base_color = texture(entity_texture, tex);
 
       // blend the color with the "mesh" color based on the texture's alpha channel
-      base_color.rgb = (base_color.rgb * base_color.a) + (mesh_color.rgb * (1 - base_color.a));
+      base_color.rgb = (base_color.rgb * base_color.a) + (color_in.rgb * (1 - base_color.a));
       base_color.a   = 1.0;
 
       // then figure out the "real" color by applying the light calculation
@@ -61,4 +95,11 @@
     <state name="z-test" value="on" />
     <state name="blend" value="off" />
   </program>
+  <program name="default-instanced">
+    <vertex-shader source="vertex-instanced" />
+    <fragment-shader source="fragment" />
+    <state name="z-write" value="on" />
+    <state name="z-test" value="on" />
+    <state name="blend" value="off" />
+  </program>
 </shader>
@@ -5,21 +5,32 @@
     uniform mat4 worldview;
     uniform mat4 lightviewproj;
 
+    // The distance between vertices at the LOD we're drawing, and how far we've morphed towards the next LOD.
+    uniform float lod_step;
+    uniform float morph;
+
     layout (location = 0) in vec3 position;
     layout (location = 1) in vec3 normal;
+    layout (location = 2) in vec2 morph_target;
 
     out vec2 tex;
     out vec4 light_pos;
     out float NdotL;
 
     void main() {
-      gl_Position = worldviewproj * vec4(position, 1);
+      // Vertices that aren't part of the next LOD slide up or down to it's surface (morph_target.x is the height of
+      // that surface here). The ones that are part of it already stay where they are.
+      vec2 next_lod = mod(position.xz, 2.0 * lod_step);
+      float vertex_morph = (next_lod.x != 0.0 || next_lod.y != 0.0) ? morph : 0.0;
+      vec3 pos = vec3(position.x, mix(position.y, morph_target.x, vertex_morph), position.z);
+
+      gl_Position = worldviewproj * vec4(pos, 1);
       NdotL = dot(normal, vec3(0.485, 0.485, 0.727));
 
-      tex = vec2(position.x, position.z);
+      tex = vec2(pos.x, pos.z);
 
       // transform the position to light projection space
-      light_pos = lightviewproj * vec4(position, 1);
+      light_pos = lightviewproj * vec4(pos, 1);
     }
   ]]></source>
   <source name="fragment"><![CDATA[
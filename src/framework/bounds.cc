@@ -0,0 +1,163 @@
+#include <framework/bounds.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace fw {
+
+Bounds::Bounds() : radius_(0.0f), empty_(true) {
+}
+
+Bounds::Bounds(Vector const &min, Vector const &max) :
+    min_(min), max_(max), center_((min + max) * 0.5f), radius_(((max - min) * 0.5f).length()), empty_(false) {
+}
+
+Bounds::Bounds(Vector const &min, Vector const &max, Vector const &center, float radius) :
+    min_(min), max_(max), center_(center), radius_(radius), empty_(false) {
+}
+
+void Bounds::merge(Bounds const &other) {
+  if (other.empty_) {
+    return;
+  }
+  if (empty_) {
+    *this = other;
+    return;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    min_[i] = std::min(min_[i], other.min_[i]);
+    max_[i] = std::max(max_[i], other.max_[i]);
+  }
+
+  // The smallest sphere around both spheres, unless one of them is already inside the other.
+  const Vector offset = other.center_ - center_;
+  const float distance = offset.length();
+  if (distance + other.radius_ <= radius_) {
+    return;
+  }
+  if (distance + radius_ <= other.radius_) {
+    center_ = other.center_;
+    radius_ = other.radius_;
+    return;
+  }
+  const float radius = (distance + radius_ + other.radius_) * 0.5f;
+  center_ = center_ + offset * ((radius - radius_) / distance);
+  radius_ = radius;
+}
+
+float Bounds::get_distance(Vector const &point) const {
+  float distance_squared = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    const float d = std::max(std::max(min_[i] - point[i], point[i] - max_[i]), 0.0f);
+    distance_squared += d * d;
+  }
+  return std::sqrt(distance_squared);
+}
+
+Bounds Bounds::transformed(Matrix const &m) const {
+  if (empty_) {
+    return *this;
+  }
+
+  Vector min;
+  Vector max;
+  for (int i = 0; i < 8; i++) {
+    const Vector corner =
+        m * Vector((i & 1) ? max_[0] : min_[0], (i & 2) ? max_[1] : min_[1], (i & 4) ? max_[2] : min_[2]);
+    if (i == 0) {
+      min = max = corner;
+      continue;
+    }
+    for (int j = 0; j < 3; j++) {
+      min[j] = std::min(min[j], corner[j]);
+      max[j] = std::max(max[j], corner[j]);
+    }
+  }
+
+  // The radius scales by however much the matrix stretches things in the direction it stretches them the most.
+  float scale = 0.0f;
+  for (int col = 0; col < 3; col++) {
+    scale = std::max(scale, Vector(m.m[col][0], m.m[col][1], m.m[col][2]).length());
+  }
+  return Bounds(min, max, m * center_, radius_ * scale);
+}
+
+//-----------------------------------------------------------------------------
+
+Frustum::Frustum(Matrix const &viewproj) {
+  // Each plane is the last row of the matrix plus or minus one of the others (see Gribb & Hartmann, "Fast Extraction
+  // of Viewing Frustum Planes from the World-View-Projection Matrix").
+  for (int i = 0; i < kNumPlanes; i++) {
+    const int row = i / 2;
+    const float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+    Vector4 plane;
+    for (int col = 0; col < 4; col++) {
+      plane[col] = viewproj.elem(3, col) + (sign * viewproj.elem(row, col));
+    }
+
+    const float length = Vector(plane[0], plane[1], plane[2]).length();
+    if (length > 0.0f) {
+      for (int col = 0; col < 4; col++) {
+        plane[col] /= length;
+      }
+    }
+    planes_[i] = plane;
+  }
+}
+
+Frustum::Frustum(CameraRenderState const &camera) : Frustum(camera.view * camera.projection) {
+}
+
+Frustum::Result Frustum::test(Bounds const &bounds) const {
+  if (bounds.is_empty()) {
+    return Result::kIntersecting;
+  }
+
+  // First the sphere: if it's completely outside any plane, we're done. If it's inside all of them, so is the box.
+  Vector const &center = bounds.get_center();
+  const float radius = bounds.get_radius();
+  bool sphere_inside = true;
+  for (int i = 0; i < kNumPlanes; i++) {
+    Vector4 const &plane = planes_[i];
+    const float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+    if (distance < -radius) {
+      return Result::kOutside;
+    }
+    if (distance < radius) {
+      sphere_inside = false;
+    }
+  }
+  if (sphere_inside) {
+    return Result::kInside;
+  }
+
+  // Then the box. For each plane, we test the corner that's furthest along the plane's normal (if it's outside, the
+  // whole box is) and the one that's furthest the other way (if it's outside, the box crosses the plane).
+  Vector const &min = bounds.get_min();
+  Vector const &max = bounds.get_max();
+  Result result = Result::kInside;
+  for (int i = 0; i < kNumPlanes; i++) {
+    Vector4 const &plane = planes_[i];
+    float near_distance = plane[3];
+    float far_distance = plane[3];
+    for (int j = 0; j < 3; j++) {
+      if (plane[j] >= 0.0f) {
+        far_distance += plane[j] * max[j];
+        near_distance += plane[j] * min[j];
+      } else {
+        far_distance += plane[j] * min[j];
+        near_distance += plane[j] * max[j];
+      }
+    }
+    if (far_distance < 0.0f) {
+      return Result::kOutside;
+    }
+    if (near_distance < 0.0f) {
+      result = Result::kIntersecting;
+    }
+  }
+  return result;
+}
+
+}
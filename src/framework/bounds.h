@@ -0,0 +1,83 @@
+#pragma once
+
+#include <framework/camera.h>
+#include <framework/math.h>
+
+namespace fw {
+
+// The bounds of a mesh (or a whole hierarchy of them), as both an axis-aligned box and a sphere. The sphere is quicker
+// to test against a Frustum, but the box is usually a tighter fit, so we test the sphere first and only bother with the
+// box if the sphere is on the edge.
+class Bounds {
+private:
+  Vector min_;
+  Vector max_;
+  Vector center_;
+  float radius_;
+  bool empty_;
+
+public:
+  // Empty bounds, which you can merge other bounds into. Things with empty bounds are never culled.
+  Bounds();
+
+  // Bounds with the given box, and the sphere around it.
+  Bounds(Vector const &min, Vector const &max);
+
+  // Bounds with the given box and sphere, e.g. if you've worked out a tighter sphere from the actual vertices.
+  Bounds(Vector const &min, Vector const &max, Vector const &center, float radius);
+
+  bool is_empty() const {
+    return empty_;
+  }
+  Vector const &get_min() const {
+    return min_;
+  }
+  Vector const &get_max() const {
+    return max_;
+  }
+  Vector const &get_center() const {
+    return center_;
+  }
+  float get_radius() const {
+    return radius_;
+  }
+
+  // Grows these bounds to include the other ones as well.
+  void merge(Bounds const &other);
+
+  // The distance from the given point to the closest point in the box (zero if the point is inside it).
+  float get_distance(Vector const &point) const;
+
+  // Returns bounds that contain these ones after they've been transformed by the given (affine) matrix. The box is
+  // the box around the transformed corners, so it can get bigger than it needs to be if there's any rotation.
+  Bounds transformed(Matrix const &m) const;
+};
+
+// The six planes of a camera's view volume. You can test Bounds against it to see whether they're on screen.
+class Frustum {
+public:
+  enum class Result {
+    kOutside,
+    kIntersecting,
+    kInside,
+  };
+
+private:
+  // Each plane is (a, b, c, d), normalized, with the inside being where ax + by + cz + d >= 0.
+  static const int kNumPlanes = 6;
+  Vector4 planes_[kNumPlanes];
+
+public:
+  // Makes the frustum for the given combined view and projection matrix (i.e. view * projection).
+  explicit Frustum(Matrix const &viewproj);
+  explicit Frustum(CameraRenderState const &camera);
+
+  // Tests the given (world space) bounds against the frustum.
+  Result test(Bounds const &bounds) const;
+
+  bool is_visible(Bounds const &bounds) const {
+    return test(bounds) != Result::kOutside;
+  }
+};
+
+}
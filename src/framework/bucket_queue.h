@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace fw {
+
+// A monotone priority queue of item indices, keyed by a non-negative float, for searches (like A* with a consistent
+// heuristic) where the keys popped never go far below the last key popped. Keys are quantized into buckets of
+// 1/kBucketsPerUnit, and the items within a bucket come out last-in first-out, which tends to favour the nodes we
+// just found (i.e. the ones furthest along the path).
+//
+// Unlike IndexedHeap, there's no decrease-key: to lower an item's key, just push it again and skip the stale copy
+// when it's popped (callers generally know this already from their own per-search "run stamps"). Pushing and popping
+// are O(1), which is much cheaper than sifting a heap with thousands of entries. Buckets keep their capacity across
+// clear(), so once a queue has warmed up it doesn't allocate any more.
+class BucketQueue {
+public:
+  static constexpr float kBucketsPerUnit = 16.0f;
+
+  inline BucketQueue() : cursor_(0), end_(0), size_(0) {
+  }
+
+  inline void clear() {
+    for (size_t i = cursor_; i < end_; i++) {
+      buckets_[i].clear();
+    }
+    cursor_ = 0;
+    end_ = 0;
+    size_ = 0;
+  }
+  inline bool empty() const {
+    return size_ == 0;
+  }
+  inline size_t size() const {
+    return size_;
+  }
+
+  inline void push(int item, float key) {
+    const size_t bucket = static_cast<size_t>(key * kBucketsPerUnit);
+    if (bucket >= buckets_.size()) {
+      buckets_.resize(bucket + 1 + (bucket / 2));
+    }
+    buckets_[bucket].push_back(item);
+
+    if (size_ == 0 || bucket < cursor_) {
+      cursor_ = bucket;
+    }
+    if (bucket >= end_) {
+      end_ = bucket + 1;
+    }
+    size_++;
+  }
+
+  // Removes and returns one of the items in the lowest non-empty bucket.
+  inline int pop() {
+    while (buckets_[cursor_].empty()) {
+      cursor_++;
+    }
+
+    std::vector<int> &bucket = buckets_[cursor_];
+    const int item = bucket.back();
+    bucket.pop_back();
+    size_--;
+    return item;
+  }
+
+private:
+  std::vector<std::vector<int>> buckets_;
+
+  // All of the items are in buckets [cursor_, end_).
+  size_t cursor_;
+  size_t end_;
+  size_t size_;
+};
+
+}
@@ -9,6 +9,7 @@
 #include <framework/gui/widget.h>
 #include <framework/gui/window.h>
 #include <framework/particle_manager.h>
+#include <framework/scenegraph.h>
 #include <framework/service_locator.h>
 #include <framework/settings.h>
 #include <framework/timer.h>
@@ -19,6 +20,8 @@ using namespace gui;
 enum ids {
   FPS_ID = 308724,
   PARTICLES_ID,
+  VISIBLE_ID,
+  SHADOW_ID,
 };
 
 DebugView::DebugView() : wnd_(nullptr), time_to_update_(9999.9f) {
@@ -33,7 +36,7 @@ void DebugView::initialize() {
 
     wnd_ = Builder<Window>()
 			<< Widget::width(LayoutParams::Mode::kFixed, 190)
-      << Widget::height(LayoutParams::Mode::kFixed, 40)
+      << Widget::height(LayoutParams::Mode::kFixed, 80)
       << (Builder<Label>()
 				  << Widget::width(LayoutParams::Mode::kMatchParent, 0)
 				  << Widget::height(LayoutParams::Mode::kFixed, 20)
@@ -43,7 +46,17 @@ void DebugView::initialize() {
           << Widget::width(LayoutParams::Mode::kMatchParent, 0)
           << Widget::height(LayoutParams::Mode::kFixed, 20)
           << Label::text_align(Label::Alignment::kRight)
-          << Widget::id(PARTICLES_ID));
+          << Widget::id(PARTICLES_ID))
+      << (Builder<Label>()
+          << Widget::width(LayoutParams::Mode::kMatchParent, 0)
+          << Widget::height(LayoutParams::Mode::kFixed, 20)
+          << Label::text_align(Label::Alignment::kRight)
+          << Widget::id(VISIBLE_ID))
+      << (Builder<Label>()
+          << Widget::width(LayoutParams::Mode::kMatchParent, 0)
+          << Widget::height(LayoutParams::Mode::kFixed, 20)
+          << Label::text_align(Label::Alignment::kRight)
+          << Widget::id(SHADOW_ID));
     fw::Get<Gui>().AttachWindow(wnd_);
   }
 }
@@ -70,6 +83,14 @@ void DebugView::update(float dt) {
     particles->set_text(
       absl::StrCat(frmwrk->get_particle_mgr()->get_num_active_particles(), " particles"));
 
+    auto sg_mgr = frmwrk->get_scenegraph_manager();
+    auto visible = wnd_->Find<Label>(VISIBLE_ID);
+    visible->set_text(
+      absl::StrCat(sg_mgr->get_num_visible_nodes(), " visible, ", sg_mgr->get_num_culled_nodes(), " culled"));
+
+    auto shadow = wnd_->Find<Label>(SHADOW_ID);
+    shadow->set_text(absl::StrCat(sg_mgr->get_num_shadow_casters(), " shadow casters"));
+
     time_to_update_ = 1.0f;
   }
 }
@@ -0,0 +1,140 @@
+#include <framework/dynamic_ring_buffer.h>
+
+#include <framework/graphics.h>
+#include <framework/logging.h>
+
+namespace fw {
+namespace {
+
+// The real backend: a GL buffer that's mapped for the whole time it's alive (persistent and coherent, so we don't have
+// to flush anything), with a fence sync per region.
+class GlRingBufferBackend : public RingBufferBackend {
+private:
+  std::shared_ptr<VertexBuffer> vb_;
+  GLsync fences_[DynamicRingBuffer::kNumRegions];
+
+public:
+  GlRingBufferBackend(VertexBuffer::setup_fn setup, size_t vertex_size) :
+      vb_(std::make_shared<VertexBuffer>(setup, vertex_size, true)) {
+    for (int i = 0; i < DynamicRingBuffer::kNumRegions; i++) {
+      fences_[i] = nullptr;
+    }
+  }
+
+  ~GlRingBufferBackend() {
+    FW_ENSURE_RENDER_THREAD();
+    for (int i = 0; i < DynamicRingBuffer::kNumRegions; i++) {
+      if (fences_[i] != nullptr) {
+        glDeleteSync(fences_[i]);
+      }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vb_->get_id());
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  uint8_t *create(size_t size) override {
+    FW_ENSURE_RENDER_THREAD();
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBindBuffer(GL_ARRAY_BUFFER, vb_->get_id());
+    glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+    void *data = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (data == nullptr) {
+      LOG(ERR) << "couldn't map ring buffer of " << size << " bytes: " << glGetError();
+    }
+    return static_cast<uint8_t *>(data);
+  }
+
+  void fence(int region) override {
+    if (fences_[region] != nullptr) {
+      glDeleteSync(fences_[region]);
+    }
+    fences_[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  void wait(int region) override {
+    if (fences_[region] == nullptr) {
+      return;
+    }
+
+    GLenum result;
+    do {
+      result = glClientWaitSync(fences_[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 /* 1ms */);
+    } while (result == GL_TIMEOUT_EXPIRED);
+    if (result == GL_WAIT_FAILED) {
+      LOG(ERR) << "waiting for ring buffer fence failed: " << glGetError();
+    }
+
+    glDeleteSync(fences_[region]);
+    fences_[region] = nullptr;
+  }
+
+  std::shared_ptr<VertexBuffer> get_vertex_buffer() const override {
+    return vb_;
+  }
+};
+
+}
+
+DynamicRingBuffer::DynamicRingBuffer(std::unique_ptr<RingBufferBackend> backend, int vertex_size, int max_vertices) :
+    backend_(std::move(backend)), data_(nullptr), vertex_size_(vertex_size), region_vertices_(max_vertices),
+    region_(kNumRegions - 1), used_vertices_(max_vertices) {
+  data_ = backend_->create(static_cast<size_t>(vertex_size_) * region_vertices_ * kNumRegions);
+  if (data_ == nullptr) {
+    // With no room in the regions, every allocation will fail.
+    region_vertices_ = 0;
+    used_vertices_ = 0;
+  }
+}
+
+void DynamicRingBuffer::begin_frame() {
+  region_ = (region_ + 1) % kNumRegions;
+  backend_->wait(region_);
+  used_vertices_ = 0;
+}
+
+void DynamicRingBuffer::end_frame() {
+  backend_->fence(region_);
+}
+
+void *DynamicRingBuffer::allocate(int num_vertices, int *first_vertex) {
+  if (num_vertices > get_remaining_vertices()) {
+    return nullptr;
+  }
+
+  *first_vertex = (region_ * region_vertices_) + used_vertices_;
+  used_vertices_ += num_vertices;
+  return data_ + (static_cast<size_t>(*first_vertex) * vertex_size_);
+}
+
+/* static */
+std::shared_ptr<IndexBuffer> DynamicRingBuffer::get_quad_index_buffer() {
+  FW_ENSURE_RENDER_THREAD();
+  static std::shared_ptr<IndexBuffer> ib;
+  if (!ib) {
+    std::vector<uint16_t> indices;
+    indices.reserve(kMaxQuadsPerDraw * 6);
+    for (int i = 0; i < kMaxQuadsPerDraw; i++) {
+      const uint16_t base = static_cast<uint16_t>(i * 4);
+      indices.push_back(base);
+      indices.push_back(base + 1);
+      indices.push_back(base + 2);
+      indices.push_back(base);
+      indices.push_back(base + 2);
+      indices.push_back(base + 3);
+    }
+
+    ib = std::make_shared<IndexBuffer>();
+    ib->set_data(static_cast<int>(indices.size()), indices.data());
+  }
+  return ib;
+}
+
+/* static */
+std::unique_ptr<RingBufferBackend> DynamicRingBuffer::create_gl_backend(
+    std::function<void()> setup, size_t vertex_size) {
+  return std::make_unique<GlRingBufferBackend>(setup, vertex_size);
+}
+
+}
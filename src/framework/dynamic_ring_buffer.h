@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace fw {
+class IndexBuffer;
+class VertexBuffer;
+
+// The thing that actually owns the memory behind a DynamicRingBuffer. The real one is a persistently-mapped GL buffer,
+// but the DynamicRingBuffer only talks to it through this so that it (and everything that fills it) can be run
+// without a GL context, with a MockRingBufferBackend.
+class RingBufferBackend {
+public:
+  virtual ~RingBufferBackend() {
+  }
+
+  // Creates the buffer, size bytes big, and returns a pointer to it that we can write to for as long as the backend
+  // is alive.
+  virtual uint8_t *create(size_t size) = 0;
+
+  // Marks the point (in the GPU's command stream) after which the GPU is done with the given region.
+  virtual void fence(int region) = 0;
+
+  // Waits until the GPU has passed the fence for the given region. Returns straight away if there's no fence.
+  virtual void wait(int region) = 0;
+
+  // The VertexBuffer to draw from, if there is one.
+  virtual std::shared_ptr<VertexBuffer> get_vertex_buffer() const {
+    return nullptr;
+  }
+};
+
+// A RingBufferBackend that's just plain memory. It keeps track of the fences so tests can check we wait for the
+// right regions.
+class MockRingBufferBackend : public RingBufferBackend {
+private:
+  std::vector<uint8_t> data_;
+  std::vector<bool> fenced_;
+  int num_waits_;
+
+public:
+  MockRingBufferBackend() : num_waits_(0) {
+  }
+
+  uint8_t *create(size_t size) override {
+    data_.resize(size);
+    return data_.data();
+  }
+
+  void fence(int region) override {
+    if (static_cast<int>(fenced_.size()) <= region) {
+      fenced_.resize(region + 1, false);
+    }
+    fenced_[region] = true;
+  }
+
+  void wait(int region) override {
+    if (static_cast<int>(fenced_.size()) > region && fenced_[region]) {
+      fenced_[region] = false;
+      num_waits_++;
+    }
+  }
+
+  // The number of times we've waited for a region that had a fence on it.
+  int get_num_waits() const {
+    return num_waits_;
+  }
+
+  // What's been written to the buffer, so tests can check it.
+  uint8_t const *get_data() const {
+    return data_.data();
+  }
+};
+
+// A vertex buffer for geometry that's rebuilt every frame (particles, mostly). Rather than uploading a new buffer for
+// each draw, the buffer is mapped once and split into kNumRegions regions: each frame writes into the next region,
+// while the GPU is still drawing from the previous ones. We only have to wait if the GPU falls more than two frames
+// behind.
+//
+// Everything in here must be called on the render thread.
+class DynamicRingBuffer {
+public:
+  static const int kNumRegions = 3;
+
+  // The most quads you can draw from the quad index buffer in one go. It's limited by the 16-bit indices.
+  static const int kMaxQuadsPerDraw = 16384;
+
+private:
+  std::unique_ptr<RingBufferBackend> backend_;
+  uint8_t *data_;
+  int vertex_size_;
+  int region_vertices_;
+
+  // The region we're writing to this frame, and how many vertices we've written to it so far.
+  int region_;
+  int used_vertices_;
+
+public:
+  // Creates a buffer that can hold up to max_vertices vertices (each vertex_size bytes) per frame.
+  DynamicRingBuffer(std::unique_ptr<RingBufferBackend> backend, int vertex_size, int max_vertices);
+  DynamicRingBuffer(DynamicRingBuffer const &) = delete;
+
+  // Creates a buffer backed by GL, for vertices of type T (one of the fw::vertex types).
+  template<typename T>
+  static std::unique_ptr<DynamicRingBuffer> create(int max_vertices) {
+    return std::make_unique<DynamicRingBuffer>(
+        create_gl_backend(T::get_setup_function(), sizeof(T)), sizeof(T), max_vertices);
+  }
+
+  // Moves on to the next region, waiting for the GPU to finish with it first if we have to.
+  void begin_frame();
+
+  // Fences the region we wrote to this frame, call this after the last draw that uses it.
+  void end_frame();
+
+  // Allocates room for num_vertices vertices in this frame's region and returns a pointer to write them to, or
+  // nullptr if there's no room left this frame. first_vertex is set to the index of the first vertex in the whole
+  // buffer, which is the base vertex you draw with.
+  void *allocate(int num_vertices, int *first_vertex);
+
+  template<typename T>
+  T *allocate(int num_vertices, int *first_vertex) {
+    return static_cast<T *>(allocate(num_vertices, first_vertex));
+  }
+
+  // The number of vertices we've still got room for this frame.
+  int get_remaining_vertices() const {
+    return region_vertices_ - used_vertices_;
+  }
+
+  std::shared_ptr<VertexBuffer> get_vertex_buffer() const {
+    return backend_->get_vertex_buffer();
+  }
+
+  // Gets an index buffer that draws quads (four vertices each, in order) as triangle lists: 0, 1, 2, 0, 2, 3, then
+  // 4, 5, 6, 4, 6, 7 and so on, for up to kMaxQuadsPerDraw quads. It's shared by everybody who draws quads.
+  static std::shared_ptr<IndexBuffer> get_quad_index_buffer();
+
+private:
+  static std::unique_ptr<RingBufferBackend> create_gl_backend(std::function<void()> setup, size_t vertex_size);
+};
+
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+
+#include <framework/math.h>
+
+namespace fw {
+
+// A fixed-point number with 16 bits before the point and 16 after. The simulation uses these (rather than floats) for
+// anything that has to come out exactly the same for every player: everything here is integer arithmetic, so unlike
+// floats, the answer doesn't depend on the compiler, the optimization level, whether multiply-adds get fused or
+// whether -ffast-math is on.
+//
+// The range is about +/-32768 with a precision of 1/65536, which is plenty for positions and directions on a map.
+// Multiplication and division round towards negative infinity and zero respectively, the same as the integer ops.
+class Fixed {
+private:
+  int32_t raw_;
+
+  constexpr explicit Fixed(int32_t raw, bool) : raw_(raw) {}
+
+public:
+  static constexpr int kFractionBits = 16;
+  static constexpr int32_t kOne = 1 << kFractionBits;
+
+  constexpr Fixed() : raw_(0) {}
+
+  static constexpr Fixed from_raw(int32_t raw) {
+    return Fixed(raw, true);
+  }
+  static constexpr Fixed from_int(int value) {
+    return Fixed(static_cast<int32_t>(static_cast<uint32_t>(value) << kFractionBits), true);
+  }
+
+  // Converts from a float by truncating towards zero. Multiplying by a power of two and truncating are both exact, so
+  // this gives the same answer for the same float no matter how it was compiled.
+  static constexpr Fixed from_float(float value) {
+    return Fixed(static_cast<int32_t>(value * static_cast<float>(kOne)), true);
+  }
+
+  // Converts to a float for things that don't have to be exact (mostly drawing). The same fixed value always gives
+  // the same float.
+  constexpr float to_float() const {
+    return static_cast<float>(raw_) * (1.0f / static_cast<float>(kOne));
+  }
+
+  constexpr int32_t raw() const {
+    return raw_;
+  }
+
+  constexpr Fixed operator-() const {
+    return from_raw(-raw_);
+  }
+  constexpr Fixed operator+(Fixed rhs) const {
+    return from_raw(raw_ + rhs.raw_);
+  }
+  constexpr Fixed operator-(Fixed rhs) const {
+    return from_raw(raw_ - rhs.raw_);
+  }
+  constexpr Fixed operator*(Fixed rhs) const {
+    return from_raw(static_cast<int32_t>((static_cast<int64_t>(raw_) * rhs.raw_) >> kFractionBits));
+  }
+
+  // Dividing by zero gives zero, rather than crashing the game.
+  constexpr Fixed operator/(Fixed rhs) const {
+    if (rhs.raw_ == 0) {
+      return Fixed();
+    }
+    return from_raw(static_cast<int32_t>((static_cast<int64_t>(raw_) * kOne) / rhs.raw_));
+  }
+
+  constexpr Fixed &operator+=(Fixed rhs) {
+    return (*this) = (*this) + rhs;
+  }
+  constexpr Fixed &operator-=(Fixed rhs) {
+    return (*this) = (*this) - rhs;
+  }
+  constexpr Fixed &operator*=(Fixed rhs) {
+    return (*this) = (*this) * rhs;
+  }
+  constexpr Fixed &operator/=(Fixed rhs) {
+    return (*this) = (*this) / rhs;
+  }
+
+  constexpr auto operator<=>(Fixed const &rhs) const = default;
+};
+
+// The square root of the given integer, rounded down. It's the digit-by-digit method, which always does the same 32
+// steps with no branches (just selects), so a batch of these can be done side-by-side with SIMD.
+constexpr uint32_t isqrt(uint64_t value) {
+  uint64_t result = 0;
+  uint64_t bit = static_cast<uint64_t>(1) << 62;
+  for (int i = 0; i < 32; i++) {
+    const uint64_t candidate = result + bit;
+    const uint64_t mask = (value >= candidate) ? ~static_cast<uint64_t>(0) : 0;
+    value -= candidate & mask;
+    result = (result >> 1) + (bit & mask);
+    bit >>= 2;
+  }
+  return static_cast<uint32_t>(result);
+}
+
+// The length of the vector with the given raw components. The sum of the squares has 32 bits after the point, so
+// it's square root has exactly the 16 we want.
+constexpr Fixed fixed_length(int32_t x, int32_t y, int32_t z) {
+  const uint64_t length_squared = static_cast<uint64_t>(static_cast<int64_t>(x) * x)
+      + static_cast<uint64_t>(static_cast<int64_t>(y) * y) + static_cast<uint64_t>(static_cast<int64_t>(z) * z);
+  return Fixed::from_raw(static_cast<int32_t>(isqrt(length_squared)));
+}
+
+// The shortest way from one coordinate to another in a world that's size across and wraps around at the edges. Both
+// coordinates are in [0, size), so it's never more than one size either way.
+constexpr int32_t wrap_delta(int32_t delta, int32_t size) {
+  const int32_t half = size / 2;
+  delta -= (delta > half) ? size : 0;
+  delta += (delta < -half) ? size : 0;
+  return delta;
+}
+
+// A vector of Fixed, for the simulation. Rendering (and anything else that doesn't have to be exact) uses fw::Vector,
+// and you can convert back and forth with from_vector and to_vector.
+class FixedVector {
+public:
+  Fixed x;
+  Fixed y;
+  Fixed z;
+
+  constexpr FixedVector() {}
+  constexpr FixedVector(Fixed x, Fixed y, Fixed z) : x(x), y(y), z(z) {}
+
+  static FixedVector from_vector(Vector const &v) {
+    return FixedVector(Fixed::from_float(v[0]), Fixed::from_float(v[1]), Fixed::from_float(v[2]));
+  }
+  Vector to_vector() const {
+    return Vector(x.to_float(), y.to_float(), z.to_float());
+  }
+
+  constexpr FixedVector operator+(FixedVector const &rhs) const {
+    return FixedVector(x + rhs.x, y + rhs.y, z + rhs.z);
+  }
+  constexpr FixedVector operator-(FixedVector const &rhs) const {
+    return FixedVector(x - rhs.x, y - rhs.y, z - rhs.z);
+  }
+  constexpr FixedVector operator*(Fixed scalar) const {
+    return FixedVector(x * scalar, y * scalar, z * scalar);
+  }
+  constexpr FixedVector &operator+=(FixedVector const &rhs) {
+    return (*this) = (*this) + rhs;
+  }
+  constexpr FixedVector &operator-=(FixedVector const &rhs) {
+    return (*this) = (*this) - rhs;
+  }
+  constexpr FixedVector &operator*=(Fixed scalar) {
+    return (*this) = (*this) * scalar;
+  }
+
+  constexpr bool operator==(FixedVector const &rhs) const = default;
+
+  constexpr Fixed length() const {
+    return fixed_length(x.raw(), y.raw(), z.raw());
+  }
+
+  // A vector of length one in the same direction, or zero if we're zero.
+  constexpr FixedVector normalized() const {
+    const Fixed len = length();
+    return FixedVector(x / len, y / len, z / len);
+  }
+};
+
+// The dot product is worked out at full precision and only rounded once, at the end.
+constexpr Fixed dot(FixedVector const &lhs, FixedVector const &rhs) {
+  const int64_t sum = static_cast<int64_t>(lhs.x.raw()) * rhs.x.raw() + static_cast<int64_t>(lhs.y.raw()) * rhs.y.raw()
+      + static_cast<int64_t>(lhs.z.raw()) * rhs.z.raw();
+  return Fixed::from_raw(static_cast<int32_t>(sum >> Fixed::kFractionBits));
+}
+
+constexpr FixedVector cross(FixedVector const &lhs, FixedVector const &rhs) {
+  return FixedVector(
+      lhs.y * rhs.z - lhs.z * rhs.y,
+      lhs.z * rhs.x - lhs.x * rhs.z,
+      lhs.x * rhs.y - lhs.y * rhs.x);
+}
+
+}
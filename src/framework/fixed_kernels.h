@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <framework/fixed.h>
+
+namespace fw {
+
+// Kernels that do the same simulation math to a whole batch of vectors at once. The vectors are stored as separate
+// arrays of x, y and z (rather than an array of FixedVector), and each kernel is a plain loop of integer arithmetic
+// with no branches, so the compiler can do several at a time with SIMD. Because it's all integers, doing them four or
+// eight at a time gives exactly the same answer as doing them one at a time: the scalar versions (which the
+// components use for one entity) share the same per-element code.
+//
+// They're all inline, so they're compiled with (and vectorized for) whatever flags the caller is compiled with.
+struct FixedVectorArray {
+  std::vector<Fixed> x;
+  std::vector<Fixed> y;
+  std::vector<Fixed> z;
+
+  int size() const {
+    return static_cast<int>(x.size());
+  }
+
+  void resize(int n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+  }
+
+  void set(int i, FixedVector const &v) {
+    x[i] = v.x;
+    y[i] = v.y;
+    z[i] = v.z;
+  }
+  FixedVector get(int i) const {
+    return FixedVector(x[i], y[i], z[i]);
+  }
+};
+
+// Wraps the given (integer) grid coordinate into [0, size).
+inline int32_t wrap_grid(int32_t value, int32_t size) {
+  value %= size;
+  return value + ((value < 0) ? size : 0);
+}
+
+// The height at (x, z), interpolated between the four vertices around it, in a width x length grid of heights that
+// wraps around at the edges. The heights are stored as floats (that's what the terrain is made of), each one is
+// converted to fixed before we interpolate.
+inline Fixed sample_height(float const *heights, int32_t width, int32_t length, Fixed x, Fixed z) {
+  constexpr int32_t kFractionMask = Fixed::kOne - 1;
+  const int32_t fx = x.raw() & kFractionMask;
+  const int32_t fz = z.raw() & kFractionMask;
+  const int32_t x0 = wrap_grid(x.raw() >> Fixed::kFractionBits, width);
+  const int32_t z0 = wrap_grid(z.raw() >> Fixed::kFractionBits, length);
+  const int32_t x1 = wrap_grid(x0 + 1, width);
+  const int32_t z1 = wrap_grid(z0 + 1, length);
+
+  const int64_t h00 = Fixed::from_float(heights[z0 * width + x0]).raw();
+  const int64_t h10 = Fixed::from_float(heights[z0 * width + x1]).raw();
+  const int64_t h01 = Fixed::from_float(heights[z1 * width + x0]).raw();
+  const int64_t h11 = Fixed::from_float(heights[z1 * width + x1]).raw();
+
+  const int64_t h0 = h00 + (((h10 - h00) * fx) >> Fixed::kFractionBits);
+  const int64_t h1 = h01 + (((h11 - h01) * fx) >> Fixed::kFractionBits);
+  return Fixed::from_raw(static_cast<int32_t>(h0 + (((h1 - h0) * fz) >> Fixed::kFractionBits)));
+}
+
+// The direction from `from` to `to`, the shortest way around a world that wraps at the edges. Heights don't wrap.
+inline FixedVector direction_to_wrapped(
+    FixedVector const &from, FixedVector const &to, Fixed world_width, Fixed world_length) {
+  return FixedVector(
+      Fixed::from_raw(wrap_delta(to.x.raw() - from.x.raw(), world_width.raw())),
+      to.y - from.y,
+      Fixed::from_raw(wrap_delta(to.z.raw() - from.z.raw(), world_length.raw())));
+}
+
+// out[i] = direction_to_wrapped(from[i], to[i]). out must be the same size as from and to.
+inline void direction_to_wrapped(FixedVectorArray const &from, FixedVectorArray const &to, Fixed world_width,
+    Fixed world_length, FixedVectorArray &out) {
+  const int n = from.size();
+  const int32_t width = world_width.raw();
+  const int32_t length = world_length.raw();
+  for (int i = 0; i < n; i++) {
+    out.x[i] = Fixed::from_raw(wrap_delta(to.x[i].raw() - from.x[i].raw(), width));
+    out.y[i] = to.y[i] - from.y[i];
+    out.z[i] = Fixed::from_raw(wrap_delta(to.z[i].raw() - from.z[i].raw(), length));
+  }
+}
+
+// out[i] = v[i].length(). out must have room for v.size() values.
+inline void lengths(FixedVectorArray const &v, Fixed *out) {
+  const int n = v.size();
+  for (int i = 0; i < n; i++) {
+    out[i] = fixed_length(v.x[i].raw(), v.y[i].raw(), v.z[i].raw());
+  }
+}
+
+// v[i] = v[i].normalized(), using lengths as scratch space (it must have room for v.size() values).
+inline void normalize(FixedVectorArray &v, Fixed *lengths_scratch) {
+  const int n = v.size();
+  lengths(v, lengths_scratch);
+  for (int i = 0; i < n; i++) {
+    v.x[i] /= lengths_scratch[i];
+    v.y[i] /= lengths_scratch[i];
+    v.z[i] /= lengths_scratch[i];
+  }
+}
+
+// out[i] = sample_height(heights, width, length, x[i], z[i]) for n points.
+inline void sample_heights(float const *heights, int32_t width, int32_t length, Fixed const *x, Fixed const *z,
+    Fixed *out, int n) {
+  for (int i = 0; i < n; i++) {
+    out[i] = sample_height(heights, width, length, x[i], z[i]);
+  }
+}
+
+}
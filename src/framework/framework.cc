@@ -30,6 +30,7 @@
 #include <framework/lang.h>
 #include <framework/misc.h>
 #include <framework/input.h>
+#include <framework/job_system.h>
 #include <framework/gui/gui.h>
 
 using namespace std::placeholders;
@@ -40,6 +41,9 @@ namespace {
 
 static std::thread::id g_update_thread_id;
 
+// We update at a fixed 40 times per second. The renderer interpolates between updates.
+const std::chrono::microseconds kUpdateInterval(1000000 / 40);
+
 }
 
 struct ScreenshotRequest {
@@ -56,7 +60,7 @@ Framework::Framework(BaseApp* app) :
     app_(app), active_(true), camera_(nullptr), paused_(false), particle_mgr_(nullptr),
     timer_(nullptr), audio_manager_(nullptr), input_(nullptr), lang_(nullptr),
     font_manager_(nullptr), model_manager_(nullptr), cursor_(nullptr),
-    debug_view_(nullptr), scenegraph_manager_(nullptr), running_(true) {
+    debug_view_(nullptr), scenegraph_manager_(nullptr), job_system_(nullptr), running_(true) {
   only_instance = this;
 }
 
@@ -81,6 +85,8 @@ Framework::~Framework() {
     delete debug_view_;
   if (audio_manager_ != nullptr)
     delete audio_manager_;
+  if (job_system_ != nullptr)
+    delete job_system_;
 }
 
 Framework *Framework::get_instance() {
@@ -102,6 +108,7 @@ fw::StatusOr<bool> Framework::initialize(char const *title) {
   }
 
   timer_ = new Timer();
+  job_system_ = new JobSystem(Settings::get<int>("job-threads"));
 
   // initialize graphics
   if (app_->wants_graphics()) {
@@ -247,9 +254,10 @@ void Framework::update_proc_impl() {
   LOG(INFO) << "application initialization complete, running...";
 
   int64_t accum_micros = 0;
-  int64_t timestep_micros = 1000000 / 40; // 40 frames per second update frequency.
+  const int64_t timestep_micros = kUpdateInterval.count();
   while (running_) {
     timer_->update();
+    const fw::Clock::time_point now = fw::Clock::now();
     accum_micros += std::chrono::duration_cast<std::chrono::microseconds>(
         timer_->get_frame_duration()).count();
 
@@ -263,6 +271,13 @@ void Framework::update_proc_impl() {
       float dt = static_cast<float>(timestep_micros) / 1000000.f;
       update(dt);
       accum_micros -= timestep_micros;
+
+      // Whatever is left in accum_micros is how far behind we are, so this update's state is for that long ago.
+      if (scenegraph_manager_ != nullptr) {
+        scenegraph_manager_->end_update(
+            now - std::chrono::microseconds(accum_micros),
+            camera_ != nullptr ? camera_->get_view_matrix() : fw::identity());
+      }
     }
 
     // TODO: should we yield or sleep for a while?
@@ -325,12 +340,13 @@ void Framework::render() {
 
   timer_->render();
 
-  scenegraph_manager_->before_render();
+  scenegraph_manager_->before_render(fw::Clock::now(), kUpdateInterval);
   
   auto& scenegraph = scenegraph_manager_->get_scenegraph();
-  scenegraph.push_camera(cam->get_render_state());
+  scenegraph.push_camera(scenegraph_manager_->interpolate_camera(cam->get_render_state()));
   fw::render(scenegraph);
   scenegraph.pop_camera();
+  scenegraph_manager_->after_render();
 
   // if we've been asked for some screenshots, take them after we've done the normal render.
   if (screenshot_requests_.size() > 0) {
@@ -415,7 +431,8 @@ void Framework::take_screenshots(sg::Scenegraph &scenegraph) {
     framebuffer->set_color_buffer(color_target);
     framebuffer->set_depth_buffer(depth_target);
 
-    scenegraph.push_camera(fw::Framework::get_instance()->get_camera()->get_render_state());
+    scenegraph.push_camera(
+        scenegraph_manager_->interpolate_camera(fw::Framework::get_instance()->get_camera()->get_render_state()));
     fw::render(scenegraph, framebuffer, request->include_gui);
     scenegraph.pop_camera();
 
@@ -22,6 +22,7 @@ class AudioManager;
 class Lang;
 class Cursor;
 class Input;
+class JobSystem;
 
 #if defined(DEBUG)
 #define FW_ENSURE_UPDATE_THREAD() \
@@ -100,6 +101,7 @@ private:
   FontManager *font_manager_;
   DebugView *debug_view_;
   sg::ScenegraphManager* scenegraph_manager_;
+  JobSystem *job_system_;
   volatile bool running_;
 
   // game updates happen (synchronized) on this thread in constant timestep
@@ -192,6 +194,9 @@ public:
   Lang *get_lang() const {
     return lang_;
   }
+  JobSystem *get_job_system() const {
+    return job_system_;
+  }
 
   static void ensure_update_thread();
 };
@@ -495,5 +495,29 @@ std::function<void()> xyz_n::get_setup_function() {
   return &xyz_n_setup;
 }
 
+void instance_setup() {
+  for (int i = 0; i < 4; i++) {
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(fw::vertex::instance),
+        reinterpret_cast<void const *>(offsetof(instance, transform) + (i * 4 * sizeof(float))));
+    glVertexAttribDivisor(3 + i, 1);
+  }
+  glEnableVertexAttribArray(7);
+  glVertexAttribPointer(
+      7, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(fw::vertex::instance), OFFSET_OF(instance, color));
+  glVertexAttribDivisor(7, 1);
+}
+
+std::function<void()> instance::get_setup_function() {
+  return &instance_setup;
+}
+
+void instance::disable() {
+  for (int i = 3; i <= 7; i++) {
+    glVertexAttribDivisor(i, 0);
+    glDisableVertexAttribArray(i);
+  }
+}
+
 }
 }
@@ -135,6 +135,10 @@ public:
     return num_vertices_;
   }
 
+  inline GLuint get_id() const {
+    return id_;
+  }
+
   void begin();
   void end();
 };
@@ -267,5 +271,17 @@ struct xyz_n {
   static std::function<void()> get_setup_function();
 };
 
+// Not really a vertex: this is what we have for each instance of an instanced draw. The setup function puts it in
+// attributes 3 to 7 (the transform takes four of them) and advances them once per instance rather than per vertex.
+struct instance {
+  float transform[16];
+  uint32_t color;
+
+  static std::function<void()> get_setup_function();
+
+  // Turns the per-instance attributes off again, so they don't get in the way of draws that aren't instanced.
+  static void disable();
+};
+
 }
 }
@@ -0,0 +1,565 @@
+#include <framework/hierarchical_path_find.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <framework/logging.h>
+#include <framework/misc.h>
+#include <framework/path_find.h>
+
+namespace fw {
+namespace {
+
+// If a run of passable cells along a border is at least this wide, we place an entrance at each end of it rather than
+// a single one in the middle. That keeps paths through wide openings from all funnelling through one cell.
+constexpr int kMaxSingleEntranceWidth = 6;
+
+constexpr float kDiagonalCost = 1.41421356f;
+
+// The octile distance, which is the exact cost of moving between two cells with nothing in the way.
+inline float octile_distance(int dx, int dz) {
+  dx = std::abs(dx);
+  dz = std::abs(dz);
+  return static_cast<float>(std::max(dx, dz)) + (kDiagonalCost - 1.0f) * static_cast<float>(std::min(dx, dz));
+}
+
+}
+
+//-------------------------------------------------------------------------
+
+SectorSearch::SectorSearch(int max_size) :
+    max_size_(max_size), x0_(0), z0_(0), width_(0), length_(0), grid_width_(0),
+    cost_(max_size * max_size), parent_(max_size * max_size), stamp_(max_size * max_size, 0),
+    target_stamp_(max_size * max_size, 0), run_no_(0), open_(max_size * max_size) {
+}
+
+int SectorSearch::to_local(int cell) const {
+  int x = (cell % grid_width_) - x0_;
+  int z = (cell / grid_width_) - z0_;
+  return (z * max_size_) + x;
+}
+
+int SectorSearch::to_cell(int local) const {
+  int x = (local % max_size_) + x0_;
+  int z = (local / max_size_) + z0_;
+  return (z * grid_width_) + x;
+}
+
+bool SectorSearch::search(PassabilityGrid const &grid, int x0, int z0, int width, int length, int start_cell,
+    int goal_cell, std::vector<int> const &targets /*= {}*/) {
+  x0_ = x0;
+  z0_ = z0;
+  width_ = width;
+  length_ = length;
+  grid_width_ = grid.get_width();
+
+  run_no_++;
+  if (run_no_ == 0) {
+    std::fill(stamp_.begin(), stamp_.end(), 0);
+    std::fill(target_stamp_.begin(), target_stamp_.end(), 0);
+    run_no_ = 1;
+  }
+  open_.clear();
+
+  const int start = to_local(start_cell);
+  const int goal = goal_cell < 0 ? -1 : to_local(goal_cell);
+  const int goal_x = goal < 0 ? 0 : goal % max_size_;
+  const int goal_z = goal < 0 ? 0 : goal / max_size_;
+
+  stamp_[start] = run_no_;
+  cost_[start] = 0.0f;
+  parent_[start] = -1;
+  open_.push(start, 0);
+
+  // For a Dijkstra search, we can stop as soon as we've settled every target.
+  int targets_remaining = 0;
+  for (int target : targets) {
+    const int local = to_local(target);
+    if (local != start && target_stamp_[local] != run_no_) {
+      target_stamp_[local] = run_no_;
+      targets_remaining++;
+    }
+  }
+  const bool has_targets = targets_remaining > 0;
+  uint8_t const *passable = grid.get_data();
+
+  while (!open_.empty()) {
+    const int curr = open_.pop();
+    if (curr == goal) {
+      return true;
+    }
+    if (has_targets && target_stamp_[curr] == run_no_ && --targets_remaining <= 0) {
+      return false;
+    }
+
+    const int curr_x = curr % max_size_;
+    const int curr_z = curr / max_size_;
+    const float curr_cost = cost_[curr];
+    for (int dz = -1; dz <= 1; dz++) {
+      const int z = curr_z + dz;
+      if (z < 0 || z >= length_) {
+        continue;
+      }
+      for (int dx = -1; dx <= 1; dx++) {
+        const int x = curr_x + dx;
+        if ((dx == 0 && dz == 0) || x < 0 || x >= width_) {
+          continue;
+        }
+
+        const int n = (z * max_size_) + x;
+        if (!passable[((z + z0_) * grid_width_) + x + x0_]) {
+          continue;
+        }
+
+        const bool visited = stamp_[n] == run_no_;
+        if (visited && !open_.contains(n)) {
+          continue;
+        }
+
+        float new_cost = curr_cost + (dx == 0 || dz == 0 ? 1.0f : kDiagonalCost);
+        if (!visited || new_cost < cost_[n]) {
+          cost_[n] = new_cost;
+          parent_[n] = curr;
+
+          float estimate = goal < 0 ? 0.0f : octile_distance(goal_x - x, goal_z - z);
+          uint64_t key = IndexedHeap::make_key(new_cost + estimate, estimate);
+          if (visited) {
+            open_.decrease(n, key);
+          } else {
+            stamp_[n] = run_no_;
+            open_.push(n, key);
+          }
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+float SectorSearch::get_cost(int cell) const {
+  int local = to_local(cell);
+  if (stamp_[local] != run_no_) {
+    return -1.0f;
+  }
+  return cost_[local];
+}
+
+void SectorSearch::append_path(std::vector<fw::Vector> &path, int cell) const {
+  size_t first = path.size();
+  for (int n = to_local(cell); parent_[n] >= 0; n = parent_[n]) {
+    int c = to_cell(n);
+    path.push_back(fw::Vector(static_cast<float>(c % grid_width_), 0.0f, static_cast<float>(c / grid_width_)));
+  }
+  std::reverse(path.begin() + first, path.end());
+}
+
+//-------------------------------------------------------------------------
+
+SectorGraph::SectorGraph(std::shared_ptr<PassabilityGrid const> grid, int sector_size) :
+    grid_(grid), sector_size_(sector_size) {
+  sectors_width_ = (grid_->get_width() + sector_size_ - 1) / sector_size_;
+  sectors_length_ = (grid_->get_length() + sector_size_ - 1) / sector_size_;
+
+  const int num_sectors = sectors_width_ * sectors_length_;
+  sectors_.resize(num_sectors);
+  east_borders_.resize(num_sectors);
+  south_borders_.resize(num_sectors);
+
+  for (int sector_z = 0; sector_z < sectors_length_; sector_z++) {
+    for (int sector_x = 0; sector_x < sectors_width_; sector_x++) {
+      build_border(sector_x, sector_z, /*east=*/true);
+      build_border(sector_x, sector_z, /*east=*/false);
+    }
+  }
+
+  SectorSearch search(sector_size_);
+  for (int i = 0; i < num_sectors; i++) {
+    build_sector(search, i);
+  }
+  link();
+}
+
+int SectorGraph::get_sector(int cell) const {
+  const int x = cell % grid_->get_width();
+  const int z = cell / grid_->get_width();
+  return ((z / sector_size_) * sectors_width_) + (x / sector_size_);
+}
+
+void SectorGraph::get_sector_bounds(int sector_index, int *x0, int *z0, int *width, int *length) const {
+  *x0 = (sector_index % sectors_width_) * sector_size_;
+  *z0 = (sector_index / sectors_width_) * sector_size_;
+  *width = std::min(sector_size_, grid_->get_width() - *x0);
+  *length = std::min(sector_size_, grid_->get_length() - *z0);
+}
+
+int SectorGraph::get_node(int sector_index, int cell) const {
+  std::vector<int> const &cells = sectors_[sector_index].cells;
+  auto it = std::lower_bound(cells.begin(), cells.end(), cell);
+  if (it == cells.end() || *it != cell) {
+    return -1;
+  }
+  return sector_nodes_[sector_index] + static_cast<int>(it - cells.begin());
+}
+
+void SectorGraph::build_border(int sector_x, int sector_z, bool east) {
+  const int grid_width = grid_->get_width();
+  const int grid_length = grid_->get_length();
+  const int sector_index = (sector_z * sectors_width_) + sector_x;
+  int x0, z0, width, length;
+  get_sector_bounds(sector_index, &x0, &z0, &width, &length);
+
+  std::vector<Transition> &transitions = east ? east_borders_[sector_index] : south_borders_[sector_index];
+  transitions.clear();
+
+  // Walk along the border, the world wraps so the last sector's east (south) neighbour is the first sector.
+  const int border_length = east ? length : width;
+  auto cell_a = [=](int i) {
+    return east ? ((z0 + i) * grid_width) + x0 + width - 1 : ((z0 + length - 1) * grid_width) + x0 + i;
+  };
+  auto cell_b = [=](int i) {
+    return east
+        ? ((z0 + i) * grid_width) + ((x0 + width) % grid_width)
+        : (((z0 + length) % grid_length) * grid_width) + x0 + i;
+  };
+
+  int run_start = -1;
+  for (int i = 0; i <= border_length; i++) {
+    bool open = i < border_length && grid_->is_passable(cell_a(i)) && grid_->is_passable(cell_b(i));
+    if (open && run_start < 0) {
+      run_start = i;
+    } else if (!open && run_start >= 0) {
+      const int run_length = i - run_start;
+      if (run_length < kMaxSingleEntranceWidth) {
+        const int mid = run_start + (run_length / 2);
+        transitions.push_back(Transition{cell_a(mid), cell_b(mid)});
+      } else {
+        transitions.push_back(Transition{cell_a(run_start), cell_b(run_start)});
+        transitions.push_back(Transition{cell_a(i - 1), cell_b(i - 1)});
+      }
+      run_start = -1;
+    }
+  }
+}
+
+void SectorGraph::build_sector(SectorSearch &search, int sector_index) {
+  const int sector_x = sector_index % sectors_width_;
+  const int sector_z = sector_index / sectors_width_;
+  const int west = (sector_z * sectors_width_) + fw::constrain(sector_x - 1, sectors_width_);
+  const int north = (fw::constrain(sector_z - 1, sectors_length_) * sectors_width_) + sector_x;
+
+  // Our entrances are our end of our own borders, plus the far end of our west and north neighbours' borders.
+  Sector &sector = sectors_[sector_index];
+  sector.cells.clear();
+  for (Transition const &t : east_borders_[sector_index]) {
+    sector.cells.push_back(t.cell_a);
+  }
+  for (Transition const &t : south_borders_[sector_index]) {
+    sector.cells.push_back(t.cell_a);
+  }
+  for (Transition const &t : east_borders_[west]) {
+    sector.cells.push_back(t.cell_b);
+  }
+  for (Transition const &t : south_borders_[north]) {
+    sector.cells.push_back(t.cell_b);
+  }
+  std::sort(sector.cells.begin(), sector.cells.end());
+  sector.cells.erase(std::unique(sector.cells.begin(), sector.cells.end()), sector.cells.end());
+
+  int x0, z0, width, length;
+  get_sector_bounds(sector_index, &x0, &z0, &width, &length);
+
+  const int num_cells = static_cast<int>(sector.cells.size());
+  sector.costs.resize(num_cells * num_cells);
+  for (int i = 0; i < num_cells; i++) {
+    search.search(*grid_, x0, z0, width, length, sector.cells[i], /*goal_cell=*/-1, sector.cells);
+    for (int j = 0; j < num_cells; j++) {
+      sector.costs[(i * num_cells) + j] = search.get_cost(sector.cells[j]);
+    }
+  }
+}
+
+void SectorGraph::link() {
+  const int num_sectors = static_cast<int>(sectors_.size());
+
+  node_cells_.clear();
+  sector_nodes_.resize(num_sectors + 1);
+  for (int i = 0; i < num_sectors; i++) {
+    sector_nodes_[i] = static_cast<int>(node_cells_.size());
+    node_cells_.insert(node_cells_.end(), sectors_[i].cells.begin(), sectors_[i].cells.end());
+  }
+  sector_nodes_[num_sectors] = static_cast<int>(node_cells_.size());
+
+  std::vector<std::vector<Edge>> adjacency(node_cells_.size());
+  for (int i = 0; i < num_sectors; i++) {
+    Sector const &sector = sectors_[i];
+    const int num_cells = static_cast<int>(sector.cells.size());
+    for (int a = 0; a < num_cells; a++) {
+      for (int b = 0; b < num_cells; b++) {
+        float cost = sector.costs[(a * num_cells) + b];
+        if (a != b && cost >= 0.0f) {
+          adjacency[sector_nodes_[i] + a].push_back(Edge{sector_nodes_[i] + b, cost});
+        }
+      }
+    }
+
+    const int sector_x = i % sectors_width_;
+    const int sector_z = i / sectors_width_;
+    const int east = (sector_z * sectors_width_) + ((sector_x + 1) % sectors_width_);
+    const int south = (((sector_z + 1) % sectors_length_) * sectors_width_) + sector_x;
+    for (Transition const &t : east_borders_[i]) {
+      int a = get_node(i, t.cell_a);
+      int b = get_node(east, t.cell_b);
+      adjacency[a].push_back(Edge{b, 1.0f});
+      adjacency[b].push_back(Edge{a, 1.0f});
+    }
+    for (Transition const &t : south_borders_[i]) {
+      int a = get_node(i, t.cell_a);
+      int b = get_node(south, t.cell_b);
+      adjacency[a].push_back(Edge{b, 1.0f});
+      adjacency[b].push_back(Edge{a, 1.0f});
+    }
+  }
+
+  edges_.clear();
+  edge_offsets_.resize(node_cells_.size() + 1);
+  for (size_t n = 0; n < adjacency.size(); n++) {
+    edge_offsets_[n] = static_cast<int>(edges_.size());
+    edges_.insert(edges_.end(), adjacency[n].begin(), adjacency[n].end());
+  }
+  edge_offsets_[adjacency.size()] = static_cast<int>(edges_.size());
+}
+
+void SectorGraph::update_sectors(std::shared_ptr<PassabilityGrid const> grid,
+    std::vector<std::tuple<int, int>> const &changed_sectors) {
+  grid_ = grid;
+
+  // A sector's borders are shared with it's neighbours, so when a sector changes we need to rebuild the borders on all
+  // four sides of it, and then the entrances of every sector touching those borders.
+  std::vector<int> dirty_sectors;
+  for (auto const &changed : changed_sectors) {
+    const int sector_x = fw::constrain(std::get<0>(changed), sectors_width_);
+    const int sector_z = fw::constrain(std::get<1>(changed), sectors_length_);
+    const int west_x = fw::constrain(sector_x - 1, sectors_width_);
+    const int north_z = fw::constrain(sector_z - 1, sectors_length_);
+
+    build_border(sector_x, sector_z, /*east=*/true);
+    build_border(sector_x, sector_z, /*east=*/false);
+    build_border(west_x, sector_z, /*east=*/true);
+    build_border(sector_x, north_z, /*east=*/false);
+
+    dirty_sectors.push_back((sector_z * sectors_width_) + sector_x);
+    dirty_sectors.push_back((sector_z * sectors_width_) + west_x);
+    dirty_sectors.push_back((sector_z * sectors_width_) + ((sector_x + 1) % sectors_width_));
+    dirty_sectors.push_back((north_z * sectors_width_) + sector_x);
+    dirty_sectors.push_back((((sector_z + 1) % sectors_length_) * sectors_width_) + sector_x);
+  }
+  std::sort(dirty_sectors.begin(), dirty_sectors.end());
+  dirty_sectors.erase(std::unique(dirty_sectors.begin(), dirty_sectors.end()), dirty_sectors.end());
+
+  SectorSearch search(sector_size_);
+  for (int sector_index : dirty_sectors) {
+    build_sector(search, sector_index);
+  }
+  link();
+}
+
+//-------------------------------------------------------------------------
+
+HierarchicalPathFind::HierarchicalPathFind(std::shared_ptr<SectorGraph const> graph) :
+    graph_(graph), sector_search_(new SectorSearch(graph->get_sector_size())), run_no_(0), last_expanded(0) {
+}
+
+HierarchicalPathFind::~HierarchicalPathFind() {
+}
+
+int HierarchicalPathFind::get_cell(fw::Vector const &loc) const {
+  int x = fw::constrain(static_cast<int>(loc[0]), graph_->grid_->get_width());
+  int z = fw::constrain(static_cast<int>(loc[2]), graph_->grid_->get_length());
+  return (z * graph_->grid_->get_width()) + x;
+}
+
+float HierarchicalPathFind::estimate_cost(int from_cell, int to_cell) const {
+  // The world wraps, so the shortest way between two cells might be across the edge of the map.
+  const int width = graph_->grid_->get_width();
+  const int length = graph_->grid_->get_length();
+  int dx = std::abs((from_cell % width) - (to_cell % width));
+  int dz = std::abs((from_cell / width) - (to_cell / width));
+  return octile_distance(std::min(dx, width - dx), std::min(dz, length - dz));
+}
+
+void HierarchicalPathFind::connect(int sector_index, int cell, std::vector<SectorGraph::Edge> &edges) {
+  int x0, z0, width, length;
+  graph_->get_sector_bounds(sector_index, &x0, &z0, &width, &length);
+  std::vector<int> const &cells = graph_->sectors_[sector_index].cells;
+  sector_search_->search(*graph_->grid_, x0, z0, width, length, cell, /*goal_cell=*/-1, cells);
+
+  edges.clear();
+  for (size_t i = 0; i < cells.size(); i++) {
+    float cost = sector_search_->get_cost(cells[i]);
+    if (cost >= 0.0f) {
+      edges.push_back(SectorGraph::Edge{graph_->sector_nodes_[sector_index] + static_cast<int>(i), cost});
+    }
+  }
+}
+
+bool HierarchicalPathFind::find_abstract(int start_cell, int goal_cell) {
+  const int num_nodes = graph_->get_num_nodes();
+  const int start_node = num_nodes;
+  const int goal_node = num_nodes + 1;
+  const int goal_sector = graph_->get_sector(goal_cell);
+
+  // The graph can change size when it's updated, make sure our scratch state is big enough.
+  if (static_cast<int>(cost_.size()) != num_nodes + 2) {
+    cost_.resize(num_nodes + 2);
+    parent_.resize(num_nodes + 2);
+    stamp_.assign(num_nodes + 2, 0);
+    open_.resize(num_nodes + 2);
+    run_no_ = 0;
+  }
+  run_no_++;
+  if (run_no_ == 0) {
+    std::fill(stamp_.begin(), stamp_.end(), 0);
+    run_no_ = 1;
+  }
+
+  // Temporarily connect the start and goal cells to the entrances of their sectors.
+  connect(graph_->get_sector(start_cell), start_cell, start_edges_);
+  connect(goal_sector, goal_cell, goal_edges_);
+  if (start_edges_.empty() || goal_edges_.empty()) {
+    return false;
+  }
+
+  auto node_cell = [&](int node) {
+    return node == start_node ? start_cell : node == goal_node ? goal_cell : graph_->node_cells_[node];
+  };
+
+  open_.clear();
+  stamp_[start_node] = run_no_;
+  cost_[start_node] = 0.0f;
+  parent_[start_node] = -1;
+  float start_estimate = estimate_cost(start_cell, goal_cell);
+  open_.push(start_node, IndexedHeap::make_key(start_estimate, start_estimate));
+
+  auto relax = [&](int from, int to, float edge_cost) {
+    const bool visited = stamp_[to] == run_no_;
+    if (visited && !open_.contains(to)) {
+      return;
+    }
+    float new_cost = cost_[from] + edge_cost;
+    if (visited && new_cost >= cost_[to]) {
+      return;
+    }
+
+    cost_[to] = new_cost;
+    parent_[to] = from;
+    float estimate = estimate_cost(node_cell(to), goal_cell);
+    uint64_t key = IndexedHeap::make_key(new_cost + estimate, estimate);
+    if (visited) {
+      open_.decrease(to, key);
+    } else {
+      stamp_[to] = run_no_;
+      open_.push(to, key);
+    }
+  };
+
+  last_expanded = 0;
+  while (!open_.empty()) {
+    const int curr = open_.pop();
+    last_expanded++;
+
+    if (curr == goal_node) {
+      waypoints_.clear();
+      for (int n = goal_node; n >= 0; n = parent_[n]) {
+        waypoints_.push_back(node_cell(n));
+      }
+      std::reverse(waypoints_.begin(), waypoints_.end());
+      return true;
+    }
+
+    if (curr == start_node) {
+      for (SectorGraph::Edge const &edge : start_edges_) {
+        relax(curr, edge.to, edge.cost);
+      }
+      continue;
+    }
+
+    for (int i = graph_->edge_offsets_[curr]; i < graph_->edge_offsets_[curr + 1]; i++) {
+      relax(curr, graph_->edges_[i].to, graph_->edges_[i].cost);
+    }
+    if (graph_->get_sector(graph_->node_cells_[curr]) == goal_sector) {
+      for (SectorGraph::Edge const &edge : goal_edges_) {
+        if (edge.to == curr) {
+          relax(curr, goal_node, edge.cost);
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+bool HierarchicalPathFind::find(
+    std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end, int max_segments /*= -1*/) {
+  PassabilityGrid const &grid = *graph_->grid_;
+  const int grid_width = grid.get_width();
+  const int start_cell = get_cell(start);
+  const int goal_cell = get_cell(end);
+  if (!grid.is_passable(goal_cell)) {
+    last_expanded = 0;
+    return false;
+  }
+
+  int x0, z0, width, length;
+  const int start_sector = graph_->get_sector(start_cell);
+  if (start_sector == graph_->get_sector(goal_cell)) {
+    // If the start and goal are in the same sector, we can usually get there without leaving it.
+    graph_->get_sector_bounds(start_sector, &x0, &z0, &width, &length);
+    if (sector_search_->search(grid, x0, z0, width, length, start_cell, goal_cell)) {
+      path.push_back(fw::Vector(
+          static_cast<float>(start_cell % grid_width), 0.0f, static_cast<float>(start_cell / grid_width)));
+      sector_search_->append_path(path, goal_cell);
+      last_expanded = 0;
+      return true;
+    }
+  }
+
+  if (!find_abstract(start_cell, goal_cell)) {
+    return false;
+  }
+
+  path.push_back(fw::Vector(
+      static_cast<float>(start_cell % grid_width), 0.0f, static_cast<float>(start_cell / grid_width)));
+  int num_segments = 0;
+  for (size_t i = 1; i < waypoints_.size(); i++) {
+    const int from = waypoints_[i - 1];
+    const int to = waypoints_[i];
+    if (from == to) {
+      continue;
+    }
+
+    const int from_sector = graph_->get_sector(from);
+    if (from_sector != graph_->get_sector(to) || estimate_cost(from, to) < 1.5f) {
+      // This is a step across the border between two sectors, the cells are right next to each other.
+      path.push_back(fw::Vector(static_cast<float>(to % grid_width), 0.0f, static_cast<float>(to / grid_width)));
+      continue;
+    }
+
+    if (max_segments >= 0 && num_segments >= max_segments) {
+      break;
+    }
+
+    graph_->get_sector_bounds(from_sector, &x0, &z0, &width, &length);
+    if (!sector_search_->search(grid, x0, z0, width, length, from, to)) {
+      // Shouldn't happen, the graph says there's a path here.
+      LOG(WARN) << "no path between entrances in sector " << from_sector;
+      return false;
+    }
+    sector_search_->append_path(path, to);
+    num_segments++;
+  }
+
+  return true;
+}
+
+}
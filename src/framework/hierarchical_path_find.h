@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <framework/indexed_heap.h>
+#include <framework/math.h>
+
+namespace fw {
+class PassabilityGrid;
+
+// Searches within a single rectangular region of a PassabilityGrid (typically one sector of a SectorGraph). The
+// region does not wrap, and all of the search state is sized for the largest region we'll be asked to search, so
+// searches don't allocate. Like PathFind, this is not thread safe.
+class SectorSearch {
+private:
+  int max_size_;
+
+  // The region we last searched, in grid coordinates.
+  int x0_, z0_, width_, length_;
+  int grid_width_;
+
+  // Per-cell search state, indexed by the cell's local (z * max_size + x) within the region.
+  std::vector<float> cost_;
+  std::vector<int> parent_;
+  std::vector<uint32_t> stamp_;
+  std::vector<uint32_t> target_stamp_;
+  uint32_t run_no_;
+  IndexedHeap open_;
+
+  int to_local(int cell) const;
+  int to_cell(int local) const;
+
+public:
+  SectorSearch(int max_size);
+
+  // Searches the given region from start_cell (which must be inside the region). If goal_cell is -1, this is a
+  // Dijkstra search that finds the cost to every cell in 'targets' (or every reachable cell in the region, if targets
+  // is empty), otherwise it's an A* search that stops once goal_cell has been reached. Returns true if goal_cell was
+  // reached (always false for a Dijkstra search).
+  bool search(PassabilityGrid const &grid, int x0, int z0, int width, int length, int start_cell, int goal_cell,
+      std::vector<int> const &targets = {});
+
+  // Gets the cost of travelling to the given cell in the last search, or a negative number if it wasn't reached.
+  float get_cost(int cell) const;
+
+  // Appends the path from the start of the last search to the given cell (which must have been reached), not
+  // including the start cell itself.
+  void append_path(std::vector<fw::Vector> &path, int cell) const;
+};
+
+// The abstract graph for hierarchical path-finding (HPA*). The grid is clustered into square sectors. Wherever a run
+// of passable cells crosses the border between two sectors we place an entrance, which is a pair of cells, one either
+// side of the border. Within each sector, we precompute the cost of travelling between each pair of entrance cells.
+// The graph is much smaller than the grid, so long-distance searches are cheap.
+//
+// A SectorGraph is read-only once built (except for update_sectors), so it can be shared by multiple
+// HierarchicalPathFinds on different threads.
+class SectorGraph {
+public:
+  struct Edge {
+    int to;
+    float cost;
+  };
+
+private:
+  friend class HierarchicalPathFind;
+
+  struct Sector {
+    // The cells of the entrances in this sector, sorted.
+    std::vector<int> cells;
+
+    // cells.size() * cells.size() matrix of the cost of travelling between entrance cells without leaving the
+    // sector. Negative if there's no path.
+    std::vector<float> costs;
+  };
+
+  // One entrance across a border: cell_a is in the sector that owns the border, cell_b is in it's east (or south)
+  // neighbour.
+  struct Transition {
+    int cell_a;
+    int cell_b;
+  };
+
+  std::shared_ptr<PassabilityGrid const> grid_;
+  int sector_size_;
+  int sectors_width_;
+  int sectors_length_;
+
+  std::vector<Sector> sectors_;
+  std::vector<std::vector<Transition>> east_borders_;
+  std::vector<std::vector<Transition>> south_borders_;
+
+  // The linked graph. Each sector's entrance cells are a contiguous range of nodes starting at sector_nodes_[sector],
+  // and the edges of each node are a contiguous range of edges_ starting at edge_offsets_[node].
+  std::vector<int> node_cells_;
+  std::vector<int> sector_nodes_;
+  std::vector<int> edge_offsets_;
+  std::vector<Edge> edges_;
+
+  void build_border(int sector_x, int sector_z, bool east);
+  void build_sector(SectorSearch &search, int sector_index);
+  void link();
+
+public:
+  SectorGraph(std::shared_ptr<PassabilityGrid const> grid, int sector_size);
+
+  // Rebuilds the entrances and costs of the given (sector_x, sector_z) sectors after the passability data in them has
+  // changed. 'grid' is the new passability data for the whole map. This is not thread-safe: nobody can be searching
+  // the graph while it's being updated.
+  void update_sectors(std::shared_ptr<PassabilityGrid const> grid,
+      std::vector<std::tuple<int, int>> const &changed_sectors);
+
+  inline int get_sector_size() const {
+    return sector_size_;
+  }
+  inline int get_num_nodes() const {
+    return static_cast<int>(node_cells_.size());
+  }
+
+  // Gets the index of the sector that contains the given cell.
+  int get_sector(int cell) const;
+
+  // Gets the bounds (in grid coordinates) of the given sector.
+  void get_sector_bounds(int sector_index, int *x0, int *z0, int *width, int *length) const;
+
+  // Gets the node of the given entrance cell in the given sector, or -1 if it's not an entrance.
+  int get_node(int sector_index, int cell) const;
+};
+
+// Finds paths using a SectorGraph: we first search the abstract graph for the sequence of entrances to pass through,
+// then refine each leg between entrances with a search that's confined to a single sector. Refining is the expensive
+// part, so callers that only need the first part of the path right now can refine just that and ask again later.
+//
+// Each thread should have it's own HierarchicalPathFind, but they can all share the same SectorGraph.
+class HierarchicalPathFind {
+private:
+  std::shared_ptr<SectorGraph const> graph_;
+  std::unique_ptr<SectorSearch> sector_search_;
+
+  // Scratch state for the abstract search, sized for the graph plus the two temporary start and goal nodes.
+  std::vector<float> cost_;
+  std::vector<int> parent_;
+  std::vector<uint32_t> stamp_;
+  uint32_t run_no_;
+  IndexedHeap open_;
+  std::vector<SectorGraph::Edge> start_edges_;
+  std::vector<SectorGraph::Edge> goal_edges_;
+  std::vector<int> waypoints_;
+
+  int get_cell(fw::Vector const &loc) const;
+  float estimate_cost(int from_cell, int to_cell) const;
+  void connect(int sector_index, int cell, std::vector<SectorGraph::Edge> &edges);
+  bool find_abstract(int start_cell, int goal_cell);
+
+public:
+  HierarchicalPathFind(std::shared_ptr<SectorGraph const> graph);
+  ~HierarchicalPathFind();
+
+  // Finds a path between 'start' and 'end', in the same format as PathFind::find (one entry per cell, starting at
+  // start). If max_segments is non-negative, we only refine that many legs of the abstract path, and the returned path
+  // will stop short of 'end' (call find again from there to get the rest). Returns false if no path exists.
+  bool find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end, int max_segments = -1);
+
+  // The number of nodes that the last call to find() expanded in the abstract graph, for diagnostics.
+  int last_expanded;
+};
+
+}
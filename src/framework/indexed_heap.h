@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace fw {
+
+// A 4-ary min-heap of item indices (0 <= item < capacity), ordered by a 64-bit key, that supports decrease-key. This
+// is the open set for our path-finding searches. All storage is allocated up-front, so pushing and popping never
+// allocates. A 4-ary heap is shallower than a binary one and the children of a node are adjacent in memory, which
+// makes pop (the common operation) cheaper.
+//
+// The heap tracks each item's position so it can find it again for decrease(). Positions aren't reset by clear(),
+// so contains() is only meaningful for items that have been pushed since the last clear() (callers generally know
+// this already from their own per-search "run stamps").
+class IndexedHeap {
+public:
+  // The value of position_[item] once it has been popped.
+  static const int kPopped = -1;
+
+  explicit inline IndexedHeap(int capacity = 0) : size_(0) {
+    resize(capacity);
+  }
+
+  // Packs two non-negative floats into one key that sorts by 'primary', then by 'secondary' for ties. Non-negative
+  // floats' bit patterns sort the same as their values, so it's one integer compare.
+  static inline uint64_t make_key(float primary, float secondary) {
+    return (static_cast<uint64_t>(std::bit_cast<uint32_t>(primary)) << 32) | std::bit_cast<uint32_t>(secondary);
+  }
+  static inline float key_secondary(uint64_t key) {
+    return std::bit_cast<float>(static_cast<uint32_t>(key & 0xffffffff));
+  }
+
+  // Makes room for items up to 'capacity'. This also clears the heap.
+  inline void resize(int capacity) {
+    entries_.resize(capacity);
+    position_.resize(capacity);
+    size_ = 0;
+  }
+
+  inline void clear() {
+    size_ = 0;
+  }
+  inline bool empty() const {
+    return size_ == 0;
+  }
+  inline int size() const {
+    return size_;
+  }
+
+  // Returns true if the given item is in the heap (see above for the caveat).
+  inline bool contains(int item) const {
+    return position_[item] != kPopped;
+  }
+
+  inline uint64_t top_key() const {
+    return entries_[0].key;
+  }
+
+  // Adds an item that isn't already in the heap.
+  inline void push(int item, uint64_t key) {
+    int pos = size_++;
+    entries_[pos] = Entry{key, item};
+    sift_up(pos);
+  }
+
+  // Gives an item that's already in the heap a new, lower key.
+  inline void decrease(int item, uint64_t key) {
+    int pos = position_[item];
+    entries_[pos].key = key;
+    sift_up(pos);
+  }
+
+  // Removes and returns the item with the lowest key.
+  inline int pop() {
+    int item = entries_[0].item;
+    position_[item] = kPopped;
+
+    size_--;
+    if (size_ > 0) {
+      entries_[0] = entries_[size_];
+      sift_down(0);
+    }
+    return item;
+  }
+
+private:
+  static const int kArity = 4;
+
+  struct Entry {
+    uint64_t key;
+    int item;
+  };
+  std::vector<Entry> entries_;
+  std::vector<int> position_;
+  int size_;
+
+  inline void sift_up(int pos) {
+    Entry entry = entries_[pos];
+    while (pos > 0) {
+      int parent = (pos - 1) / kArity;
+      Entry const &p = entries_[parent];
+      if (entry.key >= p.key) {
+        break;
+      }
+      entries_[pos] = p;
+      position_[p.item] = pos;
+      pos = parent;
+    }
+    entries_[pos] = entry;
+    position_[entry.item] = pos;
+  }
+
+  inline void sift_down(int pos) {
+    Entry entry = entries_[pos];
+    for (;;) {
+      int first_child = (pos * kArity) + 1;
+      if (first_child >= size_) {
+        break;
+      }
+
+      int last_child = std::min(first_child + kArity, size_);
+      int best = first_child;
+      for (int child = first_child + 1; child < last_child; child++) {
+        if (entries_[child].key < entries_[best].key) {
+          best = child;
+        }
+      }
+
+      Entry const &c = entries_[best];
+      if (c.key >= entry.key) {
+        break;
+      }
+      entries_[pos] = c;
+      position_[c.item] = pos;
+      pos = best;
+    }
+    entries_[pos] = entry;
+    position_[entry.item] = pos;
+  }
+};
+
+}
@@ -0,0 +1,159 @@
+#include <framework/job_system.h>
+
+#include <algorithm>
+
+#include <framework/logging.h>
+
+namespace fw {
+namespace {
+
+// The JobSystem that owns the current thread (if any) and the index of it's queue.
+thread_local JobSystem const *g_worker_job_system = nullptr;
+thread_local int g_worker_index = -1;
+
+}
+
+JobSystem::JobSystem(int num_threads) : num_queued_(0), next_queue_(0), stopping_(false) {
+  if (num_threads < 0) {
+    num_threads = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  }
+
+  const int num_queues = std::max(1, num_threads);
+  for (int i = 0; i < num_queues; i++) {
+    queues_.push_back(std::make_unique<WorkerQueue>());
+  }
+
+  LOG(INFO) << "starting " << num_threads << " job thread(s)";
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(std::bind(&JobSystem::thread_proc, this, i)));
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+int JobSystem::get_worker_index() const {
+  return g_worker_job_system == this ? g_worker_index : -1;
+}
+
+void JobSystem::run(Batch &batch, job_fn fn) {
+  batch.remaining_.fetch_add(1, std::memory_order_relaxed);
+
+  // Workers queue onto their own queue (it's likely they'll get to run it themselves, while it's data is still in
+  // cache), everybody else spreads their jobs out.
+  int index = get_worker_index();
+  if (index < 0) {
+    index = static_cast<int>(next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size());
+  }
+
+  {
+    WorkerQueue &queue = *queues_[index];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(Job {std::move(fn), &batch});
+  }
+  num_queued_.fetch_add(1, std::memory_order_release);
+
+  // Take the lock so that a worker can't check num_queued_ and then go to sleep after we've notified it.
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+  }
+  wake_.notify_one();
+}
+
+bool JobSystem::try_pop(int queue_index, Job &job) {
+  WorkerQueue &queue = *queues_[queue_index];
+  std::unique_lock<std::mutex> lock(queue.mutex);
+  if (queue.jobs.empty()) {
+    return false;
+  }
+
+  job = std::move(queue.jobs.back());
+  queue.jobs.pop_back();
+  num_queued_.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool JobSystem::try_steal(int thief_index, Job &job) {
+  // Start looking at the queue after our own, so that thieves don't all pile onto the first queue.
+  const int num_queues = static_cast<int>(queues_.size());
+  for (int i = 1; i <= num_queues; i++) {
+    const int index = (thief_index + i + num_queues) % num_queues;
+    if (index == thief_index) {
+      continue;
+    }
+
+    WorkerQueue &queue = *queues_[index];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (!queue.jobs.empty()) {
+      job = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+      num_queued_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void JobSystem::run_job(Job &job) {
+  job.fn();
+  job.batch->remaining_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::wait(Batch &batch) {
+  const int index = get_worker_index();
+  while (!batch.is_done()) {
+    Job job;
+    if ((index >= 0 && try_pop(index, job)) || try_steal(index, job)) {
+      run_job(job);
+    } else {
+      // Whatever's left is running on another thread, it shouldn't be long.
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::parallel_for(int count, int batch_size, std::function<void(int, int)> const &fn) {
+  batch_size = std::max(1, batch_size);
+
+  Batch batch;
+  for (int begin = 0; begin < count; begin += batch_size) {
+    const int end = std::min(count, begin + batch_size);
+    run(batch, [&fn, begin, end]() {
+      fn(begin, end);
+    });
+  }
+  wait(batch);
+}
+
+void JobSystem::thread_proc(int index) {
+  g_worker_job_system = this;
+  g_worker_index = index;
+
+  while (true) {
+    Job job;
+    if (try_pop(index, job) || try_steal(index, job)) {
+      run_job(job);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this]() {
+      return stopping_ || num_queued_.load(std::memory_order_acquire) > 0;
+    });
+    if (stopping_) {
+      return;
+    }
+  }
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fw {
+
+// A pool of worker threads for running lots of small jobs in parallel. Each worker has it's own queue of jobs. It
+// takes jobs from the back of it's own queue, and when that's empty it "steals" one from the front of another
+// worker's queue, so the workers keep each other busy without all fighting over a single lock.
+//
+// Jobs are queued as part of a Batch, and the thread that waits for the batch helps run jobs until it's done. That
+// means a JobSystem with no worker threads still works: everything just runs on the waiting thread, in the order it
+// was queued.
+class JobSystem {
+public:
+  typedef std::function<void()> job_fn;
+
+  // A group of jobs that you can wait for.
+  class Batch {
+  private:
+    friend class JobSystem;
+    std::atomic<int> remaining_;
+
+  public:
+    Batch() : remaining_(0) {
+    }
+    Batch(Batch const &) = delete;
+
+    bool is_done() const {
+      return remaining_.load(std::memory_order_acquire) == 0;
+    }
+  };
+
+private:
+  struct Job {
+    job_fn fn;
+    Batch *batch;
+  };
+
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  // There's one queue per worker thread (or just one if we don't have any worker threads).
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> threads_;
+
+  // The total number of jobs in all of the queues. Workers sleep when this is zero.
+  std::atomic<int> num_queued_;
+
+  // Jobs queued from outside the pool are spread over the queues round-robin.
+  std::atomic<unsigned int> next_queue_;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+
+  // Gets the index of the queue owned by the calling thread, or -1 if it's not one of our workers.
+  int get_worker_index() const;
+
+  bool try_pop(int queue_index, Job &job);
+  bool try_steal(int thief_index, Job &job);
+  void run_job(Job &job);
+  void thread_proc(int index);
+
+public:
+  // Starts the given number of worker threads. If num_threads is negative, we start one less than the number of CPU
+  // cores (the calling thread is expected to help out by waiting).
+  explicit JobSystem(int num_threads);
+  ~JobSystem();
+
+  JobSystem(JobSystem const &) = delete;
+
+  int get_num_threads() const {
+    return static_cast<int>(threads_.size());
+  }
+
+  // Queues the given job to run as part of the given batch. The batch must outlive the job, so make sure you wait()
+  // for it.
+  void run(Batch &batch, job_fn fn);
+
+  // Waits for all of the jobs in the given batch to finish. While we wait, we run any jobs that are queued (not
+  // necessarily from this batch).
+  void wait(Batch &batch);
+
+  // Splits [0, count) into ranges of at most batch_size and calls fn(begin, end) for each of them, in parallel.
+  // Returns once they've all finished.
+  void parallel_for(int count, int batch_size, std::function<void(int, int)> const &fn);
+};
+
+}
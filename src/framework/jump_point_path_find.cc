@@ -0,0 +1,331 @@
+#include <framework/jump_point_path_find.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <framework/misc.h>
+
+namespace fw {
+namespace {
+
+constexpr float kDiagonalCost = 1.41421356f;
+
+// Directions are indexed by (dz + 1) * 3 + (dx + 1), so the middle one (4) means "no direction", which is what the
+// start node has.
+struct Direction {
+  int dx;
+  int dz;
+};
+constexpr Direction kDirections[9] = {
+  {-1, -1}, {0, -1}, {1, -1},
+  {-1,  0}, {0,  0}, {1,  0},
+  {-1,  1}, {0,  1}, {1,  1},
+};
+constexpr uint8_t kNoDirection = 4;
+
+inline int get_direction(int dx, int dz) {
+  return ((dz + 1) * 3) + (dx + 1);
+}
+
+// Index into jump_distances_ of each straight direction.
+inline int get_straight_index(int dx, int dz) {
+  return dx > 0 ? 0 : dx < 0 ? 1 : dz > 0 ? 2 : 3;
+}
+
+}
+
+JumpPointPathFind::JumpPointPathFind(int width, int length, std::vector<bool> const &passability) :
+    JumpPointPathFind(std::make_shared<PassabilityGrid>(width, length, passability)) {
+}
+
+JumpPointPathFind::JumpPointPathFind(std::shared_ptr<PassabilityGrid const> grid) :
+    PathFind(grid), direction_(width_ * length_), goal_x_(0), goal_z_(0), goal_node_(0), last_expanded(0) {
+  for (int i = 0; i < 4; i++) {
+    jump_distances_[i].resize(width_ * length_);
+  }
+
+  std::vector<int> line(width_);
+  for (int z = 0; z < length_; z++) {
+    for (int x = 0; x < width_; x++) {
+      line[x] = (z * width_) + x;
+    }
+    build_jump_distances(line, 1, 0, jump_distances_[get_straight_index(1, 0)]);
+    std::reverse(line.begin(), line.end());
+    build_jump_distances(line, -1, 0, jump_distances_[get_straight_index(-1, 0)]);
+  }
+
+  line.resize(length_);
+  for (int x = 0; x < width_; x++) {
+    for (int z = 0; z < length_; z++) {
+      line[z] = (z * width_) + x;
+    }
+    build_jump_distances(line, 0, 1, jump_distances_[get_straight_index(0, 1)]);
+    std::reverse(line.begin(), line.end());
+    build_jump_distances(line, 0, -1, jump_distances_[get_straight_index(0, -1)]);
+  }
+}
+
+JumpPointPathFind::~JumpPointPathFind() {
+}
+
+bool JumpPointPathFind::is_forced(int x, int z, int dx, int dz) const {
+  // Moving straight through (x, z), if there's an obstacle beside us that ends here, the node past the end of it is a
+  // "forced" neighbour: the only shortest way to get to it is through this node, so this is a jump point.
+  if (dz == 0) {
+    return (!passable_at(x, z + 1) && passable_at(x + dx, z + 1))
+        || (!passable_at(x, z - 1) && passable_at(x + dx, z - 1));
+  } else {
+    return (!passable_at(x + 1, z) && passable_at(x + 1, z + dz))
+        || (!passable_at(x - 1, z) && passable_at(x - 1, z + dz));
+  }
+}
+
+void JumpPointPathFind::build_jump_distances(
+    std::vector<int> const &line, int dx, int dz, std::vector<int16_t> &distances) {
+  // 'line' is a whole row (or column) of nodes, in the order we'd visit them moving in direction (dx, dz). It wraps
+  // around, so the distance from each node depends on the one after it, all the way around. We start from a node
+  // whose distance doesn't depend on the next one (because the next one is an obstacle or a jump point) and work
+  // backwards from there.
+  const int size = static_cast<int>(line.size());
+  auto is_end = [&](int node) {
+    return !passable_[node] || is_forced(node % width_, node / width_, dx, dz);
+  };
+
+  int start = -1;
+  for (int i = 0; i < size; i++) {
+    if (is_end(line[(i + 1) % size])) {
+      start = i;
+      break;
+    }
+  }
+  if (start < 0) {
+    // Nothing at all in this line, we can go all the way around without finding anything.
+    for (int node : line) {
+      distances[node] = static_cast<int16_t>(-(size - 1));
+    }
+    return;
+  }
+
+  for (int i = 0; i < size; i++) {
+    const int index = (start - i + size) % size;
+    const int next = line[(index + 1) % size];
+    int distance;
+    if (!passable_[next]) {
+      distance = 0;
+    } else if (is_forced(next % width_, next / width_, dx, dz)) {
+      distance = 1;
+    } else {
+      distance = distances[next] > 0 ? distances[next] + 1 : distances[next] - 1;
+    }
+
+    // We never go further than all the way around the map.
+    if (std::abs(distance) > size - 1) {
+      distance = -(size - 1);
+    }
+    distances[line[index]] = static_cast<int16_t>(distance);
+  }
+}
+
+bool JumpPointPathFind::passable_at(int x, int z) const {
+  return passable_[(fw::constrain(z, length_) * width_) + fw::constrain(x, width_)] != 0;
+}
+
+float JumpPointPathFind::estimate_cost(int x, int z) const {
+  // The octile distance to the goal, taking into account that it might be shorter to wrap around the edge of the
+  // map. This never over-estimates, so the paths we find are optimal.
+  int dx = std::abs(goal_x_ - x);
+  int dz = std::abs(goal_z_ - z);
+  dx = std::min(dx, width_ - dx);
+  dz = std::min(dz, length_ - dz);
+  return static_cast<float>(std::max(dx, dz)) + (kDiagonalCost - 1.0f) * static_cast<float>(std::min(dx, dz));
+}
+
+int JumpPointPathFind::jump_straight(int x, int z, int dx, int dz, int *steps) const {
+  const int distance = jump_distances_[get_straight_index(dx, dz)][(z * width_) + x];
+  const int reach = std::abs(distance);
+
+  // If the goal is on this line, within reach, we stop there instead.
+  int goal_distance = 0;
+  if (dz == 0 && z == goal_z_) {
+    goal_distance = fw::constrain((goal_x_ - x) * dx, width_);
+  } else if (dx == 0 && x == goal_x_) {
+    goal_distance = fw::constrain((goal_z_ - z) * dz, length_);
+  }
+  if (goal_distance > 0 && goal_distance <= reach) {
+    *steps = goal_distance;
+    return goal_node_;
+  }
+
+  if (distance <= 0) {
+    return -1;
+  }
+  *steps = distance;
+  return (fw::constrain(z + (dz * distance), length_) * width_) + fw::constrain(x + (dx * distance), width_);
+}
+
+int JumpPointPathFind::jump(int x, int z, int dir, int *steps) const {
+  const int dx = kDirections[dir].dx;
+  const int dz = kDirections[dir].dz;
+  if (dx == 0 || dz == 0) {
+    return jump_straight(x, z, dx, dz, steps);
+  }
+
+  const int start_node = (z * width_) + x;
+  for (int i = 1; ; i++) {
+    x = fw::constrain(x + dx, width_);
+    z = fw::constrain(z + dz, length_);
+    const int n = (z * width_) + x;
+    if (n == start_node || !passable_[n]) {
+      return -1;
+    }
+    *steps = i;
+    if (n == goal_node_) {
+      return n;
+    }
+
+    if ((!passable_at(x - dx, z) && passable_at(x - dx, z + dz))
+        || (!passable_at(x, z - dz) && passable_at(x + dx, z - dz))) {
+      return n;
+    }
+
+    // Moving diagonally, this is also a jump point if there's a jump point straight ahead in either of the
+    // directions we're moving in.
+    int straight_steps;
+    if (jump_straight(x, z, dx, 0, &straight_steps) >= 0 || jump_straight(x, z, 0, dz, &straight_steps) >= 0) {
+      return n;
+    }
+  }
+}
+
+void JumpPointPathFind::relax(int from, int dir, float cost, int to) {
+  const bool visited = stamp_[to] == run_no_;
+  if (visited && !open_.contains(to)) {
+    return;
+  }
+  if (visited && cost >= cost_from_start_[to]) {
+    return;
+  }
+
+  cost_from_start_[to] = cost;
+  parent_[to] = from;
+  direction_[to] = static_cast<uint8_t>(dir);
+
+  const float estimate = estimate_cost(to % width_, to / width_);
+  const uint64_t key = IndexedHeap::make_key(cost + estimate, estimate);
+  if (visited) {
+    open_.decrease(to, key);
+  } else {
+    stamp_[to] = run_no_;
+    open_.push(to, key);
+  }
+}
+
+void JumpPointPathFind::construct_path(std::vector<fw::Vector> &path) const {
+  // Walk back from the goal to the start, filling in all of the nodes between each pair of jump points.
+  size_t first = path.size();
+  int n = goal_node_;
+  while (parent_[n] >= 0) {
+    const int parent = parent_[n];
+    Direction const &dir = kDirections[direction_[n]];
+    int x = n % width_;
+    int z = n / width_;
+    while ((z * width_) + x != parent) {
+      path.push_back(fw::Vector(static_cast<float>(x), 0.0f, static_cast<float>(z)));
+      x = fw::constrain(x - dir.dx, width_);
+      z = fw::constrain(z - dir.dz, length_);
+    }
+    n = parent;
+  }
+  path.push_back(fw::Vector(static_cast<float>(n % width_), 0.0f, static_cast<float>(n / width_)));
+  std::reverse(path.begin() + first, path.end());
+}
+
+bool JumpPointPathFind::find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end) {
+  goal_node_ = get_node_index(end);
+  if (!passable_[goal_node_]) {
+    // We can't get to the goal itself, so just get as close as we can the normal way.
+    last_expanded = 0;
+    return PathFind::find(path, start, end);
+  }
+  goal_x_ = goal_node_ % width_;
+  goal_z_ = goal_node_ / width_;
+
+  begin_run();
+  last_expanded = 0;
+
+  const int start_node = get_node_index(start);
+  stamp_[start_node] = run_no_;
+  cost_from_start_[start_node] = 0.0f;
+  parent_[start_node] = -1;
+  direction_[start_node] = kNoDirection;
+  const float start_estimate = estimate_cost(start_node % width_, start_node / width_);
+  open_.push(start_node, IndexedHeap::make_key(start_estimate, start_estimate));
+
+  int steps;
+  while (!open_.empty()) {
+    const int curr = open_.pop();
+    last_expanded++;
+    if (curr == goal_node_) {
+      construct_path(path);
+      return true;
+    }
+
+    const int x = curr % width_;
+    const int z = curr / width_;
+    const float cost = cost_from_start_[curr];
+    auto try_direction = [&](int dx, int dz) {
+      const int dir = get_direction(dx, dz);
+      const int jump_point = jump(x, z, dir, &steps);
+      if (jump_point >= 0) {
+        relax(curr, dir, cost + static_cast<float>(steps) * (dx != 0 && dz != 0 ? kDiagonalCost : 1.0f), jump_point);
+      }
+    };
+
+    const uint8_t dir = direction_[curr];
+    if (dir == kNoDirection) {
+      // The start node, we need to search in every direction.
+      for (int i = 0; i < 9; i++) {
+        if (i != kNoDirection) {
+          try_direction(kDirections[i].dx, kDirections[i].dz);
+        }
+      }
+      continue;
+    }
+
+    // Otherwise, we only need to search the "natural" neighbours (straight ahead, or for a diagonal move, the two
+    // straight directions as well) and any neighbours that an adjacent obstacle has forced us to consider.
+    const int dx = kDirections[dir].dx;
+    const int dz = kDirections[dir].dz;
+    if (dx != 0 && dz != 0) {
+      try_direction(dx, 0);
+      try_direction(0, dz);
+      try_direction(dx, dz);
+      if (!passable_at(x - dx, z)) {
+        try_direction(-dx, dz);
+      }
+      if (!passable_at(x, z - dz)) {
+        try_direction(dx, -dz);
+      }
+    } else if (dz == 0) {
+      try_direction(dx, 0);
+      if (!passable_at(x, z + 1)) {
+        try_direction(dx, 1);
+      }
+      if (!passable_at(x, z - 1)) {
+        try_direction(dx, -1);
+      }
+    } else {
+      try_direction(0, dz);
+      if (!passable_at(x + 1, z)) {
+        try_direction(1, dz);
+      }
+      if (!passable_at(x - 1, z)) {
+        try_direction(-1, dz);
+      }
+    }
+  }
+
+  return false;
+}
+
+}
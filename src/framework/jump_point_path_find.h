@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <framework/math.h>
+#include <framework/path_find.h>
+
+namespace fw {
+
+// A PathFind that uses Jump Point Search. Our grid is uniform-cost and 8-connected, so there are usually lots of
+// equally short paths between two points, and plain A* wastes most of it's time expanding all of them. JPS only
+// expands the "jump points" where a path might have to turn (next to the corner of an obstacle), and skips over
+// everything in between in a straight line. On open terrain it expands orders of magnitude fewer nodes.
+//
+// The paths are optimal (with the same cost as a Dijkstra search would find), and are returned in the same
+// one-entry-per-cell format as PathFind::find so they can be passed to simplify_path like any other path.
+//
+// Like JPS+, we precompute, for every node and each of the four straight directions, how far it is to the next jump
+// point (or obstacle) in that direction, so straight jumps are a single lookup. The world wraps, so without this a
+// straight jump across open terrain would have to walk all the way around the map before giving up.
+//
+// If the goal is impassable, we fall back to PathFind::find, which gets us as close to the goal as it can.
+class JumpPointPathFind : public PathFind {
+private:
+  // For each of the straight directions (east, west, south, north), and each node: if positive, the number of steps
+  // to the next jump point in that direction. Otherwise, minus the number of steps we can take before hitting an
+  // obstacle (or going all the way around the map).
+  std::vector<int16_t> jump_distances_[4];
+
+  // The index into kDirections of the jump that reached each node (only valid for nodes in the current run).
+  std::vector<uint8_t> direction_;
+
+  int goal_x_;
+  int goal_z_;
+  int goal_node_;
+
+  bool passable_at(int x, int z) const;
+  bool is_forced(int x, int z, int dx, int dz) const;
+  void build_jump_distances(std::vector<int> const &line, int dx, int dz, std::vector<int16_t> &distances);
+  float estimate_cost(int x, int z) const;
+
+  // Jumps from (x, z) in the given direction, returning the node of the first jump point we find (or -1 if we hit
+  // an obstacle first). steps is set to the number of steps we took to get there.
+  int jump(int x, int z, int dir, int *steps) const;
+  int jump_straight(int x, int z, int dx, int dz, int *steps) const;
+
+  void relax(int from, int dir, float cost, int to);
+  void construct_path(std::vector<fw::Vector> &path) const;
+
+public:
+  JumpPointPathFind(int width, int length, std::vector<bool> const &passability);
+  JumpPointPathFind(std::shared_ptr<PassabilityGrid const> grid);
+  virtual ~JumpPointPathFind();
+
+  bool find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end) override;
+
+  // The number of nodes that the last call to find() expanded, for diagnostics.
+  int last_expanded;
+};
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace fw {
+
+// A fixed-capacity map that evicts the least-recently used entry when it's full. This is not thread-safe, callers
+// are expected to do their own locking.
+template<typename K, typename V>
+class LruCache {
+private:
+  typedef std::list<std::pair<K, V>> EntryList;
+
+  size_t capacity_;
+
+  // Entries in order of use, the most recently used at the front.
+  EntryList entries_;
+  std::unordered_map<K, typename EntryList::iterator> index_;
+
+public:
+  explicit inline LruCache(size_t capacity) : capacity_(capacity) {
+  }
+
+  // Gets the value with the given key, and marks it as the most recently used. Returns std::nullopt if it's not in
+  // the cache.
+  inline std::optional<V> get(K const &key);
+
+  // Adds (or replaces) the value with the given key, evicting the least recently used entry if we're full.
+  inline void put(K const &key, V const &value);
+
+  inline void clear() {
+    entries_.clear();
+    index_.clear();
+  }
+
+  inline size_t size() const {
+    return entries_.size();
+  }
+};
+
+template<typename K, typename V>
+std::optional<V> LruCache<K, V>::get(K const &key) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return std::nullopt;
+  }
+
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+template<typename K, typename V>
+void LruCache<K, V>::put(K const &key, V const &value) {
+  if (capacity_ == 0) {
+    return;
+  }
+
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    it->second->second = value;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+
+  if (entries_.size() >= capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(key, value);
+  index_[key] = entries_.begin();
+}
+
+}
@@ -189,7 +189,7 @@ public:
   }
 
   // Returns a new matrix that is the inverse of this one.
-  inline Matrix inverse() {
+  inline Matrix inverse() const {
     Matrix m;
     mat4x4_invert(m.m, this->m);
     return m;
@@ -216,6 +216,31 @@ public:
 
   inline Quaternion& normalize() {
     quat_norm(q, q);
+    return *this;
+  }
+
+  // The rotation of the given matrix, which must be a pure rotation (i.e. it's axes are unit length and at right
+  // angles to each other).
+  static inline Quaternion from_matrix(const Matrix& m) {
+    // r(row, col) is m.elem(row, col), which linmath stores as m[col][row].
+    const float trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+    if (trace > 0.0f) {
+      const float s = std::sqrt(trace + 1.0f) * 2.0f;
+      return Quaternion(
+          (m.m[1][2] - m.m[2][1]) / s, (m.m[2][0] - m.m[0][2]) / s, (m.m[0][1] - m.m[1][0]) / s, 0.25f * s);
+    } else if (m.m[0][0] > m.m[1][1] && m.m[0][0] > m.m[2][2]) {
+      const float s = std::sqrt(1.0f + m.m[0][0] - m.m[1][1] - m.m[2][2]) * 2.0f;
+      return Quaternion(
+          0.25f * s, (m.m[1][0] + m.m[0][1]) / s, (m.m[2][0] + m.m[0][2]) / s, (m.m[1][2] - m.m[2][1]) / s);
+    } else if (m.m[1][1] > m.m[2][2]) {
+      const float s = std::sqrt(1.0f + m.m[1][1] - m.m[0][0] - m.m[2][2]) * 2.0f;
+      return Quaternion(
+          (m.m[1][0] + m.m[0][1]) / s, 0.25f * s, (m.m[2][1] + m.m[1][2]) / s, (m.m[2][0] - m.m[0][2]) / s);
+    } else {
+      const float s = std::sqrt(1.0f + m.m[2][2] - m.m[0][0] - m.m[1][1]) * 2.0f;
+      return Quaternion(
+          (m.m[2][0] + m.m[0][2]) / s, (m.m[2][1] + m.m[1][2]) / s, 0.25f * s, (m.m[0][1] - m.m[1][0]) / s);
+    }
   }
 
   inline Vector operator*(const Vector& v) const {
@@ -260,6 +285,63 @@ inline Quaternion rotate_axis_angle(const Vector& axis, float angle) {
   return q;
 }
 
+// Interpolates between two rotations along the shortest arc, at a constant speed.
+inline Quaternion slerp(const Quaternion& from, const Quaternion& to, float t) {
+  float cos_theta = quat_mul_inner(from.q, to.q);
+  float to_sign = 1.0f;
+  if (cos_theta < 0.0f) {
+    // q and -q are the same rotation, but only one of them is the short way round.
+    cos_theta = -cos_theta;
+    to_sign = -1.0f;
+  }
+
+  float from_weight = 1.0f - t;
+  float to_weight = t;
+  if (cos_theta < 0.9995f) {
+    // Otherwise they're so close that we can just interpolate them linearly (and we'd be dividing by ~0 here).
+    const float theta = std::acos(cos_theta);
+    const float sin_theta = std::sin(theta);
+    from_weight = std::sin((1.0f - t) * theta) / sin_theta;
+    to_weight = std::sin(t * theta) / sin_theta;
+  }
+  to_weight *= to_sign;
+
+  Quaternion res(
+      from.q[0] * from_weight + to.q[0] * to_weight, from.q[1] * from_weight + to.q[1] * to_weight,
+      from.q[2] * from_weight + to.q[2] * to_weight, from.q[3] * from_weight + to.q[3] * to_weight);
+  return res.normalize();
+}
+
+// Interpolates between two transforms that are made of a rotation, a scale and a translation (but no shear or
+// projection). The translation and scale are interpolated linearly and the rotation with slerp. Just interpolating
+// each element of the matrices would squash things as they turn.
+inline Matrix interpolate(const Matrix& from, const Matrix& to, float t) {
+  Matrix from_rotation = identity();
+  Matrix to_rotation = identity();
+  Vector from_scale;
+  Vector to_scale;
+  for (int col = 0; col < 3; col++) {
+    from_scale[col] = Vector(from.m[col][0], from.m[col][1], from.m[col][2]).length();
+    to_scale[col] = Vector(to.m[col][0], to.m[col][1], to.m[col][2]).length();
+    for (int row = 0; row < 3; row++) {
+      from_rotation.m[col][row] = from_scale[col] > 0.0f ? from.m[col][row] / from_scale[col] : 0.0f;
+      to_rotation.m[col][row] = to_scale[col] > 0.0f ? to.m[col][row] / to_scale[col] : 0.0f;
+    }
+  }
+
+  Matrix res = slerp(Quaternion::from_matrix(from_rotation), Quaternion::from_matrix(to_rotation), t).to_matrix();
+  for (int col = 0; col < 3; col++) {
+    const float s = from_scale[col] + (to_scale[col] - from_scale[col]) * t;
+    for (int row = 0; row < 3; row++) {
+      res.m[col][row] *= s;
+    }
+  }
+  for (int row = 0; row < 3; row++) {
+    res.m[3][row] = from.m[3][row] + (to.m[3][row] - from.m[3][row]) * t;
+  }
+  return res;
+}
+
 inline Matrix translation(const Vector& v) {
   Matrix m;
   mat4x4_translate(m.m, v.x(), v.y(), v.z());
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <framework/model.h>
 #include <framework/model_node.h>
 #include <framework/scenegraph.h>
@@ -22,6 +24,28 @@ ModelMeshNoanim::ModelMeshNoanim(int num_vertices, int num_indices) :
 ModelMeshNoanim::~ModelMeshNoanim() {
 }
 
+void ModelMeshNoanim::update_bounds() {
+  if (vertices.empty()) {
+    bounds_ = fw::Bounds();
+    return;
+  }
+
+  fw::Vector min(vertices[0].x, vertices[0].y, vertices[0].z);
+  fw::Vector max = min;
+  for (auto const &v : vertices) {
+    min = fw::Vector(std::min(min[0], v.x), std::min(min[1], v.y), std::min(min[2], v.z));
+    max = fw::Vector(std::max(max[0], v.x), std::max(max[1], v.y), std::max(max[2], v.z));
+  }
+
+  // The sphere is centered on the box, but we can usually make it smaller than the one around the box's corners.
+  const fw::Vector center = (min + max) * 0.5f;
+  float radius = 0.0f;
+  for (auto const &v : vertices) {
+    radius = std::max(radius, (fw::Vector(v.x, v.y, v.z) - center).length());
+  }
+  bounds_ = fw::Bounds(min, max, center, radius);
+}
+
 void ModelMeshNoanim::SetupBuffers() {
   if (vb_)
     return;
@@ -44,6 +68,10 @@ Model::Model(const std::vector<std::shared_ptr<fw::ModelMesh>>& meshes, std::sha
 Model::~Model() {
 }
 
+fw::Bounds const &Model::get_bounds() const {
+  return root_node_->get_bounds();
+}
+
 std::shared_ptr<fw::ModelNode> Model::create_node(fw::Color color) {
   auto clone = std::dynamic_pointer_cast<fw::ModelNode>(root_node_->clone());
   clone->set_color(color);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <framework/bounds.h>
 #include <framework/color.h>
 #include <framework/graphics.h>
 #include <framework/math.h>
@@ -17,6 +18,7 @@ protected:
   std::shared_ptr<VertexBuffer> vb_;
   std::shared_ptr<IndexBuffer> ib_;
   std::shared_ptr<Shader> shader_;
+  fw::Bounds bounds_;
 
   virtual void SetupBuffers() = 0;
 
@@ -36,6 +38,11 @@ public:
     SetupBuffers();
     return shader_;
   }
+
+  // The bounds of the mesh's vertices, in the mesh's own space.
+  fw::Bounds const &get_bounds() const {
+    return bounds_;
+  }
 };
 
 // A specialization of ModelMesh that doesn't support animation.
@@ -49,6 +56,9 @@ public:
 
   std::vector<fw::vertex::xyz_n_uv> vertices;
   std::vector<uint16_t> indices;
+
+  // Works out our bounds from the vertices. Call this after you've filled them in.
+  void update_bounds();
 };
 
 // A Model consists of a hierarchy of nodes, each of which contains one or more meshes, each with their own (though
@@ -71,6 +81,9 @@ public:
   Model(const std::vector<std::shared_ptr<fw::ModelMesh>>& meshes, std::shared_ptr<fw::ModelNode> root_node);
   ~Model();
 
+  // The bounds of the whole model, in the root node's space.
+  fw::Bounds const &get_bounds() const;
+
   // Creates a new scenegraph node you can use that will render this model.
   std::shared_ptr<fw::ModelNode> create_node(fw::Color color);
 };
@@ -24,6 +24,20 @@ void ModelNode::initialize(Model *mdl) {
   }
 }
 
+void ModelNode::update_bounds(std::vector<std::shared_ptr<ModelMesh>> const &meshes) {
+  fw::Bounds bounds;
+  if (mesh_index >= 0 && mesh_index < static_cast<int>(meshes.size())) {
+    bounds = meshes[mesh_index]->get_bounds();
+  }
+
+  for (std::shared_ptr<Node> &child_node : children_) {
+    auto child = std::dynamic_pointer_cast<ModelNode>(child_node);
+    child->update_bounds(meshes);
+    bounds.merge(child->get_bounds().transformed(child->get_local_transform()));
+  }
+  set_bounds(bounds);
+}
+
 void ModelNode::render(sg::Scenegraph *sg, fw::Matrix const &model_matrix /*= fw::identity()*/) {
   if (need_initialize_) {
     if (mesh_index >= 0) {
@@ -39,6 +53,9 @@ void ModelNode::render(sg::Scenegraph *sg, fw::Matrix const &model_matrix /*= fw
       }
       params->set_color("mesh_color", fw::Color(1, 1, 1));
       set_shader_parameters(params);
+
+      // Every node made from this model shares the mesh's buffers, so we can draw all of them at once.
+      set_instanced(true);
     }
     need_initialize_ = false;
   }
@@ -52,7 +69,8 @@ void ModelNode::render(sg::Scenegraph *sg, fw::Matrix const &model_matrix /*= fw
     get_shader_parameters()->set_color("mesh_color", color_);
   }
 
-  Node::render(sg, transform * model_matrix);
+  // Node::render applies our transform, as part of get_render_transform().
+  Node::render(sg, model_matrix);
 
 //  if (model_->get_wireframe()) {
 //    device->SetRenderState(D3DRS_FILLMODE, D3DFILL_SOLID);
@@ -73,6 +91,7 @@ void ModelNode::populate_clone(std::shared_ptr<sg::Node> clone) {
 
 void ModelNode::set_color(fw::Color color) {
   color_ = color;
+  set_instance_color(color);
   for(std::shared_ptr<Node> &child_node: children_) {
     std::dynamic_pointer_cast<ModelNode>(child_node)->set_color(color);
   }
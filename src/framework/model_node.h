@@ -41,6 +41,21 @@ public:
   // You can call this after setting mesh_index to set up the Node.
   void initialize(Model *mdl);
 
+  // Works out the bounds of this node (and all our children) from the given meshes. The bounds are in the space our
+  // mesh is in, so they include our children's transforms but not our own.
+  void update_bounds(std::vector<std::shared_ptr<ModelMesh>> const &meshes);
+
+  fw::Matrix get_local_transform() const override {
+    return world_ * transform;
+  }
+
+  using sg::Node::set_local_transform;
+
+  // Replaces the model's transform (not the world matrix), which is how entities move their meshes around.
+  void set_local_transform(fw::Matrix const &m) override {
+    transform = m;
+  }
+
   virtual std::shared_ptr<sg::Node> clone();
 };
 
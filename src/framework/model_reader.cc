@@ -45,12 +45,14 @@ fw::StatusOr<std::shared_ptr<Model>> ModelReader::read(fs::path const &filename)
     uint16_t const *indices_end =
         reinterpret_cast<uint16_t const *>(pb_mesh.indices().data() + pb_mesh.indices().size());
     mesh_noanim->indices.assign(indices_begin, indices_end);
+    mesh_noanim->update_bounds();
     meshes.push_back(mesh_noanim);
   }
 
   std::shared_ptr<ModelNode> root_node = std::shared_ptr<ModelNode>(new ModelNode());
   add_node(root_node, pb_model.root_node());
-  
+  root_node->update_bounds(meshes);
+
   return std::make_shared<fw::Model>(meshes, root_node);
 }
 
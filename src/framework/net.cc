@@ -26,7 +26,7 @@ void destroy() {
 
 //-------------------------------------------------------------------------
 Peer::Peer(Host *host, ENetPeer *peer, bool connected) :
-    host_(host), peer_(peer), connected_(connected) {
+    host_(host), peer_(peer), connected_(connected), encoding_(Encoding::kLegacy) {
 }
 
 Peer::~Peer() {
@@ -36,7 +36,7 @@ Peer::~Peer() {
 }
 
 void Peer::send(Packet &pkt, int channel /*= 0*/) {
-  PacketBuffer buff(pkt.get_identifier());
+  PacketBuffer buff(pkt.get_identifier(), encoding_);
   pkt.serialize(buff);
 
   enet_uint32 flags = 0;
@@ -44,8 +44,17 @@ void Peer::send(Packet &pkt, int channel /*= 0*/) {
     flags |= ENET_PACKET_FLAG_RELIABLE;
   }
 
-  ENetPacket *Packet = enet_packet_create(buff.get_buffer(), buff.get_size(), flags);
-  enet_peer_send(peer_, static_cast<enet_uint8>(channel), Packet);
+  // The packet takes the bytes we just serialized, rather than copying them.
+  ENetPacket *packet = buff.release_packet(flags);
+  if (packet == nullptr) {
+    LOG(ERR) << "error creating packet";
+    return;
+  }
+  if (enet_peer_send(peer_, static_cast<enet_uint8>(channel), packet) < 0) {
+    // ENet only takes ownership of the packet if it was able to queue it.
+    LOG(ERR) << "error sending packet";
+    enet_packet_destroy(packet);
+  }
 }
 
 void Peer::on_connect() {
@@ -57,9 +66,21 @@ void Peer::on_receive(ENetPacket *Packet, enet_uint8 /*channel*/) {
   LOG(INFO) << "packet received from " << peer_->address.host << ":" << peer_->address.port;
 
   if (handler_) {
+    // The buffer reads straight out of the ENet packet, which stays around until we return.
     PacketBuffer buff(reinterpret_cast<char *>(Packet->data), Packet->dataLength);
+    if (buff.has_read_error()) {
+      LOG(WARN) << "couldn't read packet header (maybe it's from a newer version?), ignoring";
+      return;
+    }
     std::shared_ptr<net::Packet> pkt(create_packet(buff));
+    if (!pkt) {
+      return;
+    }
     pkt->deserialize(buff);
+    if (buff.has_read_error()) {
+      LOG(WARN) << "packet was too short, ignoring (type: " << buff.get_packet_type() << ")";
+      return;
+    }
     handler_(pkt);
   }
 }
@@ -7,6 +7,7 @@
 #include <enet/enet.h>
 
 #include <framework/packet.h>
+#include <framework/packet_buffer.h>
 #include <framework/status.h>
 
 namespace fw {
@@ -70,15 +71,35 @@ public:
   /** Sends the given Packet to this Peer. */
   void send(Packet &pkt, int channel = 0);
 
+  /**
+   * Gets or sets the encoding we use for packets we send to this Peer. It starts out as Encoding::kLegacy, until we've
+   * agreed on something better. Packets we receive say which encoding they're in themselves.
+   */
+  Encoding get_encoding() const {
+    return encoding_;
+  }
+  void set_encoding(Encoding encoding) {
+    encoding_ = encoding;
+  }
+
   bool is_connected() const {
     return connected_;
   }
+
+  /** Gets ENet's (smoothed) round-trip time to this Peer, and it's variance, in milliseconds. */
+  int get_round_trip_time() const {
+    return static_cast<int>(peer_->roundTripTime);
+  }
+  int get_round_trip_time_variance() const {
+    return static_cast<int>(peer_->roundTripTimeVariance);
+  }
 protected:
   friend class Host;
 
   Host *host_;
   ENetPeer *peer_;
   bool connected_;
+  Encoding encoding_;
 
   std::function<void(std::shared_ptr<Packet> const &)> handler_;
 
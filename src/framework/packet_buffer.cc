@@ -1,48 +1,250 @@
 #include <framework/packet_buffer.h>
 
-namespace fw {
-namespace net {
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <new>
 
-PacketBuffer::PacketBuffer(uint16_t packet_type) :
-    flushed_(false) {
-  (*this) << packet_type;
+namespace fw::net {
+namespace {
+
+// Blocks come in powers of two from kMinBlockSize up, and each thread keeps up to kMaxFreeBlocks of each of the
+// smallest kNumPooledSizes sizes around for next time. Anything bigger than that is rare enough that we just allocate
+// it and free it.
+constexpr std::size_t kMinBlockSize = 256;
+constexpr int kNumPooledSizes = 9;
+constexpr int kMaxFreeBlocks = 16;
+
+// Each block starts with one of these, and the bytes come straight after it.
+struct BlockHeader {
+  std::size_t capacity;
+  int size_index;
+  BlockHeader *next;
+};
+
+constexpr std::size_t kHeaderSize = (sizeof(BlockHeader) + alignof(std::max_align_t) - 1)
+    & ~(alignof(std::max_align_t) - 1);
+
+BlockHeader *get_header(uint8_t *data) {
+  return reinterpret_cast<BlockHeader *>(data - kHeaderSize);
+}
+
+class BlockPool {
+private:
+  BlockHeader *free_lists_[kNumPooledSizes] = {};
+  int num_free_[kNumPooledSizes] = {};
+
+public:
+  ~BlockPool();
+
+  uint8_t *allocate(std::size_t min_capacity, std::size_t *capacity);
+  void free(uint8_t *data);
+};
+
+// A block can be freed on a different thread to the one that allocated it (ENet frees packets on whichever thread is
+// servicing the host), in which case it just goes into that thread's pool. If a thread's pool has already been
+// destroyed (because the thread is exiting), we just free the block.
+thread_local BlockPool g_pool;
+thread_local bool g_pool_destroyed = false;
+
+BlockPool::~BlockPool() {
+  g_pool_destroyed = true;
+  for (int i = 0; i < kNumPooledSizes; i++) {
+    while (free_lists_[i] != nullptr) {
+      BlockHeader *header = free_lists_[i];
+      free_lists_[i] = header->next;
+      ::operator delete(header);
+    }
+  }
+}
+
+uint8_t *BlockPool::allocate(std::size_t min_capacity, std::size_t *capacity) {
+  int size_index = 0;
+  std::size_t block_size = kMinBlockSize;
+  while (block_size < min_capacity) {
+    block_size <<= 1;
+    size_index++;
+  }
+
+  BlockHeader *header = nullptr;
+  if (size_index < kNumPooledSizes && free_lists_[size_index] != nullptr) {
+    header = free_lists_[size_index];
+    free_lists_[size_index] = header->next;
+    num_free_[size_index]--;
+  } else {
+    header = static_cast<BlockHeader *>(::operator new(kHeaderSize + block_size));
+    header->capacity = block_size;
+    header->size_index = size_index;
+  }
+  header->next = nullptr;
+
+  *capacity = header->capacity;
+  return reinterpret_cast<uint8_t *>(header) + kHeaderSize;
+}
+
+void BlockPool::free(uint8_t *data) {
+  BlockHeader *header = get_header(data);
+  const int size_index = header->size_index;
+  if (size_index >= kNumPooledSizes || num_free_[size_index] >= kMaxFreeBlocks) {
+    ::operator delete(header);
+    return;
+  }
+
+  header->next = free_lists_[size_index];
+  free_lists_[size_index] = header;
+  num_free_[size_index]++;
+}
+
+void free_block(uint8_t *data) {
+  if (g_pool_destroyed) {
+    ::operator delete(get_header(data));
+  } else {
+    g_pool.free(data);
+  }
+}
+
+// Called by ENet when it destroys a packet we made in release_packet.
+void free_packet_data(ENetPacket *packet) {
+  free_block(packet->data);
+}
+
+// The encoding goes in the top four bits of the packet type.
+constexpr int kEncodingShift = 12;
+constexpr uint16_t kPacketTypeMask = (1 << kEncodingShift) - 1;
+
+// Positions further out than this won't fit on the grid (and aren't on the map anyway).
+constexpr float kMaxGridPosition = 1 << 20;
+
+// Works out the grid step for the given value, if it's exactly on the grid. We compare the bits rather than the values
+// so that things like -0.0 (which would come back as 0.0) get sent as floats.
+bool to_grid(float value, int32_t &step) {
+  if (!(std::abs(value) < kMaxGridPosition)) {
+    return false;
+  }
+  step = static_cast<int32_t>(std::lround(value * kPositionScale));
+  return std::bit_cast<uint32_t>(static_cast<float>(step) / kPositionScale) == std::bit_cast<uint32_t>(value);
+}
+
+}
+
+Vector quantize_position(Vector const &position) {
+  Vector quantized;
+  for (int i = 0; i < 3; i++) {
+    quantized[i] = (std::abs(position[i]) < kMaxGridPosition)
+        ? static_cast<float>(std::lround(position[i] * kPositionScale)) / kPositionScale
+        : position[i];
+  }
+  return quantized;
+}
+
+PacketBuffer::PacketBuffer(uint16_t packet_type, Encoding encoding) :
+    data_(nullptr), size_(0), capacity_(0), read_pos_(0), owns_data_(false), read_error_(false),
+    packet_type_(packet_type), encoding_(encoding), last_id_(0) {
+  grow(kMinBlockSize);
+  add_fixed(packet_type | (static_cast<uint16_t>(encoding) << kEncodingShift), 2);
 }
 
 PacketBuffer::PacketBuffer(char const *bytes, std::size_t n) :
-    buffer_(std::string(bytes, n)), flushed_(false) {
-  (*this) >> packet_type_;
+    data_(reinterpret_cast<uint8_t *>(const_cast<char *>(bytes))), size_(n), capacity_(n), read_pos_(0),
+    owns_data_(false), read_error_(false), packet_type_(0), encoding_(Encoding::kLegacy), last_id_(0) {
+  const uint16_t header = static_cast<uint16_t>(get_fixed(2));
+  const int encoding = header >> kEncodingShift;
+  if (encoding > static_cast<int>(kLatestEncoding)) {
+    // It's from a newer version than us, we can't read it.
+    read_error_ = true;
+    return;
+  }
+  packet_type_ = header & kPacketTypeMask;
+  encoding_ = static_cast<Encoding>(encoding);
 }
 
 PacketBuffer::~PacketBuffer() {
+  if (owns_data_) {
+    free_block(data_);
+  }
 }
 
-void PacketBuffer::add_bytes(char const *bytes, std::size_t offset, std::size_t n) {
-  flushed_ = false;
-  buffer_.write(bytes + offset, n);
+void PacketBuffer::grow(std::size_t min_capacity) {
+  std::size_t capacity;
+  uint8_t *data = g_pool.allocate(std::max(min_capacity, capacity_ * 2), &capacity);
+  if (size_ > 0) {
+    std::memcpy(data, data_, size_);
+  }
+  if (owns_data_) {
+    free_block(data_);
+  }
+
+  data_ = data;
+  capacity_ = capacity;
+  owns_data_ = true;
 }
 
-void PacketBuffer::get_bytes(char *bytes, std::size_t offset, std::size_t n) {
-  buffer_.read(bytes + offset, n);
+void PacketBuffer::read_past_end(char *bytes, std::size_t n) {
+  std::memset(bytes, 0, n);
+  read_pos_ = size_;
+  read_error_ = true;
 }
 
-void PacketBuffer::flush() {
-  if (flushed_)
+void PacketBuffer::add_vector(Vector const &value) {
+  if (encoding_ == Encoding::kLegacy) {
+    for (int i = 0; i < 3; i++) {
+      add_fixed(std::bit_cast<uint32_t>(value[i]), 4);
+    }
     return;
+  }
 
-  buffer_.flush();
-  value_ = buffer_.str();
-  flushed_ = true;
+  // One byte to say whether the whole thing is on the grid, then either the grid steps or the floats.
+  int32_t steps[3];
+  const bool on_grid = to_grid(value[0], steps[0]) && to_grid(value[1], steps[1]) && to_grid(value[2], steps[2]);
+  add_fixed(on_grid ? 0 : 1, 1);
+  for (int i = 0; i < 3; i++) {
+    if (on_grid) {
+      add_varint(zigzag(steps[i]));
+    } else {
+      add_fixed(std::bit_cast<uint32_t>(value[i]), 4);
+    }
+  }
 }
 
-char const *PacketBuffer::get_buffer() {
-  flush();
-  return value_.c_str();
+void PacketBuffer::get_vector(Vector &value) {
+  const bool on_grid = (encoding_ != Encoding::kLegacy) && (get_fixed(1) == 0);
+  for (int i = 0; i < 3; i++) {
+    if (on_grid) {
+      value[i] = static_cast<float>(unzigzag(get_varint())) / kPositionScale;
+    } else {
+      value[i] = std::bit_cast<float>(static_cast<uint32_t>(get_fixed(4)));
+    }
+  }
 }
 
-std::size_t PacketBuffer::get_size() {
-  flush();
-  return value_.length();
+std::string_view PacketBuffer::get_view(std::size_t n) {
+  if (n > size_ - read_pos_) {
+    read_pos_ = size_;
+    read_error_ = true;
+    return std::string_view();
+  }
+
+  std::string_view view(reinterpret_cast<char const *>(data_ + read_pos_), n);
+  read_pos_ += n;
+  return view;
 }
 
+ENetPacket *PacketBuffer::release_packet(enet_uint32 flags) {
+  if (!owns_data_) {
+    // We're just looking at someone else's bytes, so we'll need our own copy to give away.
+    grow(size_);
+  }
+
+  ENetPacket *packet = enet_packet_create(data_, size_, flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+  if (packet == nullptr) {
+    return nullptr;
+  }
+  packet->freeCallback = &free_packet_data;
+
+  data_ = nullptr;
+  size_ = capacity_ = read_pos_ = 0;
+  owns_data_ = false;
+  return packet;
 }
+
 }
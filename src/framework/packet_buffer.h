@@ -1,167 +1,371 @@
 #pragma once
 
-#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <enet/enet.h>
+
 #include <framework/color.h>
 #include <framework/math.h>
 
 namespace fw::net {
 
+// How the values in a packet are written on the wire. The encoding goes in the top bits of the packet type, so the
+// receiver always knows how to read a packet. Each connection uses the newest one that both ends support, which they
+// agree on when they join (see game::JoinRequestPacket).
+enum class Encoding : uint8_t {
+  // Integers at full width and vectors as three floats. This is all that older versions understand, so packets that
+  // they know about must be written exactly the way they always were in this encoding (new fields can only go on the
+  // end, where older versions ignore them).
+  kLegacy = 0,
+
+  // Integers as LEB128 varints (zigzag-encoded if they're signed), vectors on a grid of 1/kPositionScale map units
+  // where possible, and ids as the difference from the previous id in the packet.
+  kCompact = 1,
+};
+
+static constexpr Encoding kLatestEncoding = Encoding::kCompact;
+
+// Positions that are on a grid of this many steps per map unit are sent as (small) integers in the compact encoding,
+// anything else is sent as raw floats.
+static constexpr float kPositionScale = 16.0f;
+
+// Snaps the given map-space position to the grid, so that it's as cheap as possible to send. Only do this before you
+// post a command, so that everybody (including us) runs it with the same position.
+Vector quantize_position(Vector const &position);
+
 // This class represents a "buffer" we use for reading/writing packets that get sent between net_peers.
+//
+// When you're writing a packet, the bytes go straight into a block of memory from a per-thread pool (which we swap for
+// a bigger one if it fills up). When it's time to send, release_packet() hands that block to an ENetPacket as-is, so
+// the bytes are never copied, and ENet gives the block back to the pool when it's done with it.
+//
+// When you're reading a packet, the buffer just points at the bytes you give it, so they have to stay around for as
+// long as the buffer does. You can read strings as std::string_views into those bytes, rather than copying them.
+//
+// Everything is little-endian, whatever the encoding, so hosts with different byte orders can talk to each other.
 class PacketBuffer {
 private:
-  bool flushed_;
-  std::string value_;
-  std::stringstream buffer_;
+  uint8_t *data_;
+  std::size_t size_;
+  std::size_t capacity_;
+  std::size_t read_pos_;
+  // True if data_ is a block from the pool that we have to give back, false if it belongs to someone else.
+  bool owns_data_;
+  // Set if we've tried to read past the end of the packet.
+  bool read_error_;
   uint16_t packet_type_;
+  Encoding encoding_;
+  // The last id we wrote or read, which the next one is delta-coded against.
+  uint32_t last_id_;
+
+  static constexpr int kMaxVarintSize = 10;
+
+  void grow(std::size_t min_capacity);
+  void read_past_end(char *bytes, std::size_t n);
+
+  void add_varint(uint64_t value) {
+    if (size_ + kMaxVarintSize > capacity_) {
+      grow(size_ + kMaxVarintSize);
+    }
+    while (value >= 0x80) {
+      data_[size_++] = static_cast<uint8_t>(value) | 0x80;
+      value >>= 7;
+    }
+    data_[size_++] = static_cast<uint8_t>(value);
+  }
+
+  uint64_t get_varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (read_pos_ == size_) {
+        read_error_ = true;
+        return 0;
+      }
+      const uint8_t b = data_[read_pos_++];
+      value |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return value;
+      }
+    }
+    // More than ten bytes can't be a valid varint.
+    read_error_ = true;
+    return 0;
+  }
 
-  void flush();
+  static uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+  }
+  static int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
 
 public:
-  PacketBuffer(uint16_t packet_type);
+  // Starts writing a packet of the given type, in the given encoding.
+  PacketBuffer(uint16_t packet_type, Encoding encoding = Encoding::kLegacy);
+
+  // Reads the packet in the given bytes, in whatever encoding it says it's in.
   PacketBuffer(char const *bytes, std::size_t n);
   ~PacketBuffer();
 
-  void add_bytes(char const *bytes, std::size_t offset, std::size_t n);
-  void get_bytes(char *bytes, std::size_t offset, std::size_t n);
+  PacketBuffer(PacketBuffer const &) = delete;
+  PacketBuffer &operator=(PacketBuffer const &) = delete;
+
+  void add_bytes(char const *bytes, std::size_t offset, std::size_t n) {
+    if (size_ + n > capacity_) {
+      grow(size_ + n);
+    }
+    std::memcpy(data_ + size_, bytes + offset, n);
+    size_ += n;
+  }
+
+  // Reads the next n bytes. If there's not that many left, you get zeros and has_read_error() starts returning true.
+  void get_bytes(char *bytes, std::size_t offset, std::size_t n) {
+    if (n > size_ - read_pos_) {
+      read_past_end(bytes + offset, n);
+      return;
+    }
+    std::memcpy(bytes + offset, data_ + read_pos_, n);
+    read_pos_ += n;
+  }
+
+  // Like get_bytes, but returns a view of the bytes in the buffer instead of copying them. The view is only good for as
+  // long as the buffer is (and you haven't written anything else to it).
+  std::string_view get_view(std::size_t n);
+
+  // Always exactly width bytes, whatever the encoding.
+  void add_fixed(uint64_t value, int width) {
+    if (size_ + width > capacity_) {
+      grow(size_ + width);
+    }
+    for (int i = 0; i < width; i++) {
+      data_[size_ + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    size_ += width;
+  }
+
+  uint64_t get_fixed(int width) {
+    if (static_cast<std::size_t>(width) > size_ - read_pos_) {
+      read_pos_ = size_;
+      read_error_ = true;
+      return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < width; i++) {
+      value |= static_cast<uint64_t>(data_[read_pos_ + i]) << (8 * i);
+    }
+    read_pos_ += width;
+    return value;
+  }
 
-  char const *get_buffer();
-  std::size_t get_size();
+  // Integers that are width bytes wide in the legacy encoding, and varints in the compact encoding (except for single
+  // bytes, which are just written as-is).
+  void add_uint(uint64_t value, int width) {
+    if (encoding_ == Encoding::kLegacy || width == 1) {
+      add_fixed(value, width);
+    } else {
+      add_varint(value);
+    }
+  }
+
+  uint64_t get_uint(int width) {
+    if (encoding_ == Encoding::kLegacy || width == 1) {
+      return get_fixed(width);
+    }
+    return get_varint();
+  }
+
+  void add_int(int64_t value, int width) {
+    if (encoding_ == Encoding::kLegacy || width == 1) {
+      add_fixed(static_cast<uint64_t>(value), width);
+    } else {
+      add_varint(zigzag(value));
+    }
+  }
+
+  int64_t get_int(int width) {
+    if (encoding_ == Encoding::kLegacy || width == 1) {
+      const int shift = 64 - (8 * width);
+      return static_cast<int64_t>(get_fixed(width) << shift) >> shift;
+    }
+    return unzigzag(get_varint());
+  }
+
+  // Ids (e.g. entity ids) are delta-coded against the previous one in the compact encoding, so a group of units that
+  // were created together (and tend to get their orders together) only costs a byte or so each.
+  void add_id(uint32_t id) {
+    if (encoding_ == Encoding::kLegacy) {
+      add_fixed(id, 4);
+    } else {
+      add_varint(zigzag(static_cast<int64_t>(id) - static_cast<int64_t>(last_id_)));
+    }
+    last_id_ = id;
+  }
+
+  uint32_t get_id() {
+    if (encoding_ == Encoding::kLegacy) {
+      last_id_ = static_cast<uint32_t>(get_fixed(4));
+    } else {
+      last_id_ = static_cast<uint32_t>(static_cast<int64_t>(last_id_) + unzigzag(get_varint()));
+    }
+    return last_id_;
+  }
+
+  void add_vector(Vector const &value);
+  void get_vector(Vector &value);
+
+  bool has_read_error() const {
+    return read_error_;
+  }
+  std::size_t get_bytes_remaining() const {
+    return size_ - read_pos_;
+  }
+  Encoding get_encoding() const {
+    return encoding_;
+  }
+
+  char const *get_buffer() const {
+    return reinterpret_cast<char const *>(data_);
+  }
+  std::size_t get_size() const {
+    return size_;
+  }
   uint16_t get_packet_type() const {
     return packet_type_;
   }
+
+  // Makes an ENetPacket with the given flags (plus ENET_PACKET_FLAG_NO_ALLOCATE) out of the bytes we've written. The
+  // packet takes the block we wrote them into, and the buffer is empty afterwards. Returns nullptr if ENet couldn't
+  // make the packet, in which case we keep our bytes.
+  ENetPacket *release_packet(enet_uint32 flags);
 };
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, int32_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 4);
+  lhs.add_int(rhs, 4);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, int32_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 4);
+  rhs = static_cast<int32_t>(lhs.get_int(4));
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, uint32_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 4);
+  lhs.add_uint(rhs, 4);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, uint32_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 4);
+  rhs = static_cast<uint32_t>(lhs.get_uint(4));
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, int16_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 2);
+  lhs.add_int(rhs, 2);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, int16_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 2);
+  rhs = static_cast<int16_t>(lhs.get_int(2));
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, uint16_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 2);
+  lhs.add_uint(rhs, 2);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, uint16_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 2);
+  rhs = static_cast<uint16_t>(lhs.get_uint(2));
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, int64_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 8);
+  lhs.add_int(rhs, 8);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, int64_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 8);
+  rhs = lhs.get_int(8);
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, uint64_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 8);
+  lhs.add_uint(rhs, 8);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, uint64_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 8);
+  rhs = lhs.get_uint(8);
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, uint8_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, 1);
+  lhs.add_uint(rhs, 1);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, uint8_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, 1);
+  rhs = static_cast<uint8_t>(lhs.get_uint(1));
   return lhs;
 }
 
 #ifdef __APPLE__
 // CLang for Apple makes size_t a different type, but on other platforms, it's the same as uint64_t (or uint32_t).
 
-inline packet_buffer &operator <<(packet_buffer &lhs, size_t rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, sizeof(size_t));
+inline PacketBuffer &operator <<(PacketBuffer &lhs, size_t rhs) {
+  lhs.add_uint(rhs, sizeof(size_t));
   return lhs;
 }
 
-inline packet_buffer &operator >>(packet_buffer &lhs, size_t &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, sizeof(size_t));
+inline PacketBuffer &operator >>(PacketBuffer &lhs, size_t &rhs) {
+  rhs = static_cast<size_t>(lhs.get_uint(sizeof(size_t)));
   return lhs;
 }
 
 #endif
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, fw::Vector const &rhs) {
-  lhs.add_bytes(reinterpret_cast<char const *>(rhs.v), 0, sizeof(float) * 3);
+  lhs.add_vector(rhs);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, fw::Vector &rhs) {
-  lhs.get_bytes(reinterpret_cast<char *>(rhs.v), 0, sizeof(float) * 3);
+  lhs.get_vector(rhs);
   return lhs;
 }
 
 inline PacketBuffer &operator <<(PacketBuffer &lhs, Color const &rhs) {
-  uint32_t rgba = rhs.to_rgba();
-  lhs.add_bytes(reinterpret_cast<char const *>(&rgba), 0, sizeof(uint32_t));
+  lhs.add_fixed(rhs.to_rgba(), 4);
   return lhs;
 }
 
 inline PacketBuffer &operator >>(PacketBuffer &lhs, Color &rhs) {
-  uint32_t rgba;
-  lhs.get_bytes(reinterpret_cast<char *>(&rgba), 0, sizeof(uint32_t));
-  rhs = fw::Color(rgba);
+  rhs = fw::Color(static_cast<uint32_t>(lhs.get_fixed(4)));
   return lhs;
 }
 
-inline PacketBuffer &operator <<(PacketBuffer &lhs, std::string const &rhs) {
+inline PacketBuffer &operator <<(PacketBuffer &lhs, std::string_view rhs) {
   // strings are length-prefixed
   uint16_t length = static_cast<uint16_t>(rhs.length());
   lhs << length;
-  lhs.add_bytes(rhs.c_str(), 0, length);
+  lhs.add_bytes(rhs.data(), 0, length);
   return lhs;
 }
 
-inline PacketBuffer &operator >>(PacketBuffer &lhs, std::string &rhs) {
+inline PacketBuffer &operator >>(PacketBuffer &lhs, std::string_view &rhs) {
   uint16_t length;
   lhs >> length;
+  rhs = lhs.get_view(length);
+  return lhs;
+}
 
-  if (length < 80) { // If it's < 80 bytes, just allocate on the stack.
-    char *value = reinterpret_cast<char *>(alloca(length));
-    lhs.get_bytes(value, 0, length);
-    rhs = std::string(value, length);
-  } else {
-    char *value = new char[length];
-    lhs.get_bytes(value, 0, length);
-    rhs = std::string(value, length);
-    delete[] value;
-  }
-
+inline PacketBuffer &operator >>(PacketBuffer &lhs, std::string &rhs) {
+  std::string_view value;
+  lhs >> value;
+  rhs.assign(value);
   return lhs;
 }
 
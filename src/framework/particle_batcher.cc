@@ -0,0 +1,439 @@
+#include <framework/particle_batcher.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <tuple>
+
+#include <framework/dynamic_ring_buffer.h>
+#include <framework/graphics.h>
+#include <framework/misc.h>
+#include <framework/particle_store.h>
+#include <framework/simd_ops.h>
+#include <framework/texture.h>
+
+namespace fw {
+namespace {
+
+// We only draw particles that are closer than this to the camera.
+constexpr float kMaxDistance = 50.0f;
+
+// The layout of the sort keys, see ParticleBatcher::keys_.
+constexpr int kIndexBits = 24;
+constexpr int kDistanceShift = kIndexBits;
+constexpr int kRankShift = 56;
+constexpr uint64_t kIndexMask = (1ULL << kIndexBits) - 1;
+constexpr int kMaxRank = 255;
+constexpr int kMaxParticles = 1 << kIndexBits;
+
+// The radix sort only looks at the bytes above the index, see sort_particles.
+constexpr int kFirstSortByte = kIndexBits / 8;
+constexpr int kNumSortPasses = 8 - kFirstSortByte;
+
+// Gets the offset (in multiples of the world size) to move a particle at pos by so that it's as close as it can be to
+// the camera at camera_pos. Both are inside the world, so it's always -1, 0 or 1.
+inline float get_wrap_offset(float pos, float camera_pos, float wrap) {
+  return std::min(std::max(std::round((camera_pos - pos) / wrap), -1.0f), 1.0f);
+}
+
+// Gets the bits of a (positive) distance so that they sort the other way around: closer distances have bigger keys.
+inline uint64_t get_distance_bits(float distance_sq) {
+  uint32_t bits;
+  std::memcpy(&bits, &distance_sq, sizeof(bits));
+  return static_cast<uint64_t>(~bits);
+}
+
+// Writes the fields of a vertex straight into the (mapped) vertex buffer. xyz_c_uv has a user-provided copy
+// constructor, so assigning a temporary to it is deprecated.
+inline void set_vertex(fw::vertex::xyz_c_uv &vertex, float x, float y, float z, uint32_t color, float u, float v) {
+  vertex.x = x;
+  vertex.y = y;
+  vertex.z = z;
+  vertex.color = color;
+  vertex.u = u;
+  vertex.v = v;
+}
+
+}
+
+// The particles we're building billboards for, kChunkSize at a time. The gather step (in write_batch) fills in the
+// position, size and rotation of each, then build_billboards works out the two vectors from the middle of the
+// billboard to it's edges, u (to the right-hand edge) and w (to the top edge).
+struct ParticleBatcher::Chunk {
+  alignas(32) float x[kChunkSize];
+  alignas(32) float y[kChunkSize];
+  alignas(32) float z[kChunkSize];
+  alignas(32) float half_width[kChunkSize];
+  alignas(32) float half_height[kChunkSize];
+  alignas(32) float cos_angle[kChunkSize];
+  alignas(32) float sin_angle[kChunkSize];
+
+  alignas(32) float u_x[kChunkSize];
+  alignas(32) float u_y[kChunkSize];
+  alignas(32) float u_z[kChunkSize];
+  alignas(32) float w_x[kChunkSize];
+  alignas(32) float w_y[kChunkSize];
+  alignas(32) float w_z[kChunkSize];
+
+  uint32_t color[kChunkSize];
+  Rectangle<float> area[kChunkSize];
+};
+
+// Works out u and w for count particles in the chunk (rounded up to a multiple of Ops::kWidth, the chunk has room).
+// This is what we used to do with matrices, fw::align(to_camera, z) * fw::rotate_axis_angle(z, angle) applied to the
+// billboard's (scaled) corners, but without building any: align is a rotation whose columns are an orthonormalized
+// (right, forward, up), and the z rotation just mixes the first two of them.
+template<typename Ops>
+void ParticleBatcher::build_billboards(Chunk &chunk, int count, fw::Vector const &camera_position) {
+  typedef typename Ops::Float Float;
+
+  const Float camera_x = Ops::set(camera_position[0]);
+  const Float camera_y = Ops::set(camera_position[1]);
+  const Float camera_z = Ops::set(camera_position[2]);
+  const Float one = Ops::set(1.0f);
+  const Float min_length = Ops::set(0.000001f);
+
+  // 1 / |x, y, z|, but without dividing by zero if the camera is right on top of a particle.
+  auto inverse_length = [&](Float x, Float y, Float z) {
+    return Ops::div(one, Ops::max(
+        Ops::sqrt(Ops::add(Ops::add(Ops::mul(x, x), Ops::mul(y, y)), Ops::mul(z, z))), min_length));
+  };
+  auto dot = [](Float ax, Float ay, Float az, Float bx, Float by, Float bz) {
+    return Ops::add(Ops::add(Ops::mul(ax, bx), Ops::mul(ay, by)), Ops::mul(az, bz));
+  };
+
+  const int end = ((count + Ops::kWidth - 1) / Ops::kWidth) * Ops::kWidth;
+  for (int i = 0; i < end; i += Ops::kWidth) {
+    // forward is the direction to the camera, right is forward x (0, 0, 1) and up is right x forward.
+    Float forward_x = Ops::sub(camera_x, Ops::load(chunk.x + i));
+    Float forward_y = Ops::sub(camera_y, Ops::load(chunk.y + i));
+    Float forward_z = Ops::sub(camera_z, Ops::load(chunk.z + i));
+    Float scale = inverse_length(forward_x, forward_y, forward_z);
+    forward_x = Ops::mul(forward_x, scale);
+    forward_y = Ops::mul(forward_y, scale);
+    forward_z = Ops::mul(forward_z, scale);
+
+    const Float right_x = forward_y;
+    const Float right_y = Ops::sub(Ops::set(0.0f), forward_x);
+    const Float up_x = Ops::mul(right_y, forward_z);
+    const Float up_y = Ops::sub(Ops::set(0.0f), Ops::mul(right_x, forward_z));
+    const Float up_z = Ops::sub(Ops::mul(right_x, forward_y), Ops::mul(right_y, forward_x));
+
+    // The columns of the align matrix, orthonormalized in the same order as mat4x4_orthonormalize does it.
+    Float c2_x = Ops::set(0.0f);
+    Float c2_y = forward_z;
+    Float c2_z = up_z;
+    scale = inverse_length(c2_x, c2_y, c2_z);
+    c2_y = Ops::mul(c2_y, scale);
+    c2_z = Ops::mul(c2_z, scale);
+
+    Float c1_x = right_y;
+    Float c1_y = forward_y;
+    Float c1_z = up_y;
+    Float d = dot(c1_x, c1_y, c1_z, c2_x, c2_y, c2_z);
+    c1_x = Ops::sub(c1_x, Ops::mul(c2_x, d));
+    c1_y = Ops::sub(c1_y, Ops::mul(c2_y, d));
+    c1_z = Ops::sub(c1_z, Ops::mul(c2_z, d));
+    scale = inverse_length(c1_x, c1_y, c1_z);
+    c1_x = Ops::mul(c1_x, scale);
+    c1_y = Ops::mul(c1_y, scale);
+    c1_z = Ops::mul(c1_z, scale);
+
+    Float c0_x = right_x;
+    Float c0_y = forward_x;
+    Float c0_z = up_x;
+    d = dot(c0_x, c0_y, c0_z, c2_x, c2_y, c2_z);
+    c0_x = Ops::sub(c0_x, Ops::mul(c2_x, d));
+    c0_y = Ops::sub(c0_y, Ops::mul(c2_y, d));
+    c0_z = Ops::sub(c0_z, Ops::mul(c2_z, d));
+    d = dot(c0_x, c0_y, c0_z, c1_x, c1_y, c1_z);
+    c0_x = Ops::sub(c0_x, Ops::mul(c1_x, d));
+    c0_y = Ops::sub(c0_y, Ops::mul(c1_y, d));
+    c0_z = Ops::sub(c0_z, Ops::mul(c1_z, d));
+    scale = inverse_length(c0_x, c0_y, c0_z);
+    c0_x = Ops::mul(c0_x, scale);
+    c0_y = Ops::mul(c0_y, scale);
+    c0_z = Ops::mul(c0_z, scale);
+
+    // Rotating (x, y) by the angle gives (x cos - y sin, x sin + y cos), so u = width * (cos c0 + sin c1) and
+    // w = height * (cos c1 - sin c0).
+    const Float cos_angle = Ops::load(chunk.cos_angle + i);
+    const Float sin_angle = Ops::load(chunk.sin_angle + i);
+    const Float half_width = Ops::load(chunk.half_width + i);
+    const Float half_height = Ops::load(chunk.half_height + i);
+    Ops::store(chunk.u_x + i, Ops::mul(half_width, Ops::add(Ops::mul(cos_angle, c0_x), Ops::mul(sin_angle, c1_x))));
+    Ops::store(chunk.u_y + i, Ops::mul(half_width, Ops::add(Ops::mul(cos_angle, c0_y), Ops::mul(sin_angle, c1_y))));
+    Ops::store(chunk.u_z + i, Ops::mul(half_width, Ops::add(Ops::mul(cos_angle, c0_z), Ops::mul(sin_angle, c1_z))));
+    Ops::store(chunk.w_x + i, Ops::mul(half_height, Ops::sub(Ops::mul(cos_angle, c1_x), Ops::mul(sin_angle, c0_x))));
+    Ops::store(chunk.w_y + i, Ops::mul(half_height, Ops::sub(Ops::mul(cos_angle, c1_y), Ops::mul(sin_angle, c0_y))));
+    Ops::store(chunk.w_z + i, Ops::mul(half_height, Ops::sub(Ops::mul(cos_angle, c1_z), Ops::mul(sin_angle, c0_z))));
+  }
+}
+
+// The kernel runs over whole registers, past the end of the chunk's particles, so we zero the chunk to begin with to
+// make sure it's never running over garbage.
+ParticleBatcher::ParticleBatcher() : chunk_(std::make_unique<Chunk>()) {
+}
+
+ParticleBatcher::~ParticleBatcher() {
+}
+
+void ParticleBatcher::build(ParticleManager::Snapshot const &snapshot, View const &view, DynamicRingBuffer &ring) {
+  batches_.clear();
+  rank_stores(snapshot);
+  collect_particles(snapshot, view);
+  sort_particles();
+
+  const int num_particles = static_cast<int>(keys_.size());
+  int index = 0;
+  while (index < num_particles) {
+    // A batch is every particle with the same texture and mode, up to the most we can draw at once. Those all have
+    // the same rank, unless there's so many textures that we ran out of ranks.
+    const uint64_t rank = keys_[index] >> kRankShift;
+    ParticleEmitterConfig const &config = *particles_[keys_[index] & kIndexMask].store->get_config();
+    int end = index + 1;
+    while (end < num_particles && end - index < DynamicRingBuffer::kMaxQuadsPerDraw) {
+      if ((keys_[end] >> kRankShift) != rank) {
+        break;
+      }
+      if (rank == kMaxRank) {
+        ParticleEmitterConfig const &next_config = *particles_[keys_[end] & kIndexMask].store->get_config();
+        if (next_config.billboard.texture != config.billboard.texture
+            || next_config.billboard.mode != config.billboard.mode) {
+          break;
+        }
+      }
+      end++;
+    }
+
+    const int num_quads = std::min(end - index, ring.get_remaining_vertices() / 4);
+    if (num_quads <= 0) {
+      break;
+    }
+
+    ParticleBatch batch;
+    batch.texture = config.billboard.texture;
+    batch.mode = config.billboard.mode;
+    batch.num_quads = num_quads;
+    void *vertices = ring.allocate(num_quads * 4, &batch.first_vertex);
+    write_batch(index, index + num_quads, view, vertices);
+    batches_.push_back(batch);
+
+    index = end;
+  }
+}
+
+void ParticleBatcher::rank_stores(ParticleManager::Snapshot const &snapshot) {
+  // It doesn't matter which order the textures go in, as long as it's the same for every particle this frame.
+  std::vector<std::tuple<Texture const *, ParticleEmitterConfig::BillboardMode, int>> stores;
+  for (int i = 0; i < static_cast<int>(snapshot.stores.size()); i++) {
+    ParticleEmitterConfig const &config = *snapshot.stores[i]->get_config();
+    stores.emplace_back(config.billboard.texture.get(), config.billboard.mode, i);
+  }
+  std::sort(stores.begin(), stores.end());
+
+  store_ranks_.resize(snapshot.stores.size());
+  int rank = -1;
+  for (int i = 0; i < static_cast<int>(stores.size()); i++) {
+    if (i == 0 || std::get<0>(stores[i]) != std::get<0>(stores[i - 1])
+        || std::get<1>(stores[i]) != std::get<1>(stores[i - 1])) {
+      rank = std::min(rank + 1, kMaxRank);
+    }
+    store_ranks_[std::get<2>(stores[i])] = rank;
+  }
+}
+
+void ParticleBatcher::collect_particles(ParticleManager::Snapshot const &snapshot, View const &view) {
+  particles_.clear();
+  keys_.clear();
+  const bool wrap = view.wrap_x > 1.0f && view.wrap_z > 1.0f;
+  const float camera_x = view.camera_position[0];
+  const float camera_y = view.camera_position[1];
+  const float camera_z = view.camera_position[2];
+  const float max_distance_sq = kMaxDistance * kMaxDistance;
+
+  for (int store_index = 0; store_index < static_cast<int>(snapshot.stores.size()); store_index++) {
+    ParticleStore const *store = snapshot.stores[store_index].get();
+    const uint64_t rank = static_cast<uint64_t>(store_ranks_[store_index]) << kRankShift;
+    float const *pos_x = store->get(ParticleStore::kPositionX);
+    float const *pos_y = store->get(ParticleStore::kPositionY);
+    float const *pos_z = store->get(ParticleStore::kPositionZ);
+    float const *last_pos_x = store->get(ParticleStore::kLastPositionX);
+    float const *last_pos_y = store->get(ParticleStore::kLastPositionY);
+    float const *last_pos_z = store->get(ParticleStore::kLastPositionZ);
+    for (int i = 0; i < store->get_count(); i++) {
+      float x = fw::lerp(last_pos_x[i], pos_x[i], view.alpha);
+      const float y = fw::lerp(last_pos_y[i], pos_y[i], view.alpha);
+      float z = fw::lerp(last_pos_z[i], pos_z[i], view.alpha);
+
+      // Draw the particle wherever it's closest to the camera. We only draw particles within kMaxDistance of the
+      // camera, and the world is bigger than that, so there's only ever one place it could be drawn.
+      if (wrap) {
+        x += get_wrap_offset(x, camera_x, view.wrap_x) * view.wrap_x;
+        z += get_wrap_offset(z, camera_z, view.wrap_z) * view.wrap_z;
+      }
+
+      const float dx = camera_x - x;
+      const float dy = camera_y - y;
+      const float dz = camera_z - z;
+      const float distance_sq = (dx * dx) + (dy * dy) + (dz * dz);
+      if (distance_sq > max_distance_sq) {
+        continue;
+      }
+      if (static_cast<int>(particles_.size()) == kMaxParticles) {
+        return;
+      }
+
+      keys_.push_back(rank | (get_distance_bits(distance_sq) << kDistanceShift) | particles_.size());
+      particles_.push_back(ParticleRef {store, i, x, y, z});
+    }
+  }
+}
+
+void ParticleBatcher::sort_particles() {
+  // An LSD radix sort, one byte at a time. We don't need to sort on the index bits: the particles were added in
+  // index order and each pass is stable. We count all of the bytes in one go, and skip the passes where every key has
+  // the same byte (e.g. the rank, when there's only one texture).
+  const size_t num_keys = keys_.size();
+  if (num_keys < 2) {
+    return;
+  }
+  sort_buffer_.resize(num_keys);
+
+  size_t counts[kNumSortPasses][256] = {};
+  for (uint64_t key : keys_) {
+    for (int pass = 0; pass < kNumSortPasses; pass++) {
+      counts[pass][(key >> ((kFirstSortByte + pass) * 8)) & 0xff]++;
+    }
+  }
+
+  uint64_t *src = keys_.data();
+  uint64_t *dest = sort_buffer_.data();
+  for (int pass = 0; pass < kNumSortPasses; pass++) {
+    const int shift = (kFirstSortByte + pass) * 8;
+    size_t *offsets = counts[pass];
+    if (offsets[(src[0] >> shift) & 0xff] == num_keys) {
+      continue;
+    }
+
+    size_t offset = 0;
+    for (int digit = 0; digit < 256; digit++) {
+      const size_t count = offsets[digit];
+      offsets[digit] = offset;
+      offset += count;
+    }
+    for (size_t i = 0; i < num_keys; i++) {
+      dest[offsets[(src[i] >> shift) & 0xff]++] = src[i];
+    }
+    std::swap(src, dest);
+  }
+
+  if (src != keys_.data()) {
+    keys_.swap(sort_buffer_);
+  }
+}
+
+void ParticleBatcher::write_batch(int begin, int end, View const &view, void *vertices) {
+  Chunk &chunk = *chunk_;
+  auto *quad = static_cast<fw::vertex::xyz_c_uv *>(vertices);
+
+  // the color_row is divided by this value to get the value between 0 and 1.
+  const float color_texture_factor = 1.0f / view.color_texture_height;
+
+  // Particles that point in the direction they're going rather than at the camera. There's not usually many of these,
+  // so they use the matrix path, after the kernel.
+  int directed[kChunkSize];
+
+  for (int chunk_begin = begin; chunk_begin < end; chunk_begin += kChunkSize) {
+    const int count = std::min(kChunkSize, end - chunk_begin);
+    int num_directed = 0;
+
+    for (int j = 0; j < count; j++) {
+      ParticleRef const &ref = particles_[keys_[chunk_begin + j] & kIndexMask];
+      ParticleStore const &store = *ref.store;
+      ParticleEmitterConfig const &config = *store.get_config();
+      const int i = ref.index;
+
+      // The color and rotation come straight from the config's life table.
+      ParticleEmitterConfig::LifeTable const &life_table = config.life_table;
+      float t;
+      const int life_index = ParticleEmitterConfig::LifeTable::get_index(store.get(ParticleStore::kAge)[i], &t);
+      const float color_factor =
+          life_table.color_factor.start[life_index] + (life_table.color_factor.delta[life_index] * t);
+      fw::Color color(store.get(ParticleStore::kAlpha)[i],
+          (static_cast<float>(life_table.color1[life_index]) + 0.5f) * color_texture_factor,
+          (static_cast<float>(life_table.color2[life_index]) + 0.5f) * color_texture_factor, color_factor);
+      chunk.color[j] = color.to_abgr();
+
+      Rectangle<float> &area = chunk.area[j];
+      if (config.billboard.areas.empty()) {
+        area.left = area.top = 0.0f;
+        area.width = area.height = 1.0f;
+      } else {
+        area = config.billboard.areas[static_cast<int>(store.get(ParticleStore::kArea)[i])];
+      }
+
+      const float size = store.get(ParticleStore::kSize)[i];
+      chunk.x[j] = ref.x;
+      chunk.y[j] = ref.y;
+      chunk.z[j] = ref.z;
+      chunk.half_width[j] = 0.5f * size;
+      chunk.half_height[j] = 0.5f * size * (area.height / area.width);
+      if (life_table.rotation[life_index] != ParticleRotation::kDirection) {
+        const float angle =
+            fw::lerp(store.get(ParticleStore::kLastAngle)[i], store.get(ParticleStore::kAngle)[i], view.alpha);
+        chunk.cos_angle[j] = std::cos(angle);
+        chunk.sin_angle[j] = std::sin(angle);
+      } else {
+        chunk.cos_angle[j] = 1.0f;
+        chunk.sin_angle[j] = 0.0f;
+        directed[num_directed++] = j;
+      }
+    }
+
+    build_billboards<SimdOps>(chunk, count, view.camera_position);
+
+    for (int n = 0; n < num_directed; n++) {
+      const int j = directed[n];
+      ParticleRef const &ref = particles_[keys_[chunk_begin + j] & kIndexMask];
+      const fw::Vector direction(
+          ref.store->get(ParticleStore::kDirectionX)[ref.index],
+          ref.store->get(ParticleStore::kDirectionY)[ref.index],
+          ref.store->get(ParticleStore::kDirectionZ)[ref.index]);
+      Matrix m = fw::identity();
+      m *= fw::rotate(Vector(-1, 0, 0), direction);
+      const fw::Vector u = m * fw::Vector(chunk.half_width[j], 0.0f, 0.0f);
+      const fw::Vector w = m * fw::Vector(0.0f, chunk.half_height[j], 0.0f);
+      chunk.u_x[j] = u[0];
+      chunk.u_y[j] = u[1];
+      chunk.u_z[j] = u[2];
+      chunk.w_x[j] = w[0];
+      chunk.w_y[j] = w[1];
+      chunk.w_z[j] = w[2];
+    }
+
+    // The vertices go in the order the quad index buffer expects: bottom-left, top-left, top-right, bottom-right.
+    for (int j = 0; j < count; j++) {
+      const float x = chunk.x[j];
+      const float y = chunk.y[j];
+      const float z = chunk.z[j];
+      const float ux = chunk.u_x[j];
+      const float uy = chunk.u_y[j];
+      const float uz = chunk.u_z[j];
+      const float wx = chunk.w_x[j];
+      const float wy = chunk.w_y[j];
+      const float wz = chunk.w_z[j];
+      const uint32_t color = chunk.color[j];
+      Rectangle<float> const &area = chunk.area[j];
+      const float right = area.left + area.width;
+      const float bottom = area.top + area.height;
+      set_vertex(quad[0], x - ux - wx, y - uy - wy, z - uz - wz, color, area.left, bottom);
+      set_vertex(quad[1], x - ux + wx, y - uy + wy, z - uz + wz, color, area.left, area.top);
+      set_vertex(quad[2], x + ux + wx, y + uy + wy, z + uz + wz, color, right, area.top);
+      set_vertex(quad[3], x + ux - wx, y + uy - wy, z + uz - wz, color, right, bottom);
+      quad += 4;
+    }
+  }
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <framework/math.h>
+#include <framework/particle_config.h>
+#include <framework/particle_manager.h>
+
+namespace fw {
+class DynamicRingBuffer;
+class ParticleStore;
+class Texture;
+
+// A run of particles that can all be drawn in one go: they've all got the same texture and billboard mode, and their
+// vertices are next to each other in the ring buffer (four per particle, drawn with the quad index buffer).
+struct ParticleBatch {
+  std::shared_ptr<Texture> texture;
+  ParticleEmitterConfig::BillboardMode mode;
+  int first_vertex;
+  int num_quads;
+};
+
+// Works out which particles to draw and builds the vertices for them. This is the CPU half of the ParticleRenderer,
+// it doesn't touch GL itself, so it can be run against a DynamicRingBuffer with a MockRingBufferBackend.
+//
+// Each frame we cull the particles against the camera (once, picking the closest wrapped copy of each), give each of
+// them a 64-bit sort key (texture and mode, then distance), radix sort the keys and then build the billboards for each
+// batch with a SIMD kernel.
+class ParticleBatcher {
+public:
+  // Everything we need to know about the view to build the batches.
+  struct View {
+    fw::Vector camera_position;
+
+    // The size of the world, particles are drawn wherever they're closest to the camera.
+    float wrap_x;
+    float wrap_z;
+
+    // How far to interpolate from each particle's last position to it's current one, from 0 to 1.
+    float alpha;
+
+    // The height of the color texture, so that we can turn the particle's color rows into texture coordinates.
+    int color_texture_height;
+  };
+
+private:
+  // The most particles we'll write vertices for in one go, see write_batch.
+  static const int kChunkSize = 256;
+
+  // A particle that we're going to draw this frame, and where we're going to draw it (interpolated between the last
+  // two updates, and wrapped around the world).
+  struct ParticleRef {
+    ParticleStore const *store;
+    int index;
+    float x;
+    float y;
+    float z;
+  };
+
+  // Scratch space for the billboard kernel, one chunk of particles at a time, as a structure of arrays.
+  struct Chunk;
+
+  // These are kept from frame to frame so that we don't have to reallocate them. Each particle has a key in keys_:
+  // the top 8 bits are it's store's rank, then 32 bits of (inverted) squared distance to the camera so the furthest
+  // particles come first, then 24 bits of index into particles_.
+  std::vector<ParticleRef> particles_;
+  std::vector<uint64_t> keys_;
+  std::vector<uint64_t> sort_buffer_;
+  std::vector<ParticleBatch> batches_;
+  std::unique_ptr<Chunk> chunk_;
+
+  // The rank of each of the snapshot's stores (by texture and mode) that goes in the top of the sort keys, so that all
+  // the particles that can be batched together end up next to each other.
+  std::vector<int> store_ranks_;
+
+  void rank_stores(ParticleManager::Snapshot const &snapshot);
+  void collect_particles(ParticleManager::Snapshot const &snapshot, View const &view);
+  void sort_particles();
+  void write_batch(int begin, int end, View const &view, void *vertices);
+
+  template<typename Ops>
+  static void build_billboards(Chunk &chunk, int count, fw::Vector const &camera_position);
+
+public:
+  ParticleBatcher();
+  ~ParticleBatcher();
+
+  // Builds this frame's batches from the given snapshot, writing their vertices into the ring buffer. If the ring
+  // buffer runs out of room, the rest of the particles are skipped.
+  void build(ParticleManager::Snapshot const &snapshot, View const &view, DynamicRingBuffer &ring);
+
+  std::vector<ParticleBatch> const &get_batches() const {
+    return batches_;
+  }
+
+  // The number of particles we found to draw in the last build(), whether they fit or not.
+  int get_num_particles() const {
+    return static_cast<int>(particles_.size());
+  }
+};
+
+}
@@ -1,6 +1,7 @@
 #include <framework/particle_config.h>
 
 #include <filesystem>
+#include <functional>
 
 #include <absl/strings/numbers.h>
 #include <absl/strings/str_cat.h>
@@ -165,7 +166,7 @@ fw::Status ParticleEmitterConfig::LoadEmitter(XmlElement const &emitter_elem) {
 
   auto initial_count = emitter_elem.GetAttributei<int>("initial");
   if (initial_count.ok()) {
-    initial_count = *initial_count;
+    this->initial_count = *initial_count;
   }
 
   for (XmlElement child : emitter_elem.children()) {
@@ -183,6 +184,8 @@ fw::Status ParticleEmitterConfig::LoadEmitter(XmlElement const &emitter_elem) {
       return fw::ErrorStatus("unknown child element of <emitter>: ") << child.get_value();
     }
   }
+
+  BakeLifeTable();
   return fw::OkStatus();
 }
 
@@ -281,6 +284,113 @@ fw::Status ParticleEmitterConfig::LoadEmitPolicy(XmlElement const &elem) {
   return fw::OkStatus();
 }
 
+void ParticleEmitterConfig::BakeLifeTable() {
+  std::vector<LifeState> states = life;
+  if (states.empty()) {
+    states.push_back(LifeState());
+  }
+
+  // Finds the states either side of the given age, returns how far between them we are.
+  auto find_states = [&states](float age, LifeState const **prev, LifeState const **next) {
+    size_t index = 0;
+    while (index + 1 < states.size() && states[index + 1].age <= age) {
+      index++;
+    }
+    *prev = &states[index];
+    *next = &states[std::min(index + 1, states.size() - 1)];
+    if ((*next)->age <= (*prev)->age) {
+      return 0.0f;
+    }
+    return std::clamp((age - (*prev)->age) / ((*next)->age - (*prev)->age), 0.0f, 1.0f);
+  };
+
+  // Fills in interval i of the given curve, given it's values at the start and end of the interval.
+  auto bake_curve = [](Curve &curve, int i, float start_value, float end_value) {
+    curve.start[i] = start_value;
+    curve.delta[i] = end_value - start_value;
+  };
+
+  // Same, but for a Random value, where get_value(state) gets the value from a LifeState.
+  auto bake_random = [&find_states, &bake_curve](
+      RandomCurve &curve, int i, float start_age, float end_age,
+      std::function<Random<float>(LifeState const &)> const &get_value) {
+    float min[2];
+    float range[2];
+    float const ages[2] = {start_age, end_age};
+    for (int j = 0; j < 2; j++) {
+      LifeState const *prev;
+      LifeState const *next;
+      const float t = find_states(ages[j], &prev, &next);
+      const Random<float> prev_value = get_value(*prev);
+      const Random<float> next_value = get_value(*next);
+      min[j] = fw::lerp(prev_value.min, next_value.min, t);
+      range[j] = fw::lerp(prev_value.max - prev_value.min, next_value.max - next_value.min, t);
+    }
+    bake_curve(curve.min, i, min[0], min[1]);
+    bake_curve(curve.range, i, range[0], range[1]);
+  };
+
+  bool has_directed = false;
+  for (int i = 0; i < kLifeTableSize; i++) {
+    const float start_age = static_cast<float>(i) / kLifeTableSize;
+    const float end_age = static_cast<float>(i + 1) / kLifeTableSize;
+
+    bake_random(life_table.size, i, start_age, end_age, [](LifeState const &state) {
+      return state.size;
+    });
+    bake_random(life_table.speed, i, start_age, end_age, [](LifeState const &state) {
+      return state.speed;
+    });
+    bake_random(life_table.gravity, i, start_age, end_age, [](LifeState const &state) {
+      return state.gravity;
+    });
+    bake_random(life_table.rotation_speed, i, start_age, end_age, [](LifeState const &state) {
+      // Particles that point in the direction they're going don't spin.
+      if (state.rotation != ParticleRotation::kRandom) {
+        return Random<float> {0.0f, 0.0f};
+      }
+      return state.rotation_speed;
+    });
+    bake_random(life_table.direction_x, i, start_age, end_age, [](LifeState const &state) {
+      return Random<float> {state.direction.min[0], state.direction.max[0]};
+    });
+    bake_random(life_table.direction_y, i, start_age, end_age, [](LifeState const &state) {
+      return Random<float> {state.direction.min[1], state.direction.max[1]};
+    });
+    bake_random(life_table.direction_z, i, start_age, end_age, [](LifeState const &state) {
+      return Random<float> {state.direction.min[2], state.direction.max[2]};
+    });
+
+    LifeState const *prev;
+    LifeState const *next;
+    const float start_t = find_states(start_age, &prev, &next);
+    LifeState const *end_prev;
+    LifeState const *end_next;
+    const float end_t = find_states(end_age, &end_prev, &end_next);
+    bake_curve(life_table.alpha, i,
+        fw::lerp(prev->alpha, next->alpha, start_t), fw::lerp(end_prev->alpha, end_next->alpha, end_t));
+
+    // The colors stick with the states at the start of the interval, even if the interval goes past the next state.
+    // color_factor just stops at 1, which is the same color as the next state's color_factor of 0.
+    life_table.color1[i] = prev->color_row;
+    life_table.color2[i] = next->color_row;
+    float end_factor = 0.0f;
+    if (next->age > prev->age) {
+      end_factor = std::clamp((end_age - prev->age) / (next->age - prev->age), 0.0f, 1.0f);
+    }
+    bake_curve(life_table.color_factor, i, start_t, end_factor);
+
+    auto has_direction = [](LifeState const &state) {
+      return state.direction.min.length() > 0.001f || state.direction.max.length() > 0.001f;
+    };
+    const bool directed = has_direction(*prev) && has_direction(*next);
+    life_table.directed[i] = directed ? 1.0f : 0.0f;
+    life_table.rotation[i] = prev->rotation;
+    has_directed = has_directed || directed;
+  }
+  life_table.has_directed = has_directed;
+}
+
 fw::StatusOr<ParticleEmitterConfig::LifeState> ParticleEmitterConfig::ParseLifeState(
     XmlElement const &elem, std::optional<LifeState> last_life_state) {
   LifeState state = last_life_state.has_value() ? LifeState(*last_life_state) : LifeState();
@@ -1,11 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
 #include <framework/color.h>
 #include <framework/math.h>
-#include <framework/particle.h>
+#include <framework/misc.h>
 #include <framework/status.h>
 #include <framework/texture.h>
 #include <framework/xml.h>
@@ -14,6 +15,10 @@ namespace fw {
 class EmitPolicy;
 class ParticleEmitterConfig;
 
+enum ParticleRotation {
+  kRandom, kDirection
+};
+
 /**
  * particle_effect_config represents a collection of particle_emitter_configs, one for each emitter
  * the corresponding effect represents.
@@ -52,6 +57,9 @@ class ParticleEmitterConfig {
 public:
   friend class ParticleEffectConfig;
 
+  // The number of intervals we bake the life states into, see LifeTable.
+  static const int kLifeTableSize = 64;
+
   // Represents the different kinds of falloff that is possible when we're talking about something
   // centered at a point with a radius.
   enum FalloffKind {
@@ -129,6 +137,58 @@ public:
     LifeState(LifeState const &copy);
   };
 
+  // A value that changes linearly over each of the LifeTable's intervals: in interval i, it's
+  // start[i] + (delta[i] * t), where t goes from 0 to 1 over the interval.
+  struct Curve {
+    float start[kLifeTableSize];
+    float delta[kLifeTableSize];
+  };
+
+  // A Random value that changes over the LifeTable's intervals. Each particle picks a number r between 0 and 1 when
+  // it's emitted, and the value is min + (r * range) for it's whole life.
+  struct RandomCurve {
+    Curve min;
+    Curve range;
+  };
+
+  /**
+   * The life states, baked into a table of kLifeTableSize equal intervals of (normalized) age, so that updating a
+   * particle is just a lookup, rather than searching for the two states it's between. The ParticleStore's update
+   * kernels read from here.
+   */
+  struct LifeTable {
+    RandomCurve size;
+    RandomCurve rotation_speed;
+    RandomCurve speed;
+    RandomCurve gravity;
+    RandomCurve direction_x;
+    RandomCurve direction_y;
+    RandomCurve direction_z;
+    Curve alpha;
+
+    // The color is a lerp between two rows of the color texture. The rows are the same for the whole interval (so
+    // that we never lerp the row numbers), color_factor goes from 0 to 1 between two states.
+    int color1[kLifeTableSize];
+    int color2[kLifeTableSize];
+    Curve color_factor;
+
+    // 1.0 if the particle's direction comes from the life states in this interval, 0.0 if it just flies (and falls)
+    // in the direction it was going.
+    float directed[kLifeTableSize];
+    ParticleRotation rotation[kLifeTableSize];
+
+    // True if any interval is directed, if not the update kernel can skip the direction curves entirely.
+    bool has_directed;
+
+    // Gets the index of the interval the given normalized age is in, and how far through the interval it is.
+    static int get_index(float age, float *t) {
+      const float x = std::clamp(age, 0.0f, 1.0f) * kLifeTableSize;
+      const int index = std::min(static_cast<int>(x), kLifeTableSize - 1);
+      *t = x - index;
+      return index;
+    }
+  };
+
   /**
    * This is the start and end time for the emitter. the emitter will only emit particles after
    * start_time seconds have passed, and will kill itself after end_time seconds have passed (if
@@ -161,6 +221,9 @@ public:
   // to lerp between each LifeState to provide smooth Particle effects.
   std::vector<LifeState> life;
 
+  // The life states above, baked into a table when the config is loaded.
+  LifeTable life_table;
+
   // This is the "policy" we use for deciding when to emit a new Particle.
   std::string emit_policy_name;
   float emit_policy_value;
@@ -173,6 +236,7 @@ private:
   fw::Status LoadBillboard(XmlElement const &elem);
   fw::Status LoadLife(XmlElement const &elem);
   fw::Status LoadEmitPolicy(XmlElement const &elem);
+  void BakeLifeTable();
   fw::StatusOr<LifeState> ParseLifeState(
       XmlElement const &elem, std::optional<LifeState> last_life_state = std::nullopt);
   fw::StatusOr<Random<float>> ParseRandomFloat(XmlElement const &elem);
@@ -4,11 +4,9 @@
 #include <vector>
 
 #include <framework/math.h>
-#include <framework/object_pool.h>
 #include <framework/particle_emitter.h>
 
 namespace fw {
-class Particle;
 class ParticleManager;
 class ParticleEffectConfig;
 
@@ -25,8 +23,7 @@ private:
 
 public:
   ParticleEffect(
-    ParticleManager *mgr, ObjectPool<Particle>& particle_pool, std::shared_ptr<ParticleEffectConfig> const &config,
-    const fw::Vector& initial_position);
+    ParticleManager *mgr, std::shared_ptr<ParticleEffectConfig> const &config, const fw::Vector& initial_position);
   ~ParticleEffect();
 
   void destroy();
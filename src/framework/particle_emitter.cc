@@ -1,18 +1,18 @@
+#include <algorithm>
 #include <stack>
 
 #include <framework/misc.h>
-#include <framework/particle.h>
 #include <framework/particle_config.h>
 #include <framework/particle_emitter.h>
 #include <framework/particle_manager.h>
+#include <framework/particle_store.h>
 
 namespace fw {
 
 ParticleEmitter::ParticleEmitter(
-    ParticleManager *mgr, ObjectPool<Particle>& particle_pool, std::shared_ptr<ParticleEmitterConfig> config,
-    const fw::Vector& initial_position)
-    : mgr_(mgr), particle_pool_(particle_pool), emit_policy_(0), config_(config), dead_(false), age_(0.0f),
-      position_(initial_position) {
+    ParticleManager *mgr, std::shared_ptr<ParticleEmitterConfig> config, const fw::Vector& initial_position)
+    : mgr_(mgr), store_(mgr->get_store(config)), emit_policy_(0), config_(config), dead_(false), age_(0.0f),
+      particles_end_age_(0.0f), position_(initial_position) {
   if (config_->emit_policy_name == "distance") {
     emit_policy_ = new DistanceEmitPolicy(this, config_->emit_policy_value);
   } else if (config_->emit_policy_name == "timed") {
@@ -48,18 +48,8 @@ bool ParticleEmitter::update(float dt) {
     emit_policy_->check_emit(dt);
   }
 
-  // go through each Particle and update it's various properties
-  for (ParticleList::iterator it = particles_.begin(); it != particles_.end();) {
-    auto p = *it;
-    if (!p->update(dt)) {
-      // It's dead, so remove it.
-      it = particles_.erase(it);
-    } else {
-      ++it;
-    }
-  }
-
-  return (!dead_ || particles_.size() != 0);
+  // The particles themselves are updated by the ParticleManager, all of the ones in our store at once.
+  return (!dead_ || age_ < particles_end_age_);
 }
 
 void ParticleEmitter::destroy() {
@@ -68,16 +58,9 @@ void ParticleEmitter::destroy() {
 
 // This is called when it's time to emit a new Particle. The offset is used when emitting "extra" particles, we need
 // to offset their age and position a bit.
-std::shared_ptr<Particle> ParticleEmitter::emit(fw::Vector pos, float time_offset /*= 0.0f*/) {
-  std::shared_ptr<Particle> p(particle_pool_.get_or_new());
-  p->initialize(config_);
-  p->pos = pos;
-  p->age = time_offset;
-
-  particles_.push_back(p);
-  mgr_->add_particle(p);
-
-  return p;
+void ParticleEmitter::emit(fw::Vector pos, float time_offset /*= 0.0f*/) {
+  const float life_time = store_->add(pos, time_offset);
+  particles_end_age_ = std::max(particles_end_age_, age_ + life_time);
 }
 
 //-------------------------------------------------------------------------
@@ -116,7 +99,7 @@ void TimedEmitPolicy::check_emit(float dt) {
 //-------------------------------------------------------------------------
 
 DistanceEmitPolicy::DistanceEmitPolicy(ParticleEmitter* emitter, float max_distance)
-  : EmitPolicy(emitter), max_distance_(0.0f) {
+  : EmitPolicy(emitter), has_last_position_(false), max_distance_(0.0f) {
   max_distance_ = max_distance;
 }
 
@@ -124,9 +107,10 @@ DistanceEmitPolicy::~DistanceEmitPolicy() {
 }
 
 void DistanceEmitPolicy::check_emit(float) {
-  std::shared_ptr<Particle> last_particle = last_particle_.lock();
-  if (!last_particle) {
-    last_particle_ = emitter_->emit(emitter_->get_position());
+  if (!has_last_position_) {
+    last_position_ = emitter_->get_position();
+    has_last_position_ = true;
+    emitter_->emit(last_position_);
     return;
   }
 
@@ -134,7 +118,7 @@ void DistanceEmitPolicy::check_emit(float) {
   float wrap_z = emitter_->get_manager()->get_wrap_z();
 
   fw::Vector next_pos = emitter_->get_position();
-  fw::Vector last_pos = last_particle->pos;
+  fw::Vector last_pos = last_position_;
   fw::Vector dir = get_direction_to(last_pos, next_pos, wrap_x, wrap_z).normalized();
   fw::Vector curr_pos = last_pos + (dir * max_distance_);
 
@@ -143,7 +127,8 @@ void DistanceEmitPolicy::check_emit(float) {
   float this_distance = calculate_distance(curr_pos, next_pos, wrap_x, wrap_z);
   float last_distance = this_distance + 1.0f;
   while (last_distance >= this_distance) {
-    last_particle_ = emitter_->emit(curr_pos, time_offset);
+    emitter_->emit(curr_pos, time_offset);
+    last_position_ = curr_pos;
     curr_pos += dir * max_distance_;
 
     last_distance = this_distance;
@@ -1,16 +1,14 @@
 #pragma once
 
-#include <list>
 #include <memory>
 
 #include <framework/math.h>
-#include <framework/object_pool.h>
 #include <framework/xml.h>
 
 namespace fw {
 class ParticleManager;
-class Particle;
 class ParticleEmitterConfig;
+class ParticleStore;
 class EmitPolicy;
 
 /**
@@ -20,13 +18,17 @@ class EmitPolicy;
 class ParticleEmitter {
 private:
   std::shared_ptr<ParticleEmitterConfig> config_;
-  ObjectPool<Particle>& particle_pool_;
+
+  // Our particles live in the ParticleStore for our config, along with the particles of every other emitter with the
+  // same config.
+  ParticleStore *store_;
   ParticleManager *mgr_;
   float age_;
   int initial_count_;
 
-  typedef std::list<std::shared_ptr<Particle>> ParticleList;
-  ParticleList particles_;
+  // The age at which the last of the particles we've emitted will die. We don't keep track of the particles
+  // themselves, so this is how we know when we're finished.
+  float particles_end_age_;
 
   fw::Vector position_;
   EmitPolicy *emit_policy_;
@@ -34,8 +36,7 @@ private:
 
 public:
   ParticleEmitter(
-    ParticleManager *mgr, ObjectPool<Particle>& particle_pool, std::shared_ptr<ParticleEmitterConfig> config,
-    const fw::Vector& initial_position);
+    ParticleManager *mgr, std::shared_ptr<ParticleEmitterConfig> config, const fw::Vector& initial_position);
   ~ParticleEmitter();
 
   bool update(float dt);
@@ -58,7 +59,7 @@ public:
   }
 
   // This is called by the EmitPolicy when it decides to emit a new Particle.
-  std::shared_ptr<Particle> emit(fw::Vector pos, float time_offset = 0.0f);
+  void emit(fw::Vector pos, float time_offset = 0.0f);
 };
 
 // This is the base class for the "policy" which decide how and when we emit new particles. It might be an "x per
@@ -96,7 +97,9 @@ public:
 // becomes greater than some threshold.
 class DistanceEmitPolicy: public EmitPolicy {
 private:
-  std::weak_ptr<Particle> last_particle_;
+  // Where we emitted the last particle (if we've emitted one yet).
+  bool has_last_position_;
+  fw::Vector last_position_;
   float max_distance_;
 
 public:
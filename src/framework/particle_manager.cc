@@ -3,8 +3,8 @@
 #include <framework/particle_emitter.h>
 #include <framework/particle_effect.h>
 #include <framework/particle_config.h>
-#include <framework/particle.h>
 #include <framework/particle_renderer.h>
+#include <framework/particle_store.h>
 #include <framework/framework.h>
 #include <framework/timer.h>
 #include <framework/scenegraph.h>
@@ -12,7 +12,8 @@
 namespace fw {
 
 ParticleManager::ParticleManager() :
-    renderer_(nullptr), wrap_x_(0.0f), wrap_z_(0.0f), particle_pool_(/*initial_size=*/1000) {
+    renderer_(nullptr), back_snapshot_(0), front_snapshot_(2), ready_snapshot_(1), num_active_particles_(0),
+    wrap_x_(0.0f), wrap_z_(0.0f) {
   renderer_ = new ParticleRenderer(this);
   auto* renderer = renderer_;
   fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
@@ -35,38 +36,74 @@ void ParticleManager::set_world_wrap(float x, float z) {
 }
 
 void ParticleManager::update(float dt) {
-  paused_.store(fw::Framework::get_instance()->is_paused());
-}
+  if (fw::Framework::get_instance()->is_paused()) {
+    return;
+  }
 
-ParticleManager::ParticleList& ParticleManager::on_render(float dt) {
-  if (!paused_.load()) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    for (EffectList::iterator it = effects_.begin(); it != effects_.end(); ++it) {
-      (*it)->update(dt);
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // The effects emit new particles, then we update all of the particles in each store in one go.
+  for (EffectList::iterator it = effects_.begin(); it != effects_.end();) {
+    (*it)->update(dt);
+    if ((*it)->is_finished()) {
+      it = effects_.erase(it);
+    } else {
+      ++it;
     }
   }
+  for (auto &kvp : stores_) {
+    kvp.second->update(dt);
+  }
+
+  publish_snapshot();
+}
 
-  if (!paused_.load()) {
-    // remove any dead particles
-    particles_.erase(std::remove_if(particles_.begin(), particles_.end(), [](const std::weak_ptr<Particle>& p) {
-      // If the underlying shared_ptr is gone, we remove it.
-      return p.expired();
-    }), particles_.end());
+void ParticleManager::publish_snapshot() {
+  Snapshot &snapshot = snapshots_[back_snapshot_];
+
+  // Stores are never removed, so the stores in the snapshot line up with the first stores in stores_.
+  long num_particles = 0;
+  size_t index = 0;
+  for (auto &kvp : stores_) {
+    if (index == snapshot.stores.size()) {
+      snapshot.stores.push_back(std::make_unique<ParticleStore>(kvp.second->get_config()));
+    }
+    snapshot.stores[index]->copy_from(*kvp.second);
+    num_particles += kvp.second->get_count();
+    index++;
   }
+  sg::ScenegraphManager *sg_manager = fw::Framework::get_instance()->get_scenegraph_manager();
+  snapshot.update = (sg_manager != nullptr) ? sg_manager->get_next_update() : 0;
+  num_active_particles_.store(num_particles, std::memory_order_relaxed);
 
-  // Return the particles so that the renderer can render them.
-  return particles_;
+  back_snapshot_ =
+      ready_snapshot_.exchange(back_snapshot_ | kSnapshotNew, std::memory_order_acq_rel) & ~kSnapshotNew;
+}
+
+ParticleManager::Snapshot const &ParticleManager::get_render_snapshot() {
+  if ((ready_snapshot_.load(std::memory_order_acquire) & kSnapshotNew) != 0) {
+    front_snapshot_ = ready_snapshot_.exchange(front_snapshot_, std::memory_order_acq_rel) & ~kSnapshotNew;
+  }
+  return snapshots_[front_snapshot_];
 }
 
 long ParticleManager::get_num_active_particles() const {
-  // some may have died but not been removed yet, that's OK as this is just to give us an idea.
-  return particles_.size();
+  return num_active_particles_.load(std::memory_order_relaxed);
+}
+
+ParticleStore *ParticleManager::get_store(std::shared_ptr<ParticleEmitterConfig> const &config) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_ptr<ParticleStore> &store = stores_[config.get()];
+  if (!store) {
+    store = std::make_unique<ParticleStore>(config);
+  }
+  return store.get();
 }
 
 fw::StatusOr<std::shared_ptr<ParticleEffect>> ParticleManager::CreateEffect(
     std::string_view name, fw::Vector const &initial_position) {
   ASSIGN_OR_RETURN(auto config, ParticleEffectConfig::Load(name));
-  auto effect = std::make_shared<ParticleEffect>(this, particle_pool_, config, initial_position);
+  auto effect = std::make_shared<ParticleEffect>(this, config, initial_position);
 
   {
     std::unique_lock<std::mutex> lock(mutex_);
@@ -86,10 +123,4 @@ void ParticleManager::remove_effect(const std::shared_ptr<ParticleEffect>& effec
   }
 }
 
-void ParticleManager::add_particle(std::weak_ptr<Particle> p) {
-  FW_ENSURE_RENDER_THREAD();
-
-  particles_.push_back(p);
-}
-
 }
@@ -1,54 +1,80 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <vector>
 
 #include <framework/graphics.h>
-#include <framework/object_pool.h>
 #include <framework/status.h>
 #include <framework/texture.h>
 
 namespace fw {
-class Particle;
 class ParticleEmitter;
+class ParticleEmitterConfig;
 class ParticleEffect;
 class ParticleRenderer;
+class ParticleStore;
 
 /** The ParticleManager manages all of the Particle emitters in the game. */
 class ParticleManager {
 public:
   typedef std::list<std::shared_ptr<ParticleEffect>> EffectList;
-  typedef std::list<std::weak_ptr<Particle>> ParticleList;
+
+  // A copy of all the particles as they were at the end of an update, for the renderer to draw. The particles also
+  // remember their position from the update before, so the renderer can interpolate between the two.
+  struct Snapshot {
+    std::vector<std::unique_ptr<ParticleStore>> stores;
+
+    // The update that made this snapshot (see ScenegraphManager::get_next_update), so the renderer can interpolate
+    // the particles the same amount as everything else.
+    int64_t update = 0;
+  };
 
 private:
-  // Controls access to the effect list, which can be access from both the render thread and update
-  // thread.
+  // Controls access to the effect list and stores, which are updated on the update thread but effects can be created
+  // from anywhere. The renderer never takes this lock, it only looks at snapshots.
   std::mutex mutex_;
 
-  ObjectPool<Particle> particle_pool_;
   ParticleRenderer *renderer_;
   EffectList effects_;
-  ParticleList particles_;
+
+  // The particles themselves live in a ParticleStore per emitter config. There's only a handful of configs, so we
+  // just keep the stores around once they're created.
+  std::map<ParticleEmitterConfig const *, std::unique_ptr<ParticleStore>> stores_;
+
+  // The update thread fills in the back snapshot while the renderer draws the front one. When the update finishes, it
+  // swaps the back snapshot with the ready one, and the renderer swaps the ready one with the front when it sees
+  // there's a new one. That way neither thread ever waits for the other.
+  static const int kSnapshotNew = 4;
+  Snapshot snapshots_[3];
+  int back_snapshot_;
+  int front_snapshot_;
+  // The index of the ready snapshot, or'd with kSnapshotNew if the renderer hasn't picked it up yet.
+  std::atomic<int> ready_snapshot_;
+
+  std::atomic<long> num_active_particles_;
+
   float wrap_x_;
   float wrap_z_;
 
-  // If true, the game is paused, so we shouldn't update any particules either. Particulars are
-  // updated on the render thread, so we need this to be atomic.
-  std::atomic<bool> paused_;
+  // Copies the stores into the back snapshot and hands it over to the renderer.
+  void publish_snapshot();
 
 public:
   ParticleManager();
   ~ParticleManager();
 
   fw::Status Initialize();
+
+  // Updates all of the effects and particles, on the update thread.
   void update(float dt);
 
-  // This is called by the ParticleRenderer when we're about to render the particles. We return the
-  // particle list so that it can actually render the particles.
-  ParticleList& on_render(float dt);
+  // This is called by the ParticleRenderer on the render thread to get the latest particles to draw.
+  Snapshot const &get_render_snapshot();
 
   // created the named effect (we load the properties from the given .wwpart file)
   fw::StatusOr<std::shared_ptr<ParticleEffect>> CreateEffect(
@@ -71,8 +97,8 @@ public:
   /** Gets a count of the number of active (alive) particles, mostly for debugging. */
   long get_num_active_particles() const;
 
-  // this is called by the ParticleEmitter to add a new Particle
-  void add_particle(std::weak_ptr<Particle> p);
+  // This is called by the ParticleEmitter to get the store it should add it's particles to.
+  ParticleStore *get_store(std::shared_ptr<ParticleEmitterConfig> const &config);
 };
 
 }
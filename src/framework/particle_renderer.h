@@ -1,38 +1,44 @@
 #pragma once
 
-#include <list>
+#include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
+#include <framework/dynamic_ring_buffer.h>
+#include <framework/particle_batcher.h>
+#include <framework/particle_manager.h>
 #include <framework/texture.h>
 #include <framework/scenegraph.h>
 #include <framework/shader.h>
 #include <framework/status.h>
 
-struct RenderState;
-
 namespace fw {
-class Particle;
-class ParticleManager;
 
-// The ParticleRenderer is responsible for rendering particles. We create our own special Scenegraph Node that does
-// the main work.
+// The ParticleRenderer is responsible for rendering particles. The ParticleBatcher builds the vertices straight into
+// a DynamicRingBuffer, and then we draw each batch with the shared quad index buffer.
 class ParticleRenderer : public fw::sg::ScenegraphCallback {
-public:
-  // This is the type of a list of particles. It must match the ParticleList type defined in ParticleManager.
-  typedef std::list<std::weak_ptr<Particle>> ParticleList;
-
 private:
+  // The most particles we'll draw in one frame.
+  static const int kMaxParticles = 65536;
+
   std::shared_ptr<Shader> shader_;
   std::shared_ptr<ShaderParameters> shader_params_;
   std::shared_ptr<Texture> color_texture_;
   ParticleManager *mgr_;
-  int draw_frame_;
 
-  void render_particles(RenderState &rs, float offset_x, float offset_z);
-  bool add_particle(RenderState &rs, int base_index, std::shared_ptr<Particle>& p, float offset_x, float offset_z);
+  ParticleBatcher batcher_;
+
+  // Created on the render thread the first time we render.
+  std::unique_ptr<DynamicRingBuffer> ring_buffer_;
+
+  // The nodes we draw the batches with, and the shader parameters for each texture and mode, kept from frame to frame
+  // so we're not creating them for every batch.
+  std::vector<std::shared_ptr<sg::Node>> batch_nodes_;
+  std::map<std::pair<Texture const *, ParticleEmitterConfig::BillboardMode>, std::shared_ptr<ShaderParameters>>
+      batch_shader_params_;
 
-  // sort the particles so they're optimal for rendering
-  void sort_particles(ParticleRenderer::ParticleList &particles);
+  std::shared_ptr<ShaderParameters> const &get_shader_parameters(ParticleBatch const &batch);
 
 public:
   ParticleRenderer(ParticleManager *mgr);
@@ -0,0 +1,263 @@
+#include <framework/particle_store.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+#include <framework/misc.h>
+#include <framework/particle_config.h>
+#include <framework/simd_ops.h>
+
+namespace fw {
+namespace {
+
+typedef ParticleEmitterConfig::LifeTable LifeTable;
+typedef ParticleEmitterConfig::Curve Curve;
+typedef ParticleEmitterConfig::RandomCurve RandomCurve;
+
+// The arrays are aligned for (and their capacity is a multiple of) the widest registers we use, which is AVX's.
+constexpr int kAlignment = 32;
+constexpr int kMaxWidth = 8;
+constexpr int kInitialCapacity = 256;
+
+// Gets the value of the given curve, for particles in interval index, t of the way through it.
+template<typename Ops>
+inline typename Ops::Float get_curve(
+    Curve const &curve, typename Ops::Index const &index, typename Ops::Float t) {
+  return Ops::add(Ops::gather(curve.start, index), Ops::mul(Ops::gather(curve.delta, index), t));
+}
+
+template<typename Ops>
+inline typename Ops::Float get_random_curve(
+    RandomCurve const &curve, typename Ops::Index const &index, typename Ops::Float t, typename Ops::Float random) {
+  return Ops::add(get_curve<Ops>(curve.min, index, t), Ops::mul(random, get_curve<Ops>(curve.range, index, t)));
+}
+
+// Updates the particles from begin to end, which must be a multiple of Ops::kWidth. This is a direct translation of
+// the old per-particle update, except the life states come from the LifeTable. We don't remove the dead particles
+// here, just age them past 1.
+template<typename Ops, bool kHasDirected>
+void update_particles(float *data, int capacity, int begin, int end, LifeTable const &table, float dt) {
+  typedef typename Ops::Float Float;
+  typedef typename Ops::Index Index;
+
+  float *pos_x = data + (ParticleStore::kPositionX * capacity);
+  float *pos_y = data + (ParticleStore::kPositionY * capacity);
+  float *pos_z = data + (ParticleStore::kPositionZ * capacity);
+  float *dir_x = data + (ParticleStore::kDirectionX * capacity);
+  float *dir_y = data + (ParticleStore::kDirectionY * capacity);
+  float *dir_z = data + (ParticleStore::kDirectionZ * capacity);
+  float *ages = data + (ParticleStore::kAge * capacity);
+  float const *age_rates = data + (ParticleStore::kAgeRate * capacity);
+  float *sizes = data + (ParticleStore::kSize * capacity);
+  float *alphas = data + (ParticleStore::kAlpha * capacity);
+  float *angles = data + (ParticleStore::kAngle * capacity);
+  float const *size_randoms = data + (ParticleStore::kSizeRandom * capacity);
+  float const *motion_randoms = data + (ParticleStore::kMotionRandom * capacity);
+
+  const Float delta = Ops::set(dt);
+  const Float zero = Ops::set(0.0f);
+  const Float one = Ops::set(1.0f);
+  const Float min_length = Ops::set(0.000001f);
+  const Float table_size = Ops::set(static_cast<float>(ParticleEmitterConfig::kLifeTableSize));
+  const Float max_index = Ops::set(static_cast<float>(ParticleEmitterConfig::kLifeTableSize - 1));
+
+  for (int i = begin; i < end; i += Ops::kWidth) {
+    const Float age = Ops::add(Ops::load(ages + i), Ops::mul(Ops::load(age_rates + i), delta));
+    Ops::store(ages + i, age);
+
+    // Work out which interval of the table we're in (see LifeTable::get_index).
+    const Float x = Ops::mul(Ops::min(Ops::max(age, zero), one), table_size);
+    const Index index = Ops::to_index(Ops::min(x, max_index));
+    const Float t = Ops::sub(x, Ops::to_float(index));
+
+    const Float size_random = Ops::load(size_randoms + i);
+    const Float motion_random = Ops::load(motion_randoms + i);
+
+    Ops::store(sizes + i, get_random_curve<Ops>(table.size, index, t, size_random));
+    Ops::store(alphas + i, get_curve<Ops>(table.alpha, index, t));
+
+    const Float rotation_speed = get_random_curve<Ops>(table.rotation_speed, index, t, size_random);
+    Ops::store(angles + i, Ops::add(Ops::load(angles + i), Ops::mul(rotation_speed, delta)));
+
+    const Float speed = get_random_curve<Ops>(table.speed, index, t, motion_random);
+    const Float gravity = get_random_curve<Ops>(table.gravity, index, t, motion_random);
+
+    // By default, particles keep going the way they were going, and gravity pulls them down.
+    Float dx = Ops::load(dir_x + i);
+    Float dy = Ops::sub(Ops::load(dir_y + i), Ops::mul(gravity, delta));
+    Float dz = Ops::load(dir_z + i);
+    if (kHasDirected) {
+      // In directed intervals, the direction comes from the life states instead (plus more gravity the older it gets),
+      // normalized. We blend between the two with directed, which is 0 or 1.
+      const Float target_x = get_random_curve<Ops>(table.direction_x, index, t, motion_random);
+      const Float target_y = Ops::sub(
+          get_random_curve<Ops>(table.direction_y, index, t, motion_random), Ops::mul(gravity, age));
+      const Float target_z = get_random_curve<Ops>(table.direction_z, index, t, motion_random);
+      const Float length = Ops::sqrt(Ops::add(
+          Ops::add(Ops::mul(target_x, target_x), Ops::mul(target_y, target_y)), Ops::mul(target_z, target_z)));
+      const Float inverse_length = Ops::div(one, Ops::max(length, min_length));
+
+      const Float directed = Ops::gather(table.directed, index);
+      dx = Ops::add(dx, Ops::mul(Ops::sub(Ops::mul(target_x, inverse_length), dx), directed));
+      dy = Ops::add(dy, Ops::mul(Ops::sub(Ops::mul(target_y, inverse_length), dy), directed));
+      dz = Ops::add(dz, Ops::mul(Ops::sub(Ops::mul(target_z, inverse_length), dz), directed));
+    }
+    Ops::store(dir_x + i, dx);
+    Ops::store(dir_y + i, dy);
+    Ops::store(dir_z + i, dz);
+
+    const Float distance = Ops::mul(speed, delta);
+    Ops::store(pos_x + i, Ops::add(Ops::load(pos_x + i), Ops::mul(dx, distance)));
+    Ops::store(pos_y + i, Ops::add(Ops::load(pos_y + i), Ops::mul(dy, distance)));
+    Ops::store(pos_z + i, Ops::add(Ops::load(pos_z + i), Ops::mul(dz, distance)));
+  }
+}
+
+template<typename Ops>
+void run_kernel(float *data, int capacity, int count, LifeTable const &table, float dt) {
+  // We can go past count up to the next multiple of the width, there's always room in the arrays and whatever junk
+  // is there will just be ignored.
+  const int end = ((count + Ops::kWidth - 1) / Ops::kWidth) * Ops::kWidth;
+  if (table.has_directed) {
+    update_particles<Ops, true>(data, capacity, 0, end, table, dt);
+  } else {
+    update_particles<Ops, false>(data, capacity, 0, end, table, dt);
+  }
+}
+
+float *allocate_fields(int capacity) {
+  const size_t size = sizeof(float) * ParticleStore::kNumFields * capacity;
+  float *data = static_cast<float *>(::operator new(size, std::align_val_t(kAlignment)));
+  std::memset(data, 0, size);
+  return data;
+}
+
+void free_fields(float *data) {
+  ::operator delete(data, std::align_val_t(kAlignment));
+}
+
+}
+
+ParticleStore::ParticleStore(std::shared_ptr<ParticleEmitterConfig> const &config) :
+    config_(config), data_(nullptr), capacity_(0), count_(0) {
+  grow();
+}
+
+ParticleStore::~ParticleStore() {
+  free_fields(data_);
+}
+
+char const *ParticleStore::get_simd_name() {
+  return kSimdName;
+}
+
+void ParticleStore::grow() {
+  static_assert(kInitialCapacity % kMaxWidth == 0);
+  const int new_capacity = std::max(kInitialCapacity, capacity_ * 2);
+  float *new_data = allocate_fields(new_capacity);
+  if (data_ != nullptr) {
+    for (int field = 0; field < kNumFields; field++) {
+      std::memcpy(new_data + (field * new_capacity), data_ + (field * capacity_), sizeof(float) * count_);
+    }
+    free_fields(data_);
+  }
+
+  data_ = new_data;
+  capacity_ = new_capacity;
+}
+
+float ParticleStore::add(fw::Vector const &pos, float time_offset) {
+  if (count_ == capacity_) {
+    grow();
+  }
+  const int index = count_++;
+
+  const float max_age = std::max(config_->max_age.GetValue(), 0.001f);
+  const float age = std::min(std::max(time_offset, 0.0f) / max_age, 1.0f);
+  get_mutable(kAge)[index] = age;
+  get_mutable(kAgeRate)[index] = 1.0f / max_age;
+
+  get_mutable(kPositionX)[index] = pos[0];
+  get_mutable(kPositionY)[index] = pos[1];
+  get_mutable(kPositionZ)[index] = pos[2];
+  get_mutable(kLastPositionX)[index] = pos[0];
+  get_mutable(kLastPositionY)[index] = pos[1];
+  get_mutable(kLastPositionZ)[index] = pos[2];
+
+  const fw::Vector direction =
+      fw::Vector(fw::random() - 0.5f, fw::random() - 0.5f, fw::random() - 0.5f).normalized();
+  get_mutable(kDirectionX)[index] = direction[0];
+  get_mutable(kDirectionY)[index] = direction[1];
+  get_mutable(kDirectionZ)[index] = direction[2];
+
+  get_mutable(kSize)[index] = 0.0f;
+  get_mutable(kAlpha)[index] = 0.0f;
+  get_mutable(kAngle)[index] = 0.0f;
+  get_mutable(kLastAngle)[index] = 0.0f;
+  get_mutable(kSizeRandom)[index] = fw::random();
+  get_mutable(kMotionRandom)[index] = fw::random();
+
+  const int num_areas = static_cast<int>(config_->billboard.areas.size());
+  get_mutable(kArea)[index] = static_cast<float>(
+      num_areas == 0 ? 0 : std::min(static_cast<int>(fw::random() * num_areas), num_areas - 1));
+
+  return max_age * (1.0f - age);
+}
+
+void ParticleStore::copy_from(ParticleStore const &other) {
+  // Throw away our particles first, so that grow() doesn't bother copying them.
+  count_ = 0;
+  while (capacity_ < other.count_) {
+    grow();
+  }
+
+  for (int field = 0; field < kNumFields; field++) {
+    std::memcpy(
+        get_mutable(static_cast<Field>(field)), other.get(static_cast<Field>(field)), sizeof(float) * other.count_);
+  }
+  count_ = other.count_;
+}
+
+void ParticleStore::update(float dt, Kernel kernel) {
+  if (count_ == 0) {
+    return;
+  }
+
+  std::memcpy(get_mutable(kLastPositionX), get(kPositionX), sizeof(float) * count_);
+  std::memcpy(get_mutable(kLastPositionY), get(kPositionY), sizeof(float) * count_);
+  std::memcpy(get_mutable(kLastPositionZ), get(kPositionZ), sizeof(float) * count_);
+  std::memcpy(get_mutable(kLastAngle), get(kAngle), sizeof(float) * count_);
+
+  LifeTable const &table = config_->life_table;
+  if (kernel == Kernel::kSimd) {
+    run_kernel<SimdOps>(data_, capacity_, count_, table, dt);
+  } else {
+    run_kernel<ScalarOps>(data_, capacity_, count_, table, dt);
+  }
+
+  remove_dead();
+}
+
+void ParticleStore::remove_dead() {
+  float const *ages = get(kAge);
+  int index = 0;
+  while (index < count_) {
+    if (ages[index] <= 1.0f) {
+      index++;
+      continue;
+    }
+
+    // Move the last particle into this one's place, and look at this index again.
+    count_--;
+    if (index != count_) {
+      for (int field = 0; field < kNumFields; field++) {
+        float *values = get_mutable(static_cast<Field>(field));
+        values[index] = values[count_];
+      }
+    }
+  }
+}
+
+}
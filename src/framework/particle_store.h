@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+
+#include <framework/math.h>
+
+namespace fw {
+class ParticleEmitterConfig;
+
+// Holds all of the live particles for one ParticleEmitterConfig, as a structure of arrays: each field of the particles
+// is a separate (aligned) array of floats, so the update kernel can run over them four or eight particles at a time
+// with SSE/AVX. All of the emitters that use the same config share the same store.
+//
+// Particles don't have a stable index: when one dies, the last particle is moved into it's place.
+class ParticleStore {
+public:
+  enum Field {
+    kPositionX,
+    kPositionY,
+    kPositionZ,
+    kDirectionX,
+    kDirectionY,
+    kDirectionZ,
+
+    // The particle's age, from 0 when it's emitted to 1 when it dies, and how much that goes up per second.
+    kAge,
+    kAgeRate,
+
+    kSize,
+    kAlpha,
+    kAngle,
+
+    // The numbers between 0 and 1 that pick each particle's values from the config's Random ranges. kSizeRandom is for
+    // size and rotation speed, kMotionRandom is for speed, gravity and direction.
+    kSizeRandom,
+    kMotionRandom,
+
+    // The index into the config's billboard areas. It's a float so we can move it around with everything else.
+    kArea,
+
+    // The position and angle as they were before the last update, so the renderer can interpolate between updates.
+    kLastPositionX,
+    kLastPositionY,
+    kLastPositionZ,
+    kLastAngle,
+
+    kNumFields
+  };
+
+  // Which version of the update kernel to run. You'll always want kSimd, except to compare them.
+  enum class Kernel {
+    kScalar,
+    kSimd,
+  };
+
+  explicit ParticleStore(std::shared_ptr<ParticleEmitterConfig> const &config);
+  ~ParticleStore();
+
+  ParticleStore(ParticleStore const &) = delete;
+
+  // Adds a new particle at the given position. time_offset is how long ago (in seconds) it should have been emitted.
+  // Returns how long (in seconds) the particle will live for.
+  float add(fw::Vector const &pos, float time_offset);
+
+  // Updates all of the particles and removes the ones that have died.
+  void update(float dt, Kernel kernel = Kernel::kSimd);
+
+  // Makes this store an exact copy of the given one, which should be for the same config.
+  void copy_from(ParticleStore const &other);
+
+  int get_count() const {
+    return count_;
+  }
+
+  float const *get(Field field) const {
+    return data_ + (field * capacity_);
+  }
+
+  std::shared_ptr<ParticleEmitterConfig> const &get_config() const {
+    return config_;
+  }
+
+  // Gets the name of the instruction set the kSimd kernel was compiled for ("AVX2", "SSE2" or "scalar").
+  static char const *get_simd_name();
+
+private:
+  std::shared_ptr<ParticleEmitterConfig> config_;
+
+  // All of the fields, one after the other, each of them capacity_ floats long. capacity_ is a multiple of the widest
+  // SIMD register, so the kernels can always read and write a whole register's worth of particles.
+  float *data_;
+  int capacity_;
+  int count_;
+
+  float *get_mutable(Field field) {
+    return data_ + (field * capacity_);
+  }
+
+  void grow();
+  void remove_dead();
+};
+
+}
@@ -1,6 +1,7 @@
 #include <framework/path_find.h>
 
-#include <set>
+#include <algorithm>
+#include <cmath>
 
 #include <framework/logging.h>
 #include <framework/math.h>
@@ -8,139 +9,157 @@
 #include <framework/timer.h>
 
 namespace fw {
+namespace {
+
+float estimate_cost(float x, float z, fw::Vector const &to, int width, int length) {
+  // we'll use the manhatten distance, remembering that the map wraps around so it might be shorter to go the other
+  // way around.
+  float dx = std::abs(x - to[0]);
+  float dz = std::abs(z - to[2]);
+  return std::min(dx, width - dx) + std::min(dz, length - dz);
+}
 
-struct PathNode {
-  PathNode *previous;
-  float cost_to_goal;
-  float cost_from_start;
-  fw::Vector loc;
-  bool passable;
-
-  struct cost_comparer {
-    bool operator()(PathNode const *lhs, PathNode const *rhs) const {
-      float lhs_total_cost = lhs->cost_to_goal + lhs->cost_from_start;
-      float rhs_total_cost = rhs->cost_to_goal + rhs->cost_from_start;
-      return lhs_total_cost < rhs_total_cost;
-    }
-  };
+struct Neighbour {
+  int dx;
+  int dz;
 
-  std::multiset<PathNode *, cost_comparer>::iterator open_it;
-  int open_run_no;  // the run_no we were last inserted into the open set
-  int closed_run_no;  // the run_no we were last inserted into the closed set
+  // the actual cost of moving to this neighbour: sqrt(2) for diagonals; 1 for straights (that's the actual length of
+  // the line...)
+  float cost;
 };
 
-PathFind::PathFind(int width, int length, std::vector<bool> const &passability) :
-    width_(width), length_(length), run_no_(0) {
-  nodes_ = new PathNode[width_ * length_];
-  for (int z = 0; z < length_; z++) {
-    for (int x = 0; x < width_; x++) {
-      PathNode &node = nodes_[(z * width_) + x];
-      node.loc = fw::Vector(x, 0, z);
-      node.open_run_no = 0;
-      node.closed_run_no = 0;
-      node.passable = passability[(z * width_) + x];
-    }
+constexpr int kNumNeighbours = 8;
+constexpr Neighbour kNeighbours[kNumNeighbours] = {
+  {-1, -1, 1.41421356f}, {0, -1, 1.0f}, {1, -1, 1.41421356f},
+  {-1,  0, 1.0f},                       {1,  0, 1.0f},
+  {-1,  1, 1.41421356f}, {0,  1, 1.0f}, {1,  1, 1.41421356f},
+};
+
+}
+
+PassabilityGrid::PassabilityGrid(int width, int length, std::vector<bool> const &passability) :
+    width_(width), length_(length), passable_(width * length) {
+  for (int i = 0; i < width_ * length_; i++) {
+    passable_[i] = passability[i] ? 1 : 0;
   }
 }
 
-PathFind::~PathFind() {
-  delete[] nodes_;
+//-------------------------------------------------------------------------
+
+PathFind::PathFind(int width, int length, std::vector<bool> const &passability) :
+    PathFind(std::make_shared<PassabilityGrid>(width, length, passability)) {
 }
 
-float estimate_cost(fw::Vector const &from, fw::Vector const &to) {
-  // we'll use the manhatten distance.
-  return abs(from[0] - to[0]) + abs(from[2] - to[2]);
+PathFind::PathFind(std::shared_ptr<PassabilityGrid const> grid) :
+    grid_(grid), width_(grid->get_width()), length_(grid->get_length()), passable_(grid->get_data()),
+    cost_from_start_(width_ * length_), parent_(width_ * length_), stamp_(width_ * length_, 0),
+    open_(width_ * length_), run_no_(0) {
 }
 
-void construct_path(std::vector<fw::Vector> &path, PathNode const *goal_node) {
-  PathNode const *Node = goal_node;
-  while (Node != 0) {
-    path.insert(path.begin(), Node->loc);
-    Node = Node->previous;
-  }
+PathFind::~PathFind() {
 }
 
-PathNode *PathFind::get_node(fw::Vector const &loc) const {
+int PathFind::get_node_index(fw::Vector const &loc) const {
   int x = fw::constrain(static_cast<int>(loc[0]), width_);
   int z = fw::constrain(static_cast<int>(loc[2]), length_);
-  return &nodes_[(z * width_) + x];
+  return (z * width_) + x;
 }
 
-bool PathFind::find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end) {
-  std::multiset<PathNode *, PathNode::cost_comparer> open_set;
+void PathFind::begin_run() {
+  // increment the run_no (basically invalidating all the current nodes). We go up by two so that run_no_ + 1 is
+  // free for find() to mark closed nodes with.
+  run_no_ += 2;
+  if (run_no_ == 0) {
+    // We've wrapped around, any stale stamp could now look current so reset them all.
+    std::fill(stamp_.begin(), stamp_.end(), 0);
+    run_no_ = 2;
+  }
 
-  // increment the run_no (basically invalidating all the current path_nodes)
-  run_no_++;
+  open_.clear();
+}
+
+void PathFind::construct_path(std::vector<fw::Vector> &path, int goal_node) const {
+  size_t first = path.size();
+  for (int n = goal_node; n >= 0; n = parent_[n]) {
+    path.push_back(fw::Vector(static_cast<float>(n % width_), 0.0f, static_cast<float>(n / width_)));
+  }
+  std::reverse(path.begin() + first, path.end());
+}
+
+bool PathFind::find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end_unwrapped) {
+  // The estimate (and the goal test) assume the goal is on the map, so wrap it around like we do with the start.
+  const fw::Vector end(fw::constrain(end_unwrapped[0], static_cast<float>(width_)), end_unwrapped[1],
+      fw::constrain(end_unwrapped[2], static_cast<float>(length_)));
+
+  begin_run();
+  buckets_.clear();
+  const uint32_t closed = run_no_ + 1;
 
   // add the initial Node to the open set
-  PathNode *start_node = get_node(start);
-  start_node->previous = 0;
-  start_node->open_run_no = run_no_;
-  start_node->cost_to_goal = estimate_cost(start_node->loc, end);
-  start_node->cost_from_start = 0.0f;
-  start_node->open_it = open_set.insert(start_node);
-
-  auto open_it = open_set.begin();
-  while (open_it != open_set.end()) {
-    // grab the first Node from the open set
-    PathNode *curr = *open_it;
+  int start_node = get_node_index(start);
+  stamp_[start_node] = run_no_;
+  parent_[start_node] = -1;
+  cost_from_start_[start_node] = 0.0f;
+  buckets_.push(start_node, estimate_cost(
+      static_cast<float>(start_node % width_), static_cast<float>(start_node / width_), end, width_, length_));
+
+  while (!buckets_.empty()) {
+    // grab the first Node from the open set, we've now processed it so it goes into the closed set. If it's already
+    // closed, this is a stale entry from before we found a cheaper way to get to it.
+    int curr = buckets_.pop();
+    if (stamp_[curr] == closed)
+      continue;
+    stamp_[curr] = closed;
+
+    const int curr_x = curr % width_;
+    const int curr_z = curr / width_;
+    const float curr_cost_from_start = cost_from_start_[curr];
 
     // work out if we're at the goal
-    float cost_to_goal = curr->cost_to_goal;
-    if (cost_to_goal <= 1.0f) {
+    if (estimate_cost(static_cast<float>(curr_x), static_cast<float>(curr_z), end, width_, length_) <= 1.0f) {
       construct_path(path, curr);
       return true;
     }
 
-    // we've now processed this Node, add it to the closed set
-    curr->closed_run_no = run_no_;
-    curr->open_run_no = 0;
-    open_set.erase(curr->open_it);
+    // Nodes away from the edge of the map can find their neighbours with a simple offset, only nodes on the edge need
+    // to wrap around to the other side.
+    const bool interior = curr_x > 0 && curr_x < width_ - 1 && curr_z > 0 && curr_z < length_ - 1;
 
     // find all the neighbours and add them to the open set
-    for (int dz = -1; dz <= 1; dz++) {
-      for (int dx = -1; dx <= 1; dx++) {
-        // skip the current Node!!
-        if (dx == 0 && dz == 0)
-          continue;
-
-        // find the Node, if we've already visited and discounted it, don't visit it again
-        PathNode *n = get_node(fw::Vector(curr->loc[0] + dx, 0.0f, curr->loc[2] + dz));
-
-        // if it's in the closed list already or not passable, don't even consider it
-        if (n->closed_run_no == run_no_ || !n->passable)
-          continue;
-
-        // estimate the cost to the goal from this Node
-        float new_cost_to_goal = estimate_cost(n->loc, end);
-
-        // the actual cost from the start: sqrt(2) for diagonals; 1 for straights (that's the actual length of the
-        // line...)
-        float new_cost_from_start = curr->cost_from_start + (dx == 0 || dz == 0 ? 1.0f : 1.41421356f);
-
-        // if it's a non-visited Node, or if it's cheaper to travel this path than go directly from that one, then use
-        // this path instead
-        if (n->open_run_no != run_no_
-            || (new_cost_from_start + new_cost_to_goal) < (n->cost_from_start + n->cost_to_goal)) {
-          // the next closest Node to this one is the one we're already looking at
-          n->previous = curr;
-
-          n->cost_to_goal = new_cost_to_goal;
-          n->cost_from_start = new_cost_from_start;
-
-          if (n->open_run_no == run_no_) {
-            // if it's already on the open list, remove it and re-add it since, by definition, it will now be lower
-            // cost
-            open_set.erase(n->open_it);
-          } else {
-            n->open_run_no = run_no_;
-          }
-          n->open_it = open_set.insert(n);
-        }
+    for (int i = 0; i < kNumNeighbours; i++) {
+      Neighbour const &nb = kNeighbours[i];
+      int x, z, n;
+      if (interior) {
+        x = curr_x + nb.dx;
+        z = curr_z + nb.dz;
+        n = curr + nb.dx + (nb.dz * width_);
+      } else {
+        x = fw::constrain(curr_x + nb.dx, width_);
+        z = fw::constrain(curr_z + nb.dz, length_);
+        n = (z * width_) + x;
       }
-    }
 
-    open_it = open_set.begin();
+      // if it's in the closed list already or not passable, don't even consider it
+      if (!passable_[n])
+        continue;
+      const uint32_t stamp = stamp_[n];
+      if (stamp == closed)
+        continue;
+
+      // if it's a non-visited Node, or if it's cheaper to travel this path than go directly from that one, then use
+      // this path instead. The estimate to the goal is the same either way, so we only need to compare the cost from
+      // the start.
+      float new_cost_from_start = curr_cost_from_start + nb.cost;
+      if (stamp == run_no_ && new_cost_from_start >= cost_from_start_[n])
+        continue;
+
+      // the next closest Node to this one is the one we're already looking at
+      stamp_[n] = run_no_;
+      parent_[n] = curr;
+      cost_from_start_[n] = new_cost_from_start;
+      buckets_.push(n, new_cost_from_start + estimate_cost(
+          static_cast<float>(x), static_cast<float>(z), end, width_, length_));
+    }
   }
 
   // if we get here, it means we couldn't find a path at all.
@@ -171,8 +190,7 @@ bool PathFind::is_passable(fw::Vector const &start, fw::Vector const &end) const
   float x = static_cast<float>(sx);
   float z = static_cast<float>(sz);
   for (int i = 0; i <= steps; i++) {
-    PathNode *Node = get_node(fw::Vector(x, 0, z));
-    if (!Node->passable)
+    if (!passable_[get_node_index(fw::Vector(x, 0, z))])
       return false;
 
     x += xinc;
@@ -212,10 +230,121 @@ void PathFind::simplify_path(std::vector<fw::Vector> const &full_path, std::vect
 
 //-------------------------------------------------------------------------
 
+FlowField::FlowField(std::shared_ptr<PassabilityGrid const> grid) :
+    grid_(grid), width_(grid->get_width()), length_(grid->get_length()), passable_(grid->get_data()),
+    cost_to_goal_(width_ * length_), next_(width_ * length_), stamp_(width_ * length_, 0),
+    start_stamp_(width_ * length_, 0), open_(width_ * length_), run_no_(0) {
+}
+
+int FlowField::get_node_index(fw::Vector const &loc) const {
+  int x = fw::constrain(static_cast<int>(loc[0]), width_);
+  int z = fw::constrain(static_cast<int>(loc[2]), length_);
+  return (z * width_) + x;
+}
+
+int FlowField::get_start_node(fw::Vector const &start) const {
+  // Units can end up slightly inside an impassable node, in which case they start from the first passable neighbour.
+  const int n = get_node_index(start);
+  if (passable_[n]) {
+    return n;
+  }
+
+  const int x = n % width_;
+  const int z = n / width_;
+  for (int i = 0; i < kNumNeighbours; i++) {
+    const int neighbour =
+        (fw::constrain(z + kNeighbours[i].dz, length_) * width_) + fw::constrain(x + kNeighbours[i].dx, width_);
+    if (passable_[neighbour]) {
+      return neighbour;
+    }
+  }
+  return n;
+}
+
+void FlowField::build(fw::Vector const &goal, std::vector<fw::Vector> const &starts) {
+  run_no_++;
+  if (run_no_ == 0) {
+    std::fill(stamp_.begin(), stamp_.end(), 0);
+    std::fill(start_stamp_.begin(), start_stamp_.end(), 0);
+    run_no_ = 1;
+  }
+  open_.clear();
+
+  // The number of (distinct) starts we still need to reach.
+  int remaining = 0;
+  for (fw::Vector const &start : starts) {
+    const int n = get_start_node(start);
+    if (start_stamp_[n] != run_no_) {
+      start_stamp_[n] = run_no_;
+      remaining++;
+    }
+  }
+
+  const int goal_node = get_node_index(goal);
+  stamp_[goal_node] = run_no_;
+  cost_to_goal_[goal_node] = 0.0f;
+  next_[goal_node] = -1;
+  open_.push(goal_node, IndexedHeap::make_key(0.0f, 0.0f));
+
+  while (!open_.empty()) {
+    const int curr = open_.pop();
+    if (start_stamp_[curr] == run_no_ && --remaining <= 0) {
+      break;
+    }
+
+    const int curr_x = curr % width_;
+    const int curr_z = curr / width_;
+    const float curr_cost = cost_to_goal_[curr];
+    for (int i = 0; i < kNumNeighbours; i++) {
+      Neighbour const &nb = kNeighbours[i];
+      const int x = fw::constrain(curr_x + nb.dx, width_);
+      const int z = fw::constrain(curr_z + nb.dz, length_);
+      const int n = (z * width_) + x;
+      if (!passable_[n])
+        continue;
+      const bool visited = stamp_[n] == run_no_;
+      if (visited && !open_.contains(n))
+        continue;
+
+      // Movement costs are symmetric, so the cost from n to curr is the same as from curr to n.
+      float new_cost = curr_cost + nb.cost;
+      if (!visited || new_cost < cost_to_goal_[n]) {
+        cost_to_goal_[n] = new_cost;
+        next_[n] = curr;
+        if (visited) {
+          open_.decrease(n, IndexedHeap::make_key(new_cost, 0.0f));
+        } else {
+          stamp_[n] = run_no_;
+          open_.push(n, IndexedHeap::make_key(new_cost, 0.0f));
+        }
+      }
+    }
+  }
+}
+
+bool FlowField::get_path(std::vector<fw::Vector> &path, fw::Vector const &start) const {
+  int n = get_start_node(start);
+  if (stamp_[n] != run_no_ || open_.contains(n)) {
+    // We never reached this start, or we reached it but stopped before it's cost was final.
+    return false;
+  }
+
+  for (; n >= 0; n = next_[n]) {
+    path.push_back(fw::Vector(static_cast<float>(n % width_), 0.0f, static_cast<float>(n / width_)));
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+
 TimedPathFind::TimedPathFind(int width, int length, std::vector<bool> &passability) :
     PathFind(width, length, passability), total_time(0) {
 }
 
+TimedPathFind::TimedPathFind(std::shared_ptr<PassabilityGrid const> grid) :
+    PathFind(grid), total_time(0) {
+}
+
 TimedPathFind::~TimedPathFind() {
 }
 
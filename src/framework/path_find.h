@@ -1,32 +1,93 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
+#include <framework/bucket_queue.h>
+#include <framework/indexed_heap.h>
 #include <framework/math.h>
 
 namespace fw {
-struct PathNode;
+
+// The passability data that PathFind searches over. It's immutable once constructed, so one instance can be shared by
+// any number of PathFinds running on different threads.
+class PassabilityGrid {
+private:
+  int width_;
+  int length_;
+
+  // Passability of each node (indexed by z * width + x), 1 if passable, 0 if not.
+  std::vector<uint8_t> passable_;
+
+public:
+  PassabilityGrid(int width, int length, std::vector<bool> const &passability);
+
+  inline int get_width() const {
+    return width_;
+  }
+  inline int get_length() const {
+    return length_;
+  }
+  inline bool is_passable(int index) const {
+    return passable_[index] != 0;
+  }
+  inline uint8_t const *get_data() const {
+    return passable_.data();
+  }
+};
 
 // Class for finding a path between point "A" and point "B" in a grid. This class is not thread safe, you should only
-// attempt to find one path at a time on a single thread.
+// attempt to find one path at a time on a single thread. To search on multiple threads, give each thread it's own
+// PathFind over the same PassabilityGrid.
+//
+// All of the per-node search state is kept in flat arrays (indexed by z * width + x) that are allocated once in the
+// constructor, and the open set keeps it's storage between searches, so once it has warmed up a call to find() does
+// not allocate (other than growing the output path).
 class PathFind {
-private:
+protected:
+  std::shared_ptr<PassabilityGrid const> grid_;
   int width_;
   int length_;
-  PathNode *nodes_;
-  int run_no_;
+  uint8_t const *passable_;
+
+  // The per-node search state. A node's state is only valid if stamp_[n] == run_no_, otherwise it's left over from
+  // a previous search and the node is treated as unvisited. run_no_ goes up by two each search, PathFind::find marks
+  // the nodes it has closed with run_no_ + 1.
+  std::vector<float> cost_from_start_;
+  std::vector<int> parent_;
+  std::vector<uint32_t> stamp_;
+
+  // The open set for subclasses that need an exact ordering, keyed on the total estimated cost with ties broken in
+  // favour of the node closest to the goal. A visited node that's no longer in the open set is in the closed set.
+  IndexedHeap open_;
+
+  uint32_t run_no_;
+
+  int get_node_index(fw::Vector const &loc) const;
+  void begin_run();
+
+private:
+  // The open set for PathFind::find. Nodes that get cheaper are pushed again rather than moved, so it can have stale
+  // entries for nodes that are already closed.
+  BucketQueue buckets_;
 
-  PathNode *get_node(fw::Vector const &loc) const;
   bool is_passable(fw::Vector const &start, fw::Vector const &end) const;
+  void construct_path(std::vector<fw::Vector> &path, int goal_node) const;
 
 public:
   PathFind(int width, int length, std::vector<bool> const &passability);
+  PathFind(std::shared_ptr<PassabilityGrid const> grid);
   virtual ~PathFind();
 
+  inline std::shared_ptr<PassabilityGrid const> get_grid() const {
+    return grid_;
+  }
+
   // Finds a path between the given 'start' and 'end' vectors. We ignore the y component of the vectors and just look
   // at the (x,y) components. The 'path' is populated with the path we found and we'll assume the agent will travel
   // between it's current location and the first element of path, then to the second element and so on traveling in a
-  // straight line each time.
+  // straight line each time. An 'end' off the edge of the map wraps around onto it.
   //
   // Returns true if a path was found, false if no path exists
   virtual bool find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end);
@@ -39,11 +100,49 @@ public:
   virtual void simplify_path(std::vector<fw::Vector> const &full_path, std::vector<fw::Vector> &new_path);
 };
 
+// A "flow field" towards a single goal: a reverse Dijkstra search outward from the goal, which records for each node
+// the next node to step to on the shortest path to the goal. When a group of units is heading to the same goal, one
+// field gives every unit it's path, instead of doing a separate search for each of them. Like PathFind, this is not
+// thread safe, but multiple FlowFields can share the same PassabilityGrid.
+class FlowField {
+private:
+  std::shared_ptr<PassabilityGrid const> grid_;
+  int width_;
+  int length_;
+  uint8_t const *passable_;
+
+  // Per-node state, valid only if stamp_[n] == run_no_ (same as PathFind). next_[n] is the node to step to from n.
+  std::vector<float> cost_to_goal_;
+  std::vector<int> next_;
+  std::vector<uint32_t> stamp_;
+
+  // start_stamp_[n] == run_no_ if n is one of the starts we're building the field for.
+  std::vector<uint32_t> start_stamp_;
+
+  IndexedHeap open_;
+  uint32_t run_no_;
+
+  int get_node_index(fw::Vector const &loc) const;
+  int get_start_node(fw::Vector const &start) const;
+
+public:
+  FlowField(std::shared_ptr<PassabilityGrid const> grid);
+
+  // Builds the field towards the given goal. We stop expanding as soon as all of the given starts have been reached
+  // (or once we've searched the whole map, if some of them can't reach the goal at all).
+  void build(fw::Vector const &goal, std::vector<fw::Vector> const &starts);
+
+  // Gets the path from 'start' to the goal of the last build(), in the same format as PathFind::find. Returns false
+  // if start wasn't reached by the last build().
+  bool get_path(std::vector<fw::Vector> &path, fw::Vector const &start) const;
+};
+
 // This specialization of PathFind adds some timing methods and it also keeps the final Node structure around
 // for visualization
 class TimedPathFind: public PathFind {
 public:
   TimedPathFind(int width, int length, std::vector<bool> &passability);
+  TimedPathFind(std::shared_ptr<PassabilityGrid const> grid);
   virtual ~TimedPathFind();
 
   // the total time the last find() call took, in seconds.
@@ -0,0 +1,256 @@
+#include <framework/render_queue.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <framework/dynamic_ring_buffer.h>
+#include <framework/graphics.h>
+#include <framework/logging.h>
+#include <framework/shader.h>
+#include <framework/texture.h>
+
+namespace fw::sg {
+namespace {
+
+GLenum get_gl_primitive_type(PrimitiveType primitive_type) {
+  switch (primitive_type) {
+  case kLineStrip:
+    return GL_LINE_STRIP;
+  case kLineList:
+    return GL_LINES;
+  case kTriangleStrip:
+    return GL_TRIANGLE_STRIP;
+  case kTriangleList:
+  default:
+    return GL_TRIANGLES;
+  }
+}
+
+class GlRenderBackend : public RenderBackend {
+private:
+  bool instancing_ = false;
+
+public:
+  void bind_program(Shader *shader, ShaderProgram *program) override {
+    Shader::BeginProgram(program);
+  }
+
+  void apply_parameters(ShaderProgram *program, ShaderParameters *parameters) override {
+    if (parameters != nullptr) {
+      Shader::ApplyParameters(program, *parameters);
+    }
+  }
+
+  void bind_shadow_map(ShaderProgram *program, Texture *shadow_map) override {
+    Shader::SetShadowMap(program, shadow_map);
+  }
+
+  void bind_vertex_buffer(VertexBuffer *vb) override {
+    vb->begin();
+  }
+
+  void bind_index_buffer(IndexBuffer *ib) override {
+    ib->begin();
+  }
+
+  void bind_instance_buffer(VertexBuffer *instance_vb) override {
+    if (instance_vb != nullptr) {
+      instance_vb->begin();
+      instancing_ = true;
+    } else if (instancing_) {
+      fw::vertex::instance::disable();
+      instancing_ = false;
+    }
+  }
+
+  void draw(RenderCommand const &cmd) override {
+    Shader::SetTransforms(cmd.program, cmd.transforms, cmd.shadow_map != nullptr);
+
+    const GLenum mode = get_gl_primitive_type(cmd.primitive_type);
+    if (cmd.num_instances > 0) {
+      draw_instanced(mode, cmd);
+    } else if (cmd.ib != nullptr && cmd.num_indices >= 0) {
+      glDrawElementsBaseVertex(mode, cmd.num_indices, GL_UNSIGNED_SHORT, nullptr, cmd.base_vertex);
+    } else if (cmd.ib != nullptr) {
+      glDrawElements(mode, cmd.ib->get_num_indices(), GL_UNSIGNED_SHORT, nullptr);
+    } else {
+      glDrawArrays(mode, 0, cmd.vb->get_num_vertices());
+    }
+  }
+
+  void draw_instanced(GLenum mode, RenderCommand const &cmd) {
+    if (cmd.ib != nullptr) {
+      const bool has_range = cmd.num_indices >= 0;
+      glDrawElementsInstancedBaseVertexBaseInstance(mode, has_range ? cmd.num_indices : cmd.ib->get_num_indices(),
+          GL_UNSIGNED_SHORT, nullptr, cmd.num_instances, has_range ? cmd.base_vertex : 0, cmd.first_instance);
+    } else {
+      glDrawArraysInstancedBaseInstance(
+          mode, 0, cmd.vb->get_num_vertices(), cmd.num_instances, cmd.first_instance);
+    }
+  }
+
+  void finish() override {
+    if (instancing_) {
+      fw::vertex::instance::disable();
+      instancing_ = false;
+    }
+    glUseProgram(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+};
+
+}
+
+uint64_t RenderQueue::make_key(Pass pass, uint32_t program_id, uint32_t texture_key, uint32_t vb_id, float depth) {
+  // Positive floats sort the same as their bits do, which is all we need for the depth.
+  uint32_t depth_bits;
+  std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+  depth_bits &= 0x7fffffff;
+  const uint64_t textures = (texture_key ^ (texture_key >> 16)) & 0xffff;
+
+  if (pass == kOpaque) {
+    // [63] 0, [62..48] program, [47..32] textures, [31..16] vertex buffer, [15..0] the top bits of the depth.
+    return (static_cast<uint64_t>(program_id & 0x7fff) << 48) | (textures << 32)
+        | (static_cast<uint64_t>(vb_id & 0xffff) << 16) | (depth_bits >> 15);
+  }
+
+  // [63] 1, [62..32] the depth, flipped so that further things come first, [31..16] program, [15..0] textures.
+  return (1ULL << 63) | (static_cast<uint64_t>(0x7fffffff - depth_bits) << 32)
+      | (static_cast<uint64_t>(program_id & 0xffff) << 16) | textures;
+}
+
+RenderCommand &RenderQueue::add() {
+  return commands_.emplace_back();
+}
+
+void RenderQueue::add_instance(
+    RenderCommand const &cmd, uint32_t texture_key, fw::Matrix const &transform, uint32_t color) {
+  // There's usually only a handful of different meshes on screen, so a linear search is quicker than hashing.
+  InstanceGroup *group = nullptr;
+  for (int i = 0; i < num_instance_groups_; i++) {
+    InstanceGroup &g = instance_groups_[i];
+    if (g.cmd.program == cmd.program && g.cmd.vb == cmd.vb && g.cmd.ib == cmd.ib && g.texture_key == texture_key
+        && g.cmd.base_vertex == cmd.base_vertex && g.cmd.num_indices == cmd.num_indices
+        && g.cmd.primitive_type == cmd.primitive_type) {
+      group = &g;
+      break;
+    }
+  }
+  if (group == nullptr) {
+    if (num_instance_groups_ == static_cast<int>(instance_groups_.size())) {
+      instance_groups_.emplace_back();
+    }
+    group = &instance_groups_[num_instance_groups_++];
+    group->cmd = cmd;
+    group->texture_key = texture_key;
+    group->instances.clear();
+  }
+
+  fw::vertex::instance &instance = group->instances.emplace_back();
+  std::memcpy(instance.transform, transform.m, sizeof(instance.transform));
+  instance.color = color;
+}
+
+void RenderQueue::add_instance_groups() {
+  for (int i = 0; i < num_instance_groups_; i++) {
+    InstanceGroup &group = instance_groups_[i];
+    const int num_instances = static_cast<int>(group.instances.size());
+    int first_instance = 0;
+    auto *data = instance_buffer_ == nullptr
+        ? nullptr : instance_buffer_->allocate<fw::vertex::instance>(num_instances, &first_instance);
+    if (data == nullptr) {
+      if (!warned_instance_buffer_full_) {
+        LOG(WARN) << "no room in the instance buffer for " << num_instances << " instances, skipping them";
+        warned_instance_buffer_full_ = true;
+      }
+      continue;
+    }
+    std::memcpy(data, group.instances.data(), sizeof(fw::vertex::instance) * num_instances);
+
+    RenderCommand &cmd = add();
+    cmd = group.cmd;
+    cmd.instance_vb = instance_buffer_->get_vertex_buffer().get();
+    cmd.first_instance = first_instance;
+    cmd.num_instances = num_instances;
+  }
+  num_instance_groups_ = 0;
+}
+
+void RenderQueue::execute(RenderBackend &backend) {
+  add_instance_groups();
+  if (commands_.empty()) {
+    return;
+  }
+
+  // When two keys are the same the pairs are sorted by index, so they're drawn in the order they were added.
+  order_.clear();
+  for (uint32_t i = 0; i < commands_.size(); i++) {
+    order_.emplace_back(commands_[i].key, i);
+  }
+  std::sort(order_.begin(), order_.end());
+
+  ShaderProgram *program = nullptr;
+  ShaderParameters *parameters = nullptr;
+  Texture *shadow_map = nullptr;
+  VertexBuffer *vb = nullptr;
+  IndexBuffer *ib = nullptr;
+  VertexBuffer *instance_vb = nullptr;
+  bool instancing = false;
+  for (auto const &entry : order_) {
+    RenderCommand const &cmd = commands_[entry.second];
+    if (cmd.program != program) {
+      backend.bind_program(cmd.shader, cmd.program);
+      program = cmd.program;
+      stats_.num_program_binds++;
+
+      // The parameters and shadow map are set on the program, so they have to be set again for the new one.
+      parameters = nullptr;
+      shadow_map = nullptr;
+    }
+    if (cmd.parameters != parameters) {
+      backend.apply_parameters(program, cmd.parameters);
+      parameters = cmd.parameters;
+      stats_.num_parameter_binds++;
+    }
+    if (cmd.shadow_map != shadow_map) {
+      if (cmd.shadow_map != nullptr) {
+        backend.bind_shadow_map(program, cmd.shadow_map);
+      }
+      shadow_map = cmd.shadow_map;
+    }
+    if (cmd.vb != vb) {
+      backend.bind_vertex_buffer(cmd.vb);
+      vb = cmd.vb;
+      stats_.num_buffer_binds++;
+    }
+    if (cmd.ib != nullptr && cmd.ib != ib) {
+      backend.bind_index_buffer(cmd.ib);
+      ib = cmd.ib;
+      stats_.num_buffer_binds++;
+    }
+    if ((cmd.num_instances > 0) != instancing || (instancing && cmd.instance_vb != instance_vb)) {
+      instancing = (cmd.num_instances > 0);
+      instance_vb = instancing ? cmd.instance_vb : nullptr;
+      backend.bind_instance_buffer(instance_vb);
+      stats_.num_buffer_binds++;
+    }
+
+    backend.draw(cmd);
+    stats_.num_draws++;
+    if (cmd.num_instances > 0) {
+      stats_.num_instanced_draws++;
+      stats_.num_instances += cmd.num_instances;
+    }
+  }
+
+  backend.finish();
+  commands_.clear();
+}
+
+void RenderQueue::execute() {
+  static GlRenderBackend backend;
+  execute(backend);
+}
+
+}
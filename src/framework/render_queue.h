@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <framework/graphics.h>
+#include <framework/math.h>
+#include <framework/shader.h>
+
+namespace fw {
+class DynamicRingBuffer;
+class Texture;
+}
+
+namespace fw::sg {
+
+enum PrimitiveType {
+  kUnknownPrimitiveType,
+  kLineStrip,
+  kLineList,
+  kTriangleStrip,
+  kTriangleList
+};
+
+// Everything we need to make one draw call. The pointers are only borrowed: whoever adds a command has to keep the
+// things it points to alive until the queue is executed (which is always in the same frame).
+struct RenderCommand {
+  uint64_t key;
+
+  Shader *shader;
+  ShaderProgram *program;
+  ShaderParameters *parameters;
+  VertexBuffer *vb;
+  IndexBuffer *ib;
+  PrimitiveType primitive_type;
+
+  // If num_indices is >= 0, we only draw that many indices from the index buffer, starting at base_vertex in the
+  // vertex buffer, rather than the whole thing (see Node::set_draw_range).
+  int base_vertex;
+  int num_indices;
+
+  // The shadow map to sample from, if any. Commands in the shadow pass don't have one.
+  Texture *shadow_map;
+  ShaderTransforms transforms;
+
+  // For instanced draws (see RenderQueue::add_instance), the buffer with the per-instance data, and which instances in
+  // it to draw. num_instances is 0 for normal draws.
+  VertexBuffer *instance_vb = nullptr;
+  int first_instance = 0;
+  int num_instances = 0;
+};
+
+// The thing that actually does the drawing for a RenderQueue. The RenderQueue works out which of these calls it can
+// skip, so the backend just does what it's told. The real one draws with GL, there's a RecordingRenderBackend that
+// just remembers what it was told so that we can check the queue without a GPU.
+class RenderBackend {
+public:
+  virtual ~RenderBackend() {
+  }
+
+  // Makes the given program current and sets up it's states.
+  virtual void bind_program(Shader *shader, ShaderProgram *program) = 0;
+
+  // Sets the given parameters on the current program.
+  virtual void apply_parameters(ShaderProgram *program, ShaderParameters *parameters) = 0;
+
+  // Binds the shadow map to the current program.
+  virtual void bind_shadow_map(ShaderProgram *program, Texture *shadow_map) = 0;
+
+  virtual void bind_vertex_buffer(VertexBuffer *vb) = 0;
+  virtual void bind_index_buffer(IndexBuffer *ib) = 0;
+
+  // Binds the per-instance data for instanced draws, or turns it off again if instance_vb is null.
+  virtual void bind_instance_buffer(VertexBuffer *instance_vb) = 0;
+
+  // Sets the command's transforms and draws it. Everything else has already been bound.
+  virtual void draw(RenderCommand const &cmd) = 0;
+
+  // Called after the last draw, to unbind everything.
+  virtual void finish() = 0;
+};
+
+// A RenderBackend that doesn't draw anything, it just keeps a list of what it was asked to do.
+class RecordingRenderBackend : public RenderBackend {
+public:
+  enum CallType {
+    kBindProgram,
+    kApplyParameters,
+    kBindShadowMap,
+    kBindVertexBuffer,
+    kBindIndexBuffer,
+    kBindInstanceBuffer,
+    kDraw,
+    kFinish,
+  };
+
+  struct Call {
+    CallType type;
+
+    // The program, parameters, shadow map or buffer that was bound. For draws, it's the command's parameters.
+    void const *object;
+
+    // For draws, the command's key.
+    uint64_t key;
+  };
+
+private:
+  std::vector<Call> calls_;
+  std::vector<RenderCommand> draws_;
+
+public:
+  void bind_program(Shader *shader, ShaderProgram *program) override {
+    calls_.push_back(Call {kBindProgram, program, 0});
+  }
+  void apply_parameters(ShaderProgram *program, ShaderParameters *parameters) override {
+    calls_.push_back(Call {kApplyParameters, parameters, 0});
+  }
+  void bind_shadow_map(ShaderProgram *program, Texture *shadow_map) override {
+    calls_.push_back(Call {kBindShadowMap, shadow_map, 0});
+  }
+  void bind_vertex_buffer(VertexBuffer *vb) override {
+    calls_.push_back(Call {kBindVertexBuffer, vb, 0});
+  }
+  void bind_index_buffer(IndexBuffer *ib) override {
+    calls_.push_back(Call {kBindIndexBuffer, ib, 0});
+  }
+  void bind_instance_buffer(VertexBuffer *instance_vb) override {
+    calls_.push_back(Call {kBindInstanceBuffer, instance_vb, 0});
+  }
+  void draw(RenderCommand const &cmd) override {
+    calls_.push_back(Call {kDraw, cmd.parameters, cmd.key});
+    draws_.push_back(cmd);
+  }
+  void finish() override {
+    calls_.push_back(Call {kFinish, nullptr, 0});
+  }
+
+  std::vector<Call> const &get_calls() const {
+    return calls_;
+  }
+
+  // A copy of every command we drew, in the order we drew them.
+  std::vector<RenderCommand> const &get_draws() const {
+    return draws_;
+  }
+
+  int count(CallType type) const {
+    int n = 0;
+    for (Call const &call : calls_) {
+      if (call.type == type) {
+        n++;
+      }
+    }
+    return n;
+  }
+
+  void clear() {
+    calls_.clear();
+    draws_.clear();
+  }
+};
+
+// Rather than drawing each node as we walk the scenegraph, nodes add a RenderCommand to the RenderQueue, which sorts
+// them and draws them all in one go. Sorting means that everything drawn with the same program, textures and vertex
+// buffer ends up together, so we can skip binding them again for each draw.
+//
+// The key of each command decides the order. Opaque things are drawn first, sorted by program, then textures, then
+// vertex buffer, then front to back. Then blended things are drawn back to front (so they blend properly), and by
+// program and textures when they're the same distance away. Commands with the same key are drawn in the order they
+// were added.
+//
+// Things that are drawn many times over (like the meshes of every unit of the same type) can be added as instances
+// instead. All the instances of the same mesh, with the same program and textures, are drawn with one instanced
+// command, and each one's transform and color go in the instance buffer.
+class RenderQueue {
+public:
+  enum Pass {
+    kOpaque,
+    kBlended,
+  };
+
+  // The number of things we did in the execute()s since the last reset_stats(). A bind is counted when we actually
+  // bind something, not when we skip it.
+  struct Stats {
+    int num_draws = 0;
+    int num_program_binds = 0;
+    int num_parameter_binds = 0;
+    int num_buffer_binds = 0;
+
+    // The number of draws that were instanced, and the total number of instances they drew.
+    int num_instanced_draws = 0;
+    int num_instances = 0;
+  };
+
+private:
+  // All the instances of one mesh. The command is the first instance's, everything else that's in the command
+  // (including the transforms and the key) is the same for all of them.
+  struct InstanceGroup {
+    RenderCommand cmd;
+    uint32_t texture_key;
+    std::vector<fw::vertex::instance> instances;
+  };
+
+  std::vector<RenderCommand> commands_;
+
+  // The key and index of each command, which is what we actually sort.
+  std::vector<std::pair<uint64_t, uint32_t>> order_;
+  Stats stats_;
+
+  // We keep the groups (and their instance arrays) from frame to frame, so we don't have to allocate them again.
+  // Only the first num_instance_groups_ are in use.
+  std::vector<InstanceGroup> instance_groups_;
+  int num_instance_groups_ = 0;
+  DynamicRingBuffer *instance_buffer_ = nullptr;
+  bool warned_instance_buffer_full_ = false;
+
+  void add_instance_groups();
+
+public:
+  // Makes the key for a command. The IDs don't have to be unique (we compare the actual pointers before skipping any
+  // binds), but the better they are the more binds we can skip. depth is the distance from the camera.
+  static uint64_t make_key(Pass pass, uint32_t program_id, uint32_t texture_key, uint32_t vb_id, float depth);
+
+  // Adds a new command to the queue and returns it so you can fill it in. The reference is only good until the next
+  // call to add().
+  RenderCommand &add();
+
+  // Sets the buffer we write per-instance data into. Until there is one, can_instance() returns false and you have to
+  // add() everything. The buffer is only borrowed, and it's up to the owner to begin and end it's frames.
+  void set_instance_buffer(DynamicRingBuffer *instance_buffer) {
+    instance_buffer_ = instance_buffer;
+  }
+  bool can_instance() const {
+    return instance_buffer_ != nullptr;
+  }
+
+  // Adds one instance of an instanced draw. cmd should be set up for the instanced program, with the transforms for
+  // an instance at the origin, because each instance's own transform is applied in the vertex shader. Instances with
+  // the same program, buffers, draw range and texture_key are drawn together, with the first one's command.
+  void add_instance(RenderCommand const &cmd, uint32_t texture_key, fw::Matrix const &transform, uint32_t color);
+
+  // Sorts the commands, draws them with the given backend (or with GL, if you don't give us one) and then clears the
+  // queue, ready for more.
+  void execute(RenderBackend &backend);
+  void execute();
+
+  int get_num_commands() const {
+    return static_cast<int>(commands_.size());
+  }
+
+  Stats const &get_stats() const {
+    return stats_;
+  }
+  void reset_stats() {
+    stats_ = Stats();
+  }
+};
+
+}
@@ -1,10 +1,14 @@
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <memory>
 
 #include <framework/scenegraph.h>
 #include <framework/graphics.h>
 #include <framework/framework.h>
 #include <framework/camera.h>
+#include <framework/dynamic_ring_buffer.h>
 #include <framework/logging.h>
 #include <framework/misc.h>
 #include <framework/shader.h>
@@ -16,21 +20,13 @@
 static std::shared_ptr<fw::Shader> shadow_shader;
 static std::shared_ptr<fw::Shader> basic_shader;
 
+// The per-instance data for instanced nodes goes in here. Each instance is 68 bytes, and there's three frames worth.
+static const int kMaxInstancesPerFrame = 16384;
+static std::unique_ptr<fw::DynamicRingBuffer> instance_buffer;
+
 static bool is_rendering_shadow = false;
 static std::shared_ptr<fw::ShadowSource> shadowsrc;
 
-static std::map<fw::sg::PrimitiveType, uint32_t> g_primitive_type_map;
-
-static void ensure_primitive_type_map() {
-  if (g_primitive_type_map.size() > 0)
-    return;
-
-  g_primitive_type_map[fw::sg::PrimitiveType::kLineStrip] = GL_LINE_STRIP;
-  g_primitive_type_map[fw::sg::PrimitiveType::kLineList] = GL_LINES;
-  g_primitive_type_map[fw::sg::PrimitiveType::kTriangleList] = GL_TRIANGLES;
-  g_primitive_type_map[fw::sg::PrimitiveType::kTriangleStrip] = GL_TRIANGLE_STRIP;
-}
-
 namespace fw {
 
 namespace sg {
@@ -54,7 +50,7 @@ Light::~Light() {
 //-------------------------------------------------------------------------------------
 Node::Node() :
     world_(fw::identity()), parent_(0), cast_shadows_(true), primitive_type_(PrimitiveType::kUnknownPrimitiveType),
-    enabled_(true) {
+    enabled_(true), base_vertex_(0), num_indices_(-1), instanced_(false), instance_color_(1, 1, 1) {
 }
 
 Node::~Node() {
@@ -88,16 +84,12 @@ void Node::clear_children() {
 // Get the Shader file to use. if we don't have one defined, look at our parent and keep looking up at our parents
 // until we find one.
 std::shared_ptr<fw::Shader> Node::get_shader() const {
-  std::shared_ptr<fw::Shader> shader = shader_;
-  if (!shader) {
-    Node *parent = parent_;
-    while (!shader && parent != 0) {
-      shader = parent->shader_;
-      parent = parent->parent_;
-    }
+  Node const *node = this;
+  while (node != nullptr && !node->shader_) {
+    node = node->parent_;
   }
 
-  return shader;
+  return node == nullptr ? nullptr : node->shader_;
 }
 
 void Node::render(Scenegraph *sg, fw::Matrix const &model_matrix /*= fw::identity()*/) {
@@ -111,19 +103,24 @@ void Node::render(Scenegraph *sg, fw::Matrix const &model_matrix /*= fw::identit
     return;
   }
 
-  fw::Matrix transform(world_ * model_matrix);
-  if (vb_) {
-    std::shared_ptr<fw::Shader> shader = get_shader();
-    if (is_rendering_shadow) {
-      shader = shadow_shader;
-    }
+  fw::Matrix transform(get_render_transform(*sg) * model_matrix);
 
-    fw::CameraRenderState camera = sg->get_camera();
+  // If we know how big we are (including our children), we can skip the whole lot when it's off screen.
+  if (!bounds_.is_empty() && sg->cull(bounds_, transform)) {
+    return;
+  }
+
+  if (vb_) {
+    std::shared_ptr<fw::Shader> shader = is_rendering_shadow ? shadow_shader : get_shader();
     if (!shader) {
-      render_noshader(camera, transform);
-    } else {
-      render_shader(shader, camera, transform);
+      // if we don't have a shader, just use the basic one.
+      if (!basic_shader) {
+        basic_shader = fw::Shader::CreateOrEmpty("basic.shader");
+      }
+      shader = basic_shader;
     }
+
+    render_shader(sg->get_render_queue(), shader.get(), sg->get_camera(), transform);
   }
 
   // render the children as well (todo: pass transformations)
@@ -132,28 +129,64 @@ void Node::render(Scenegraph *sg, fw::Matrix const &model_matrix /*= fw::identit
   }
 }
 
+void Node::set_local_transform(fw::Matrix const &previous, fw::Matrix const &transform, int64_t update) {
+  if (std::memcmp(previous.m, transform.m, sizeof(previous.m)) == 0) {
+    // We didn't move, so there's nothing to interpolate.
+    local_transform_update_ = -1;
+  } else {
+    set_local_transform(previous);
+    previous_local_transform_ = get_local_transform();
+    local_transform_update_ = update;
+  }
+  set_local_transform(transform);
+}
+
+fw::Matrix Node::get_render_transform(Scenegraph const &sg) const {
+  const float alpha = sg.get_interpolation_alpha(local_transform_update_);
+  if (alpha >= 1.0f) {
+    return get_local_transform();
+  }
+  return fw::interpolate(previous_local_transform_, get_local_transform(), alpha);
+}
+
 // this is called when we're rendering a given Shader
 void Node::render_shader(
-    std::shared_ptr<fw::Shader> shader, const fw::CameraRenderState& camera, fw::Matrix const &transform) {
+    RenderQueue &queue, fw::Shader *shader, const fw::CameraRenderState &camera, fw::Matrix const &transform) {
+  // We only need to create the parameters once, the per-draw matrices are set on the command rather than on them.
+  if (!shader_params_) {
+    shader_params_ = shader->CreateParameters();
+  }
+  ShaderProgram *program = shader->GetProgram(shader_params_.get());
+  if (program == nullptr) {
+    return;
+  }
 
-  std::shared_ptr<fw::ShaderParameters> parameters;
-  if (shader_params_) {
-    parameters = shader_params_;
-  } else {
-    parameters = shader->CreateParameters();
+  // Instances have their transform applied in the vertex shader, so the rest of the transforms are for the origin.
+  ShaderProgram *instanced_program =
+      (instanced_ && queue.can_instance()) ? Shader::GetInstancedProgram(program) : nullptr;
+  if (instanced_program != nullptr) {
+    program = instanced_program;
   }
+  fw::Matrix const &world = instanced_program != nullptr ? fw::identity() : transform;
+
+  RenderCommand cmd;
+  cmd.shader = shader;
+  cmd.program = program;
+  cmd.parameters = shader_params_.get();
+  cmd.vb = vb_.get();
+  cmd.ib = ib_.get();
+  cmd.primitive_type = primitive_type_;
+  cmd.base_vertex = base_vertex_;
+  cmd.num_indices = num_indices_;
+  cmd.shadow_map = nullptr;
 
   // add the world_view and world_view_proj parameters as well as shadow parameters
-  fw::Matrix worldview = camera.view;
-  worldview = transform * worldview;
-  fw::Matrix worldviewproj = worldview * camera.projection;
-
-  parameters->set_matrix("worldviewproj", worldviewproj);
-  parameters->set_matrix("worldview", worldview);
-  parameters->set_matrix("proj", camera.projection);
+  cmd.transforms.worldview = world * camera.view;
+  cmd.transforms.worldviewproj = cmd.transforms.worldview * camera.projection;
+  cmd.transforms.proj = camera.projection;
 
   if (!is_rendering_shadow && shadowsrc) {
-    fw::Matrix lightviewproj = transform * shadowsrc->get_camera().get_view_matrix();
+    fw::Matrix lightviewproj = world * shadowsrc->get_camera().get_view_matrix();
     lightviewproj *= shadowsrc->get_camera().get_projection_matrix();
 
     fw::Matrix bias = fw::Matrix(
@@ -163,30 +196,22 @@ void Node::render_shader(
         { 0.0f, 0.0f, 0.5f, 0.0f },
         { 0.5f, 0.5f, 0.5f, 1.0f }});
 
-    parameters->set_matrix("lightviewproj", bias * lightviewproj);
-    parameters->set_texture("shadow_map", shadowsrc->get_shadowmap()->get_depth_buffer());
+    cmd.transforms.lightviewproj = bias * lightviewproj;
+    cmd.shadow_map = shadowsrc->get_shadowmap()->get_depth_buffer().get();
   }
 
-  vb_->begin();
-  shader->Begin(parameters);
-  if (ib_) {
-    ib_->begin();
-    glDrawElements(
-        g_primitive_type_map[primitive_type_], ib_->get_num_indices(), GL_UNSIGNED_SHORT, nullptr);
-    ib_->end();
-  } else {
-    glDrawArrays(g_primitive_type_map[primitive_type_], 0, vb_->get_num_vertices());
-  }
-  shader->End();
-  vb_->end();
-}
+  // The depth is how far our origin is from the camera, which is the translation part of the worldview matrix.
+  fw::Matrix const worldview = transform * camera.view;
+  const float depth = fw::Vector(worldview.m[3][0], worldview.m[3][1], worldview.m[3][2]).length();
+  cmd.key = RenderQueue::make_key(
+      Shader::IsBlended(program) ? RenderQueue::kBlended : RenderQueue::kOpaque, Shader::GetProgramId(program),
+      shader_params_->get_texture_key(), vb_->get_id(), depth);
 
-void Node::render_noshader(const fw::CameraRenderState& camera, fw::Matrix const &transform) {
-  if (!basic_shader) {
-    basic_shader = fw::Shader::CreateOrEmpty("basic.shader");
+  if (instanced_program != nullptr) {
+    queue.add_instance(cmd, shader_params_->get_texture_key(), transform, instance_color_.to_abgr());
+  } else {
+    queue.add() = cmd;
   }
-
-  render_shader(basic_shader, camera, transform);
 }
 
 void Node::populate_clone(std::shared_ptr<Node> clone) {
@@ -194,11 +219,16 @@ void Node::populate_clone(std::shared_ptr<Node> clone) {
   clone->primitive_type_ = primitive_type_;
   clone->vb_ = vb_;
   clone->ib_ = ib_;
+  clone->base_vertex_ = base_vertex_;
+  clone->num_indices_ = num_indices_;
   clone->shader_ = shader_;
   if (shader_params_)
     clone->shader_params_ = shader_params_->Clone();
   clone->parent_ = parent_;
   clone->world_ = world_;
+  clone->instanced_ = instanced_;
+  clone->instance_color_ = instance_color_;
+  clone->bounds_ = bounds_;
 
   // clone the children as well!
   for(auto& child : children_) {
@@ -221,6 +251,39 @@ Scenegraph::Scenegraph()
 Scenegraph::~Scenegraph() {
 }
 
+bool Scenegraph::cull(fw::Bounds const &bounds, fw::Matrix const &transform) {
+  if (frustum_stack_.empty()) {
+    return false;
+  }
+
+  CullStats &stats = is_rendering_shadow ? shadow_cull_stats_ : cull_stats_;
+  if (frustum_stack_.top().is_visible(bounds.transformed(transform))) {
+    stats.num_visible++;
+    return false;
+  }
+  stats.num_culled++;
+  return true;
+}
+
+
+//-----------------------------------------------------------------------------------------
+
+float TransformChannel::get_alpha(fw::Clock::time_point now, fw::Clock::duration update_interval) const {
+  if (num_updates_ == 0) {
+    return 1.0f;
+  }
+
+  // The last update's state is for get_update_time(), and the next one will be for update_interval after that. If the
+  // next one is late, we just wait at the last one.
+  const float alpha = std::chrono::duration<float>(now - last_update_.time) / update_interval;
+  return std::clamp(alpha, 0.0f, 1.0f);
+}
+
+fw::Matrix TransformChannel::interpolate_view(float alpha) const {
+  // We interpolate where the camera is rather than it's view matrix, which is the inverse of that, otherwise it'd
+  // move in a curve while it turns.
+  return fw::interpolate(last_update_.previous.inverse(), last_update_.transform.inverse(), alpha).inverse();
+}
 
 //-----------------------------------------------------------------------------------------
 
@@ -228,11 +291,44 @@ Scenegraph::~Scenegraph() {
 // that you can update, or whatever is needed.
 void ScenegraphManager::enqueue(std::function<void(Scenegraph&)> closure) {
   std::unique_lock<std::mutex> lock(mutex_);
-  closures_[update_index_].push_back(closure);
+  pending_closures_.push_back(closure);
+}
+
+void ScenegraphManager::set_transform(Node *node, fw::Matrix const &previous, fw::Matrix const &transform) {
+  if (transforms_.push(node, previous, transform)) {
+    return;
+  }
+
+  // The render thread must have fallen a long way behind. Let it have what we've got so far, so it can make room.
+  transforms_.flush();
+  if (transforms_.push(node, previous, transform)) {
+    return;
+  }
+
+  // We don't want to wait for it, so this one goes the slow way. It'll still be applied in the right order relative to
+  // any closures, just possibly after later transforms.
+  if (!warned_transforms_full_) {
+    LOG(WARN) << "transform channel is full (" << transforms_.capacity() << " records), falling back to closures";
+    warned_transforms_full_ = true;
+  }
+  enqueue([node, transform](Scenegraph&) {
+    node->set_local_transform(transform);
+  });
+}
+
+void ScenegraphManager::end_update(fw::Clock::time_point time, fw::Matrix const &view) {
+  transforms_.end_update(time, has_last_view_ ? last_view_ : view, view);
+  last_view_ = view;
+  has_last_view_ = true;
+
+  // The closures go after the transforms, so the render thread will see the transforms first (see before_render).
+  std::unique_lock<std::mutex> lock(mutex_);
+  closures_[update_index_].splice(closures_[update_index_].end(), pending_closures_);
 }
 
-// Called on the render thread, before rendering a frame. We'll run all of the enqueued closures.
-void ScenegraphManager::before_render() {
+// Called on the render thread, before rendering a frame. We'll apply all of the transforms, then run all of the
+// enqueued closures.
+void ScenegraphManager::before_render(fw::Clock::time_point now, fw::Clock::duration update_interval) {
   FW_ENSURE_RENDER_THREAD();
 
   int render_index;
@@ -247,11 +343,28 @@ void ScenegraphManager::before_render() {
     }
   }
 
+  // Any transform for a node that one of these closures removes was pushed before the closure was enqueued, so we
+  // have to apply them first, while the closure is still keeping the node alive.
+  transforms_.apply();
+
   auto& closures = closures_[render_index];
   for (auto& closure : closures) {
     closure(scenegraph_);
   }
   closures.clear();
+
+  scenegraph_.set_interpolation(transforms_.get_num_updates(), transforms_.get_alpha(now, update_interval));
+}
+
+fw::CameraRenderState ScenegraphManager::interpolate_camera(fw::CameraRenderState const &camera) const {
+  const int64_t update = transforms_.get_num_updates();
+  if (update == 0) {
+    return camera;
+  }
+
+  fw::CameraRenderState state = camera;
+  state.view = transforms_.interpolate_view(scenegraph_.get_interpolation_alpha(update));
+  return state;
 }
 
 Scenegraph& ScenegraphManager::get_scenegraph() {
@@ -259,6 +372,13 @@ Scenegraph& ScenegraphManager::get_scenegraph() {
   return scenegraph_;
 }
 
+void ScenegraphManager::after_render() {
+  FW_ENSURE_RENDER_THREAD();
+  num_visible_nodes_.store(scenegraph_.get_cull_stats().num_visible, std::memory_order_relaxed);
+  num_culled_nodes_.store(scenegraph_.get_cull_stats().num_culled, std::memory_order_relaxed);
+  num_shadow_casters_.store(scenegraph_.get_shadow_cull_stats().num_visible, std::memory_order_relaxed);
+}
+
 }
 //-----------------------------------------------------------------------------------------
 static const bool g_shadow_debug = true;
@@ -266,7 +386,6 @@ static const bool g_shadow_debug = true;
 // renders the scene!
 void render(sg::Scenegraph &scenegraph, std::shared_ptr<fw::Framebuffer> render_target /*= nullptr*/,
     bool render_gui /*= true*/) {
-  ensure_primitive_type_map();
 
   auto &g = fw::Get<Graphics>();
   Timer* timer = fw::Framework::get_instance()->get_timer();
@@ -274,6 +393,13 @@ void render(sg::Scenegraph &scenegraph, std::shared_ptr<fw::Framebuffer> render_
   if (!shadow_shader) {
     shadow_shader = fw::Shader::CreateOrEmpty("shadow.shader");
   }
+  if (!instance_buffer) {
+    instance_buffer = DynamicRingBuffer::create<vertex::instance>(kMaxInstancesPerFrame);
+  }
+  instance_buffer->begin_frame();
+  scenegraph.get_render_queue().set_instance_buffer(instance_buffer.get());
+  scenegraph.get_render_queue().reset_stats();
+  scenegraph.reset_cull_stats();
 
   // set up the shadow sources that we'll need to render from first to get the various shadows going.
   std::vector<std::shared_ptr<ShadowSource>> shadows;
@@ -290,7 +416,8 @@ void render(sg::Scenegraph &scenegraph, std::shared_ptr<fw::Framebuffer> render_
     }
   }
 
-  // render the shadowmap(s) first
+  // render the shadowmap(s) first. We push the light's camera, so the nodes are culled against the light's frustum
+  // rather than ours: things that are off screen can still cast a shadow onto things that aren't.
   is_rendering_shadow = true;
   for(auto shadowsrc : shadows) {
     shadowsrc->begin_scene();
@@ -299,6 +426,7 @@ void render(sg::Scenegraph &scenegraph, std::shared_ptr<fw::Framebuffer> render_
     for(auto& node : scenegraph.get_nodes()) {
       node->render(&scenegraph);
     }
+    scenegraph.flush();
     g.end_scene();
     scenegraph.pop_camera();
     shadowsrc->end_scene();
@@ -314,8 +442,11 @@ void render(sg::Scenegraph &scenegraph, std::shared_ptr<fw::Framebuffer> render_
   for(auto& node : scenegraph.get_nodes()) {
     node->render(&scenegraph);
   }
+  scenegraph.flush();
 
   scenegraph.call_after_render(timer->get_frame_time());
+  scenegraph.flush();
+  instance_buffer->end_frame();
 
   // make sure the shadowsrc is empty
   std::shared_ptr<ShadowSource> debug_shadowsrc;
@@ -346,26 +477,23 @@ void render(sg::Scenegraph &scenegraph, std::shared_ptr<fw::Framebuffer> render_
         shader_params->set_texture(
             "texsampler", debug_shadowsrc->get_shadowmap()->get_color_buffer());
 
-        std::shared_ptr<VertexBuffer> vb = VertexBuffer::create<vertex::xyz_uv>();
-        fw::vertex::xyz_uv vertices[4];
-        vertices[0] = fw::vertex::xyz_uv(0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
-        vertices[1] = fw::vertex::xyz_uv(0.0f, 1.0f, 0.0f, 0.0f, 1.0f);
-        vertices[2] = fw::vertex::xyz_uv(1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
-        vertices[3] = fw::vertex::xyz_uv(1.0f, 1.0f, 0.0f, 1.0f, 1.0f);
-        vb->set_data(4, vertices);
-
-        auto ib = std::make_shared<fw::IndexBuffer>();
-        uint16_t indices[4];
-        indices[0] = 0;
-        indices[1] = 1;
-        indices[2] = 2;
-        indices[3] = 3;
-        ib->set_data(4, indices);
+        // The quad never changes, so we only need to make it once. It's drawn with the shared quad indices.
+        static std::shared_ptr<VertexBuffer> vb;
+        if (!vb) {
+          vb = VertexBuffer::create<vertex::xyz_uv>();
+          fw::vertex::xyz_uv vertices[4];
+          vertices[0] = fw::vertex::xyz_uv(0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+          vertices[1] = fw::vertex::xyz_uv(0.0f, 1.0f, 0.0f, 0.0f, 1.0f);
+          vertices[2] = fw::vertex::xyz_uv(1.0f, 1.0f, 0.0f, 1.0f, 1.0f);
+          vertices[3] = fw::vertex::xyz_uv(1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+          vb->set_data(4, vertices);
+        }
+        std::shared_ptr<IndexBuffer> ib = DynamicRingBuffer::get_quad_index_buffer();
 
         vb->begin();
         ib->begin();
         (*shader)->Begin(shader_params);
-        glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT, nullptr);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, nullptr);
         (*shader)->End();
         ib->end();
         vb->end();
@@ -1,29 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <list>
 #include <memory>
 #include <stack>
 
+#include <framework/bounds.h>
 #include <framework/camera.h>
 #include <framework/color.h>
 #include <framework/graphics.h>
 #include <framework/math.h>
+#include <framework/render_queue.h>
 #include <framework/shader.h>
 #include <framework/shadows.h>
+#include <framework/spsc_queue.h>
 #include <framework/texture.h>
+#include <framework/timer.h>
 
 namespace fw::sg {
 
 class Scenegraph;
 
-enum PrimitiveType {
-  kUnknownPrimitiveType,
-  kLineStrip,
-  kLineList,
-  kTriangleStrip,
-  kTriangleList
-};
-
 // represents the properties of a Light that we'll need to add to the
 // scene (we'll need at least one Light-source of course!
 class Light {
@@ -61,7 +60,8 @@ public:
 };
 
 // This is the base scene graph Node contains all the information needed to render a single object in the scene. In
-// general, this will translate to a single OpenGL draw call.
+// general, this will translate to a single OpenGL draw call: rendering a node adds a RenderCommand to the scenegraph's
+// RenderQueue, and the draw happens when the queue is flushed.
 class Node {
 private:
   bool cast_shadows_;
@@ -70,20 +70,36 @@ private:
   PrimitiveType primitive_type_;
   std::shared_ptr<fw::VertexBuffer> vb_;
   std::shared_ptr<fw::IndexBuffer> ib_;
+
+  // If num_indices_ is >= 0, we only draw that many indices from the index buffer, starting at base_vertex_ in the
+  // vertex buffer, rather than the whole thing.
+  int base_vertex_;
+  int num_indices_;
   std::shared_ptr<fw::Shader> shader_;
   std::shared_ptr<fw::ShaderParameters> shader_params_;
 
-  // Renders the Node if the Shader file is null (basically just uses the basic Shader).
-  void render_noshader(const fw::CameraRenderState& camera, fw::Matrix const &transform);
+  // If we're instanced, and our shader has an instanced program, we're drawn along with all the other nodes that have
+  // the same buffers and shader, in one instanced draw call. instance_color_ is passed to the shader per-instance.
+  bool instanced_;
+  fw::Color instance_color_;
+
+  // The bounds of our vertices and all of our children's, in the same space as our vertices. If they're empty, we
+  // don't know how big we are and we're never culled.
+  fw::Bounds bounds_;
+
+  // Our local transform from before the last time the TransformChannel moved us, and which update that was, so that we
+  // can interpolate between them. See get_render_transform.
+  fw::Matrix previous_local_transform_;
+  int64_t local_transform_update_ = -1;
 
 protected:
   Node *parent_;
   std::vector<std::shared_ptr<Node> > children_;
   fw::Matrix world_;
 
-  // this is called when we're rendering a given Shader
-  virtual void render_shader(
-    std::shared_ptr<fw::Shader> shader, const fw::CameraRenderState& camera, fw::Matrix const &transform);
+  // this is called when we're rendering a given Shader, it adds the command to draw us to the queue.
+  virtual void render_shader(RenderQueue &queue, fw::Shader *shader, const fw::CameraRenderState &camera,
+      fw::Matrix const &transform);
 
   // called by clone() to populate the clone
   virtual void populate_clone(std::shared_ptr<Node> clone);
@@ -119,6 +135,32 @@ public:
     return world_;
   }
 
+  // The transform from our space to our parent's.
+  virtual fw::Matrix get_local_transform() const {
+    return world_;
+  }
+
+  // Moves the node to the given transform. For most nodes that's just the world matrix, but subclasses with a
+  // transform of their own (like ModelNode) replace that instead.
+  virtual void set_local_transform(fw::Matrix const &transform) {
+    world_ = transform;
+  }
+
+  // Moves the node from previous to transform in the given update. Until the scenegraph moves on to another update,
+  // we're drawn somewhere between the two.
+  void set_local_transform(fw::Matrix const &previous, fw::Matrix const &transform, int64_t update);
+
+  // The local transform we should be drawn with. That's get_local_transform(), unless we were moved in the
+  // scenegraph's current update, in which case we're part way there (see Scenegraph::set_interpolation).
+  fw::Matrix get_render_transform(Scenegraph const &sg) const;
+
+  void set_bounds(fw::Bounds const &bounds) {
+    bounds_ = bounds;
+  }
+  fw::Bounds const &get_bounds() const {
+    return bounds_;
+  }
+
   void set_vertex_buffer(std::shared_ptr<fw::VertexBuffer> vb) {
     vb_ = vb;
   }
@@ -133,6 +175,13 @@ public:
     return ib_;
   }
 
+  // Draw only the first num_indices indices of the index buffer, offset by base_vertex. This is for drawing part of a
+  // shared buffer, like a DynamicRingBuffer with the quad index buffer.
+  void set_draw_range(int base_vertex, int num_indices) {
+    base_vertex_ = base_vertex;
+    num_indices_ = num_indices;
+  }
+
   void set_shader(std::shared_ptr<fw::Shader> Shader) {
     shader_ = Shader;
   }
@@ -145,6 +194,18 @@ public:
     return shader_params_;
   }
 
+  // Instanced nodes must not have anything in their shader parameters that's different from other nodes with the same
+  // buffers and shader, except for the textures: only the first node's parameters are used to draw all of them.
+  void set_instanced(bool instanced) {
+    instanced_ = instanced;
+  }
+  bool is_instanced() const {
+    return instanced_;
+  }
+  void set_instance_color(fw::Color const &color) {
+    instance_color_ = color;
+  }
+
   void set_cast_shadows(bool cast_shadows) {
     cast_shadows_ = cast_shadows;
   }
@@ -177,15 +238,34 @@ public:
 // (that is, it persists from frame-to-frame). You can add nodes to it, and then post closures to the scenegraph to
 // update the nodes on the render thread.
 class Scenegraph {
+public:
+  // How many nodes we tested against the frustum (i.e. nodes that have bounds), and how many of them were off screen.
+  // A culled node's children aren't tested, so they aren't counted.
+  struct CullStats {
+    int num_visible = 0;
+    int num_culled = 0;
+  };
+
 private:
   std::vector<std::shared_ptr<Light>> lights_;
   std::vector<std::shared_ptr<Node>> root_nodes_;
   fw::Color clear_color_;
   std::stack<CameraRenderState> camera_stack_;
 
+  // The frustum of each camera in the camera stack.
+  std::stack<Frustum> frustum_stack_;
+  CullStats cull_stats_;
+  CullStats shadow_cull_stats_;
+
+  // The last update we've seen, and how far we are between it and the next one. See set_interpolation.
+  int64_t update_ = -1;
+  float update_alpha_ = 1.0f;
+
   // A list of callbacks that are called after we finish rendering nodes, but before the GUI renders.
   std::vector<ScenegraphCallback*> callbacks_;
 
+  RenderQueue render_queue_;
+
 public:
   Scenegraph();
   ~Scenegraph();
@@ -233,9 +313,11 @@ public:
 
   void push_camera(const fw::CameraRenderState& camera) {
     camera_stack_.push(camera);
+    frustum_stack_.push(Frustum(camera));
   }
   void pop_camera() {
     camera_stack_.pop();
+    frustum_stack_.pop();
   }
   fw::CameraRenderState get_camera() const {
     if (camera_stack_.empty()) {
@@ -243,6 +325,209 @@ public:
     }
     return camera_stack_.top();
   }
+
+  // Returns true if the given bounds, transformed by transform, are outside the current camera's frustum (which means
+  // that whatever they belong to doesn't need to be drawn). Without a camera, nothing is culled.
+  bool cull(fw::Bounds const &bounds, fw::Matrix const &transform);
+
+  // The stats for the main pass and the shadow pass (which is culled against the lights' frustums) since the last
+  // reset_cull_stats(). fw::render resets them at the start of each frame.
+  CullStats const &get_cull_stats() const {
+    return cull_stats_;
+  }
+  CullStats const &get_shadow_cull_stats() const {
+    return shadow_cull_stats_;
+  }
+  void reset_cull_stats() {
+    cull_stats_ = CullStats();
+    shadow_cull_stats_ = CullStats();
+  }
+
+  // Sets the last update we've seen, and how far we are (from 0 to 1) between the one before it and it. Nodes that
+  // were moved in that update are drawn that far between where they were and where they were moved to. Anything that
+  // was moved in an earlier update has already got where it was going.
+  void set_interpolation(int64_t update, float alpha) {
+    update_ = update;
+    update_alpha_ = alpha;
+  }
+
+  // The alpha to interpolate something that was moved in the given update with. If we haven't seen the end of that
+  // update yet, it hasn't started moving.
+  float get_interpolation_alpha(int64_t update) const {
+    if (update > update_) {
+      return 0.0f;
+    }
+    return update == update_ ? update_alpha_ : 1.0f;
+  }
+
+  // The queue that nodes add their draw commands to when they're rendered.
+  RenderQueue &get_render_queue() {
+    return render_queue_;
+  }
+
+  // Draws everything in the render queue. fw::render does this after rendering the nodes and again after the
+  // callbacks, but if a callback needs it's nodes drawn before it returns (e.g. to fence a buffer) it can call this.
+  void flush() {
+    render_queue_.execute();
+  }
+};
+
+// Carries node transforms from the update thread to the render thread. Most of what the update thread tells the
+// scenegraph every frame is just where things have moved to, so rather than a closure for each one (which means an
+// allocation, and a lock to enqueue it) they go through a lock-free ring of (node, transform) records, which the
+// render thread applies all at once before each frame.
+//
+// The update thread runs at a fixed rate that's usually slower than we render, so each record has where the node was
+// before the update as well as where it is after it, and each update ends with a record that has the time it was for
+// and the camera's view before and after it. The render thread can then draw everything part way between the last two
+// updates (see Scenegraph::set_interpolation), rather than jumping once per update. None of an update's records are
+// visible to the render thread until it's finished, so we never draw half of one update and half of the next.
+//
+// Nodes are referenced by raw pointer, so a node has to stay alive until the render thread has applied it's
+// transforms. ScenegraphManager applies the transforms before it runs the closures, so the usual pattern of removing
+// the node with a closure after it's last transform is fine.
+class TransformChannel {
+public:
+  struct Record {
+    // The node to move, or null for the record that marks the end of an update, in which case the transforms are the
+    // camera's view matrix.
+    Node *node = nullptr;
+    fw::Matrix previous;
+    fw::Matrix transform;
+
+    // For the end of an update, the time that the update was for and it's number (see get_next_update).
+    fw::Clock::time_point time;
+    int64_t update = 0;
+  };
+
+  // Enough for every unit in a big game to move for a few updates, even if the render thread falls behind.
+  static constexpr int kDefaultCapacity = 16384;
+
+private:
+  SpscQueue<Record> records_;
+
+  // Only used by the update thread: the number of updates that have ended.
+  int64_t updates_ended_ = 0;
+
+  // These are only used by the render thread: the number of updates we've applied, and the end of the last one.
+  int64_t num_updates_ = 0;
+  Record last_update_;
+
+public:
+  explicit TransformChannel(int capacity = kDefaultCapacity) : records_(capacity) {
+    last_update_.previous = last_update_.transform = fw::identity();
+  }
+
+  // Called on the update thread. Moves the node from previous to transform in this update. Returns false (and doesn't
+  // add it) if the channel is full.
+  bool push(Node *node, fw::Matrix const &previous, fw::Matrix const &transform) {
+    Record record;
+    record.node = node;
+    record.previous = previous;
+    record.transform = transform;
+    return records_.write(record);
+  }
+  bool push(Node *node, fw::Matrix const &transform) {
+    return push(node, transform, transform);
+  }
+
+  // Called on the update thread. Makes everything pushed since the last end_update() visible to the render thread.
+  // time is the time the update was for, and the views are the camera's view matrix before and after it. Returns false
+  // if there wasn't room to mark the end of the update, in which case the render thread will treat this update and the
+  // next one as one update.
+  bool end_update(fw::Clock::time_point time, fw::Matrix const &previous_view, fw::Matrix const &view) {
+    Record record {nullptr, previous_view, view, time, ++updates_ended_};
+    const bool ended = records_.write(record);
+    records_.publish();
+    return ended;
+  }
+
+  // Called on the update thread. The number of the update we're in the middle of, which is what get_num_updates() on
+  // the render thread will be once it has seen the end of it. Updates are numbered from 1.
+  int64_t get_next_update() const {
+    return updates_ended_ + 1;
+  }
+
+  // Called on the update thread. Makes everything pushed so far visible to the render thread, even though the update
+  // hasn't finished yet. Used when the channel is full, so the render thread can make room.
+  void flush() {
+    records_.publish();
+  }
+
+  // Called on the render thread. Sets the transforms of every node in the channel, in the order they were pushed, and
+  // returns the number of nodes moved.
+  int apply() {
+    int num_moved = 0;
+    records_.drain([this, &num_moved](Record const &record) {
+      if (record.node == nullptr) {
+        // If there wasn't room for the end of an update, we skip straight past it.
+        num_updates_ = record.update;
+        last_update_ = record;
+      } else {
+        // This record is part of the update after the last one we've seen the end of.
+        record.node->set_local_transform(record.previous, record.transform, num_updates_ + 1);
+        num_moved++;
+      }
+    });
+    return num_moved;
+  }
+
+  // Called on the render thread. The number of updates we've applied, the time the last one was for, and the camera's
+  // view before and after it.
+  int64_t get_num_updates() const {
+    return num_updates_;
+  }
+  fw::Clock::time_point get_update_time() const {
+    return last_update_.time;
+  }
+  fw::Matrix const &get_previous_view() const {
+    return last_update_.previous;
+  }
+  fw::Matrix const &get_view() const {
+    return last_update_.transform;
+  }
+
+  // Called on the render thread. How far (from 0 to 1) the given time is from the last update we've applied to the
+  // next one. If we haven't had an update yet, or the next one is late, it's 1.
+  float get_alpha(fw::Clock::time_point now, fw::Clock::duration update_interval) const;
+
+  // Called on the render thread. The camera's view matrix, alpha of the way between the last two updates.
+  fw::Matrix interpolate_view(float alpha) const;
+
+  int capacity() const {
+    return static_cast<int>(records_.capacity());
+  }
+};
+
+// For things that the simulation moves once a turn, which is usually a few updates long. If we just pushed where the
+// simulation has them through the TransformChannel, they'd move for the first update of each turn and then stand still
+// for the rest of it. Instead, call set_target() each time the simulation moves it, and each update push get(alpha),
+// where alpha is how far (from 0 to 1) the update is through the turn. It's drawn a turn behind the simulation, moving
+// from where it was at the end of the last turn to where it is at the end of this one.
+class TurnInterpolator {
+private:
+  fw::Matrix from_;
+  fw::Matrix to_;
+  bool has_target_ = false;
+
+public:
+  void set_target(fw::Matrix const &transform) {
+    from_ = has_target_ ? to_ : transform;
+    to_ = transform;
+    has_target_ = true;
+  }
+
+  bool has_target() const {
+    return has_target_;
+  }
+
+  // Things that aren't moving give back exactly the same matrix, so the node knows not to interpolate them.
+  fw::Matrix get(float alpha) const {
+    if (alpha >= 1.0f || std::memcmp(from_.m, to_.m, sizeof(from_.m)) == 0) {
+      return to_;
+    }
+    return fw::interpolate(from_, to_, std::max(alpha, 0.0f));
+  }
 };
 
 // The ScenegraphManager manages access to the scenegraph. Because manipulation of the scenegraph can only occur on the
@@ -257,17 +542,75 @@ private:
   // the index of the list we are accessing from the update thread.
   std::list<std::function<void(Scenegraph&)>> closures_[2];
   int update_index_ = 0;
+
+  // Closures that were enqueued during the current update. They're moved to closures_ at the end of the update, so
+  // that they're run after all of the update's transforms have been applied.
+  std::list<std::function<void(Scenegraph&)>> pending_closures_;
+
+  // Node transforms, which are applied before the closures. See set_transform.
+  TransformChannel transforms_;
+  bool warned_transforms_full_ = false;
+
+  // The camera's view at the end of the last update. Only used on the update thread.
+  fw::Matrix last_view_;
+  bool has_last_view_ = false;
+
+  // The cull stats from the last frame, so that the update thread can show them.
+  std::atomic<int> num_visible_nodes_ = 0;
+  std::atomic<int> num_culled_nodes_ = 0;
+  std::atomic<int> num_shadow_casters_ = 0;
 public:
 
-  // Called on the update thread. Enqueues the given closure to run on the render thread. We'll pass it the scenegraph
-  // that you can update, or whatever is needed.
+  // Called on the update thread. Enqueues the given closure to run on the render thread, once the current update has
+  // finished. We'll pass it the scenegraph that you can update, or whatever is needed.
   void enqueue(std::function<void(Scenegraph&)> closure);
 
-  // Called on the render thread, before rendering a frame. We'll run all of the enqueued closures.
-  void before_render();
+  // Called on the update thread. Moves the node (see Node::set_local_transform) from previous to transform in this
+  // update, so it's drawn moving smoothly between them until the next update. If you don't pass previous, it just
+  // jumps there. Use this rather than enqueue() for things that move every update: it doesn't allocate or lock. The
+  // node has to stay alive until the render thread has applied it, see TransformChannel.
+  void set_transform(Node *node, fw::Matrix const &previous, fw::Matrix const &transform);
+  void set_transform(Node *node, fw::Matrix const &transform) {
+    set_transform(node, transform, transform);
+  }
+
+  // Called on the update thread at the end of each update. time is the time the update was for, and view is the
+  // camera's view matrix after it. Hands the update's transforms and closures over to the render thread.
+  void end_update(fw::Clock::time_point time, fw::Matrix const &view);
+
+  // Called on the update thread. The number of the update we're in the middle of. Things that interpolate between
+  // updates on their own (like particles) can pass this to Scenegraph::get_interpolation_alpha on the render thread,
+  // to move in step with the nodes.
+  int64_t get_next_update() const {
+    return transforms_.get_next_update();
+  }
+
+  // Called on the render thread, before rendering a frame. We'll apply all of the transforms, then run all of the
+  // enqueued closures. now is the time of the frame and update_interval the time between updates, which we use to
+  // work out how far between the last two updates the frame is.
+  void before_render(fw::Clock::time_point now, fw::Clock::duration update_interval);
+
+  // Called on the render thread. Returns the camera state with it's view part way between the last two updates, the
+  // same as the nodes (see TransformChannel). Until we've had an update, returns the camera unchanged.
+  fw::CameraRenderState interpolate_camera(fw::CameraRenderState const &camera) const;
 
   // Called on the render thread, returns the scenegraph.
   Scenegraph& get_scenegraph();
+
+  // Called on the render thread, after rendering a frame, to save the frame's cull stats.
+  void after_render();
+
+  // These can be called on any thread, they're the cull stats from the last frame: the number of nodes that were
+  // visible and culled in the main pass and the number that were drawn into the shadow map(s).
+  int get_num_visible_nodes() const {
+    return num_visible_nodes_.load(std::memory_order_relaxed);
+  }
+  int get_num_culled_nodes() const {
+    return num_culled_nodes_.load(std::memory_order_relaxed);
+  }
+  int get_num_shadow_casters() const {
+    return num_shadow_casters_.load(std::memory_order_relaxed);
+  }
 };
 
 }  // namespace fw::sg
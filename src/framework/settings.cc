@@ -250,6 +250,11 @@ fw::Status Settings::initialize(
       .add_setting<bool>(
           "help", "If specified, we'll print out this help message and exit.", false)
       .add_setting<std::string>("data-path", "Path to load data files from.", "")
+      .add_setting<int>(
+          "job-threads",
+          "The number of threads used to run parallel jobs on the update thread's behalf. -1 means one less than "
+          "the number of CPU cores, 0 means everything runs on the update thread.",
+          -1)
       .add_setting<std::string>(
           "lang",
           "Name of the language we'll use for display and UI, etc.", "en");
@@ -162,12 +162,26 @@ namespace fw {
 class ShaderProgram {
 private:
   friend class fw::ShaderParameters;
+  friend class fw::Shader;
 
   std::string name_;
   std::map<std::string, std::string> states_;
   GLuint program_id_;
   std::map<std::string, fw::ShaderVariable> shader_variables_;
 
+  // The locations of the uniforms that Shader::SetTransforms and SetShadowMap set, -1 if the program doesn't use them.
+  GLint worldviewproj_location_ = -1;
+  GLint worldview_location_ = -1;
+  GLint proj_location_ = -1;
+  GLint lightviewproj_location_ = -1;
+  GLint shadow_map_location_ = -1;
+
+  int id_;
+  bool blended_ = false;
+
+  // The program in the same file called "<our name>-instanced", if there is one.
+  ShaderProgram *instanced_ = nullptr;
+
   /**
    * Called during begin to set the given GL state to the given value.
    *
@@ -177,14 +191,21 @@ private:
   void ApplyState(std::string_view name, std::string_view value);
 
 public:
-  ShaderProgram() = default;
+  ShaderProgram();
   ~ShaderProgram() = default;
 
   fw::Status Initialize(fw::XmlElement const &program_elem);
 
   void Begin();
+
+  GLint get_uniform_location(std::string const &name) const;
 };
 
+ShaderProgram::ShaderProgram() {
+  static int next_id = 0;
+  id_ = next_id++;
+}
+
 fw::Status ShaderProgram::Initialize(fw::XmlElement const &program_elem) {
   GLint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
   GLint fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
@@ -222,9 +243,26 @@ fw::Status ShaderProgram::Initialize(fw::XmlElement const &program_elem) {
     shader_variables_[name] = fw::ShaderVariable(location, name, size, type);
   }
 
+  worldviewproj_location_ = get_uniform_location("worldviewproj");
+  worldview_location_ = get_uniform_location("worldview");
+  proj_location_ = get_uniform_location("proj");
+  lightviewproj_location_ = get_uniform_location("lightviewproj");
+  shadow_map_location_ = get_uniform_location("shadow_map");
+
+  auto blend = states_.find("blend");
+  blended_ = (blend != states_.end() && blend->second != "off");
+
   return fw::OkStatus();
 }
 
+GLint ShaderProgram::get_uniform_location(std::string const &name) const {
+  auto it = shader_variables_.find(name);
+  if (it == shader_variables_.end()) {
+    return -1;
+  }
+  return it->second.location;
+}
+
 void ShaderProgram::Begin() {
   glUseProgram(program_id_);
 
@@ -277,7 +315,7 @@ void ShaderProgram::ApplyState(std::string_view name, std::string_view value) {
 }
 
 //-------------------------------------------------------------------------
-ShaderParameters::ShaderParameters() {
+ShaderParameters::ShaderParameters() : texture_key_(0) {
 }
 
 ShaderParameters::~ShaderParameters() {
@@ -289,10 +327,21 @@ void ShaderParameters::set_program_name(std::string_view name) {
 
 void ShaderParameters::set_texture(std::string_view name, std::shared_ptr<Texture> const &tex) {
   textures_[std::string(name)] = tex;
+  update_texture_key();
 }
 
 void ShaderParameters::set_texture(std::string_view name, std::shared_ptr<TextureArray> const& tex) {
   textures_[std::string(name)] = tex;
+  update_texture_key();
+}
+
+void ShaderParameters::update_texture_key() {
+  uint32_t hash = 2166136261u;
+  for (auto const &it : textures_) {
+    const uintptr_t ptr = reinterpret_cast<uintptr_t>(it.second.get());
+    hash = (hash ^ static_cast<uint32_t>(ptr >> 4)) * 16777619u;
+  }
+  texture_key_ = hash;
 }
 
 void ShaderParameters::set_matrix(std::string_view name, Matrix const &m) {
@@ -314,6 +363,7 @@ void ShaderParameters::set_scalar(std::string_view name, float f) {
 std::shared_ptr<ShaderParameters> ShaderParameters::Clone() {
   auto clone = std::make_shared<ShaderParameters>();
   clone->textures_ = textures_;
+  clone->texture_key_ = texture_key_;
   clone->matrices_ = matrices_;
   clone->vectors_ = vectors_;
   clone->colors_ = colors_;
@@ -429,6 +479,71 @@ void Shader::End() {
   glUseProgram(0);
 }
 
+ShaderProgram *Shader::GetProgram(ShaderParameters const *parameters) {
+  if (parameters != nullptr && parameters->program_name_ != "") {
+    auto it = programs_.find(parameters->program_name_);
+    if (it != programs_.end()) {
+      return it->second.get();
+    }
+  }
+  return default_program_;
+}
+
+/*static*/
+void Shader::BeginProgram(ShaderProgram *program) {
+  program->Begin();
+}
+
+/*static*/
+void Shader::ApplyParameters(ShaderProgram *program, ShaderParameters const &parameters) {
+  parameters.Apply(*program);
+}
+
+/*static*/
+void Shader::SetShadowMap(ShaderProgram *program, Texture *shadow_map) {
+  // ShaderParameters::Apply uses (and clears) the texture units below this one.
+  constexpr int kShadowMapTextureUnit = 9;
+  if (program->shadow_map_location_ < 0 || shadow_map == nullptr) {
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + kShadowMapTextureUnit);
+  shadow_map->ensure_created();
+  shadow_map->bind();
+  glUniform1i(program->shadow_map_location_, kShadowMapTextureUnit);
+}
+
+/*static*/
+void Shader::SetTransforms(ShaderProgram *program, ShaderTransforms const &transforms, bool has_shadow_map) {
+  if (program->worldviewproj_location_ >= 0) {
+    glUniformMatrix4fv(program->worldviewproj_location_, 1, GL_FALSE, transforms.worldviewproj.m[0]);
+  }
+  if (program->worldview_location_ >= 0) {
+    glUniformMatrix4fv(program->worldview_location_, 1, GL_FALSE, transforms.worldview.m[0]);
+  }
+  if (program->proj_location_ >= 0) {
+    glUniformMatrix4fv(program->proj_location_, 1, GL_FALSE, transforms.proj.m[0]);
+  }
+  if (has_shadow_map && program->lightviewproj_location_ >= 0) {
+    glUniformMatrix4fv(program->lightviewproj_location_, 1, GL_FALSE, transforms.lightviewproj.m[0]);
+  }
+}
+
+/*static*/
+int Shader::GetProgramId(ShaderProgram const *program) {
+  return program->id_;
+}
+
+/*static*/
+bool Shader::IsBlended(ShaderProgram const *program) {
+  return program->blended_;
+}
+
+/*static*/
+ShaderProgram *Shader::GetInstancedProgram(ShaderProgram const *program) {
+  return program->instanced_;
+}
+
 std::shared_ptr<ShaderParameters> Shader::CreateParameters() {
   return std::make_shared<ShaderParameters>();
 }
@@ -446,9 +561,17 @@ fw::Status Shader::Load(fs::path const &full_path) {
     ASSIGN_OR_RETURN(std::string program_name, child.GetAttribute("name"));
     if (default_program_name_ == "") {
       default_program_name_ = program_name;
+      default_program_ = program.get();
     }
     programs_[program_name] = program;
   }
+
+  for (auto &it : programs_) {
+    auto instanced = programs_.find(it.first + "-instanced");
+    if (instanced != programs_.end()) {
+      it.second->instanced_ = instanced->second.get();
+    }
+  }
   return fw::OkStatus();
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <string>
 #include <map>
@@ -29,10 +30,16 @@ public:
   void set_scalar(std::string_view name, float f);
 
   std::shared_ptr<ShaderParameters> Clone();
+
+  // A hash of the textures we've got, so that things drawn with the same textures can be sorted next to each other.
+  uint32_t get_texture_key() const {
+    return texture_key_;
+  }
 private:
   friend class Shader;
 
   std::string program_name_;
+  uint32_t texture_key_;
   std::map<std::string, std::shared_ptr<fw::TextureBase>> textures_;
   std::map<std::string, Matrix> matrices_;
   std::map<std::string, Vector> vectors_;
@@ -40,7 +47,16 @@ private:
   std::map<std::string, float> scalars_;
 
   void Apply(ShaderProgram &prog) const;
+  void update_texture_key();
+};
 
+// The matrices that change with every draw call. Rather than going through ShaderParameters, these are set straight on
+// the program's uniforms (worldviewproj, worldview, proj and, if there's a shadow map, lightviewproj).
+struct ShaderTransforms {
+  Matrix worldviewproj;
+  Matrix worldview;
+  Matrix proj;
+  Matrix lightviewproj;
 };
 
 /** Contains information about a Shader variable in a complied Shader program. */
@@ -73,10 +89,36 @@ public:
 
   void Begin(std::shared_ptr<ShaderParameters> parameters);
   void End();
+
+  // Gets the program that Begin would use with the given parameters, or nullptr if we don't have any programs (e.g. if
+  // we failed to load).
+  ShaderProgram *GetProgram(ShaderParameters const *parameters);
+
+  // These are the pieces of Begin, for the RenderQueue, which skips the ones that haven't changed since the last draw.
+  // BeginProgram makes the program current and sets up it's states, ApplyParameters sets the given parameters on it,
+  // SetShadowMap binds the shadow map to it's own texture unit (that ApplyParameters doesn't touch) and SetTransforms
+  // sets the per-draw matrices.
+  static void BeginProgram(ShaderProgram *program);
+  static void ApplyParameters(ShaderProgram *program, ShaderParameters const &parameters);
+  static void SetShadowMap(ShaderProgram *program, Texture *shadow_map);
+  static void SetTransforms(ShaderProgram *program, ShaderTransforms const &transforms, bool has_shadow_map);
+
+  // A small number that's unique to each program, for sorting.
+  static int GetProgramId(ShaderProgram const *program);
+
+  // Returns true if the program blends (rather than just overwriting what's already been drawn), which means it has to
+  // be drawn after the opaque things, back to front.
+  static bool IsBlended(ShaderProgram const *program);
+
+  // Gets the version of the program that draws instances (see RenderQueue::add_instance), or nullptr if it doesn't
+  // have one. It's the program with the same name plus "-instanced". Instead of the world part of the worldviewproj
+  // and worldview matrices, it uses the per-instance transform and color in vertex attributes 3 to 7.
+  static ShaderProgram *GetInstancedProgram(ShaderProgram const *program);
 private:
   std::filesystem::path filename_;
   std::map<std::string, std::shared_ptr<ShaderProgram>> programs_;
   std::string default_program_name_;
+  ShaderProgram *default_program_ = nullptr;
 
   fw::Status Load(std::filesystem::path const &full_path);
 };
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FW_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FW_SIMD_SSE2
+#endif
+
+namespace fw {
+
+// Each of these structs wraps up the handful of operations our kernels need for one instruction set, so that we can
+// write a kernel once (see the particle update in ParticleStore) and compile it for each of them. Float holds kWidth
+// floats, Index holds kWidth indices into a table. SimdOps is the widest one we were compiled for.
+//
+// load and store need their pointers aligned to kWidth floats.
+struct ScalarOps {
+  typedef float Float;
+  typedef int Index;
+  static const int kWidth = 1;
+
+  static Float load(float const *p) {
+    return *p;
+  }
+  static void store(float *p, Float value) {
+    *p = value;
+  }
+  static Float set(float value) {
+    return value;
+  }
+  static Float add(Float a, Float b) {
+    return a + b;
+  }
+  static Float sub(Float a, Float b) {
+    return a - b;
+  }
+  static Float mul(Float a, Float b) {
+    return a * b;
+  }
+  static Float div(Float a, Float b) {
+    return a / b;
+  }
+  // min and max return b if either is NaN, the same as the SSE instructions do.
+  static Float min(Float a, Float b) {
+    return a < b ? a : b;
+  }
+  static Float max(Float a, Float b) {
+    return a > b ? a : b;
+  }
+  static Float sqrt(Float a) {
+    return std::sqrt(a);
+  }
+  static Index to_index(Float a) {
+    return static_cast<int>(a);
+  }
+  static Float to_float(Index index) {
+    return static_cast<float>(index);
+  }
+  static Float gather(float const *table, Index index) {
+    return table[index];
+  }
+};
+
+#if defined(FW_SIMD_SSE2)
+struct Sse2Ops {
+  typedef __m128 Float;
+  struct Index {
+    alignas(16) int32_t values[4];
+  };
+  static const int kWidth = 4;
+
+  static Float load(float const *p) {
+    return _mm_load_ps(p);
+  }
+  static void store(float *p, Float value) {
+    _mm_store_ps(p, value);
+  }
+  static Float set(float value) {
+    return _mm_set1_ps(value);
+  }
+  static Float add(Float a, Float b) {
+    return _mm_add_ps(a, b);
+  }
+  static Float sub(Float a, Float b) {
+    return _mm_sub_ps(a, b);
+  }
+  static Float mul(Float a, Float b) {
+    return _mm_mul_ps(a, b);
+  }
+  static Float div(Float a, Float b) {
+    return _mm_div_ps(a, b);
+  }
+  static Float min(Float a, Float b) {
+    return _mm_min_ps(a, b);
+  }
+  static Float max(Float a, Float b) {
+    return _mm_max_ps(a, b);
+  }
+  static Float sqrt(Float a) {
+    return _mm_sqrt_ps(a);
+  }
+  static Index to_index(Float a) {
+    Index index;
+    _mm_store_si128(reinterpret_cast<__m128i *>(index.values), _mm_cvttps_epi32(a));
+    return index;
+  }
+  static Float to_float(Index const &index) {
+    return _mm_cvtepi32_ps(_mm_load_si128(reinterpret_cast<__m128i const *>(index.values)));
+  }
+  // SSE2 doesn't have a gather instruction, but the tables are small enough to be in L1, so this is pretty quick.
+  static Float gather(float const *table, Index const &index) {
+    return _mm_setr_ps(
+        table[index.values[0]], table[index.values[1]], table[index.values[2]], table[index.values[3]]);
+  }
+};
+typedef Sse2Ops SimdOps;
+static char const *const kSimdName = "SSE2";
+#elif defined(FW_SIMD_AVX2)
+struct Avx2Ops {
+  typedef __m256 Float;
+  typedef __m256i Index;
+  static const int kWidth = 8;
+
+  static Float load(float const *p) {
+    return _mm256_load_ps(p);
+  }
+  static void store(float *p, Float value) {
+    _mm256_store_ps(p, value);
+  }
+  static Float set(float value) {
+    return _mm256_set1_ps(value);
+  }
+  static Float add(Float a, Float b) {
+    return _mm256_add_ps(a, b);
+  }
+  static Float sub(Float a, Float b) {
+    return _mm256_sub_ps(a, b);
+  }
+  static Float mul(Float a, Float b) {
+    return _mm256_mul_ps(a, b);
+  }
+  static Float div(Float a, Float b) {
+    return _mm256_div_ps(a, b);
+  }
+  static Float min(Float a, Float b) {
+    return _mm256_min_ps(a, b);
+  }
+  static Float max(Float a, Float b) {
+    return _mm256_max_ps(a, b);
+  }
+  static Float sqrt(Float a) {
+    return _mm256_sqrt_ps(a);
+  }
+  static Index to_index(Float a) {
+    return _mm256_cvttps_epi32(a);
+  }
+  static Float to_float(Index index) {
+    return _mm256_cvtepi32_ps(index);
+  }
+  static Float gather(float const *table, Index index) {
+    return _mm256_i32gather_ps(table, index, sizeof(float));
+  }
+};
+typedef Avx2Ops SimdOps;
+static char const *const kSimdName = "AVX2";
+#else
+typedef ScalarOps SimdOps;
+static char const *const kSimdName = "scalar";
+#endif
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace fw {
+
+// A fixed-size, lock-free queue for exactly one producer thread and one consumer thread. All the memory is allocated
+// up front, so pushing and popping never allocate or lock anything. When the queue is full, push() just fails and it's
+// up to the producer to decide what to do about it.
+//
+// The producer can also write() a batch of items and then publish() them all at once, so the consumer never sees half
+// of a batch.
+//
+// T has to be default constructible and copyable: we construct all the slots up front, and copy items in and out.
+template<typename T>
+class SpscQueue {
+private:
+  // The head and tail are on their own cache lines, so the producer and consumer don't keep stealing the line from
+  // each other. Each side also keeps a copy of the other side's index, which it only updates when it looks like the
+  // queue is full (or empty), so most of the time it doesn't have to touch the other side's line at all.
+  static constexpr size_t kCacheLineSize = 64;
+
+  std::unique_ptr<T[]> items_;
+  const size_t capacity_;
+  const size_t mask_;
+
+  // The index after the last item the consumer can see. The producer also has the index of the next slot it will write
+  // to, which is ahead of head_ if it has written items that it hasn't published yet, and it's copy of tail_.
+  alignas(kCacheLineSize) std::atomic<size_t> head_ = 0;
+  size_t write_head_ = 0;
+  size_t cached_tail_ = 0;
+
+  // The index of the next slot the consumer will read from, and it's copy of head_.
+  alignas(kCacheLineSize) std::atomic<size_t> tail_ = 0;
+  size_t cached_head_ = 0;
+
+  static size_t round_up_to_power_of_two(size_t n) {
+    size_t capacity = 1;
+    while (capacity < n) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+public:
+  // The capacity is rounded up to a power of two.
+  explicit SpscQueue(size_t capacity) :
+      capacity_(round_up_to_power_of_two(capacity)), mask_(capacity_ - 1) {
+    items_ = std::make_unique<T[]>(capacity_);
+  }
+
+  SpscQueue(SpscQueue const &) = delete;
+  SpscQueue &operator=(SpscQueue const &) = delete;
+
+  // Called on the producer thread. Adds the given item to the queue (and publishes anything else that has been
+  // written), or returns false if the queue is full.
+  bool push(T const &item) {
+    if (!write(item)) {
+      return false;
+    }
+    publish();
+    return true;
+  }
+
+  // Called on the producer thread. Adds the given item to the queue, but the consumer won't see it until the next
+  // publish(). Returns false if the queue is full (which includes the items that haven't been published).
+  bool write(T const &item) {
+    if (write_head_ - cached_tail_ == capacity_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (write_head_ - cached_tail_ == capacity_) {
+        return false;
+      }
+    }
+
+    items_[write_head_ & mask_] = item;
+    write_head_++;
+    return true;
+  }
+
+  // Called on the producer thread. Lets the consumer see everything that has been written so far.
+  void publish() {
+    head_.store(write_head_, std::memory_order_release);
+  }
+
+  // Called on the consumer thread. Pops the next item into item, or returns false if the queue is empty.
+  bool pop(T &item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == cached_head_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail == cached_head_) {
+        return false;
+      }
+    }
+
+    item = items_[tail & mask_];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Called on the consumer thread. Calls fn with each item that's in the queue right now, then frees up all of their
+  // slots at once. The items are only good until fn returns. Returns the number of items.
+  template<typename Fn>
+  size_t drain(Fn &&fn) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    cached_head_ = head_.load(std::memory_order_acquire);
+    for (size_t i = tail; i != cached_head_; i++) {
+      fn(items_[i & mask_]);
+    }
+    tail_.store(cached_head_, std::memory_order_release);
+    return cached_head_ - tail;
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  // The number of published items in the queue. Unless you call it from the producer or consumer, it could be out of
+  // date by the time it returns.
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+};
+
+}
@@ -2,13 +2,14 @@
 
 #include <condition_variable>
 #include <mutex>
+#include <optional>
 #include <queue>
 
 namespace fw {
 
 /**
  * A work queue is basically a thread-safe queue that, when you call dequeue, it'll block until a
- * work-item is available.
+ * work-item is available. Any number of threads can enqueue and dequeue at the same time.
  */
 template<typename T>
 class WorkQueue {
@@ -16,6 +17,7 @@ private:
   std::queue<T> q_;
   std::mutex mutex_;
   std::condition_variable condition_;
+  bool closed_ = false;
 
 public:
   /**
@@ -23,8 +25,26 @@ public:
    */
   inline T dequeue();
 
+  /**
+   * Like dequeue, but once the queue has been closed returns std::nullopt instead of waiting
+   * forever. Use this when more than one thread is dequeuing and they all need to be told to stop.
+   */
+  inline std::optional<T> dequeue_unless_closed();
+
+  /** Removes an item from the queue if there is one, or returns std::nullopt straight away if it's empty. */
+  inline std::optional<T> try_dequeue();
+
   /** Add an item to the queue. */
   inline void enqueue(T const &val);
+
+  /**
+   * Close the queue: wakes up every thread waiting in dequeue_unless_closed. Any items that are
+   * still in the queue are discarded.
+   */
+  inline void close();
+
+  /** Reopens a closed queue, so that it can be used again (e.g. when the workers are started again). */
+  inline void reopen();
 };
 
 template<typename T>
@@ -40,6 +60,35 @@ T WorkQueue<T>::dequeue() {
   return val;
 }
 
+template<typename T>
+std::optional<T> WorkQueue<T>::dequeue_unless_closed() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (q_.size() == 0 && !closed_) {
+    condition_.wait(lock);
+  }
+  if (closed_) {
+    return std::nullopt;
+  }
+
+  T val = q_.front();
+  q_.pop();
+
+  return val;
+}
+
+template<typename T>
+std::optional<T> WorkQueue<T>::try_dequeue() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (q_.size() == 0) {
+    return std::nullopt;
+  }
+
+  T val = q_.front();
+  q_.pop();
+
+  return val;
+}
+
 template<typename T>
 void WorkQueue<T>::enqueue(T const &val) {
   {
@@ -50,4 +99,21 @@ void WorkQueue<T>::enqueue(T const &val) {
   condition_.notify_one();
 }
 
+template<typename T>
+void WorkQueue<T>::close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+    q_ = std::queue<T>();
+  }
+
+  condition_.notify_all();
+}
+
+template<typename T>
+void WorkQueue<T>::reopen() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  closed_ = false;
+}
+
 }
@@ -1,72 +1,319 @@
+#include <algorithm>
 #include <functional>
 #include <thread>
+#include <utility>
 
+#include <framework/hierarchical_path_find.h>
+#include <framework/jump_point_path_find.h>
 #include <framework/logging.h>
+#include <framework/misc.h>
 #include <framework/path_find.h>
+#include <framework/settings.h>
+#include <framework/timer.h>
 
 #include <game/ai/pathing_thread.h>
 #include <game/world/world.h>
 #include <game/world/terrain.h>
 
 namespace game {
+namespace {
 
-// "no" flags, the default
-int FLAG_NONE = 0;
+// Paths shorter than this (in cells) use a flat A* search, since they don't span enough sectors for the hierarchical
+// search to be worth it.
+constexpr float kMinHierarchicalDistance = 2.0f * Terrain::PATCH_SIZE;
 
-// if set, this means out stop() method has been called and the worker thread is to stop
-int FLAG_STOP = 1;
+// For a hierarchical search, the number of sectors of the path we refine up-front.
+constexpr int kRefinedSegments = 2;
+
+// A group needs at least this many units, all within this distance of the goal, for it to be worth building a flow
+// field. The field is built out to the furthest unit, so its cost grows with the square of the distance, whereas
+// separate searches for far away units are cheap thanks to the hierarchical search.
+constexpr int kMinFlowFieldGroup = 4;
+constexpr float kMaxFlowFieldDistance = 2.0f * Terrain::PATCH_SIZE;
 
-PathingThread::PathingThread() : terrain_(nullptr) {
 }
 
-void PathingThread::start() {
-  // initialize the pather with the current world's map
+PathingThread::PathingThread() :
+    terrain_(nullptr), default_algorithm_(Algorithm::kJumpPoint),
+    cache_(fw::Settings::get<int>("pathing-cache-size")), cache_hits_(0), cache_misses_(0), coalesced_(0),
+    searches_(0), flow_field_paths_(0) {
+}
+
+PathingThread::~PathingThread() {
+  stop();
+}
+
+void PathingThread::initialize_grid() {
+  // initialize the passability grid with the current world's map, this is shared by all of the workers.
   terrain_ = game::World::get_instance()->get_terrain();
-  std::shared_ptr<fw::PathFind> pf(
-      new fw::PathFind(
-          terrain_->get_width(),
-          terrain_->get_length(),
-          terrain_->get_collision_data()));
-  pather_ = pf;
+  grid_ = std::make_shared<fw::PassabilityGrid>(
+      terrain_->get_width(), terrain_->get_length(), terrain_->get_collision_data());
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cache_.clear();
+  }
+
+  // The abstract graph for hierarchical searches. Sectors are the same size as the terrain's patches.
+  fw::Timer timer;
+  timer.start();
+  sector_graph_ = std::make_shared<fw::SectorGraph>(grid_, Terrain::PATCH_SIZE);
+  timer.stop();
+  LOG(INFO) << "built sector graph with " << sector_graph_->get_num_nodes() << " node(s) in "
+            << (timer.get_total_time() * 1000.0f) << "ms";
 
-  // start the thread that will simply wait for jobs to arrive and
-  // then process them in order.
-  thread_ = std::thread(std::bind(&PathingThread::thread_proc, this));
+  std::string algorithm = fw::Settings::get<std::string>("pathing-algorithm");
+  if (algorithm == "astar") {
+    default_algorithm_ = Algorithm::kAStar;
+  } else if (algorithm == "jps") {
+    default_algorithm_ = Algorithm::kJumpPoint;
+  } else {
+    LOG(WARN) << "unknown pathing-algorithm '" << algorithm << "', using jps";
+    default_algorithm_ = Algorithm::kJumpPoint;
+  }
+}
+
+std::shared_ptr<PathingThread::Worker> PathingThread::create_worker() const {
+  auto worker = std::make_shared<Worker>();
+  worker->pather = std::make_shared<fw::JumpPointPathFind>(grid_);
+  worker->hierarchical = std::make_shared<fw::HierarchicalPathFind>(sector_graph_);
+  return worker;
+}
+
+void PathingThread::start() {
+  initialize_grid();
+
+  // if we've been stopped before, the queue is closed and the workers would exit straight away.
+  work_queue_.reopen();
+
+  int num_threads = fw::Settings::get<int>("pathing-threads");
+  if (num_threads <= 0) {
+    // Leave one core for the update and render threads.
+    num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  }
+  LOG(INFO) << "starting " << num_threads << " pathing thread(s)";
+
+  // start the threads that will simply wait for jobs to arrive and then process them as they come in.
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(std::bind(&PathingThread::thread_proc, this, create_worker())));
+  }
+}
+
+void PathingThread::start_synchronous() {
+  initialize_grid();
+  work_queue_.reopen();
+  synchronous_worker_ = create_worker();
+}
+
+void PathingThread::run_queued_requests() {
+  // Callbacks can make new requests, which we'll pick up as we go around again.
+  for (;;) {
+    std::optional<std::shared_ptr<PathRequestData>> request = work_queue_.try_dequeue();
+    if (!request) {
+      return;
+    }
+    process_request(*synchronous_worker_, **request);
+  }
 }
 
 void PathingThread::stop() {
-  // add an item to the queue to shutdown...
-  PathRequestData request;
-  request.flags = FLAG_STOP;
-  work_queue_.enqueue(request);
+  // closing the queue wakes up all of the workers and tells them to stop.
+  work_queue_.close();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+
+  // whatever was still queued has been thrown away, so forget about it (otherwise new requests for the same paths would
+  // wait for it forever after we're started again).
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    in_flight_.clear();
+    queued_by_goal_.clear();
+  }
+
+  Stats stats = get_stats();
+  LOG(INFO) << "pathing stats: " << stats.cache_hits << " cache hit(s), " << stats.cache_misses << " miss(es), "
+            << stats.coalesced << " coalesced, " << stats.searches << " search(es), " << stats.flow_field_paths
+            << " path(s) from flow fields";
 }
 
-void PathingThread::request_path(fw::Vector const &start, fw::Vector const &goal, callback_fn on_path_found) {
-  PathRequestData request;
-  request.flags = 0;
-  request.start = start;
-  request.goal = goal;
-  request.callback = on_path_found;
+int PathingThread::get_cell(fw::Vector const &loc) const {
+  int x = fw::constrain(static_cast<int>(loc[0]), grid_->get_width());
+  int z = fw::constrain(static_cast<int>(loc[2]), grid_->get_length());
+  return (z * grid_->get_width()) + x;
+}
+
+// The key is the exact start cell, the algorithm and the goal cell. Two units in different cells can't share a path,
+// even if they're close together, since there might be a wall between them. Maps are much smaller than 2^15 cells
+// across, so the cells fit in 30 bits each.
+uint64_t PathingThread::get_request_key(fw::Vector const &start, fw::Vector const &goal, Algorithm algorithm) const {
+  const uint64_t start_cell = static_cast<uint64_t>(get_cell(start));
+  const uint64_t goal_cell = static_cast<uint64_t>(get_cell(goal));
+  return (start_cell << 32) | (static_cast<uint64_t>(algorithm) << 30) | goal_cell;
+}
+
+void PathingThread::request_path(
+    fw::Vector const &start, fw::Vector const &goal, callback_fn on_path_found, Algorithm algorithm) {
+  if (algorithm == Algorithm::kDefault) {
+    algorithm = default_algorithm_;
+  }
+  const uint64_t key = get_request_key(start, goal, algorithm);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::optional<std::vector<fw::Vector>> cached = cache_.get(key);
+  if (cached) {
+    lock.unlock();
+    cache_hits_++;
+    if (on_path_found) {
+      on_path_found(*cached);
+    }
+    return;
+  }
+  cache_misses_++;
+
+  auto in_flight = in_flight_.find(key);
+  if (in_flight != in_flight_.end()) {
+    // Someone's already asked for this path, we'll just piggy-back on their search.
+    coalesced_++;
+    in_flight->second.push_back(on_path_found);
+    return;
+  }
+  in_flight_[key].push_back(on_path_found);
+
+  const int goal_cell = get_cell(goal);
+  auto queued = queued_by_goal_.find(goal_cell);
+  if (queued != queued_by_goal_.end()) {
+    // There's already a job for this goal that no worker has picked up yet, join it.
+    queued->second->requests.push_back(PathRequest{key, start, algorithm});
+    return;
+  }
+
+  auto request = std::make_shared<PathRequestData>();
+  request->goal = goal;
+  request->requests.push_back(PathRequest{key, start, algorithm});
+  queued_by_goal_[goal_cell] = request;
+  lock.unlock();
+
   work_queue_.enqueue(request);
 }
 
-void PathingThread::thread_proc() {
+PathingThread::Stats PathingThread::get_stats() const {
+  Stats stats;
+  stats.cache_hits = cache_hits_;
+  stats.cache_misses = cache_misses_;
+  stats.coalesced = coalesced_;
+  stats.searches = searches_;
+  stats.flow_field_paths = flow_field_paths_;
+  return stats;
+}
+
+bool PathingThread::find_path(
+    Worker &worker, PathRequest const &request, fw::Vector const &goal, std::vector<fw::Vector> &path) {
+  searches_++;
+  fw::Vector dir = fw::get_direction_to(request.start, goal,
+      static_cast<float>(grid_->get_width()), static_cast<float>(grid_->get_length()));
+  dir[1] = 0.0f;
+  if (dir.length() >= kMinHierarchicalDistance) {
+    if (worker.hierarchical->find(path, request.start, goal, kRefinedSegments)) {
+      return true;
+    }
+
+    // The hierarchical search gives up if the goal is impassable or in a sector we can't get to (and it might have
+    // left half a path behind). The flat search will at least get us next to an impassable goal.
+    path.clear();
+  }
+
+  if (request.algorithm == Algorithm::kJumpPoint) {
+    return worker.pather->find(path, request.start, goal);
+  } else {
+    return worker.pather->PathFind::find(path, request.start, goal);
+  }
+}
+
+void PathingThread::path_found(uint64_t key, std::vector<fw::Vector> const &path, bool found) {
+  std::vector<callback_fn> callbacks;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (found && !path.empty()) {
+      cache_.put(key, path);
+    }
+
+    auto it = in_flight_.find(key);
+    if (it != in_flight_.end()) {
+      callbacks.swap(it->second);
+      in_flight_.erase(it);
+    }
+  }
+
+  for (auto &callback : callbacks) {
+    if (callback) {
+      callback(path);
+    }
+  }
+}
+
+void PathingThread::thread_proc(std::shared_ptr<Worker> worker) {
   for (;;) {
-    PathRequestData request = work_queue_.dequeue();
-    if (request.flags == FLAG_STOP) {
+    std::optional<std::shared_ptr<PathRequestData>> request = work_queue_.dequeue_unless_closed();
+    if (!request) {
       LOG(INFO) << "pathing_thread::stop() has been called, thread_proc stopping.";
       return;
     }
+    process_request(*worker, **request);
+  }
+}
 
-    std::vector<fw::Vector> path;
-    pather_->find(path, request.start, request.goal);
+void PathingThread::process_request(Worker &worker, PathRequestData &request) {
+  const float world_width = static_cast<float>(grid_->get_width());
+  const float world_length = static_cast<float>(grid_->get_length());
 
-    std::vector<fw::Vector> simplified;
-    pather_->simplify_path(path, simplified);
+  // Once we've taken the job off the queue, new requests for the same goal have to start a new one. After this,
+  // nobody else will touch the job, so we don't need the lock to read it.
+  std::vector<PathRequest> requests;
+  fw::Vector goal = request.goal;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queued_by_goal_.erase(get_cell(goal));
+    requests.swap(request.requests);
+  }
 
-    if (request.callback) {
-      request.callback(simplified);
+  bool use_flow_field = static_cast<int>(requests.size()) >= kMinFlowFieldGroup;
+  for (PathRequest const &req : requests) {
+    fw::Vector dir = fw::get_direction_to(req.start, goal, world_width, world_length);
+    dir[1] = 0.0f;
+    if (dir.length() > kMaxFlowFieldDistance) {
+      use_flow_field = false;
+      break;
+    }
+  }
+  if (use_flow_field) {
+    if (!worker.flow_field) {
+      worker.flow_field = std::make_shared<fw::FlowField>(grid_);
+    }
+    worker.flow_starts.clear();
+    for (PathRequest const &req : requests) {
+      worker.flow_starts.push_back(req.start);
     }
+    worker.flow_field->build(goal, worker.flow_starts);
+    searches_++;
+  }
+
+  for (PathRequest const &req : requests) {
+    worker.path.clear();
+    bool found = true;
+    if (use_flow_field && worker.flow_field->get_path(worker.path, req.start)) {
+      flow_field_paths_++;
+    } else {
+      // the flow field didn't get as far as this unit, so it gets a search of it's own.
+      worker.path.clear();
+      found = find_path(worker, req, goal, worker.path);
+    }
+
+    // If the search failed, we still tell the callbacks (with whatever we've got), but we don't cache it: the next
+    // request for the same path gets another go.
+    worker.simplified.clear();
+    worker.pather->simplify_path(worker.path, worker.simplified);
+    path_found(req.key, worker.simplified, found);
   }
 }
 }
@@ -1,49 +1,164 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <framework/lru_cache.h>
 #include <framework/math.h>
 #include <framework/work_queue.h>
 
 namespace fw {
+class FlowField;
+class HierarchicalPathFind;
+class JumpPointPathFind;
+class PassabilityGrid;
 class PathFind;
+class SectorGraph;
 }
 
 namespace game {
 class Terrain;
 
-// Encapsulates a thread that all players will queue requests for path-finding to. We then execute one request
-// at a time and call the player back when the path is found.
+// Encapsulates a pool of threads that all players will queue requests for path-finding to. Each worker thread has it's
+// own fw::PathFind (which holds the scratch state for a search) over a single, shared passability grid, so requests
+// are executed in parallel, one per worker. The player's callback is called on the worker thread when the path is
+// found.
+//
+// Short paths are found with a Jump Point Search (or plain A*, see Algorithm) over the grid. Longer paths go through a
+// hierarchical search over a shared fw::SectorGraph, and we only refine the first couple of sectors of the path. In
+// that case, the path we return stops short of the goal and it's up to the caller to request the rest of the path as
+// it gets closer.
+//
+// When a group of units is ordered somewhere, they all request a path to the same goal at once, so we try hard not to
+// do the same work more than once:
+//  * Paths are cached by start cell, goal cell and algorithm. A request that hits the cache has it's callback called
+//    straight away, on the calling thread. The passability can't change while we're running, so the cache is only
+//    cleared when we're started again.
+//  * A request for a path that's already being searched for just adds it's callback to the in-flight search.
+//  * Requests for the same goal that are still waiting in the queue are grouped into one job. If there's enough of
+//    them close enough to the goal, the job builds a single fw::FlowField out from the goal that gives every unit in
+//    the group it's path.
 class PathingThread {
 public:
   typedef std::function<void(std::vector<fw::Vector> const &)> callback_fn;
 
+  // The search to use for paths that are too short to need the hierarchical search. kDefault means whatever the
+  // "pathing-algorithm" setting says.
+  enum class Algorithm {
+    kDefault,
+    kAStar,
+    kJumpPoint,
+  };
+
+  // Counters for how much work the cache and coalescing are saving us.
+  struct Stats {
+    // Requests that were answered straight from the cache.
+    uint64_t cache_hits;
+
+    // Requests that were not in the cache.
+    uint64_t cache_misses;
+
+    // Requests (out of the cache misses) that were merged into another identical request that was already queued.
+    uint64_t coalesced;
+
+    // Searches that we actually ran, and the number of paths we got out of a flow field instead.
+    uint64_t searches;
+    uint64_t flow_field_paths;
+  };
+
 private:
-  struct PathRequestData {
-    int flags;
+  // One distinct request. The callbacks are in in_flight_, keyed by the same key.
+  struct PathRequest {
+    uint64_t key;
     fw::Vector start;
+    Algorithm algorithm;
+  };
+
+  // All of the requests to a single goal that are waiting to be processed.
+  struct PathRequestData {
     fw::Vector goal;
-    callback_fn callback;
+    std::vector<PathRequest> requests;
+  };
+
+  // Everything a worker thread needs to do a search. Each worker has it's own.
+  struct Worker {
+    // JumpPointPathFind is also a plain A* PathFind (by calling PathFind::find), so we use it for both.
+    std::shared_ptr<fw::JumpPointPathFind> pather;
+    std::shared_ptr<fw::HierarchicalPathFind> hierarchical;
+
+    // We only create the flow field once it's needed, since it's as big as the pather.
+    std::shared_ptr<fw::FlowField> flow_field;
+
+    // Scratch space for the paths, so we're not allocating them for every request.
+    std::vector<fw::Vector> path;
+    std::vector<fw::Vector> simplified;
+    std::vector<fw::Vector> flow_starts;
   };
 
-  std::shared_ptr<fw::PathFind> pather_;
   std::shared_ptr<Terrain> terrain_;
-  std::thread thread_;
-  fw::WorkQueue<PathRequestData> work_queue_;
+  std::shared_ptr<fw::PassabilityGrid const> grid_;
+  std::shared_ptr<fw::SectorGraph> sector_graph_;
+  std::vector<std::thread> threads_;
+
+  // When we've been started with start_synchronous(), this is the worker that run_queued_requests() uses.
+  std::shared_ptr<Worker> synchronous_worker_;
+  fw::WorkQueue<std::shared_ptr<PathRequestData>> work_queue_;
+  Algorithm default_algorithm_;
+
+  // Locks all of the members below.
+  std::mutex mutex_;
+
+  // Callbacks waiting for a path, keyed by request key. A request is "in flight" from when it's queued until its
+  // callbacks are called.
+  std::unordered_map<uint64_t, std::vector<callback_fn>> in_flight_;
 
-  void thread_proc();
+  // Jobs that are still in the work queue, keyed by goal cell, so new requests for the same goal can join them.
+  std::unordered_map<int, std::shared_ptr<PathRequestData>> queued_by_goal_;
+
+  // Simplified paths we've found recently, keyed by request key.
+  fw::LruCache<uint64_t, std::vector<fw::Vector>> cache_;
+
+  std::atomic<uint64_t> cache_hits_;
+  std::atomic<uint64_t> cache_misses_;
+  std::atomic<uint64_t> coalesced_;
+  std::atomic<uint64_t> searches_;
+  std::atomic<uint64_t> flow_field_paths_;
+
+  int get_cell(fw::Vector const &loc) const;
+  uint64_t get_request_key(fw::Vector const &start, fw::Vector const &goal, Algorithm algorithm) const;
+
+  void initialize_grid();
+  std::shared_ptr<Worker> create_worker() const;
+  void thread_proc(std::shared_ptr<Worker> worker);
+  void process_request(Worker &worker, PathRequestData &request);
+  bool find_path(Worker &worker, PathRequest const &request, fw::Vector const &goal, std::vector<fw::Vector> &path);
+  void path_found(uint64_t key, std::vector<fw::Vector> const &path, bool found);
 
 public:
   PathingThread();
+  ~PathingThread();
 
   PathingThread(PathingThread const&) = delete;
 
   void start();
   void stop();
 
-  void request_path(fw::Vector const &start, fw::Vector const &goal, callback_fn on_path_found);
+  // Like start(), but without any threads. Requests that aren't in the cache wait in the queue until you call
+  // run_queued_requests(), which finds their paths one at a time on the calling thread. That way we find exactly the
+  // same paths, and call the callbacks in exactly the same order, every time (the replay tool needs that).
+  void start_synchronous();
+  void run_queued_requests();
+
+  void request_path(fw::Vector const &start, fw::Vector const &goal, callback_fn on_path_found,
+      Algorithm algorithm = Algorithm::kDefault);
+
+  Stats get_stats() const;
 };
 
 }
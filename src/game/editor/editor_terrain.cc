@@ -1,7 +1,10 @@
 
+#include <algorithm>
+
 #include <framework/framework.h>
 #include <framework/graphics.h>
 #include <framework/bitmap.h>
+#include <framework/misc.h>
 #include <framework/texture.h>
 
 #include <game/world/terrain_helper.h>
@@ -52,6 +55,19 @@ void EditorTerrain::set_vertex_height(int x, int z, float height) {
   if (!found) {
     patches_to_bake_.push_back(this_patch);
   }
+
+  // the collision data depends on the normal, which is calculated from the neighbouring vertices as well, so the
+  // patches of the neighbours are affected too.
+  for (int dz = -1; dz <= 1; dz++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      auto patch = std::make_tuple(
+          fw::constrain(x + dx, width_) / PATCH_SIZE, fw::constrain(z + dz, length_) / PATCH_SIZE);
+      if (std::find(collision_dirty_patches_.begin(), collision_dirty_patches_.end(), patch)
+          == collision_dirty_patches_.end()) {
+        collision_dirty_patches_.push_back(patch);
+      }
+    }
+  }
   
   if (!bake_queued_.exchange(true)) {
     fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
@@ -147,4 +163,24 @@ fw::Status EditorTerrain::BuildCollisionData(std::vector<bool> &vertices) {
   return game::BuildCollisionData(vertices, heights_, width_, length_);
 }
 
+fw::Status EditorTerrain::UpdateCollisionData(
+    std::vector<bool> &vertices, std::vector<std::tuple<int, int>> &changed_patches) {
+  if (static_cast<int>(vertices.size()) < (width_ * length_)) {
+    return fw::ErrorStatus("vertices vector is too small!");
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(patches_to_bake_mutex_);
+    changed_patches.swap(collision_dirty_patches_);
+    collision_dirty_patches_.clear();
+  }
+
+  for (auto patch : changed_patches) {
+    RETURN_IF_ERROR(game::BuildCollisionData(vertices, heights_, width_, length_,
+        std::get<0>(patch) * PATCH_SIZE, std::get<1>(patch) * PATCH_SIZE, PATCH_SIZE, PATCH_SIZE));
+  }
+
+  return fw::OkStatus();
+}
+
 }
@@ -20,6 +20,9 @@ private:
   std::vector<std::tuple<int, int>> patches_to_bake_;
   std::atomic<bool> bake_queued_;
 
+  // patches whose heights have changed since the last UpdateCollisionData, also locked by patches_to_bake_mutex_
+  std::vector<std::tuple<int, int>> collision_dirty_patches_;
+
   // we keep a separate vector of the splatt bitmaps for easy editing
   std::vector<fw::Bitmap> splatt_bitmaps_;
 
@@ -51,8 +54,15 @@ public:
 
   // builds the collision data for the whole map. we assume the vertices buffer
   // is big enough to hold one data point per vertex in the map. each data point
-  // holds a single boolean flag - true means "passable", false means "impassable"
+  // holds a single boolean flag - true means "passable", false means "impassable". This doesn't touch the patches
+  // that UpdateCollisionData thinks are dirty: other things (like saving the map) build their own copy, which says
+  // nothing about whether the copy UpdateCollisionData is updating is up to date.
   fw::Status BuildCollisionData(std::vector<bool> &vertices);
+
+  // rebuilds the collision data only for the patches that have been edited since the last time this was called.
+  // There can only be one copy of the collision data that's kept up to date like this (the pathing tool's).
+  // changed_patches is populated with the (patch_x, patch_z) of those patches.
+  fw::Status UpdateCollisionData(std::vector<bool> &vertices, std::vector<std::tuple<int, int>> &changed_patches);
 };
 
 }
@@ -20,6 +20,8 @@
 #include <framework/shader.h>
 #include <framework/paths.h>
 #include <framework/path_find.h>
+#include <framework/hierarchical_path_find.h>
+#include <framework/timer.h>
 
 #include <game/editor/tools/pathing_tool.h>
 #include <game/editor/windows/main_menu.h>
@@ -61,6 +63,7 @@ private:
   bool on_start_click(Widget &w);
   bool on_end_click(Widget &w);
   bool on_simplify_click(Widget &w);
+  bool on_hierarchical_click(Widget &w);
 
 public:
   PathingToolWindow(ed::PathingTool &tool);
@@ -101,6 +104,12 @@ PathingToolWindow::PathingToolWindow(ed::PathingTool &tool) :
               << Widget::margin(5.f, 10.f, 10.0f, 10.0f)
               << Checkbox::text("Simplify")
               << Widget::click(std::bind(&PathingToolWindow::on_simplify_click, this, _1)))
+          << (Builder<Checkbox>()
+              << Widget::width(Widget::MatchParent())
+              << Widget::height(Widget::WrapContent())
+              << Widget::margin(0.f, 10.f, 10.0f, 10.0f)
+              << Checkbox::text("Hierarchical")
+              << Widget::click(std::bind(&PathingToolWindow::on_hierarchical_click, this, _1)))
       );
   fw::Get<Gui>().AttachWindow(wnd_);
 }
@@ -138,6 +147,11 @@ bool PathingToolWindow::on_simplify_click(Widget &w) {
   return true;
 }
 
+bool PathingToolWindow::on_hierarchical_click(Widget &w) {
+  tool_.set_hierarchical(dynamic_cast<Checkbox &>(w).is_checked());
+  return true;
+}
+
 //-----------------------------------------------------------------------------
 
 // CollisionPatchNode renders the 'state' of the collision information for a patch of terrain.
@@ -196,7 +210,8 @@ namespace ed {
 REGISTER_TOOL("pathing", PathingTool);
 
 PathingTool::PathingTool(EditorWorld *wrld) :
-    Tool(wrld), start_set_(false), end_set_(false), test_mode_(kTestNone), simplify_(true) {
+    Tool(wrld), start_set_(false), end_set_(false), test_mode_(kTestNone), simplify_(true),
+    hierarchical_(false) {
   wnd_ = std::make_unique<PathingToolWindow>(*this);
   auto model = fw::Framework::get_instance()->get_model_manager()->get_model("marker");
   if (!model.ok()) {
@@ -214,18 +229,42 @@ void PathingTool::activate() {
 
   int width = get_terrain()->get_width();
   int length = get_terrain()->get_length();
-  collision_data_.resize(width * length);
-  auto status = get_terrain()->BuildCollisionData(collision_data_);
-  if (!status.ok()) {
-    LOG(ERR) << "error building collision data: " << status;
+  fw::Timer timer;
+  timer.start();
+  if (!sector_graph_) {
+    collision_data_.resize(width * length);
+    auto status = get_terrain()->BuildCollisionData(collision_data_);
+    if (!status.ok()) {
+      LOG(ERR) << "error building collision data: " << status;
+    }
+
+    auto grid = std::make_shared<fw::PassabilityGrid>(width, length, collision_data_);
+    sector_graph_ = std::make_shared<fw::SectorGraph>(grid, game::Terrain::PATCH_SIZE);
+    LOG(INFO) << "built sector graph: " << sector_graph_->get_num_nodes() << " node(s)";
+  } else {
+    // We've been activated before, only the patches that have been edited since then need to be rebuilt. Our
+    // sectors are the same size as the terrain's patches, so the changed patches are the changed sectors.
+    std::vector<std::tuple<int, int>> changed_patches;
+    auto status = get_terrain()->UpdateCollisionData(collision_data_, changed_patches);
+    if (!status.ok()) {
+      LOG(ERR) << "error updating collision data: " << status;
+    }
+
+    if (!changed_patches.empty()) {
+      auto grid = std::make_shared<fw::PassabilityGrid>(width, length, collision_data_);
+      sector_graph_->update_sectors(grid, changed_patches);
+      LOG(INFO) << "updated sector graph: " << changed_patches.size() << " sector(s) changed, "
+                << sector_graph_->get_num_nodes() << " node(s)";
+    }
   }
+  timer.stop();
+  LOG(INFO) << "collision data ready in " << (timer.get_total_time() * 1000.0f) << "ms";
 
   patches_.resize((width / PATCH_SIZE) * (length / PATCH_SIZE));
 
-  std::shared_ptr<fw::TimedPathFind> pf(
-      new fw::TimedPathFind(
-          get_terrain()->get_width(), get_terrain()->get_length(), collision_data_));
-  path_find_ = pf;
+  path_find_ = std::make_shared<fw::TimedPathFind>(
+      std::make_shared<fw::PassabilityGrid>(width, length, collision_data_));
+  hierarchical_path_find_ = std::make_shared<fw::HierarchicalPathFind>(sector_graph_);
 
   fw::Input *inp = fw::Framework::get_instance()->get_input();
   keybind_tokens_.push_back(
@@ -296,6 +335,11 @@ void PathingTool::set_simplify(bool value) {
   find_path();
 }
 
+void PathingTool::set_hierarchical(bool value) {
+  hierarchical_ = value;
+  find_path();
+}
+
 void PathingTool::set_test_start() {
   test_mode_ = kTestStart;
 }
@@ -342,17 +386,28 @@ void PathingTool::find_path() {
   if (!start_set_ || !end_set_)
     return;
 
-  std::vector<fw::Vector> full_path;
-  if (!path_find_->find(full_path, start_pos_, end_pos_)) {
-    statusbar->set_message(
-      absl::StrCat("No path found after ", path_find_->total_time * 1000.0f, "ms"));
+  // We always run both searches, so that we can compare the timings.
+  std::vector<fw::Vector> flat_path;
+  bool flat_found = path_find_->find(flat_path, start_pos_, end_pos_);
+
+  std::vector<fw::Vector> hierarchical_path;
+  fw::Timer timer;
+  timer.start();
+  bool hierarchical_found = hierarchical_path_find_->find(hierarchical_path, start_pos_, end_pos_);
+  timer.stop();
+  std::string timings = absl::StrCat(
+      "flat: ", path_find_->total_time * 1000.0f, "ms, hierarchical: ", timer.get_total_time() * 1000.0f, "ms (",
+      hierarchical_path_find_->last_expanded, " abstract nodes)");
+
+  std::vector<fw::Vector> &full_path = hierarchical_ ? hierarchical_path : flat_path;
+  if (!(hierarchical_ ? hierarchical_found : flat_found)) {
+    statusbar->set_message(absl::StrCat("No path found - ", timings));
   } else {
     std::vector<fw::Vector> path;
     path_find_->simplify_path(full_path, path);
     statusbar->set_message(
       absl::StrCat(
-        "Path found in ", path_find_->total_time * 1000.0f, "ms, ", full_path.size(), " nodes, ",
-        path.size(), " nodes (simplified)"));
+        "Path found - ", timings, ", ", full_path.size(), " nodes, ", path.size(), " nodes (simplified)"));
 
     std::vector<fw::vertex::xyz_c> buffer;
 
@@ -2,6 +2,7 @@
 
 #include <memory>
 
+#include <framework/hierarchical_path_find.h>
 #include <framework/model.h>
 #include <framework/path_find.h>
 #include <framework/scenegraph.h>
@@ -29,9 +30,15 @@ private:
   fw::Vector end_pos_;
   bool end_set_;
   bool simplify_;
+  bool hierarchical_;
   std::vector<std::shared_ptr<CollisionPatchNode>> patches_;
   std::shared_ptr<fw::TimedPathFind> path_find_;
 
+  // The sector graph is kept around between activations, so that we only need to rebuild the parts of it that have
+  // been edited in the meantime.
+  std::shared_ptr<fw::SectorGraph> sector_graph_;
+  std::shared_ptr<fw::HierarchicalPathFind> hierarchical_path_find_;
+
   std::shared_ptr<fw::sg::Node> current_path_node_;
   std::shared_ptr<fw::ModelNode> start_marker_;
   std::shared_ptr<fw::ModelNode> end_marker_;
@@ -46,6 +53,7 @@ public:
   virtual void deactivate();
 
   void set_simplify(bool enabled);
+  void set_hierarchical(bool enabled);
   void set_test_start();
   void set_test_end();
   void stop_testing();
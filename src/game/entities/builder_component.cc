@@ -1,5 +1,7 @@
 #include <functional>
 
+#include <framework/packet_buffer.h>
+
 #include <game/entities/entity_factory.h>
 #include <game/entities/builder_component.h>
 #include <game/entities/selectable_component.h>
@@ -97,8 +99,9 @@ void BuilderComponent::update(float dt) {
         std::shared_ptr<game::CreateEntityCommand> cmd(
             game::create_command<game::CreateEntityCommand>(our_ownable->get_owner()->get_player_no()));
         cmd->template_name = entry.tmpl["name"];
-        cmd->initial_position = our_pos->get_position();
-        cmd->initial_goal = our_pos->get_position() + (our_pos->get_direction() * 3.0f);
+        cmd->initial_position = fw::net::quantize_position(our_pos->get_position());
+        cmd->initial_goal =
+            fw::net::quantize_position(our_pos->get_position() + (our_pos->get_direction() * 3.0f));
         game::SimulationThread::get_instance()->post_command(cmd);
       }
     }
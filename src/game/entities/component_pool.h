@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <game/entities/entity.h>
+
+namespace ent {
+
+// The base class for ComponentPool, so that an EntityComponent can be given back to the pool it came from without
+// knowing it's type.
+class ComponentPoolBase {
+public:
+  virtual ~ComponentPoolBase() {
+  }
+
+  // Destroys the given component and returns it's memory to the pool.
+  virtual void release(EntityComponent *comp) = 0;
+};
+
+// Holds all of the components of one type in fixed-size chunks of contiguous memory, rather than allocating each one
+// individually. Components never move once they're allocated (other components keep pointers to them), and freed
+// slots are reused. Note that subclasses have their own pools (e.g. SeekingProjectileComponent and
+// BallisticProjectileComponent are in different pools).
+//
+// ENT_COMPONENT_REGISTER allocates components from here, so you don't usually need to use this directly. Allocating
+// and releasing is thread-safe.
+template<typename T>
+class ComponentPool : public ComponentPoolBase {
+private:
+  static const int kChunkSize = 64;
+
+  struct Chunk {
+    alignas(T) unsigned char storage[sizeof(T) * kChunkSize];
+  };
+
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+
+  // Indices (chunk * kChunkSize + index in the chunk) of the free slots in the chunks we've already allocated.
+  std::vector<int> free_slots_;
+  std::mutex mutex_;
+
+  T *get_slot(int slot) const {
+    return reinterpret_cast<T *>(chunks_[slot / kChunkSize]->storage) + (slot % kChunkSize);
+  }
+
+  ComponentPool() {
+  }
+
+public:
+  // Gets the pool for our type. Like the rest of the component registry, pools live for the lifetime of the process.
+  static ComponentPool<T> &get() {
+    static ComponentPool<T> *pool = new ComponentPool<T>();
+    return *pool;
+  }
+
+  // Allocates and constructs a new component.
+  T *allocate();
+
+  void release(EntityComponent *comp) override;
+};
+
+template<typename T>
+T *ComponentPool<T>::allocate() {
+  int slot;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (free_slots_.empty()) {
+      const int first_slot = static_cast<int>(chunks_.size()) * kChunkSize;
+      auto chunk = std::make_unique<Chunk>();
+      for (int i = kChunkSize - 1; i >= 0; i--) {
+        free_slots_.push_back(first_slot + i);
+      }
+      chunks_.push_back(std::move(chunk));
+    }
+
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+
+  T *comp = new(get_slot(slot)) T();
+  comp->pool_ = this;
+  comp->pool_slot_ = slot;
+  return comp;
+}
+
+template<typename T>
+void ComponentPool<T>::release(EntityComponent *comp) {
+  const int slot = comp->pool_slot_;
+  static_cast<T *>(comp)->~T();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  free_slots_.push_back(slot);
+}
+
+}
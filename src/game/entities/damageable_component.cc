@@ -40,13 +40,13 @@ void DamageableComponent::initialize() {
   }
 }
 
-void DamageableComponent::apply_damage(float amt) {
+void DamageableComponent::apply_damage(fw::Fixed amt) {
   std::shared_ptr<Entity> Entity(entity_);
   EntityAttribute *attr = Entity->get_attribute("health");
   if (attr != nullptr) {
-    float curr_value = attr->get_value<float>();
-    if (curr_value > 0) {
-      attr->set_value(curr_value - amt);
+    fw::Fixed curr_value = fw::Fixed::from_float(attr->get_value<float>());
+    if (curr_value > fw::Fixed()) {
+      attr->set_value((curr_value - amt).to_float());
     }
   }
 }
@@ -59,7 +59,7 @@ void DamageableComponent::check_explode(std::any health_value) {
   }
 }
 
-void apply_damage(std::shared_ptr<Entity> ent, float amt) {
+void apply_damage(std::shared_ptr<Entity> ent, fw::Fixed amt) {
   DamageableComponent *damageable = ent->get_component<DamageableComponent>();
   if (damageable != 0) {
     damageable->apply_damage(amt);
@@ -78,7 +78,8 @@ void DamageableComponent::explode() {
   PositionComponent *our_position = entity->get_component<PositionComponent>();
   if (our_position != nullptr) {
     std::list<std::weak_ptr<ent::Entity>> entities;
-    our_position->get_entities_within_radius(5.0f, std::back_inserter(entities));
+    const fw::Fixed radius = fw::Fixed::from_int(5);
+    our_position->get_entities_within_radius(radius, std::back_inserter(entities));
     for(std::weak_ptr<ent::Entity> const &wp : entities) {
       std::shared_ptr<ent::Entity> ent = wp.lock();
 
@@ -86,7 +87,7 @@ void DamageableComponent::explode() {
       if (!ent || ent == entity)
         continue;
 
-      ent::apply_damage(ent, (5.0f - our_position->get_direction_to(ent).length()));
+      ent::apply_damage(ent, radius - our_position->get_fixed_direction_to(ent).length());
     }
   }
 }
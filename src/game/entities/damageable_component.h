@@ -2,6 +2,7 @@
 
 #include <any>
 
+#include <framework/fixed.h>
 #include <framework/signals.h>
 
 #include <game/entities/entity.h>
@@ -24,7 +25,9 @@ public:
   void apply_template(fw::lua::Value tmpl) override;
   virtual void initialize();
 
-  void apply_damage(float amt);
+  // Health is a float attribute (so that lua and the UI can read it), but the damage is worked out in fixed-point so
+  // that it comes out the same for every player.
+  void apply_damage(fw::Fixed amt);
   void explode();
 
 private:
@@ -1,4 +1,6 @@
 
+#include <algorithm>
+
 #include <framework/framework.h>
 #include <framework/graphics.h>
 #include <framework/math.h>
@@ -7,20 +9,28 @@
 #include <framework/timer.h>
 
 #include <game/entities/entity.h>
+#include <game/entities/component_pool.h>
 #include <game/entities/entity_debug.h>
 #include <game/entities/entity_factory.h>
+#include <game/entities/entity_manager.h>
 #include <game/entities/position_component.h>
 #include <game/entities/moveable_component.h>
 
 namespace ent {
 
 Entity::Entity(EntityManager *mgr, entity_id id)
-  : mgr_(mgr), debug_flags_(static_cast<EntityDebugFlags>(0)), id_(id), create_time_(0) {
+  : mgr_(mgr), debug_flags_(static_cast<EntityDebugFlags>(0)), id_(id), create_time_(0), manager_index_(-1),
+    state_hash_(0) {
+  component_slots_.fill(nullptr);
 }
 
 Entity::~Entity() {
-  for(auto& pair : components_) {
-    delete pair.second;
+  for(EntityComponent *comp : components_) {
+    if (comp->pool_ != nullptr) {
+      comp->pool_->release(comp);
+    } else {
+      delete comp;
+    }
   }
   for (auto& cleanup_fn : cleanup_functions_) {
     cleanup_fn();
@@ -28,27 +38,49 @@ Entity::~Entity() {
 }
 
 void Entity::add_component(EntityComponent *comp) {
+  const int identifier = comp->get_identifier();
+  const int slot = get_component_slot(identifier);
+  if (identifier % kComponentIdentifierSpacing != 0 || slot < 0 || slot >= kMaxComponentSlots) {
+    LOG(ERR) << "invalid component identifier: " << identifier;
+    return;
+  }
+
   // you can only have one component of each type
-  auto it = components_.find(comp->get_identifier());
-  if (it != components_.end()) {
-    LOG(ERR) << "only one component of each type is allowed: " << comp->get_identifier();
+  if (component_slots_[slot] != nullptr) {
+    LOG(ERR) << "only one component of each type is allowed: " << identifier;
     return;
   }
 
-  components_[comp->get_identifier()] = comp;
+  component_slots_[slot] = comp;
+
+  // keep components_ sorted by identifier
+  auto it = std::upper_bound(components_.begin(), components_.end(), comp,
+      [](EntityComponent *lhs, EntityComponent *rhs) {
+        return lhs->get_identifier() < rhs->get_identifier();
+      });
+  components_.insert(it, comp);
 }
 
 EntityComponent *Entity::get_component(int identifier) {
-  auto it = components_.find(identifier);
-  if (it == components_.end()) {
+  const int slot = get_component_slot(identifier);
+  if (slot < 0 || slot >= kMaxComponentSlots) {
     return nullptr;
   }
 
-  return (*it).second;
+  return component_slots_[slot];
 }
 
 bool Entity::contains_component(int identifier) const {
-  return (components_.find(identifier) != components_.end());
+  const int slot = get_component_slot(identifier);
+  return slot >= 0 && slot < kMaxComponentSlots && component_slots_[slot] != nullptr;
+}
+
+uint64_t Entity::get_component_bits() {
+  uint64_t bits = 0;
+  for (EntityComponent *comp : components_) {
+    bits |= get_component_bit(comp->get_identifier());
+  }
+  return bits;
 }
 
 void Entity::add_attribute(EntityAttribute const &attr) {
@@ -71,15 +103,27 @@ EntityAttribute *Entity::get_attribute(std::string const &name) {
 }
 
 void Entity::initialize() {
-  create_time_ = fw::Framework::get_instance()->get_timer()->get_total_time();
-  for(auto &pair : components_) {
-    pair.second->initialize();
+  create_time_ = mgr_->get_time();
+  for(EntityComponent *comp : components_) {
+    comp->initialize();
+    components_by_phase_[static_cast<int>(comp->get_update_phase())].push_back(comp);
   }
 }
 
-void Entity::update(float dt) {
-  for (auto& pair : components_) {
-    pair.second->update(dt);
+void Entity::prepare_update(UpdatePhase phase, float dt) {
+  for (EntityComponent *comp : components_by_phase_[static_cast<int>(phase)]) {
+    comp->prepare_update(dt);
+  }
+}
+
+void Entity::update(UpdatePhase phase, float dt) {
+  for (EntityComponent *comp : components_by_phase_[static_cast<int>(phase)]) {
+    comp->update(dt);
+  }
+
+  // the debug view is updated after everything else
+  if (phase != UpdatePhase::kDefault) {
+    return;
   }
 
   if (debug_view_ && debug_flags_ == 0) {
@@ -105,13 +149,49 @@ void Entity::set_position(fw::Vector const &pos) {
 }
 
 float Entity::get_age() const {
-  float curr_time = fw::Framework::get_instance()->get_timer()->get_total_time();
-  return (curr_time - create_time_);
+  return (mgr_->get_time() - create_time_);
+}
+
+void Entity::get_hashed_state(fw::Vector &position, float &health) {
+  PositionComponent *position_component = get_component<PositionComponent>();
+  if (position_component != nullptr) {
+    // don't let it update the position, we're just looking.
+    position = position_component->get_position(/*allow_update=*/false);
+  }
+
+  health = 0.0f;
+  auto it = attributes_.find("health");
+  if (it != attributes_.end() && it->second.get_value().type() == typeid(float)) {
+    health = it->second.get_value<float>();
+  }
+}
+
+EntityState Entity::get_state() {
+  EntityState state;
+  state.id = id_;
+  state.name = name_;
+  get_hashed_state(state.position, state.health);
+  state.hash = StateHash::hash_entity(state.id, state.name, state.position, state.health);
+  return state;
+}
+
+void Entity::update_state_hash() {
+  if (manager_index_ < 0) {
+    // we're not in the hash until the EntityManager adds us (or after it's removed us)
+    return;
+  }
+
+  fw::Vector position;
+  float health;
+  get_hashed_state(position, health);
+  const uint64_t hash = StateHash::hash_entity(id_, name_, position, health);
+  mgr_->get_state_hash().replace(state_hash_, hash);
+  state_hash_ = hash;
 }
 
 //-------------------------------------------------------------------------
 
-EntityComponent::EntityComponent() {
+EntityComponent::EntityComponent() : pool_(nullptr), pool_slot_(-1) {
 }
 
 EntityComponent::~EntityComponent() {
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <array>
+#include <cassert>
 #include <memory>
+#include <vector>
 
 #include <framework/lua.h>
 
 #include <game/entities/entity_attribute.h>
 #include <game/entities/entity_debug.h>
+#include <game/entities/state_hash.h>
 
 namespace fw {
 class Graphics;
@@ -16,9 +20,11 @@ class Scenegraph;
 }
 
 namespace ent {
+class ComponentPoolBase;
 class EntityDebugView;
 class Entity;
 class EntityManager;
+template<typename T> class ComponentPool;
 
 /**
  * This is the identifier for an Entity, it's actually made up of two components, the
@@ -27,9 +33,50 @@ class EntityManager;
  */
 typedef uint32_t entity_id;
 
+// Each frame, the EntityManager updates all of the entities' components one phase at a time, in this order: every
+// component in one phase is updated before any component in the next.
+enum class UpdatePhase {
+  kPosition = 0,
+  kMovement,
+  kWeapons,
+  kProjectiles,
+
+  // Everything else.
+  kDefault,
+};
+static const int kNumUpdatePhases = static_cast<int>(UpdatePhase::kDefault) + 1;
+
+// Component identifiers are all multiples of kComponentIdentifierSpacing, which lets us turn them into a small "slot"
+// number at compile time. Each Entity has an array of components indexed by slot.
+static const int kComponentIdentifierSpacing = 50;
+static const int kMaxComponentSlots = 32;
+
+constexpr int get_component_slot(int identifier) {
+  return identifier / kComponentIdentifierSpacing;
+}
+
+// Gets the slot of the component type T at compile time. Subclasses of a component (e.g. the different kinds of
+// ProjectileComponent) share the identifier, and the slot, of the base class.
+template<typename T>
+struct ComponentSlot {
+  static_assert(T::identifier % kComponentIdentifierSpacing == 0,
+      "component identifiers must be a multiple of kComponentIdentifierSpacing");
+  static_assert(get_component_slot(T::identifier) < kMaxComponentSlots, "component identifier is too big");
+
+  static constexpr int value = get_component_slot(T::identifier);
+};
+
 // This is the base class for components of entities. It's just got a couple of methods
 // and stuff that let us figure out how the component fits in and so on.
 class EntityComponent {
+private:
+  template<typename T> friend class ComponentPool;
+  friend class Entity;
+
+  // The pool we were allocated from (and our slot in it), or null if we were allocated with new.
+  ComponentPoolBase *pool_;
+  int pool_slot_;
+
 protected:
   std::weak_ptr<Entity> entity_;
 
@@ -42,7 +89,19 @@ public:
   virtual void initialize() {
   }
 
-  // This is called each frame in the "update" round.
+  // The phase that we're updated in.
+  virtual UpdatePhase get_update_phase() const {
+    return UpdatePhase::kDefault;
+  }
+
+  // This is called each frame, just before update(), for every component in our phase IN PARALLEL. This is where you
+  // should do any expensive queries of the world (e.g. searching for the nearest Entity), and save the results for
+  // update() to use. You must not change anything but this component's own state in here.
+  virtual void prepare_update(float) {
+  }
+
+  // This is called each frame in the "update" round. Components are updated one at a time, so it's safe to change
+  // anything here.
   virtual void update(float) {
   }
 
@@ -75,7 +134,14 @@ private:
   friend class EntityManager;
   Entity(EntityManager *mgr, entity_id id);
 
-  std::map<int, EntityComponent *> components_;
+  // Our components, indexed by their slot (see ComponentSlot). Slots we don't have a component for are null.
+  std::array<EntityComponent *, kMaxComponentSlots> component_slots_;
+
+  // All of our components in order of identifier, which is the order they're updated in.
+  std::vector<EntityComponent *> components_;
+
+  // Our components, grouped by their UpdatePhase.
+  std::vector<EntityComponent *> components_by_phase_[kNumUpdatePhases];
   std::map<std::string, EntityAttribute> attributes_;
   std::weak_ptr<Entity> creator_;
   std::vector<std::function<void()>> cleanup_functions_;
@@ -86,6 +152,15 @@ private:
   EntityDebugFlags debug_flags_;
   std::unique_ptr<EntityDebugView> debug_view_;
   EntityManager *mgr_;
+
+  // Our index in the EntityManager's list of entities, or -1 once we've been removed from it.
+  int manager_index_;
+
+  // Our contribution to the EntityManager's StateHash, or zero if we're not in it.
+  uint64_t state_hash_;
+
+  // Gets the values that go into our StateHash.
+  void get_hashed_state(fw::Vector &position, float &health);
 public:
   ~Entity();
 
@@ -96,6 +171,13 @@ public:
   // determines whether we contain a component of the given type
   bool contains_component(int identifier) const;
 
+  // gets a mask with the get_component_bit() of each of our components set.
+  uint64_t get_component_bits();
+
+  static uint64_t get_component_bit(int identifier) {
+    return static_cast<uint64_t>(1) << get_component_slot(identifier);
+  }
+
   // adds an attribute, or gets a pointer to the attribute with the given name
   void add_attribute(EntityAttribute const &attr);
   EntityAttribute *get_attribute(std::string const &name);
@@ -120,14 +202,19 @@ public:
   void initialize();
 
   // this is a templated version of get_component that uses the fact that the components all
-  // have a static member called "identifier" which contains the identifier
+  // have a static member called "identifier" which contains the identifier. It's just a lookup in the slot array,
+  // the component in T's slot is always a T (or a subclass of T), so no dynamic_cast is needed.
   template<class T>
   inline T *get_component() {
-    return dynamic_cast<T *>(get_component(T::identifier));
+    EntityComponent *comp = component_slots_[ComponentSlot<T>::value];
+    assert(comp == nullptr || dynamic_cast<T *>(comp) != nullptr);
+    return static_cast<T *>(comp);
   }
   template<class T>
   inline T const *get_component() const {
-    return dynamic_cast<T const *>(get_component(T::identifier));
+    EntityComponent const *comp = component_slots_[ComponentSlot<T>::value];
+    assert(comp == nullptr || dynamic_cast<T const *>(comp) != nullptr);
+    return static_cast<T const *>(comp);
   }
 
   template<class T>
@@ -135,12 +222,19 @@ public:
     return contains_component(T::identifier);
   }
 
-  // these are called each frame to update the Entity
-  void update(float dt);
+  // these are called each frame to update the Entity, once for each phase. prepare_update is called for every Entity
+  // in parallel, then update is called on each Entity in turn. See EntityComponent::prepare_update.
+  void prepare_update(UpdatePhase phase, float dt);
+  void update(UpdatePhase phase, float dt);
 
   // this is a helper that you can use to move an Entity directly to somewhere on the map.
   void set_position(fw::Vector const &pos);
 
+  // Gets the part of our state that goes into the StateHash, and updates our contribution to it. Components call
+  // update_state_hash whenever they change any of that state (our position or health).
+  EntityState get_state();
+  void update_state_hash();
+
   void set_debug_flags(EntityDebugFlags flags) {
     debug_flags_ = flags;
   }
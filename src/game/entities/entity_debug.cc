@@ -244,11 +244,14 @@ void EntityDebugView::update(float dt) {
         scenegraph.add_node(sg_node);
       }
       
-      std::shared_ptr<fw::VertexBuffer> vb = fw::VertexBuffer::create<fw::vertex::xyz_c>();
+      // Keep using the same (dynamic) buffer, rather than making a new one every update.
+      std::shared_ptr<fw::VertexBuffer> vb = sg_node->get_vertex_buffer();
+      if (!vb) {
+        vb = fw::VertexBuffer::create<fw::vertex::xyz_c>(true);
+        sg_node->set_vertex_buffer(vb);
+      }
       vb->set_data(vertices_size, vertices);
       delete[] vertices;
-
-      sg_node->set_vertex_buffer(vb);
     });
 }
 
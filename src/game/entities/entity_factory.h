@@ -7,15 +7,17 @@
 
 #include <framework/lua.h>
 
+#include <game/entities/component_pool.h>
 #include <game/entities/entity_attribute.h>
 
 namespace fw {
 class XmlElement;
 }
 
-// This is a helper macro for registering component types with the entity_factory.
+// This is a helper macro for registering component types with the entity_factory. Components of the given type are
+// allocated from it's ComponentPool.
 #define ENT_COMPONENT_REGISTER(name, type) \
-  ent::component_register reg_ ## type(name, []() { return new type(); })
+  ent::component_register reg_ ## type(name, []() { return ent::ComponentPool<type>::get().allocate(); })
 
 namespace ent {
 class Entity;
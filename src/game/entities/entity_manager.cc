@@ -1,10 +1,12 @@
+#include <algorithm>
+#include <chrono>
 #include <functional>
 
 #include <framework/framework.h>
 #include <framework/camera.h>
 #include <framework/input.h>
+#include <framework/job_system.h>
 #include <framework/graphics.h>
-#include <framework/timer.h>
 #include <framework/misc.h>
 #include <framework/logging.h>
 
@@ -13,21 +15,32 @@
 #include <game/entities/entity.h>
 #include <game/entities/entity_factory.h>
 #include <game/entities/entity_manager.h>
+#include <game/entities/mesh_component.h>
 #include <game/entities/entity_debug.h>
 #include <game/entities/position_component.h>
 #include <game/entities/ownable_component.h>
 #include <game/entities/selectable_component.h>
+#include <game/entities/spatial_index.h>
 
 using namespace std::placeholders;
 
 namespace ent {
 
+// The entities "near" the view center are the ones within this distance of it. We look at whole blocks of this size
+// (aligned to the world), so it's actually a bit more than that depending on where the view center is.
+static const int kViewAreaSize = 64;
+
+// The number of entities in each job when we prepare_update the entities in parallel. Each one is pretty quick (a
+// query of the spatial index at most), so we don't want jobs that are too small.
+static const int kUpdateBatchSize = 64;
+
 EntityManager::EntityManager() :
-    patch_mgr_(0), debug_(0) {
+    spatial_index_(0), debug_(0), time_(0.0f), job_system_(nullptr), view_turn_(0), view_turn_length_ms_(0.0f),
+    view_turn_alpha_(1.0f) {
 }
 
 EntityManager::~EntityManager() {
-  delete patch_mgr_;
+  delete spatial_index_;
   delete debug_;
 }
 
@@ -36,7 +49,7 @@ void EntityManager::initialize() {
   auto terrain = wrld->get_terrain();
 
   debug_ = new EntityDebug(this);
-  patch_mgr_ = new PatchManager(
+  spatial_index_ = new SpatialIndex(
       static_cast<float>(terrain->get_width()),
       static_cast<float>(terrain->get_length()));
 }
@@ -64,7 +77,7 @@ std::shared_ptr<Entity> EntityManager::create_entity(
     PositionComponent *creator_pos = created_by->get_component<PositionComponent>();
     PositionComponent *new_pos = ent->get_component<PositionComponent>();
     if (new_pos != nullptr && creator_pos != nullptr) {
-      new_pos->set_position(creator_pos->get_position());
+      new_pos->set_fixed_position(creator_pos->get_fixed_position());
     }
 
     // if they're both ownable, set the new Entity's owner to the given value.
@@ -79,15 +92,29 @@ std::shared_ptr<Entity> EntityManager::create_entity(
 
   LOG(DBG) << "created entity: " << template_name << "(identifier: " << id << ")";
 
-  for (auto& pair : ent->components_) {
-    EntityComponent *comp = pair.second;
+  for (EntityComponent *comp : ent->components_) {
     if (comp->allow_get_by_component()) {
       std::list<std::weak_ptr<Entity>> &entities_by_component = get_entities_by_component(comp->get_identifier());
       entities_by_component.push_back(ent);
     }
   }
 
-  all_entities_.push_back(ent);
+  ent->manager_index_ = static_cast<int>(entities_.size());
+  entities_.push_back(ent);
+  if (id != 0) {
+    entities_by_id_[id] = ent->manager_index_;
+  }
+
+  // we're part of the state of the game now, and so is our health whenever it changes (the position component takes
+  // care of the position). The attribute belongs to the entity, so it's always safe to use the raw pointer.
+  ent->update_state_hash();
+  EntityAttribute *health = ent->get_attribute("health");
+  if (health != nullptr) {
+    Entity *raw_ent = ent.get();
+    health->sig_value_changed.Connect([raw_ent](std::string_view, std::any) {
+      raw_ent->update_state_hash();
+    });
+  }
   return ent;
 }
 
@@ -107,7 +134,7 @@ void EntityManager::destroy(std::weak_ptr<Entity> entity) {
 std::weak_ptr<Entity> EntityManager::get_entity(std::function<float(std::shared_ptr<Entity> &)> pred) {
   std::shared_ptr<Entity> curr_entity;
   float last_pred = 0.0f;
-  for(std::shared_ptr<Entity> &ent : all_entities_) {
+  for(std::shared_ptr<Entity> &ent : entities_) {
     if (!curr_entity) {
       curr_entity = ent;
       last_pred = pred(ent);
@@ -125,7 +152,7 @@ std::weak_ptr<Entity> EntityManager::get_entity(std::function<float(std::shared_
 
 std::list<std::weak_ptr<Entity>> EntityManager::get_entities(std::function<bool(std::shared_ptr<Entity> &)> pred) {
   std::list<std::weak_ptr<Entity>> entities;
-  for (std::shared_ptr<Entity>& ent : all_entities_) {
+  for (std::shared_ptr<Entity>& ent : entities_) {
     if (pred(ent)) {
       entities.push_back(std::weak_ptr<Entity > (ent));
     }
@@ -155,51 +182,42 @@ std::weak_ptr<Entity> EntityManager::get_entity_at_cursor() {
 std::weak_ptr<Entity> EntityManager::get_entity(fw::Vector const &start, fw::Vector const &direction) {
   fw::Vector location = get_view_center();
 
-  int centre_patch_x = (int) (location[0] / PatchManager::PATCH_SIZE);
-  int centre_patch_z = (int) (location[2] / PatchManager::PATCH_SIZE);
-
-  for (int patch_z = centre_patch_z - 1; patch_z <= centre_patch_z + 1; patch_z++) {
-    for (int patch_x = centre_patch_x - 1; patch_x <= centre_patch_x + 1; patch_x++) {
-      Patch *p = patch_mgr_->get_patch(patch_x, patch_z);
+  int centre_area_x = static_cast<int>(location[0] / kViewAreaSize);
+  int centre_area_z = static_cast<int>(location[2] / kViewAreaSize);
 
-      fw::Vector offset = fw::Vector(
-          (float) (patch_x * PatchManager::PATCH_SIZE) - p->get_origin()[0],
-          0,
-          (float) (patch_z * PatchManager::PATCH_SIZE) - p->get_origin()[2]);
+  std::weak_ptr<Entity> found;
+  spatial_index_->for_each_in_rect(
+      static_cast<float>((centre_area_x - 1) * kViewAreaSize), static_cast<float>((centre_area_z - 1) * kViewAreaSize),
+      static_cast<float>((centre_area_x + 2) * kViewAreaSize) - 1.0f,
+      static_cast<float>((centre_area_z + 2) * kViewAreaSize) - 1.0f,
+      [&](SpatialIndex::Entry const &entry, fw::Vector const &offset) {
+        if (!found.expired())
+          return;
 
-      std::list<std::weak_ptr<Entity> > patch_entities = p->get_entities();
-      for (auto it = patch_entities.begin(); it != patch_entities.end(); ++it) {
-        std::shared_ptr<Entity> Entity = (*it).lock();
-        if (!Entity)
-          continue;
-
-        SelectableComponent *sel = Entity->get_component<SelectableComponent>();
+        SelectableComponent *sel = entry.entity->get_component<SelectableComponent>();
         if (sel == nullptr)
-          continue;
+          return;
 
-        PositionComponent *pos = Entity->get_component<PositionComponent>();
+        PositionComponent *pos = entry.entity->get_component<PositionComponent>();
         if (pos == nullptr)
-          continue;
+          return;
 
         float distance = fw::distance_between_line_and_point(start, direction, pos->get_position(false) + offset);
         if (distance < sel->get_selection_radius()) {
-          return std::weak_ptr < ent::Entity > (Entity);
+          found = spatial_index_->get_entity(entry);
         }
-      }
-    }
-  }
+      });
 
-  return std::weak_ptr<Entity>();
+  return found;
 }
 
 std::weak_ptr<Entity> EntityManager::get_entity(entity_id id) {
-  // obviously, this is dumb... we should index entities by the identifier for fast access
-  for (std::shared_ptr<Entity>& ent : all_entities_) {
-    if (ent->get_id() == id)
-      return std::weak_ptr<Entity>(ent);
+  auto it = entities_by_id_.find(id);
+  if (it == entities_by_id_.end()) {
+    return std::weak_ptr<Entity>();
   }
 
-  return std::weak_ptr<Entity>();
+  return std::weak_ptr<Entity>(entities_[it->second]);
 }
 
 // gets a reference to a list of all the entities with the component with the given identifier.
@@ -249,30 +267,55 @@ void EntityManager::clear_selection() {
   selected_entities_.clear();
 }
 
+void EntityManager::remove_entity(Entity &entity) {
+  const int index = entity.manager_index_;
+  if (index < 0) {
+    // it's already been removed (it was probably destroyed twice)
+    return;
+  }
+
+  PositionComponent *position = entity.get_component<PositionComponent>();
+  if (position != nullptr) {
+    position->remove_from_spatial_index();
+  }
+
+  if (entity.get_id() != 0) {
+    entities_by_id_.erase(entity.get_id());
+  }
+
+  // move the last entity into this one's place
+  const int last_index = static_cast<int>(entities_.size()) - 1;
+  if (index != last_index) {
+    std::shared_ptr<Entity> &last = entities_[last_index];
+    last->manager_index_ = index;
+    if (last->get_id() != 0) {
+      entities_by_id_[last->get_id()] = index;
+    }
+    entities_[index] = std::move(last);
+  }
+  entities_.pop_back();
+  entity.manager_index_ = -1;
+
+  state_hash_.replace(entity.state_hash_, 0);
+  entity.state_hash_ = 0;
+}
+
 void EntityManager::cleanup_destroyed() {
   // go through the destroyed list and destroy all entities that have been marked as such
-  for(auto ent : destroyed_entities_) {
-    for (auto it = all_entities_.begin(); it != all_entities_.end();) {
-      if (*it == ent) {
-        it = all_entities_.erase(it);
-      } else {
-        ++it;
-      }
-    }
+  for(auto &ent : destroyed_entities_) {
+    remove_entity(*ent);
   }
   destroyed_entities_.clear();
 
   // clear the other Entity list(s) of entities that have been destroyed
   selected_entities_.remove_if(std::bind(&std::weak_ptr<Entity> ::expired, _1));
 
-  for(auto it : entities_by_component_) {
+  for(auto &it : entities_by_component_) {
     it.second.remove_if(std::bind(&std::weak_ptr<Entity>::expired, _1));
   }
 }
 
 void EntityManager::update() {
-  cleanup_destroyed();
-
   // work out the current "view center" which is used for things like drawing
   // the entities centred around the camera and so on.
   game::World *wrld = game::World::get_instance();
@@ -282,43 +325,84 @@ void EntityManager::update() {
 
   fw::Vector location = wrld->get_terrain()->get_cursor_location(cam_loc, cam_dir);
   view_center_ = fw::Vector(
-      fw::constrain(location[0], this->get_patch_manager()->get_world_width(), 0.0f),
+      fw::constrain(location[0], spatial_index_->get_world_width(), 0.0f),
       location[1],
-      fw::constrain(location[2], this->get_patch_manager()->get_world_length(), 0.0f));
+      fw::constrain(location[2], spatial_index_->get_world_length(), 0.0f));
+
+  // entities near the view center might need to be drawn on the other side of the edge of the world (if the view
+  // center is near the edge), so update their offsets.
+  int center_area_x = static_cast<int>(location[0] / kViewAreaSize);
+  int center_area_z = static_cast<int>(location[2] / kViewAreaSize);
+  spatial_index_->for_each_in_rect(
+      static_cast<float>((center_area_x - 1) * kViewAreaSize), static_cast<float>((center_area_z - 1) * kViewAreaSize),
+      static_cast<float>((center_area_x + 2) * kViewAreaSize) - 1.0f,
+      static_cast<float>((center_area_z + 2) * kViewAreaSize) - 1.0f,
+      [](SpatialIndex::Entry const &entry, fw::Vector const &offset) {
+        auto attr = entry.entity->get_attribute("patch_offset_");
+        if (attr != nullptr) {
+          attr->set_value(offset);
+        }
+      });
 
-  // update all of the entities
-  float dt = fw::Framework::get_instance()->get_timer()->get_update_time();
-  for(auto &ent : all_entities_) {
-    ent->update(dt);
+  // move the meshes the right part of the way through the turn, every update (not just the ones that simulate a turn)
+  if (view_turn_length_ms_ > 0.0f) {
+    const float elapsed_ms = std::chrono::duration<float, std::milli>(fw::Clock::now() - view_turn_start_).count();
+    view_turn_alpha_ = std::clamp(elapsed_ms / view_turn_length_ms_, 0.0f, 1.0f);
+  }
+  for (auto &ent : entities_) {
+    MeshComponent *mesh = ent->get_component<MeshComponent>();
+    if (mesh != nullptr) {
+      mesh->update_view();
+    }
   }
 
-  int center_patch_x = (int)(location[0] / PatchManager::PATCH_SIZE);
-  int center_patch_z = (int)(location[2] / PatchManager::PATCH_SIZE);
-  for (int patch_z = center_patch_z - 1; patch_z <= center_patch_z + 1; patch_z++) {
-    for (int patch_x = center_patch_x - 1; patch_x <= center_patch_x + 1; patch_x++) {
-      Patch* p = patch_mgr_->get_patch(patch_x, patch_z);
-
-      fw::Vector patch_offset(
-        (float)(patch_x * PatchManager::PATCH_SIZE) - p->get_origin()[0],
-        0,
-        (float)(patch_z * PatchManager::PATCH_SIZE) - p->get_origin()[2]);
+  // update the EntityDebug interface
+  debug_->update();
+}
 
-      std::list<std::weak_ptr<Entity> > patch_entities = p->get_entities();
-      for (auto it = patch_entities.begin(); it != patch_entities.end(); ++it) {
-        auto entity = (*it).lock();
-        if (!entity)
-          continue;
+void EntityManager::start_view_turn(float turn_length_ms) {
+  view_turn_++;
+  view_turn_start_ = fw::Clock::now();
+  view_turn_length_ms_ = turn_length_ms;
+  view_turn_alpha_ = 0.0f;
+}
 
-        auto attr = entity->get_attribute("patch_offset_");
-        if (attr != nullptr) {
-          attr->set_value(patch_offset);
-        }
+void EntityManager::simulate(float dt) {
+  cleanup_destroyed();
+  time_ += dt;
+
+  // We update the entities one phase at a time. In each phase, all of the entities do their (read-only) queries in
+  // prepare_update in parallel, then we update them one at a time, in order, and that's where anything actually
+  // changes. Nothing changes while the jobs are running, so we get exactly the same result no matter how many threads
+  // there are, or what order the jobs run in.
+  fw::JobSystem *job_system =
+      job_system_ != nullptr ? job_system_ : fw::Framework::get_instance()->get_job_system();
+  for (int i = 0; i < kNumUpdatePhases; i++) {
+    const UpdatePhase phase = static_cast<UpdatePhase>(i);
+
+    // entities can create other entities while they update (e.g. when they fire a weapon), which can reallocate
+    // entities_, so we index rather than iterate. New entities join in from the next phase.
+    const int num_entities = static_cast<int>(entities_.size());
+    job_system->parallel_for(num_entities, kUpdateBatchSize, [this, phase, dt](int begin, int end) {
+      for (int j = begin; j < end; j++) {
+        entities_[j]->prepare_update(phase, dt);
       }
+    });
+
+    for (int j = 0; j < num_entities; j++) {
+      Entity *ent = entities_[j].get();
+      ent->update(phase, dt);
     }
   }
 
-  // update the EntityDebug interface
-  debug_->update();
+  if (state_hash_.is_snapshot_requested()) {
+    std::vector<EntityState> snapshot;
+    snapshot.reserve(entities_.size());
+    for (auto &ent : entities_) {
+      snapshot.push_back(ent->get_state());
+    }
+    state_hash_.set_snapshot(std::move(snapshot));
+  }
 }
 
 }
@@ -1,37 +1,65 @@
 #pragma once
 
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <framework/scenegraph.h>
 #include <framework/math.h>
 
 #include <game/entities/entity.h>
+#include <game/entities/state_hash.h>
 
 namespace fw {
 class Graphics;
+class JobSystem;
 }
 
 namespace ent {
 class Entity;
 class EntityDebug;
-class PatchManager;
+class SpatialIndex;
 
 // Manages all the entities in the game, and contains various "indexes" of entities so that we
 // can access them efficiently.
 class EntityManager {
 private:
-  std::list<std::shared_ptr<Entity>> all_entities_;
-  std::list<std::shared_ptr<Entity>> destroyed_entities_;
+  // All of the live entities, packed together so that update() can run over them without chasing pointers through a
+  // list. Each Entity knows it's own index in here, so removing one is just a matter of moving the last entity into
+  // it's place. That means the order changes as entities are destroyed, but it changes the same way on every peer.
+  std::vector<std::shared_ptr<Entity>> entities_;
+
+  // Index into entities_ of each entity, by identifier. Entities created locally (projectiles, explosions and so on)
+  // all have an identifier of 0, they can't be looked up by identifier so they're not in here.
+  std::unordered_map<entity_id, int> entities_by_id_;
+
+  std::vector<std::shared_ptr<Entity>> destroyed_entities_;
   std::list<std::weak_ptr<Entity>> selected_entities_;
 
   std::map<int, std::list<std::weak_ptr<Entity>>> entities_by_component_;
 
   EntityDebug *debug_;
-  PatchManager *patch_mgr_;
+  SpatialIndex *spatial_index_;
   fw::Vector view_center_;
 
+  // The total time (in seconds) that we've simulated, see get_time().
+  float time_;
+
+  // The JobSystem that simulate() runs prepare_update on, or null for the framework's.
+  fw::JobSystem *job_system_;
+
+  // The turns that the view is drawing the entities moving through, see start_view_turn().
+  int64_t view_turn_;
+  fw::Clock::time_point view_turn_start_;
+  float view_turn_length_ms_;
+  float view_turn_alpha_;
+
+  // The hash of the state of all our entities, which each Entity keeps up-to-date as it changes.
+  StateHash state_hash_;
+
   // removes the destroyed entities from the various lists
   void cleanup_destroyed();
+  void remove_entity(Entity &entity);
 
 public:
   EntityManager();
@@ -93,9 +121,49 @@ public:
 
   void update();
 
-  // gets the patch_manager which manages the patches of entities.
-  PatchManager *get_patch_manager() const {
-    return patch_mgr_;
+  // Updates all of the entities by dt seconds. This is what actually changes the state of the game: it's called once
+  // per turn with a fixed dt (see SimulationThread::simulate_turns, and the replay tool), while update() only does
+  // the work for the view, once per frame.
+  void simulate(float dt);
+
+  // Runs simulate() on the given JobSystem rather than the framework's (pass null to go back to the framework's). This
+  // is so the replay tool can check that we get the same result no matter how many threads there are.
+  void set_job_system(fw::JobSystem *job_system) {
+    job_system_ = job_system;
+  }
+
+  // Called on the update thread when a turn of the given length has been simulated. The view then draws the entities
+  // moving from where they were at the end of the last turn to where they are now over the length of the turn,
+  // starting from now (see MeshComponent::update_view).
+  void start_view_turn(float turn_length_ms);
+
+  // The number of turns the view has started, and how far (from 0 to 1) the current update is through the last one.
+  int64_t get_view_turn() const {
+    return view_turn_;
+  }
+  float get_view_turn_alpha() const {
+    return view_turn_alpha_;
+  }
+
+  // The total time we've simulated so far. Entities should use this rather than the real time, so that they do the
+  // same thing when a game is replayed faster or slower than it was played.
+  float get_time() const {
+    return time_;
+  }
+
+  // The hash of the state of all the entities, see StateHash.
+  StateHash &get_state_hash() {
+    return state_hash_;
+  }
+
+  // All of the live entities, in the order that we update them.
+  std::vector<std::shared_ptr<Entity>> const &get_all_entities() const {
+    return entities_;
+  }
+
+  // gets the SpatialIndex that we use to find entities by their position.
+  SpatialIndex *get_spatial_index() const {
+    return spatial_index_;
   }
 };
 
@@ -12,6 +12,7 @@
 
 #include <game/entities/entity.h>
 #include <game/entities/entity_factory.h>
+#include <game/entities/entity_manager.h>
 #include <game/entities/position_component.h>
 #include <game/entities/mesh_component.h>
 #include <game/entities/ownable_component.h>
@@ -57,7 +58,13 @@ void MeshComponent::initialize() {
     }
   }
 
-  auto model = fw::Framework::get_instance()->get_model_manager()->get_model(model_name_);
+  fw::ModelManager *model_manager = fw::Framework::get_instance()->get_model_manager();
+  if (model_manager == nullptr) {
+    // no graphics (e.g. we're replaying a game headless), so there's nothing to draw.
+    return;
+  }
+
+  auto model = model_manager->get_model(model_name_);
   if (!model.ok()) {
     LOG(ERR) << "error loading model: " << model.status();
   } else {
@@ -70,23 +77,31 @@ void MeshComponent::initialize() {
   }
 }
 
-void MeshComponent::update(float dt) {
+void MeshComponent::update_view() {
   std::shared_ptr<Entity> entity(entity_);
   if (!entity) return;
 
   auto pos = entity->get_component<PositionComponent>();
-  if (pos != nullptr) {
-    fw::Matrix transform = pos->get_transform();
+  if (pos != nullptr && sg_node_) {
+    // the simulation only moves us once a turn, but we move a little way towards where it has us every update.
+    EntityManager *manager = entity->get_manager();
+    if (view_turn_ != manager->get_view_turn() || !turn_transform_.has_target()) {
+      turn_transform_.set_target(pos->get_transform());
+      view_turn_ = manager->get_view_turn();
+    }
+    fw::Matrix transform = turn_transform_.get(manager->get_view_turn_alpha());
 
     auto offset = entity->get_attribute("patch_offset_");
     if (offset != nullptr) {
       transform *= fw::translation(offset->get_value<fw::Vector>());
     }
 
-    fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
-      [transform, sg_node=sg_node_](fw::sg::Scenegraph& sg) {
-        sg_node->transform = transform;
-      });
+    // This happens for every entity, every update, so it goes through the transform channel rather than a closure.
+    // The node stays alive until it's removed in our destructor, which is always after this.
+    const fw::Matrix previous = has_last_transform_ ? last_transform_ : transform;
+    fw::Framework::get_instance()->get_scenegraph_manager()->set_transform(sg_node_.get(), previous, transform);
+    last_transform_ = transform;
+    has_last_transform_ = true;
   }
 }
 
@@ -4,6 +4,7 @@
 #include <framework/graphics.h>
 #include <framework/model.h>
 #include <framework/model_node.h>
+#include <framework/scenegraph.h>
 
 #include <game/entities/entity.h>
 
@@ -20,6 +21,15 @@ private:
   // The scenegraph node representing this entity.
   std::shared_ptr<fw::ModelNode> sg_node_;
 
+  // Where the simulation had us at the end of the last two turns, we're drawn moving between them over the current
+  // one. view_turn_ is the EntityManager's view turn that we last set the target for.
+  fw::sg::TurnInterpolator turn_transform_;
+  int64_t view_turn_ = -1;
+
+  // The transform we gave the node last update, so the renderer can interpolate from it to the new one.
+  fw::Matrix last_transform_;
+  bool has_last_transform_ = false;
+
 public:
   static const int identifier = 200;
 
@@ -30,7 +40,9 @@ public:
   void apply_template(fw::lua::Value tmpl) override;
 
   void initialize() override;
-  void update(float dt) override;
+
+  // Called every update (see EntityManager::update) to move our node part of the way through the current turn.
+  void update_view();
 
   // Gets the scenegraph node this mesh component holds. Must be called on the render thread.
   inline std::shared_ptr<fw::ModelNode> get_sg_node() const {
@@ -17,6 +17,13 @@ namespace ent {
 // register the moveable component with the entity_factory
 ENT_COMPONENT_REGISTER("Moveable", MoveableComponent);
 
+// Moving is part of the simulation, so it's all done in fixed-point (see fw::Fixed). These are the thresholds we use.
+static constexpr fw::Fixed kCloseEnough = fw::Fixed::from_float(0.1f);
+static constexpr fw::Fixed kDirectlyInFront = fw::Fixed::from_float(0.01f);
+static constexpr fw::Fixed kAlmostFacingGoal = fw::Fixed::from_float(0.95f);
+static constexpr fw::Fixed kMinSpeedScale = fw::Fixed::from_float(0.75f);
+static constexpr fw::Fixed kMinTurnScale = fw::Fixed::from_float(0.25f);
+
 MoveableComponent::MoveableComponent() :
     position_component_(nullptr), pathing_component_(nullptr), speed_(3.0f), turn_speed_(1.0f),
     avoid_collisions_(true), is_moving_(false) {
@@ -41,42 +48,42 @@ void MoveableComponent::initialize() {
   std::shared_ptr<Entity> entity(entity_);
   pathing_component_ = entity->get_component<PathingComponent>();
   position_component_ = entity->get_component<PositionComponent>();
-  goal_ = position_component_->get_position();
+  goal_ = position_component_->get_fixed_position();
   is_moving_ = false;
 }
 
 // TODO: skip_pathing is such a hack
 void MoveableComponent::set_goal(fw::Vector goal, bool skip_pathing /*= false*/) {
   std::shared_ptr<Entity> entity(entity_);
-  float world_width = entity->get_manager()->get_patch_manager()->get_world_width();
-  float world_length = entity->get_manager()->get_patch_manager()->get_world_length();
+  fw::Fixed world_width = fw::Fixed::from_float(entity->get_manager()->get_spatial_index()->get_world_width());
+  fw::Fixed world_length = fw::Fixed::from_float(entity->get_manager()->get_spatial_index()->get_world_length());
 
   // make sure we constraining the goal to the bounds of the map
-  goal_ = fw::Vector(
-      fw::constrain(goal[0], world_width, 0.0f),
-      0.0f,
-      fw::constrain(goal[2], world_length, 0.0f));
+  goal_ = fw::FixedVector(
+      fw::constrain(fw::Fixed::from_float(goal[0]), world_width, fw::Fixed()),
+      fw::Fixed(),
+      fw::constrain(fw::Fixed::from_float(goal[2]), world_length, fw::Fixed()));
   if (skip_pathing || pathing_component_ == nullptr) {
-    set_intermediate_goal(goal_);
+    set_intermediate_goal(goal_.to_vector());
   } else {
     // Start off with intermedia_goal set to the current position, and stop moving until we get a path.
-    intermediate_goal_ = position_component_->get_position();
+    intermediate_goal_ = position_component_->get_fixed_position();
     is_moving_ = false;
 
-    pathing_component_->set_goal(goal_);
+    pathing_component_->set_goal(goal_.to_vector());
   }
 }
 
 void MoveableComponent::set_intermediate_goal(fw::Vector goal) {
   std::shared_ptr<Entity> entity(entity_);
-  float world_width = entity->get_manager()->get_patch_manager()->get_world_width();
-  float world_length = entity->get_manager()->get_patch_manager()->get_world_length();
+  fw::Fixed world_width = fw::Fixed::from_float(entity->get_manager()->get_spatial_index()->get_world_width());
+  fw::Fixed world_length = fw::Fixed::from_float(entity->get_manager()->get_spatial_index()->get_world_length());
 
   // make sure we constraining the goal to the bounds of the map
-  intermediate_goal_ = fw::Vector(
-      fw::constrain(goal[0], world_width, 0.0f),
-      0.0f,
-      fw::constrain(goal[2], world_length, 0.0f));
+  intermediate_goal_ = fw::FixedVector(
+      fw::constrain(fw::Fixed::from_float(goal[0]), world_width, fw::Fixed()),
+      fw::Fixed(),
+      fw::constrain(fw::Fixed::from_float(goal[2]), world_length, fw::Fixed()));
   is_moving_ = true;
 }
 
@@ -87,17 +94,25 @@ void MoveableComponent::stop() {
   }
 }
 
+void MoveableComponent::prepare_update(float) {
+  if (is_moving_ && avoid_collisions_) {
+    nearest_obstacle_ = position_component_->get_nearest_entity();
+  } else {
+    nearest_obstacle_.reset();
+  }
+}
+
 void MoveableComponent::update(float dt) {
   if (!is_moving_) {
     return;
   }
 
-  fw::Vector pos = position_component_->get_position();
-  pos[1] = 0.0f; // ignore terrain height.
-  fw::Vector goal = intermediate_goal_;
-  fw::Vector dir = position_component_->get_direction_to(goal, /*ignore_height=*/true);
-  float distance = dir.length();
-  if (distance < 0.1f) {
+  fw::FixedVector pos = position_component_->get_fixed_position();
+  pos.y = fw::Fixed(); // ignore terrain height.
+  fw::FixedVector goal = intermediate_goal_;
+  fw::FixedVector dir = position_component_->get_fixed_direction_to(goal, /*ignore_height=*/true);
+  fw::Fixed distance = dir.length();
+  if (distance < kCloseEnough) {
     // we're close enough to the goal, so just stop!
     is_moving_ = false;
     return;
@@ -105,119 +120,125 @@ void MoveableComponent::update(float dt) {
 
   std::shared_ptr<Entity> entity(entity_);
   const bool show_steering = (entity->has_debug_view() && (entity->get_debug_flags() & kDebugShowSteering) != 0);
+  const fw::FixedVector curr_direction = position_component_->get_fixed_direction();
 
   // if we're avoiding obstacles, we'll need to figure out what is the closest Entity to us
   if (avoid_collisions_) {
-    std::shared_ptr<ent::Entity> obstacle = position_component_->get_nearest_entity().lock();
+    std::shared_ptr<ent::Entity> obstacle = nearest_obstacle_.lock();
     if (obstacle) {
-      fw::Vector obstacle_dir = position_component_->get_direction_to(obstacle);
-      float obstacle_distance = obstacle_dir.length();
+      fw::FixedVector obstacle_dir = position_component_->get_fixed_direction_to(obstacle);
+      fw::Fixed obstacle_distance = obstacle_dir.length();
 
       // only worry about the obstacle when it's in front of us
-      float d = fw::dot(position_component_->get_direction().normalized(), obstacle_dir.normalized());
-    //  LOG(INFO) << "cml::dot(_position_component->get_direction(), obstacle_dir) = " << d << std::endl;
-      if (d > 0.0f) {
+      fw::Fixed d = fw::dot(curr_direction.normalized(), obstacle_dir.normalized());
+      if (d > fw::Fixed()) {
         // if they're selectable, reduce the distance by their selection radius - that's what we ACTUALLY want to
         // avoid...
-        float obstacle_radius = 1.0f;
+        fw::Fixed obstacle_radius = fw::Fixed::from_int(1);
         SelectableComponent *their_selectable = obstacle->get_component<SelectableComponent>();
         if (their_selectable != nullptr) {
-          obstacle_radius = their_selectable->get_selection_radius();
+          obstacle_radius = fw::Fixed::from_float(their_selectable->get_selection_radius());
           obstacle_distance -= obstacle_radius;
         }
+        const fw::Fixed avoid_distance = obstacle_radius * fw::Fixed::from_int(2);
 
         // only worry about the obstacle if we're closer to it than to the goal...
-        if (obstacle_distance < (obstacle_radius * 2.0f) && obstacle_distance < distance) {
-          fw::Vector obstacle_pos = pos + obstacle_dir;
+        if (obstacle_distance < avoid_distance && obstacle_distance < distance) {
+          fw::FixedVector obstacle_pos = pos + obstacle_dir;
           if (show_steering) {
             // draw a circle around whatever we're trying to avoid
-            entity->get_debug_view().add_circle(obstacle_pos, obstacle_radius * 2.0f, fw::Color(1, 0, 0));
+            entity->get_debug_view().add_circle(
+                obstacle_pos.to_vector(), avoid_distance.to_float(), fw::Color(1, 0, 0));
           }
 
           // temporarily adjust the "goal" so as to avoid the obstacle
-          fw::Vector up = fw::cross(position_component_->get_direction(), obstacle_dir);
-          if (up.length() < 0.01f) {
+          fw::FixedVector up = fw::cross(curr_direction, obstacle_dir);
+          if (up.length() < kDirectlyInFront) {
             // if they're *directly* in front of us, just choose a random direction, left or right. we'll choose.. left
-            up = fw::Vector(0, 1, 0);
+            up = fw::FixedVector(fw::Fixed(), fw::Fixed::from_int(1), fw::Fixed());
           }
-          fw::Vector avoid_dir = fw::cross(position_component_->get_direction().normalized(), up.normalized());
+          fw::FixedVector avoid_dir = fw::cross(curr_direction.normalized(), up.normalized());
 
           if (show_steering) {
             // draw a blue line from the obstacle in the direction we're going to travel to avoid it.
-            entity->get_debug_view().add_line(
-                obstacle_pos, obstacle_pos + (avoid_dir * (obstacle_radius * 2.0f)), fw::Color(0, 0, 1));
+            entity->get_debug_view().add_line(obstacle_pos.to_vector(),
+                (obstacle_pos + (avoid_dir * avoid_distance)).to_vector(), fw::Color(0, 0, 1));
           }
 
           // our new goal is just in front of where we are now, but offset by what we're trying to avoid.
-          goal = position_component_->get_direction() + obstacle_pos + (avoid_dir * (obstacle_radius * 2.0f));
-          dir = position_component_->get_direction_to(goal);
+          goal = curr_direction + obstacle_pos + (avoid_dir * avoid_distance);
+          dir = position_component_->get_fixed_direction_to(goal);
           distance = dir.length();
         }
       }
     }
   }
 
-  float speed = speed_;
-  float turn_speed = turn_speed_;
+  // speed, turn speed and the time step come from floats, but each one is converted exactly once, so we all get the
+  // same fixed-point values from the same floats.
+  fw::Fixed speed = fw::Fixed::from_float(speed_);
+  fw::Fixed turn_speed = fw::Fixed::from_float(turn_speed_);
+  const fw::Fixed fixed_dt = fw::Fixed::from_float(dt);
 
   // adjust the speed and turn speed so that we slow down and turn faster when we get close (gives us a smaller
   // turning circle, to ensure we don't overshoot the target)
-  float turn_radius = 1.0f / turn_speed_;
-  float scale_factor = distance / (turn_radius / 0.25f);
+  fw::Fixed turn_radius = fw::Fixed::from_int(1) / turn_speed;
+  fw::Fixed scale_factor = distance / (turn_radius * fw::Fixed::from_int(4));
 
   if (show_steering) {
     // a line from us to the goal
-    entity->get_debug_view().add_line(pos, goal, fw::Color(0, 1, 0), /*offset_terrain_height=*/true);
+    entity->get_debug_view().add_line(
+        pos.to_vector(), goal.to_vector(), fw::Color(0, 1, 0), /*offset_terrain_height=*/true);
   }
 
-  if (scale_factor < 1.0f) {
-    speed *= (scale_factor < 0.75f ? 0.75f : scale_factor);
-    turn_speed *= 1.0f / (scale_factor < 0.25f ? 0.25f : scale_factor);
+  if (scale_factor < fw::Fixed::from_int(1)) {
+    speed *= (scale_factor < kMinSpeedScale ? kMinSpeedScale : scale_factor);
+    turn_speed /= (scale_factor < kMinTurnScale ? kMinTurnScale : scale_factor);
   }
 
   // turn towards the goal
-  dir = steer(position_component_->get_position(),
-      position_component_->get_direction(), dir, turn_speed * dt, show_steering);
+  dir = steer(position_component_->get_position(), curr_direction, dir, turn_speed * fixed_dt, show_steering);
 
   // move in the direction we're facing
-  pos += (dir * dt * speed);
+  pos += dir * (fixed_dt * speed);
 
-  position_component_->set_direction(dir);
-  position_component_->set_position(pos);
+  position_component_->set_fixed_direction(dir);
+  position_component_->set_fixed_position(pos);
 }
 
 // applies a steering factor to the "curr_direction" so that we slowly turn towards the goal_direction.
 //
 // if show_steering is true, we use the Entity's debug_view (which we assume is non-NULL
 //   to display the relevent steering vectors.
-fw::Vector MoveableComponent::steer(fw::Vector pos, fw::Vector curr_direction, fw::Vector goal_direction,
-    float turn_amount, bool show_steering) {
-  curr_direction.normalize();
-  goal_direction.normalize();
+fw::FixedVector MoveableComponent::steer(fw::Vector const &pos, fw::FixedVector curr_direction,
+    fw::FixedVector goal_direction, fw::Fixed turn_amount, bool show_steering) {
+  curr_direction = curr_direction.normalized();
+  goal_direction = goal_direction.normalized();
 
   // If we're almost facing the right direction already, just point straight towards the goal, no steering.
-  if (fw::dot(curr_direction, goal_direction) > 0.95f) {
+  const fw::Fixed cos_angle = fw::dot(curr_direction, goal_direction);
+  if (cos_angle > kAlmostFacingGoal) {
     return goal_direction;
   }
 
-  // so, to work out the steering factor, we start off by rotating the direction vector clockwise 90 degrees...
-  fw::Vector up = fw::cross(curr_direction, goal_direction).normalized();
-  fw::Quaternion rotation = fw::rotate_axis_angle(up, fw::pi() / 2.0f);
-  fw::Vector steer = (rotation * curr_direction).normalized();
-
-  // now, if the angle between steer and the goal is greater than 90,
-  // we need to steer in the other direction.
-  steer = fw::dot(steer, goal_direction) < 0.0f ? steer * -1.0f : steer;
+  // so, to work out the steering factor, we want the direction at 90 degrees to the current direction, on the same
+  // side as the goal. That's the part of the goal direction that isn't along the current direction. If the goal is
+  // directly behind us there's no such part, so we just pick one (turning left).
+  fw::FixedVector steer = (goal_direction - (curr_direction * cos_angle)).normalized();
+  if (steer == fw::FixedVector()) {
+    steer = fw::FixedVector(-curr_direction.z, fw::Fixed(), curr_direction.x).normalized();
+  }
 
   if (show_steering) {
     auto entity = entity_.lock();
     if (entity) {
       // draw the current "up" and "forward" vectors
+      fw::Vector up = fw::cross(curr_direction, goal_direction).normalized().to_vector();
       entity->get_debug_view().add_line(pos, pos + up, fw::Color(1, 1, 1));
-      entity->get_debug_view().add_line(pos, pos + curr_direction, fw::Color(1, 1, 1));
+      entity->get_debug_view().add_line(pos, pos + curr_direction.to_vector(), fw::Color(1, 1, 1));
 
       // draw the "steering" vector which is the direction we're going to steer in
-      entity->get_debug_view().add_line(pos, pos + steer, fw::Color(0, 1, 1));
+      entity->get_debug_view().add_line(pos, pos + steer.to_vector(), fw::Color(0, 1, 1));
     }
   }
 
@@ -226,18 +247,13 @@ fw::Vector MoveableComponent::steer(fw::Vector pos, fw::Vector curr_direction, f
   steer *= turn_amount;
 
   // adjust our current heading by applying a steering factor
-  fw::Vector new_direction = (curr_direction + steer);
-  new_direction.normalize();
+  fw::FixedVector new_direction = (curr_direction + steer).normalized();
 
   // if the new direction is on the other side of the goal_direction to the current
   // direction, that means we'd be over-steering. rather than do that (and wobble), we'll
-  // just start heading straight for the goal.
-  fw::Vector old_direction = curr_direction;
-  fw::Vector rotated = (rotation * goal_direction).normalized();
-
-  float old_direction_dot = fw::dot(old_direction, rotated);
-  float new_direction_dot = fw::dot(new_direction, rotated);
-  if ((old_direction_dot < 0 && new_direction_dot > 0) || (old_direction_dot > 0 && new_direction_dot < 0)) {
+  // just start heading straight for the goal. The current direction is always on the same side as "side".
+  fw::FixedVector side = curr_direction - (goal_direction * cos_angle);
+  if (fw::dot(new_direction, side) < fw::Fixed()) {
     return goal_direction;
   } else {
     return new_direction;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <framework/fixed.h>
 #include <framework/math.h>
 
 #include <game/entities/entity.h>
@@ -13,15 +14,18 @@ class MoveableComponent: public EntityComponent {
 private:
   PositionComponent *position_component_;
   PathingComponent *pathing_component_;
-  fw::Vector intermediate_goal_;
-  fw::Vector goal_;
+  fw::FixedVector intermediate_goal_;
+  fw::FixedVector goal_;
   float speed_;
   float turn_speed_;
   bool avoid_collisions_;
   bool is_moving_;
 
-  fw::Vector steer(fw::Vector pos, fw::Vector curr_direction,
-      fw::Vector goal_direction, float turn_amount, bool show_steering);
+  // The nearest Entity to us, which we might need to avoid. This is found in prepare_update.
+  std::weak_ptr<Entity> nearest_obstacle_;
+
+  fw::FixedVector steer(fw::Vector const &pos, fw::FixedVector curr_direction,
+      fw::FixedVector goal_direction, fw::Fixed turn_amount, bool show_steering);
 
 public:
   static const int identifier = 400;
@@ -35,6 +39,10 @@ public:
   void apply_template(fw::lua::Value tmpl) override;
 
   virtual void initialize();
+  UpdatePhase get_update_phase() const override {
+    return UpdatePhase::kMovement;
+  }
+  void prepare_update(float dt) override;
   virtual void update(float dt);
 
   void set_speed(float speed) {
@@ -49,7 +57,7 @@ public:
 
   void set_goal(fw::Vector goal, bool skip_pathing = false);
   fw::Vector get_goal() const {
-    return goal_;
+    return goal_.to_vector();
   }
 
   // Sets the "intermediate" goal, which is the location we're moving directly towards.
@@ -58,7 +66,7 @@ public:
   // have one), and the pathing_component will set intermediate goals as we go.
   void set_intermediate_goal(fw::Vector goal);
   fw::Vector get_intermediate_goal() const {
-    return intermediate_goal_;
+    return intermediate_goal_.to_vector();
   }
 
   // Stop moving.
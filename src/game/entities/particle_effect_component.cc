@@ -88,6 +88,13 @@ void ParticleEffectComponent::update(float) {
     if (effect_info.started && !effect_info.effect) {
       // It should be started, but it's not started yet, then start it.
       fw::ParticleManager* mgr = fw::Framework::get_instance()->get_particle_mgr();
+      if (mgr == nullptr) {
+        // no graphics (e.g. we're replaying a game headless), so the effect is over as soon as it starts.
+        if (effect_info.destroy_entity_on_complete) {
+          entity_.lock()->get_manager()->destroy(entity_);
+        }
+        return;
+      }
 
       // TODO: return the error?
       auto effect = mgr->CreateEffect(effect_info.name, our_position + effect_info.offset);
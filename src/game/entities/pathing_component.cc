@@ -2,25 +2,35 @@
 
 #include <framework/framework.h>
 #include <framework/logging.h>
+#include <framework/misc.h>
 #include <framework/timer.h>
 
 #include <game/entities/entity.h>
 #include <game/entities/entity_factory.h>
+#include <game/entities/entity_manager.h>
 #include <game/entities/pathing_component.h>
 #include <game/entities/position_component.h>
 #include <game/entities/moveable_component.h>
 #include <game/world/world.h>
+#include <game/world/terrain.h>
 #include <game/ai/pathing_thread.h>
 
 namespace ent {
 
 using namespace std::placeholders;
 
+// If the end of a path is further than this from the goal, the path is only partial.
+static const float kPartialPathDistance = 2.0f;
+
+// When we're following a partial path and we're down to this many nodes left to follow, we request the rest.
+static const size_t kContinuationNodes = 2;
+
 // register the pathing component with the entity_factory
 ENT_COMPONENT_REGISTER("Pathing", PathingComponent);
 
 PathingComponent::PathingComponent() :
-    position_(nullptr), moveable_(nullptr), curr_goal_node_(0), last_request_time_(0.0f) {
+    position_(nullptr), moveable_(nullptr), curr_goal_node_(0), last_request_time_(0.0f), path_partial_(false),
+    continuation_requested_(false) {
 }
 
 PathingComponent::~PathingComponent() {
@@ -42,6 +52,13 @@ void PathingComponent::update(float dt) {
       curr_goal_node_ = 0;
       new_path_.clear();
 
+      auto terrain = game::World::get_instance()->get_terrain();
+      fw::Vector dir = fw::get_direction_to(path_.back(), last_request_goal_,
+          static_cast<float>(terrain->get_width()), static_cast<float>(terrain->get_length()));
+      dir[1] = 0.0f; // path nodes don't have a height
+      path_partial_ = dir.length() > kPartialPathDistance;
+      continuation_requested_ = false;
+
       //TODO vector operator << for osteam
       //LOG(INFO) << "found path to [" << last_request_goal_ << "]: " << path_.size() << " node(s)" << std::endl;
     }
@@ -66,6 +83,10 @@ void PathingComponent::update(float dt) {
     break;
   }
 
+  if (path_partial_ && !continuation_requested_ && path_.size() - curr_goal_node_ <= kContinuationNodes) {
+    request_continuation();
+  }
+
   if (entity->has_debug_view() && (entity->get_debug_flags() & EntityDebugFlags::kDebugShowPathing) != 0) {
     for (int i = 0; i < static_cast<int>(path_.size()) - 1; i++) {
       const fw::Vector& from = path_[i];
@@ -82,7 +103,7 @@ bool PathingComponent::is_following_path() const {
 void PathingComponent::set_goal(fw::Vector const &goal) {
   // request a path from the Entity's current position to the given goal and get the pathing_thread to call our
   // set_path method when it's done
-  float now = fw::Framework::get_instance()->get_timer()->get_total_time();
+  float now = game::World::get_instance()->get_entity_manager()->get_time();
   if ((goal - last_request_goal_).length() < 1.0f) {
     // it's the same path as we're already following, don't request a new path more than one every few seconds
     // since there's really no point
@@ -98,9 +119,18 @@ void PathingComponent::set_goal(fw::Vector const &goal) {
       std::bind(&PathingComponent::on_path_found, this, _1));
 }
 
+void PathingComponent::request_continuation() {
+  // Carry on from the end of the path we've got, so that we don't have to backtrack when the new path comes back.
+  continuation_requested_ = true;
+  auto pathing_thread = game::World::get_instance()->get_pathing();
+  pathing_thread->request_path(path_.back(), last_request_goal_,
+      std::bind(&PathingComponent::on_path_found, this, _1));
+}
+
 void PathingComponent::stop() {
   path_.clear();
   curr_goal_node_ = 0;
+  path_partial_ = false;
 }
 
 void PathingComponent::on_path_found(std::vector<fw::Vector> const &path) {
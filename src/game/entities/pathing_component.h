@@ -20,6 +20,11 @@ private:
   float last_request_time_;
   size_t curr_goal_node_;
   std::vector<fw::Vector> path_;
+
+  // Long paths come back from the pathing thread only partially refined. If path_ stops short of our goal, this is
+  // true and we'll request the rest of the path once we get near the end of it.
+  bool path_partial_;
+  bool continuation_requested_;
   PositionComponent *position_;
   MoveableComponent *moveable_;
 
@@ -28,6 +33,8 @@ private:
   void on_path_found(std::vector<fw::Vector> const &path);
   std::vector<fw::Vector> new_path_;
 
+  void request_continuation();
+
 public:
   static const int identifier = 650;
   virtual int get_identifier() {
@@ -2,89 +2,34 @@
 
 #include <list>
 #include <memory>
+#include <vector>
 
+#include <framework/fixed.h>
 #include <framework/math.h>
 
 #include <game/entities/entity.h>
+#include <game/entities/entity_manager.h>
+#include <game/entities/spatial_index.h>
 
 namespace ent {
 
-// this is a "patch" for entities (with positions) exist on. The patches wrap at the edges of the world, just like the
-// terrain does. By having Entity patches that are separate to terrain patches, though, means we can make them on a
-// different scale (e.g. 4 Entity patches for every 1 terrain patch).
-class Patch {
-private:
-  fw::Vector origin_;
-  std::list<std::weak_ptr<Entity>> entities_;
-
-public:
-  Patch(fw::Vector const &origin);
-  ~Patch();
-
-  // adds the given Entity to this patch
-  void add_entity(std::weak_ptr<Entity> entity);
-
-  // removes the given Entity from this patch
-  void remove_entity(std::weak_ptr<Entity> entity);
-
-  // gets a COPY of the Entity list (this could be expensive...)
-  std::list<std::weak_ptr<Entity>> get_entities() {
-    return entities_;
-  }
-
-  fw::Vector const &get_origin() const {
-    return origin_;
-  }
-};
-
-// This class belongs to the EntityManager and manages the "patches" which belong to the game itself.
-class PatchManager {
-public:
-  static const int PATCH_SIZE = 64; // 1/2 of the terrain patch size
-private:
-  std::vector<Patch*> patches_;
-    int patch_width_;
-  int patch_length_;
-
-  int get_patch_index(int patch_x, int patch_z, int *new_patch_x = 0, int *new_patch_z = 0);
-
-public:
-  PatchManager(float size_x, float size_z);
-  ~PatchManager();
-
-  // gets the patch at the given (x, z) world-space coordinates
-  Patch *get_patch(float x, float z);
-
-  // gets the patch at the given patch (x, z) coordinates.
-  Patch *get_patch(int patch_x, int patch_z);
-
-  // gets the width/length of the world in "patches"
-  int get_patch_width() const {
-    return patch_width_;
-  }
-  int get_patch_length() const {
-    return patch_length_;
-  }
-
-  float get_world_width() const {
-    return static_cast<float>(patch_width_ * PATCH_SIZE);
-  }
-  float get_world_length() const {
-    return static_cast<float>(patch_length_ * PATCH_SIZE);
-  }
-};
-
 // the position component is a member of all entities that have position data (which, actually, is probably most of
 // them!)
+//
+// The position and direction are part of the simulation, so they're kept in fixed-point (see fw::FixedVector) to make
+// sure every player has exactly the same ones. The fw::Vector getters and setters are for everything else (drawing,
+// the spatial index and so on). "up" is only used for drawing, so it's just a float.
 class PositionComponent: public EntityComponent {
 private:
-  fw::Vector pos_;
-  fw::Vector dir_;
+  fw::FixedVector pos_;
+  fw::FixedVector dir_;
   fw::Vector up_;
   bool pos_updated_;
   bool sit_on_terrain_;
   bool orient_to_terrain_;
-  Patch *patch_;
+
+  // Our handle in the EntityManager's SpatialIndex, or -1 if we haven't been added to it yet.
+  int spatial_handle_;
 
   // if _pos_updated is true, this will calculation "real" position of the
   // Entity, taking _sit_on_terrain and _orient_to_terrain into account
@@ -98,6 +43,9 @@ public:
 
   virtual void apply_template(fw::lua::Value tmpl);
 
+  UpdatePhase get_update_phase() const override {
+    return UpdatePhase::kPosition;
+  }
   virtual void update(float dt);
 
   // gets the view transform for the Entity based on it's current world-space position
@@ -106,10 +54,16 @@ public:
   // gets or sets the current position of the Entity
   void set_position(fw::Vector const &pos);
   fw::Vector get_position(bool allow_update = true);
+  void set_fixed_position(fw::FixedVector const &pos);
+  fw::FixedVector get_fixed_position(bool allow_update = true);
 
   // gets or sets the direction the Entity is facing
   void set_direction(fw::Vector const &dir);
   fw::Vector get_direction() const;
+  void set_fixed_direction(fw::FixedVector const &dir);
+  fw::FixedVector get_fixed_direction() const {
+    return dir_;
+  }
 
   // gets or sets a value which indicates whether we want to ensure the Entity sits
   // on the terrain (for example, trees do, but missiles do not)
@@ -127,15 +81,15 @@ public:
     return orient_to_terrain_;
   }
 
-  // gets a pointer to the patch we're inside of
-  Patch *get_patch() const {
-    return patch_;
-  }
+  // removes us from the SpatialIndex, this is called by the EntityManager when the Entity is destroyed.
+  void remove_from_spatial_index();
 
   // gets the direction to the given point/Entity, taking into account the fact that it might be quicker to wrap around
   // the edges of the map. If ignore_height is true, we ignore the terrain height (basically set y to 0).
   fw::Vector get_direction_to(fw::Vector const &point, bool ignore_height = false) const;
   fw::Vector get_direction_to(std::shared_ptr<Entity> entity, bool ignore_height = false) const;
+  fw::FixedVector get_fixed_direction_to(fw::FixedVector const &point, bool ignore_height = false) const;
+  fw::FixedVector get_fixed_direction_to(std::shared_ptr<Entity> entity, bool ignore_height = false) const;
 
   // searches for the nearest Entity to us which matches the given predicate
   std::weak_ptr<Entity> get_nearest_entity(
@@ -153,30 +107,33 @@ public:
     return get_nearest_entity_with_component(T::identifier);
   }
 
-  // searches for all the entities within the given radius
+  // searches for (up to) the k nearest entities within the given radius, nearest first
   template<typename inserter_t>
-  inline void get_entities_within_radius(float radius, inserter_t ins) const {
+  inline void get_nearest_entities(int k, fw::Fixed radius, inserter_t ins) const {
     std::shared_ptr<Entity> us(entity_);
+    SpatialIndex const *index = us->get_manager()->get_spatial_index();
+
+    std::vector<SpatialIndex::Entry const *> nearest;
+    index->find_k_nearest(pos_, k, radius, [&us](SpatialIndex::Entry const &entry) {
+      return entry.entity != us.get();
+    }, nearest);
+    for (SpatialIndex::Entry const *entry : nearest) {
+      (*ins) = index->get_entity(*entry);
+    }
+  }
 
-    std::list<std::weak_ptr<Entity>> patch_entities = patch_->get_entities();
-    for (auto it = patch_entities.begin(); it != patch_entities.end(); ++it) {
-      std::shared_ptr<Entity> ent = (*it).lock();
-      if (!ent)
-        continue;
+  // searches for all the entities within the given radius
+  template<typename inserter_t>
+  inline void get_entities_within_radius(fw::Fixed radius, inserter_t ins) const {
+    std::shared_ptr<Entity> us(entity_);
+    SpatialIndex const *index = us->get_manager()->get_spatial_index();
 
+    index->for_each_within_radius(pos_, radius, [&](SpatialIndex::Entry const &entry, uint64_t) {
       // ignore ourselves
-      if (ent == us)
-        continue;
-
-      PositionComponent *their_pos = ent->get_component<PositionComponent>();
-      if (their_pos == 0)
-        continue;
-
-      float dist = get_direction_to(their_pos->get_position()).length();
-      if (dist < radius) {
-        (*ins) = std::weak_ptr<Entity>(ent);
+      if (entry.entity != us.get()) {
+        (*ins) = index->get_entity(entry);
       }
-    }
+    });
   }
 
   virtual int get_identifier() {
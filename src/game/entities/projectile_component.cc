@@ -44,22 +44,25 @@ void ProjectileComponent::set_target(std::weak_ptr<Entity> target) {
     target_position_ = sp->get_component<PositionComponent>();
 }
 
+void ProjectileComponent::prepare_update(float) {
+  nearest_damageable_ = our_position_->get_nearest_entity_with_component<DamageableComponent>();
+}
+
 void ProjectileComponent::update(float) {
   bool exploded = false;
   std::shared_ptr<ent::Entity> Entity(entity_);
 
-  // find the nearest damagable Entity - if it's closer than the "hit" distance, then we've hit them!
-  std::shared_ptr<ent::Entity> nearest =
-      our_position_->get_nearest_entity_with_component<DamageableComponent>().lock();
+  // the nearest damagable Entity - if it's closer than the "hit" distance, then we've hit them!
+  std::shared_ptr<ent::Entity> nearest = nearest_damageable_.lock();
   std::shared_ptr<ent::Entity> creator = Entity->get_creator().lock();
   if (nearest && nearest != creator) {
-    fw::Vector nearest_dir = our_position_->get_direction_to(nearest);
-    float nearest_distance = nearest_dir.length();
+    fw::FixedVector nearest_dir = our_position_->get_fixed_direction_to(nearest);
+    fw::Fixed nearest_distance = nearest_dir.length();
 
-    float hit_distance = 0.5f;
+    fw::Fixed hit_distance = fw::Fixed::from_float(0.5f);
     SelectableComponent *selectable = nearest->get_component<SelectableComponent>();
     if (selectable != 0) {
-      hit_distance = selectable->get_selection_radius();
+      hit_distance = fw::Fixed::from_float(selectable->get_selection_radius());
     }
 
     if (nearest_distance < hit_distance) {
@@ -72,9 +75,9 @@ void ProjectileComponent::update(float) {
     // check whether we've hit the ground
     auto terrain = game::World::get_instance()->get_terrain();
 
-    fw::Vector pos = our_position_->get_position();
-    float height = terrain->get_height(pos[0], pos[2]);
-    if (height > pos[1]) {
+    fw::FixedVector pos = our_position_->get_fixed_position();
+    fw::Fixed height = terrain->get_height(pos.x, pos.z);
+    if (height > pos.y) {
       explode (std::shared_ptr<ent::Entity>());
       exploded = true;
     }
@@ -86,7 +89,7 @@ void ProjectileComponent::explode(std::shared_ptr<Entity> hit) {
   if (hit) {
     DamageableComponent *damageable = hit->get_component<DamageableComponent>();
     if (damageable != nullptr) {
-      damageable->apply_damage(30.0f);
+      damageable->apply_damage(fw::Fixed::from_int(30));
     }
   }
 
@@ -158,14 +161,15 @@ void BallisticProjectileComponent::set_target(std::weak_ptr<Entity> target) {
   // and turn radius on our moveable component so that we travel in a nice-looking
   // arc towards the goal.
 
-  fw::Vector initial_pos = our_position_->get_position();
-  fw::Vector goal_pos = target_position_->get_position();
-  fw::Vector mid_pos = initial_pos + (goal_pos - initial_pos) + fw::Vector(0, max_height_, 0);
+  fw::FixedVector initial_pos = our_position_->get_fixed_position();
+  fw::FixedVector goal_pos = target_position_->get_fixed_position();
+  fw::FixedVector max_height(fw::Fixed(), fw::Fixed::from_float(max_height_), fw::Fixed());
+  fw::FixedVector mid_pos = initial_pos + (goal_pos - initial_pos) + max_height;
 
   // todo: this is *not* a nice-looking arc!
-  our_position_->set_direction((mid_pos - initial_pos).normalized());
+  our_position_->set_fixed_direction((mid_pos - initial_pos).normalized());
   our_moveable_->set_turn_speed(1.0f);
-  our_moveable_->set_intermediate_goal(goal_pos);
+  our_moveable_->set_intermediate_goal(goal_pos.to_vector());
 }
 
 }
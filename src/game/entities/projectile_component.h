@@ -17,6 +17,9 @@ protected:
   MoveableComponent *our_moveable_;
   PositionComponent *our_position_;
 
+  // The nearest thing we could hit, found in prepare_update.
+  std::weak_ptr<Entity> nearest_damageable_;
+
 public:
   static const int identifier = 600;
 
@@ -29,6 +32,10 @@ public:
   }
 
   virtual void initialize();
+  UpdatePhase get_update_phase() const override {
+    return UpdatePhase::kProjectiles;
+  }
+  void prepare_update(float dt) override;
   virtual void update(float dt);
 
   // this is called when we detect we've hit our target (or something else got in the way) not all projectiles
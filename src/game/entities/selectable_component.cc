@@ -96,7 +96,7 @@ void SelectableComponent::unhighlight() {
 }
 
 void SelectableComponent::update(float dt) {
-  if (mesh_ == nullptr || pos_ == nullptr) {
+  if (mesh_ == nullptr || pos_ == nullptr || !mesh_->get_sg_node()) {
     return;
   }
 
@@ -0,0 +1,116 @@
+#include <game/entities/spatial_index.h>
+
+#include <framework/logging.h>
+#include <framework/misc.h>
+
+#include <game/entities/entity.h>
+
+namespace ent {
+
+bool SpatialIndex::Entry::has_component(int component_type) const {
+  return (component_bits & Entity::get_component_bit(component_type)) != 0;
+}
+
+//-------------------------------------------------------------------------
+
+SpatialIndex::SpatialIndex(float world_width, float world_length) :
+    world_width_(world_width), world_length_(world_length), fixed_world_width_(fw::Fixed::from_float(world_width)),
+    fixed_world_length_(fw::Fixed::from_float(world_length)) {
+  cells_x_ = std::max(1, static_cast<int>(std::ceil(world_width / CELL_SIZE)));
+  cells_z_ = std::max(1, static_cast<int>(std::ceil(world_length / CELL_SIZE)));
+  cells_.resize(cells_x_ * cells_z_);
+}
+
+SpatialIndex::~SpatialIndex() {
+}
+
+fw::FixedVector SpatialIndex::constrain(fw::FixedVector const &point) const {
+  return fw::FixedVector(fw::constrain(point.x, fixed_world_width_, fw::Fixed()), point.y,
+      fw::constrain(point.z, fixed_world_length_, fw::Fixed()));
+}
+
+// pos must already be constrained to the world.
+int SpatialIndex::get_cell_index(fw::FixedVector const &pos) const {
+  int cell_x = std::min(pos.x.raw() / kCellSizeRaw, cells_x_ - 1);
+  int cell_z = std::min(pos.z.raw() / kCellSizeRaw, cells_z_ - 1);
+  return (cell_z * cells_x_) + cell_x;
+}
+
+int SpatialIndex::add(std::shared_ptr<Entity> const &entity, fw::FixedVector const &pos) {
+  int handle;
+  if (free_handles_.empty()) {
+    handle = static_cast<int>(locations_.size());
+    locations_.push_back(Location());
+  } else {
+    handle = free_handles_.back();
+    free_handles_.pop_back();
+  }
+
+  const fw::FixedVector constrained = constrain(pos);
+  const int cell_index = get_cell_index(constrained);
+  std::vector<Entry> &cell = cells_[cell_index];
+
+  Location &location = locations_[handle];
+  location.cell = cell_index;
+  location.slot = static_cast<int>(cell.size());
+  location.entity = entity;
+
+  Entry entry;
+  entry.pos = constrained;
+  entry.handle = handle;
+  entry.id = entity->get_id();
+  entry.component_bits = entity->get_component_bits();
+  entry.entity = entity.get();
+  cell.push_back(entry);
+  return handle;
+}
+
+void SpatialIndex::move(int handle, fw::FixedVector const &pos) {
+  const fw::FixedVector constrained = constrain(pos);
+  const int cell_index = get_cell_index(constrained);
+  Location &location = locations_[handle];
+  if (location.cell == cell_index) {
+    // This is by far the most common case, we're still in the same cell so we just update our position.
+    Entry &entry = cells_[cell_index][location.slot];
+    entry.pos = constrained;
+    return;
+  }
+
+  std::vector<Entry> &old_cell = cells_[location.cell];
+  Entry entry = old_cell[location.slot];
+  entry.pos = constrained;
+
+  // Move the last entry in the old cell into our slot, then add ourselves to the end of the new one.
+  if (location.slot != static_cast<int>(old_cell.size()) - 1) {
+    old_cell[location.slot] = old_cell.back();
+    locations_[old_cell[location.slot].handle].slot = location.slot;
+  }
+  old_cell.pop_back();
+
+  std::vector<Entry> &new_cell = cells_[cell_index];
+  location.cell = cell_index;
+  location.slot = static_cast<int>(new_cell.size());
+  new_cell.push_back(entry);
+}
+
+void SpatialIndex::remove(int handle) {
+  Location &location = locations_[handle];
+  if (location.cell < 0) {
+    LOG(WARN) << "removing entity from spatial index that's already been removed.";
+    return;
+  }
+
+  std::vector<Entry> &cell = cells_[location.cell];
+  if (location.slot != static_cast<int>(cell.size()) - 1) {
+    cell[location.slot] = cell.back();
+    locations_[cell[location.slot].handle].slot = location.slot;
+  }
+  cell.pop_back();
+
+  location.cell = -1;
+  location.slot = -1;
+  location.entity.reset();
+  free_handles_.push_back(handle);
+}
+
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <framework/fixed.h>
+#include <framework/math.h>
+#include <framework/misc.h>
+
+namespace ent {
+class Entity;
+typedef uint32_t entity_id;
+
+// A uniform grid over the world that we use to find the entities near a given point. Each cell of the grid holds a
+// packed array of the entities in it along with their positions, so a query only has to look at the handful of cells
+// around the point, and doesn't have to touch the Entity itself (let alone lock a weak_ptr) until it's found one.
+//
+// The world wraps at the edges, and so does the grid: distances are always the shortest distance, which may be around
+// the edge of the map.
+//
+// What's nearest is part of the simulation (it's what units shoot at, and what projectiles hit), so the positions are
+// fixed-point, just like the PositionComponent's, and all of the distances are worked out exactly in integers. Squared
+// distances are the raw fixed-point values squared, so they have 32 bits after the point. If two entities are the
+// same distance away, the one with the lowest id is the nearer, so it doesn't matter what order they're in the grid.
+//
+// Entities are added by their PositionComponent the first time it's position is finalized, moved each time it changes
+// after that, and removed by the EntityManager when the entity is destroyed.
+class SpatialIndex {
+public:
+  // The size of each cell, in world units. This is the size of a few units, so the short-range queries we do every
+  // frame (collision avoidance, projectiles) only need to look at a few cells.
+  static const int CELL_SIZE = 8;
+
+  struct Entry {
+    fw::FixedVector pos;
+    int handle;
+    entity_id id;
+
+    // See Entity::get_component_bits.
+    uint64_t component_bits;
+    Entity *entity;
+
+    // Returns true if the entity has a component with the given identifier.
+    bool has_component(int component_type) const;
+  };
+
+private:
+  // Where the entry for each handle currently lives.
+  struct Location {
+    int cell;
+    int slot;
+    std::weak_ptr<Entity> entity;
+  };
+
+  static constexpr int32_t kCellSizeRaw = CELL_SIZE * fw::Fixed::kOne;
+
+  float world_width_;
+  float world_length_;
+  fw::Fixed fixed_world_width_;
+  fw::Fixed fixed_world_length_;
+  int cells_x_;
+  int cells_z_;
+  std::vector<std::vector<Entry>> cells_;
+  std::vector<Location> locations_;
+  std::vector<int> free_handles_;
+
+  int get_cell_index(fw::FixedVector const &pos) const;
+  uint64_t get_distance_sq(Entry const &entry, fw::FixedVector const &centre) const;
+  fw::FixedVector constrain(fw::FixedVector const &point) const;
+
+  // Rounds towards negative infinity, unlike the / operator.
+  static int floor_div(int64_t value, int64_t divisor) {
+    return static_cast<int>((value >= 0) ? (value / divisor) : -((-value + divisor - 1) / divisor));
+  }
+
+  // Calls visit_entry(entry, distance_sq) for each entry within max_distance of centre, in rings of cells of
+  // increasing distance. After each ring, calls should_stop(min_distance_sq) with the smallest (squared) distance
+  // that anything we haven't visited yet could be, so searches for the nearest entities can stop early.
+  template<typename VisitFn, typename StopFn>
+  void visit_rings(fw::FixedVector const &centre, fw::Fixed max_distance, VisitFn visit_entry,
+      StopFn should_stop) const;
+
+public:
+  SpatialIndex(float world_width, float world_length);
+  ~SpatialIndex();
+
+  SpatialIndex(SpatialIndex const &) = delete;
+
+  // Adds the given entity at the given position, returns a handle that you use to move or remove it later.
+  int add(std::shared_ptr<Entity> const &entity, fw::FixedVector const &pos);
+  void move(int handle, fw::FixedVector const &pos);
+  void remove(int handle);
+
+  // Gets the entity that the given entry is for.
+  std::weak_ptr<Entity> get_entity(Entry const &entry) const {
+    return locations_[entry.handle].entity;
+  }
+
+  // Calls fn(entry, distance_sq) for every entity within the given radius of centre.
+  template<typename Fn>
+  void for_each_within_radius(fw::FixedVector const &centre, fw::Fixed radius, Fn fn) const;
+
+  // Calls fn(entry, offset) for every entity in the cells covering the given rectangle. The rectangle doesn't have to
+  // be inside the world: offset is what you need to add to the entity's position to move it into the rectangle. This
+  // is for the view, so it's in floats.
+  template<typename Fn>
+  void for_each_in_rect(float min_x, float min_z, float max_x, float max_z, Fn fn) const;
+
+  // Finds the nearest entity to centre (no further than max_distance away) for which filter(entry) returns true. The
+  // filter is only called for entities that are closer than the closest one we've found so far. Returns nullptr if
+  // there's nothing.
+  template<typename FilterFn>
+  Entry const *find_nearest(fw::FixedVector const &centre, fw::Fixed max_distance, FilterFn filter) const;
+
+  // Like find_nearest, but finds up to k of the nearest entities, which are added to results nearest first.
+  template<typename FilterFn>
+  void find_k_nearest(fw::FixedVector const &centre, int k, fw::Fixed max_distance, FilterFn filter,
+      std::vector<Entry const *> &results) const;
+
+  float get_world_width() const {
+    return world_width_;
+  }
+  float get_world_length() const {
+    return world_length_;
+  }
+};
+
+//-------------------------------------------------------------------------
+
+inline uint64_t SpatialIndex::get_distance_sq(Entry const &entry, fw::FixedVector const &centre) const {
+  int64_t dx = std::abs(static_cast<int64_t>(entry.pos.x.raw()) - centre.x.raw());
+  int64_t dz = std::abs(static_cast<int64_t>(entry.pos.z.raw()) - centre.z.raw());
+  dx = std::min(dx, fixed_world_width_.raw() - dx);
+  dz = std::min(dz, fixed_world_length_.raw() - dz);
+  const int64_t dy = static_cast<int64_t>(entry.pos.y.raw()) - centre.y.raw();
+  return static_cast<uint64_t>(dx * dx) + static_cast<uint64_t>(dy * dy) + static_cast<uint64_t>(dz * dz);
+}
+
+template<typename VisitFn, typename StopFn>
+void SpatialIndex::visit_rings(
+    fw::FixedVector const &point, fw::Fixed max_distance, VisitFn visit_entry, StopFn should_stop) const {
+  const fw::FixedVector centre = constrain(point);
+  const int64_t max_distance_raw = std::max(0, max_distance.raw());
+  const uint64_t max_distance_sq = static_cast<uint64_t>(max_distance_raw * max_distance_raw);
+  const int max_ring = static_cast<int>((max_distance_raw + kCellSizeRaw - 1) / kCellSizeRaw);
+  if ((max_ring * 2) + 1 > std::min(cells_x_, cells_z_)) {
+    // The rings would wrap around and overlap each other, so just look at everything in range.
+    for_each_within_radius(centre, max_distance, visit_entry);
+    return;
+  }
+
+  const int cell_x = std::min(centre.x.raw() / kCellSizeRaw, cells_x_ - 1);
+  const int cell_z = std::min(centre.z.raw() / kCellSizeRaw, cells_z_ - 1);
+
+  // How far the centre is from the closest edge of it's cell. Anything in ring n + 1 is at least this much further
+  // than (n * CELL_SIZE) away.
+  const int64_t edge_distance = std::max<int64_t>(0, std::min(
+      std::min<int64_t>(centre.x.raw() - (cell_x * kCellSizeRaw), ((cell_x + 1) * kCellSizeRaw) - centre.x.raw()),
+      std::min<int64_t>(centre.z.raw() - (cell_z * kCellSizeRaw), ((cell_z + 1) * kCellSizeRaw) - centre.z.raw())));
+
+  auto visit_cell = [&](int x, int z) {
+    std::vector<Entry> const &cell =
+        cells_[(fw::constrain(cell_z + z, cells_z_) * cells_x_) + fw::constrain(cell_x + x, cells_x_)];
+    for (Entry const &entry : cell) {
+      const uint64_t distance_sq = get_distance_sq(entry, centre);
+      if (distance_sq <= max_distance_sq) {
+        visit_entry(entry, distance_sq);
+      }
+    }
+  };
+
+  for (int ring = 0; ring <= max_ring; ring++) {
+    for (int z = -ring; z <= ring; z++) {
+      if (z == -ring || z == ring) {
+        for (int x = -ring; x <= ring; x++) {
+          visit_cell(x, z);
+        }
+      } else {
+        visit_cell(-ring, z);
+        visit_cell(ring, z);
+      }
+    }
+
+    const int64_t min_distance = (static_cast<int64_t>(ring) * kCellSizeRaw) + edge_distance;
+    if (should_stop(static_cast<uint64_t>(min_distance * min_distance))) {
+      return;
+    }
+  }
+}
+
+template<typename Fn>
+void SpatialIndex::for_each_within_radius(fw::FixedVector const &point, fw::Fixed radius, Fn fn) const {
+  const fw::FixedVector centre = constrain(point);
+  const int64_t radius_raw = std::max(0, radius.raw());
+  const uint64_t radius_sq = static_cast<uint64_t>(radius_raw * radius_raw);
+
+  int min_x = floor_div(centre.x.raw() - radius_raw, kCellSizeRaw);
+  int max_x = floor_div(centre.x.raw() + radius_raw, kCellSizeRaw);
+  int min_z = floor_div(centre.z.raw() - radius_raw, kCellSizeRaw);
+  int max_z = floor_div(centre.z.raw() + radius_raw, kCellSizeRaw);
+  if (max_x - min_x >= cells_x_) {
+    min_x = 0;
+    max_x = cells_x_ - 1;
+  }
+  if (max_z - min_z >= cells_z_) {
+    min_z = 0;
+    max_z = cells_z_ - 1;
+  }
+
+  for (int z = min_z; z <= max_z; z++) {
+    const int row = fw::constrain(z, cells_z_) * cells_x_;
+    for (int x = min_x; x <= max_x; x++) {
+      for (Entry const &entry : cells_[row + fw::constrain(x, cells_x_)]) {
+        const uint64_t distance_sq = get_distance_sq(entry, centre);
+        if (distance_sq <= radius_sq) {
+          fn(entry, distance_sq);
+        }
+      }
+    }
+  }
+}
+
+template<typename Fn>
+void SpatialIndex::for_each_in_rect(float min_x, float min_z, float max_x, float max_z, Fn fn) const {
+  int min_cell_x = static_cast<int>(std::floor(min_x / CELL_SIZE));
+  int max_cell_x = static_cast<int>(std::floor(max_x / CELL_SIZE));
+  int min_cell_z = static_cast<int>(std::floor(min_z / CELL_SIZE));
+  int max_cell_z = static_cast<int>(std::floor(max_z / CELL_SIZE));
+  max_cell_x = std::min(max_cell_x, min_cell_x + cells_x_ - 1);
+  max_cell_z = std::min(max_cell_z, min_cell_z + cells_z_ - 1);
+
+  for (int z = min_cell_z; z <= max_cell_z; z++) {
+    const int wrapped_z = fw::constrain(z, cells_z_);
+    for (int x = min_cell_x; x <= max_cell_x; x++) {
+      const int wrapped_x = fw::constrain(x, cells_x_);
+      const fw::Vector offset(
+          static_cast<float>((x - wrapped_x) * CELL_SIZE), 0.0f, static_cast<float>((z - wrapped_z) * CELL_SIZE));
+      for (Entry const &entry : cells_[(wrapped_z * cells_x_) + wrapped_x]) {
+        fn(entry, offset);
+      }
+    }
+  }
+}
+
+template<typename FilterFn>
+SpatialIndex::Entry const *SpatialIndex::find_nearest(
+    fw::FixedVector const &centre, fw::Fixed max_distance, FilterFn filter) const {
+  Entry const *nearest = nullptr;
+  uint64_t nearest_distance_sq = 0;
+  visit_rings(centre, max_distance,
+      [&](Entry const &entry, uint64_t distance_sq) {
+        const bool nearer = nearest == nullptr || distance_sq < nearest_distance_sq
+            || (distance_sq == nearest_distance_sq && entry.id < nearest->id);
+        if (nearer && filter(entry)) {
+          nearest = &entry;
+          nearest_distance_sq = distance_sq;
+        }
+      },
+      [&](uint64_t min_distance_sq) {
+        // Something in the next ring could be exactly as far away with a lower id, so only stop if it'd be further.
+        return nearest != nullptr && nearest_distance_sq < min_distance_sq;
+      });
+  return nearest;
+}
+
+template<typename FilterFn>
+void SpatialIndex::find_k_nearest(fw::FixedVector const &centre, int k, fw::Fixed max_distance, FilterFn filter,
+    std::vector<Entry const *> &results) const {
+  if (k <= 0) {
+    return;
+  }
+
+  // A max-heap on (distance, id) of the best k we've found so far. We compare ids (not the pointers) when distances
+  // are the same so that the results are the same on every peer.
+  typedef std::pair<uint64_t, Entry const *> Candidate;
+  auto compare = [](Candidate const &lhs, Candidate const &rhs) {
+    return lhs.first < rhs.first || (lhs.first == rhs.first && lhs.second->id < rhs.second->id);
+  };
+  std::vector<Candidate> best;
+  best.reserve(k);
+  visit_rings(centre, max_distance,
+      [&](Entry const &entry, uint64_t distance_sq) {
+        const bool full = static_cast<int>(best.size()) == k;
+        if (full && !compare(Candidate(distance_sq, &entry), best.front())) {
+          return;
+        }
+        if (!filter(entry)) {
+          return;
+        }
+        if (full) {
+          std::pop_heap(best.begin(), best.end(), compare);
+          best.pop_back();
+        }
+        best.push_back(Candidate(distance_sq, &entry));
+        std::push_heap(best.begin(), best.end(), compare);
+      },
+      [&](uint64_t min_distance_sq) {
+        return static_cast<int>(best.size()) == k && best.front().first < min_distance_sq;
+      });
+
+  std::sort_heap(best.begin(), best.end(), compare);
+  for (Candidate const &candidate : best) {
+    results.push_back(candidate.second);
+  }
+}
+
+}
@@ -0,0 +1,124 @@
+#include <game/entities/state_hash.h>
+
+#include <bit>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+#include <framework/logging.h>
+
+namespace ent {
+namespace {
+
+// The finalizer from splitmix64, every bit of the input affects every bit of the output.
+uint64_t mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9ULL;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111ebULL;
+  value ^= value >> 31;
+  return value;
+}
+
+uint64_t float_bits(float value) {
+  return std::bit_cast<uint32_t>(value);
+}
+
+void log_entity(std::string_view prefix, EntityState const &state) {
+  LOG(ERR) << "  " << prefix << " " << state.name << " (identifier: " << state.id << ") at ("
+           << state.position[0] << ", " << state.position[1] << ", " << state.position[2] << "), health "
+           << state.health;
+}
+
+}
+
+StateHash::StateHash() : hash_(0), snapshot_requested_(false) {
+}
+
+uint64_t StateHash::hash_entity(entity_id id, std::string_view name, fw::Vector const &position, float health) {
+  // FNV-1a of the name, so that (say) an explosion and a missile in the same place are different.
+  uint64_t hash = 14695981039346656037ULL;
+  for (char ch : name) {
+    hash ^= static_cast<uint8_t>(ch);
+    hash *= 1099511628211ULL;
+  }
+
+  hash = mix(hash ^ id);
+  hash = mix(hash ^ (float_bits(position[0]) << 32 | float_bits(position[1])));
+  hash = mix(hash ^ (float_bits(position[2]) << 32 | float_bits(health)));
+  return hash;
+}
+
+std::string StateHash::to_string(uint64_t hash) {
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ss.str();
+}
+
+void StateHash::request_snapshot() {
+  snapshot_requested_.store(true, std::memory_order_relaxed);
+}
+
+void StateHash::set_snapshot(std::vector<EntityState> snapshot) {
+  std::unique_lock<std::mutex> lock(snapshot_mutex_);
+  snapshot_ = std::move(snapshot);
+  snapshot_requested_.store(false, std::memory_order_relaxed);
+}
+
+std::optional<std::vector<EntityState>> StateHash::take_snapshot() {
+  std::unique_lock<std::mutex> lock(snapshot_mutex_);
+  std::optional<std::vector<EntityState>> snapshot;
+  snapshot.swap(snapshot_);
+  return snapshot;
+}
+
+void StateHash::log_differences(
+    std::vector<EntityState> const &ours, std::vector<EntityState> const &theirs, std::string_view who) {
+  std::unordered_map<entity_id, EntityState const *> their_entities;
+  std::map<uint64_t, int> unidentified;
+  for (EntityState const &state : theirs) {
+    if (state.id != 0) {
+      their_entities[state.id] = &state;
+    } else {
+      unidentified[state.hash]++;
+    }
+  }
+
+  int num_different = 0;
+  for (EntityState const &state : ours) {
+    if (state.id == 0) {
+      unidentified[state.hash]--;
+      continue;
+    }
+
+    auto it = their_entities.find(state.id);
+    if (it == their_entities.end()) {
+      log_entity("only we have", state);
+      num_different++;
+      continue;
+    }
+    if (it->second->hash != state.hash) {
+      log_entity("we have", state);
+      log_entity(std::string(who) + " has", *it->second);
+      num_different++;
+    }
+    their_entities.erase(it);
+  }
+  for (auto const &it : their_entities) {
+    log_entity("only " + std::string(who) + " has", *it.second);
+    num_different++;
+  }
+
+  int num_unidentified = 0;
+  for (auto const &it : unidentified) {
+    num_unidentified += std::abs(it.second);
+  }
+
+  LOG(ERR) << num_different << " entities are different between us and " << who << " (we have " << ours.size()
+           << ", they have " << theirs.size() << "), and " << num_unidentified
+           << " entities without an identifier don't match up";
+}
+
+}
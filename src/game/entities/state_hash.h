@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <framework/math.h>
+
+namespace ent {
+class Entity;
+typedef uint32_t entity_id;
+
+// The part of the game's state that goes into the StateHash for one Entity.
+struct EntityState {
+  entity_id id;
+  std::string name;
+  fw::Vector position;
+  float health;
+
+  // The Entity's contribution to the StateHash, see StateHash::hash_entity.
+  uint64_t hash;
+};
+
+// A hash of the state of every Entity that matters to the game: which entities there are, where they are and how much
+// health they've got. If two peers ever have a different hash for the same turn, their games have diverged.
+//
+// Rather than hash everything every turn, each Entity works out a hash of just it's own state whenever that changes,
+// and the hash of the whole game is the sum of those. Changing one entity is then just a matter of subtracting it's old
+// hash and adding the new one, and since addition doesn't care about order, it doesn't matter which order entities
+// are created, destroyed or updated in. Reading the hash is free, so we can compare it as often as we like.
+class StateHash {
+private:
+  // Updated on the update thread, read on the simulation thread.
+  std::atomic<uint64_t> hash_;
+
+  // When the simulation thread wants a list of the entities (to find out which ones are different), it asks for one
+  // here, and the EntityManager makes it on the update thread, where it's safe to look at them.
+  std::atomic<bool> snapshot_requested_;
+  std::mutex snapshot_mutex_;
+  std::optional<std::vector<EntityState>> snapshot_;
+
+public:
+  StateHash();
+
+  // Works out the hash of a single Entity's state. Floats are hashed by their bits, so the tiniest difference counts.
+  static uint64_t hash_entity(entity_id id, std::string_view name, fw::Vector const &position, float health);
+
+  // Called by the Entity whenever it's hash changes (zero before it's been added and after it's been removed).
+  void replace(uint64_t old_hash, uint64_t new_hash) {
+    hash_.fetch_add(new_hash - old_hash, std::memory_order_relaxed);
+  }
+
+  uint64_t get() const {
+    return hash_.load(std::memory_order_relaxed);
+  }
+
+  // Formats the given hash (as hex) for logging.
+  static std::string to_string(uint64_t hash);
+
+  // Asks for a snapshot of the entities. It's made on the update thread, and you can pick it up with take_snapshot()
+  // once it's ready. Can be called from any thread.
+  void request_snapshot();
+  bool is_snapshot_requested() const {
+    return snapshot_requested_.load(std::memory_order_relaxed);
+  }
+
+  // Called by the EntityManager with the snapshot that was asked for.
+  void set_snapshot(std::vector<EntityState> snapshot);
+
+  // Gets the snapshot we were asked for, if it's ready.
+  std::optional<std::vector<EntityState>> take_snapshot();
+
+  // Logs the difference between our entities and someone else's: the ones only we have, the ones only they have, and
+  // the ones we both have but with a different state. Entities with an id of 0 (e.g. projectiles) can't be matched up,
+  // so we just compare how many of each hash there are.
+  static void log_differences(
+      std::vector<EntityState> const &ours, std::vector<EntityState> const &theirs, std::string_view who);
+};
+
+}
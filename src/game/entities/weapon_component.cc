@@ -22,7 +22,7 @@ namespace ent {
 ENT_COMPONENT_REGISTER("Weapon", WeaponComponent);
 
 WeaponComponent::WeaponComponent() :
-    time_to_fire_(0.0f) {
+    time_to_fire_(0.0f), target_distance_(-1.0f) {
 }
 
 WeaponComponent::~WeaponComponent() {
@@ -48,6 +48,26 @@ void WeaponComponent::apply_template(fw::lua::Value tmpl) {
   }
 }
 
+void WeaponComponent::prepare_update(float) {
+  target_distance_ = -1.0f;
+
+  std::shared_ptr<ent::Entity> entity(entity_);
+  std::shared_ptr<ent::Entity> target = target_.lock();
+  if (!target)
+    return;
+
+  PositionComponent *our_pos = entity->get_component<PositionComponent>();
+  PositionComponent *their_pos = target->get_component<PositionComponent>();
+  if (our_pos == nullptr || their_pos == nullptr)
+    return;
+
+  // we can't let get_position() update the positions here, so we just use them as they are.
+  float wrap_x = game::World::get_instance()->get_terrain()->get_width();
+  float wrap_z = game::World::get_instance()->get_terrain()->get_length();
+  target_distance_ = fw::get_direction_to(
+      our_pos->get_position(false), their_pos->get_position(false), wrap_x, wrap_z).length();
+}
+
 void WeaponComponent::update(float dt) {
   time_to_fire_ -= dt;
   if (time_to_fire_ < 0)
@@ -55,20 +75,13 @@ void WeaponComponent::update(float dt) {
 
   std::shared_ptr<ent::Entity> entity(entity_);
   std::shared_ptr<ent::Entity> target = target_.lock();
-  if (target) {
-    PositionComponent *our_pos = entity->get_component<PositionComponent>();
+  if (target && target_distance_ >= 0.0f) {
     PositionComponent *their_pos = target->get_component<PositionComponent>();
     MoveableComponent *our_moveable = entity->get_component<MoveableComponent>();
 
-    if (our_pos == nullptr || their_pos == nullptr)
-      return;
-
     bool need_fire = true;
     if (our_moveable != nullptr) {
-      float wrap_x = game::World::get_instance()->get_terrain()->get_width();
-      float wrap_z = game::World::get_instance()->get_terrain()->get_length();
-      fw::Vector goal = fw::get_direction_to(our_pos->get_position(), their_pos->get_position(), wrap_x, wrap_z);
-      if (goal.length() > range_) {
+      if (target_distance_ > range_) {
         our_moveable->set_goal(their_pos->get_position());
         need_fire = false;
       } else {
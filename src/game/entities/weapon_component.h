@@ -15,6 +15,9 @@ private:
   float time_to_fire_;
   float range_;
 
+  // The distance to our target, or a negative number if we don't have one. This is calculated in prepare_update.
+  float target_distance_;
+
   void fire();
 
 public:
@@ -25,6 +28,10 @@ public:
 
   void apply_template(fw::lua::Value tmpl) override;
 
+  UpdatePhase get_update_phase() const override {
+    return UpdatePhase::kWeapons;
+  }
+  void prepare_update(float dt) override;
   virtual void update(float dt);
 
   void set_target(std::weak_ptr<Entity> target) {
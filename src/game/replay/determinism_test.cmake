@@ -0,0 +1,63 @@
+# Runs the same replay with two builds of the replay tool (normally, and with -ffast-math) and fails if the state
+# hashes they write are ever different. Run it with the determinism-test target (see ../CMakeLists.txt), or directly:
+#
+#   cmake -DREPLAY=... -DREPLAY_FAST_MATH=... -DREPLAY_FILE=... -DOUTPUT_DIR=... [-DDATA_PATH=...] \
+#       -P determinism_test.cmake
+
+foreach(var REPLAY REPLAY_FAST_MATH REPLAY_FILE OUTPUT_DIR)
+    if(NOT ${var})
+        message(FATAL_ERROR "${var} must be set (for REPLAY_FILE, set RP_DETERMINISM_REPLAY to a command log)")
+    endif()
+endforeach()
+
+set(EXTRA_ARGS)
+if(DATA_PATH)
+    list(APPEND EXTRA_ARGS --data-path ${DATA_PATH})
+endif()
+
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+
+foreach(build replay replay-fast-math)
+    if(build STREQUAL "replay")
+        set(exe ${REPLAY})
+    else()
+        set(exe ${REPLAY_FAST_MATH})
+    endif()
+
+    message(STATUS "Replaying ${REPLAY_FILE} with ${build}")
+    execute_process(
+        COMMAND ${exe} --replay-file ${REPLAY_FILE} --hash-interval 10 --hash-file ${OUTPUT_DIR}/${build}.txt
+            ${EXTRA_ARGS}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${build} failed: ${result}")
+    endif()
+endforeach()
+
+file(STRINGS ${OUTPUT_DIR}/replay.txt expected)
+file(STRINGS ${OUTPUT_DIR}/replay-fast-math.txt actual)
+list(LENGTH expected num_expected)
+list(LENGTH actual num_actual)
+if(num_expected EQUAL 0)
+    message(FATAL_ERROR "replay didn't write any hashes")
+endif()
+
+# Report the first line that's different, that's the turn where the two builds diverged.
+math(EXPR last "${num_expected} - 1")
+foreach(i RANGE ${last})
+    list(GET expected ${i} expected_line)
+    if(i LESS num_actual)
+        list(GET actual ${i} actual_line)
+    else()
+        set(actual_line "(nothing)")
+    endif()
+    if(NOT expected_line STREQUAL actual_line)
+        message(FATAL_ERROR "Builds diverged: replay has \"${expected_line}\", replay-fast-math has \"${actual_line}\"")
+    endif()
+endforeach()
+if(NOT num_actual EQUAL num_expected)
+    message(FATAL_ERROR "replay wrote ${num_expected} hashes, but replay-fast-math wrote ${num_actual}")
+endif()
+
+message(STATUS "replay and replay-fast-math agree on all ${num_expected} hashes")
@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <framework/fixed.h>
+#include <framework/fixed_kernels.h>
+#include <framework/framework.h>
+#include <framework/job_system.h>
+#include <framework/logging.h>
+#include <framework/settings.h>
+#include <framework/status.h>
+#include <framework/timer.h>
+
+#include <game/ai/pathing_thread.h>
+#include <game/entities/entity.h>
+#include <game/entities/entity_manager.h>
+#include <game/entities/moveable_component.h>
+#include <game/entities/position_component.h>
+#include <game/entities/state_hash.h>
+#include <game/entities/weapon_component.h>
+#include <game/settings.h>
+#include <game/simulation/command_log.h>
+#include <game/simulation/commands.h>
+#include <game/simulation/simulation_thread.h>
+#include <game/world/terrain.h>
+#include <game/world/world.h>
+#include <game/world/world_reader.h>
+
+fw::Status settings_initialize(int argc, char** argv);
+void display_exception(std::string const &msg);
+
+//-----------------------------------------------------------------------------
+
+// The world, without anything that needs graphics or input. Paths are found on this thread, one turn at a time, so
+// that units get exactly the same paths at exactly the same time on every run.
+class ReplayWorld : public game::World {
+protected:
+  void initialize_view() override {
+  }
+
+  void initialize_pathing() override {
+    pathing_ = new game::PathingThread();
+    pathing_->start_synchronous();
+  }
+
+public:
+  ReplayWorld(std::shared_ptr<game::WorldReader> reader) : World(reader) {
+  }
+};
+
+// The hash of the state of all the entities (see ent::StateHash). If two runs of the same game ever have a different
+// hash on the same turn, they've diverged.
+std::string format_state(ent::EntityManager *entities) {
+  return ent::StateHash::to_string(entities->get_state_hash().get());
+}
+
+float elapsed_ms(fw::Clock::time_point start) {
+  return std::chrono::duration<float, std::milli>(fw::Clock::now() - start).count();
+}
+
+// Runs the batch kernels from framework/fixed_kernels.h over every entity (the direction to the next one, how far away
+// it is, and the height of the terrain underneath it) and checks they give exactly the same answers as the scalar
+// versions the components use. Returns a hash of the answers, so that builds with different flags can compare them.
+fw::StatusOr<uint64_t> check_fixed_kernels(game::Terrain *terrain, ent::EntityManager *entities) {
+  std::vector<fw::FixedVector> positions;
+  for (auto const &entity : entities->get_all_entities()) {
+    ent::PositionComponent *position = entity->get_component<ent::PositionComponent>();
+    if (position != nullptr) {
+      positions.push_back(position->get_fixed_position(/*allow_update=*/false));
+    }
+  }
+  const int n = static_cast<int>(positions.size());
+  const fw::Fixed width = fw::Fixed::from_int(terrain->get_width());
+  const fw::Fixed length = fw::Fixed::from_int(terrain->get_length());
+
+  fw::FixedVectorArray from;
+  fw::FixedVectorArray to;
+  fw::FixedVectorArray dirs;
+  from.resize(n);
+  to.resize(n);
+  dirs.resize(n);
+  for (int i = 0; i < n; i++) {
+    from.set(i, positions[i]);
+    to.set(i, positions[(i + 1) % n]);
+  }
+  std::vector<fw::Fixed> lengths(n);
+  std::vector<fw::Fixed> scratch(n);
+  std::vector<fw::Fixed> heights(n);
+  fw::direction_to_wrapped(from, to, width, length, dirs);
+  fw::lengths(dirs, lengths.data());
+  fw::normalize(dirs, scratch.data());
+  terrain->get_heights(from.x.data(), from.z.data(), heights.data(), n);
+
+  // FNV-1a, a word at a time.
+  uint64_t hash = 14695981039346656037ULL;
+  auto add_to_hash = [&hash](fw::Fixed value) {
+    hash ^= static_cast<uint32_t>(value.raw());
+    hash *= 1099511628211ULL;
+  };
+
+  int num_mismatches = 0;
+  for (int i = 0; i < n; i++) {
+    fw::FixedVector dir = fw::direction_to_wrapped(positions[i], positions[(i + 1) % n], width, length);
+    fw::Fixed height = terrain->get_height(positions[i].x, positions[i].z);
+    if (dir.length() != lengths[i] || dir.normalized() != dirs.get(i) || height != heights[i]) {
+      num_mismatches++;
+    }
+
+    add_to_hash(lengths[i]);
+    add_to_hash(dirs.x[i]);
+    add_to_hash(dirs.y[i]);
+    add_to_hash(dirs.z[i]);
+    add_to_hash(heights[i]);
+  }
+
+  if (num_mismatches > 0) {
+    return fw::ErrorStatus("batch kernels were different to the scalar versions for ") << num_mismatches
+        << " of " << n << " entities";
+  }
+  return hash;
+}
+
+// Replays the game in the "replay-file" as fast as we can, then logs how long it took (and the hash of the final
+// state, so you can compare it with another run). If there's a "hash-file", the hashes are written to that as well, one
+// line per hash, so that two runs can be compared with a diff (see determinism_test.cmake).
+fw::Status run_replay() {
+  std::string filename = fw::Settings::get<std::string>("replay-file");
+  if (filename.empty()) {
+    return fw::ErrorStatus("no --replay-file given");
+  }
+  // every turn is a whole number of fixed steps, just like in the game
+  const float dt = static_cast<float>(game::SimulationThread::kTurnStepMs) / 1000.0f;
+  const int extra_turns = std::max(0, fw::Settings::get<int>("extra-turns"));
+  const int hash_interval = std::max(0, fw::Settings::get<int>("hash-interval"));
+  const std::string hash_filename = fw::Settings::get<std::string>("hash-file");
+
+  std::ofstream hash_file;
+  if (!hash_filename.empty()) {
+    hash_file.open(hash_filename, std::ios::out | std::ios::trunc);
+    if (!hash_file) {
+      return fw::ErrorStatus("couldn't open hash file: ") << hash_filename;
+    }
+  }
+
+  game::CommandLogReader log;
+  RETURN_IF_ERROR(log.open(filename));
+  LOG(INFO) << "replaying " << filename << " on map " << log.get_map_name() << " as player "
+            << static_cast<int>(log.get_local_player_no()) << " of " << log.get_player_nos().size();
+  game::SimulationThread::get_instance()->initialize_replay(log.get_local_player_no(), log.get_player_nos());
+
+  auto reader = std::make_shared<game::WorldReader>(/*headless=*/true);
+  RETURN_IF_ERROR(reader->Read(log.get_map_name()));
+  ReplayWorld world(reader);
+  world.initialize();
+  ent::EntityManager *entities = world.get_entity_manager();
+  game::PathingThread *pathing = world.get_pathing();
+
+  std::vector<std::shared_ptr<game::Command>> commands;
+  game::turn_id next_turn = 0;
+  int next_steps = 1;
+  int steps = 1;
+  ASSIGN_OR_RETURN(bool has_commands, log.read_turn(next_turn, next_steps, commands));
+  game::turn_id end_turn = log.get_start_turn() + extra_turns;
+
+  int num_turns = 0;
+  int num_steps = 0;
+  int num_commands = 0;
+  std::size_t max_entities = 0;
+  float max_turn_ms = 0.0f;
+  fw::Timer timer;
+  timer.start();
+  for (game::turn_id turn = log.get_start_turn() + 1; has_commands || turn <= end_turn; turn++) {
+    fw::Clock::time_point turn_start = fw::Clock::now();
+    if (has_commands && turn == next_turn) {
+      steps = next_steps;
+      for (auto &cmd : commands) {
+        cmd->execute();
+      }
+      num_commands += static_cast<int>(commands.size());
+
+      ASSIGN_OR_RETURN(has_commands, log.read_turn(next_turn, next_steps, commands));
+      if (!has_commands) {
+        end_turn = turn + extra_turns;
+      }
+    }
+
+    for (int step = 0; step < steps; step++) {
+      entities->simulate(dt);
+    }
+    pathing->run_queued_requests();
+
+    num_turns++;
+    num_steps += steps;
+    max_entities = std::max(max_entities, entities->get_all_entities().size());
+    max_turn_ms = std::max(max_turn_ms, elapsed_ms(turn_start));
+    if (hash_interval > 0 && turn % hash_interval == 0) {
+      LOG(INFO) << "turn " << turn << ": " << entities->get_all_entities().size() << " entities, state "
+                << format_state(entities);
+      if (hash_file) {
+        hash_file << "turn " << turn << " " << format_state(entities) << std::endl;
+      }
+    }
+  }
+  timer.stop();
+
+  const float total_ms = timer.get_total_time() * 1000.0f;
+  LOG(INFO) << "replayed " << num_turns << " turn(s) and " << num_commands << " command(s) in " << total_ms
+            << "ms: " << (total_ms / std::max(1, num_turns)) << "ms per turn (slowest " << max_turn_ms << "ms), up to "
+            << max_entities << " entities, "
+            << (num_steps * dt * 1000.0f / std::max(1.0f, total_ms)) << "x real time";
+  LOG(INFO) << "final state: " << entities->get_all_entities().size() << " entities, " << format_state(entities);
+
+  ASSIGN_OR_RETURN(uint64_t kernels_hash, check_fixed_kernels(world.get_terrain().get(), entities));
+  if (hash_file) {
+    hash_file << "final " << format_state(entities) << std::endl;
+    hash_file << "kernels " << ent::StateHash::to_string(kernels_hash) << std::endl;
+  }
+
+  world.destroy();
+  return fw::OkStatus();
+}
+
+// Works out how much the state hash costs each turn on the "benchmark-map" map with "benchmark-entities" tanks. Every
+// tank moves every turn, which is the worst case: normally only some of them do. We time how long it takes to move
+// them (which includes keeping the hash up-to-date), how long just updating the hash of every entity takes (which is
+// what the incremental hash adds to the turn), how long hashing them all from scratch would take instead, and how long
+// a snapshot for a state dump takes. We also check that the incremental hash is the same as the one from scratch.
+fw::Status run_state_hash_benchmark() {
+  const std::string map_name = fw::Settings::get<std::string>("benchmark-map");
+  const int num_entities = std::max(1, fw::Settings::get<int>("benchmark-entities"));
+  const int num_turns = std::max(1, fw::Settings::get<int>("benchmark-turns"));
+  game::SimulationThread::get_instance()->initialize_replay(1, {1});
+
+  auto reader = std::make_shared<game::WorldReader>(/*headless=*/true);
+  RETURN_IF_ERROR(reader->Read(map_name));
+  ReplayWorld world(reader);
+  world.initialize();
+  ent::EntityManager *entities = world.get_entity_manager();
+  const float width = static_cast<float>(world.get_terrain()->get_width());
+  const float length = static_cast<float>(world.get_terrain()->get_length());
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> random_x(0.0f, width);
+  std::uniform_real_distribution<float> random_z(0.0f, length);
+  std::uniform_real_distribution<float> random_step(-0.5f, 0.5f);
+  for (int i = 0; i < num_entities; i++) {
+    auto entity = entities->create_entity("simple-tank", static_cast<ent::entity_id>(i + 1));
+    entity->get_component<ent::PositionComponent>()->set_position(fw::Vector(random_x(random), 0.0f, random_z(random)));
+  }
+  entities->simulate(0.0f);
+  std::vector<std::shared_ptr<ent::Entity>> const &all_entities = entities->get_all_entities();
+
+  float move_ms = 0.0f;
+  float incremental_ms = 0.0f;
+  float full_ms = 0.0f;
+  int num_mismatches = 0;
+  for (int turn = 0; turn < num_turns; turn++) {
+    fw::Clock::time_point start = fw::Clock::now();
+    for (auto const &entity : all_entities) {
+      ent::PositionComponent *position = entity->get_component<ent::PositionComponent>();
+      position->set_position(position->get_position() + fw::Vector(random_step(random), 0.0f, random_step(random)));
+      position->get_position();
+    }
+    move_ms += elapsed_ms(start);
+
+    start = fw::Clock::now();
+    for (auto const &entity : all_entities) {
+      entity->update_state_hash();
+    }
+    const uint64_t incremental_hash = entities->get_state_hash().get();
+    incremental_ms += elapsed_ms(start);
+
+    start = fw::Clock::now();
+    uint64_t full_hash = 0;
+    for (auto const &entity : all_entities) {
+      ent::EntityAttribute *health = entity->get_attribute("health");
+      full_hash += ent::StateHash::hash_entity(entity->get_id(), entity->get_name(),
+          entity->get_component<ent::PositionComponent>()->get_position(/*allow_update=*/false),
+          health == nullptr ? 0.0f : health->get_value<float>());
+    }
+    full_ms += elapsed_ms(start);
+
+    if (full_hash != incremental_hash) {
+      num_mismatches++;
+    }
+  }
+
+  // the snapshot is made at the end of a turn, so it's whatever that turn takes extra.
+  fw::Clock::time_point start = fw::Clock::now();
+  entities->simulate(0.0f);
+  const float simulate_ms = elapsed_ms(start);
+  entities->get_state_hash().request_snapshot();
+  start = fw::Clock::now();
+  entities->simulate(0.0f);
+  const float snapshot_ms = elapsed_ms(start) - simulate_ms;
+  auto snapshot = entities->get_state_hash().take_snapshot();
+  const std::size_t snapshot_size = snapshot ? snapshot->size() : 0;
+
+  const float ns_per_entity = 1000000.0f / (static_cast<float>(num_turns) * all_entities.size());
+  LOG(INFO) << "state hash of " << all_entities.size() << " entities over " << num_turns << " turns, per turn: moving "
+            << (move_ms / num_turns) << "ms (including the hash), updating the hash " << (incremental_ms / num_turns)
+            << "ms (" << (incremental_ms * ns_per_entity) << "ns per entity), "
+            << "hashing from scratch " << (full_ms / num_turns) << "ms";
+  LOG(INFO) << "a snapshot of " << snapshot_size << " entities for a state dump took about " << snapshot_ms << "ms";
+  world.destroy();
+
+  if (num_mismatches > 0) {
+    return fw::ErrorStatus("incremental state hash was different to the one from scratch on ")
+        << num_mismatches << " turn(s)";
+  }
+  return fw::OkStatus();
+}
+
+// Simulates a battle on the "benchmark-map" between "benchmark-entities" tanks for "benchmark-turns" turns, with
+// EntityManager::simulate running it's jobs on the given JobSystem. Every tank drives to a random spot and shoots at the
+// next one, so the nearest-entity queries, weapons, projectiles and explosions all get a workout. Returns the state hash
+// after each turn.
+fw::StatusOr<std::vector<uint64_t>> simulate_battle(fw::JobSystem *job_system) {
+  const std::string map_name = fw::Settings::get<std::string>("benchmark-map");
+  const int num_entities = std::max(2, fw::Settings::get<int>("benchmark-entities"));
+  const int num_turns = std::max(1, fw::Settings::get<int>("benchmark-turns"));
+  const float dt = static_cast<float>(game::SimulationThread::kTurnStepMs) / 1000.0f;
+
+  auto reader = std::make_shared<game::WorldReader>(/*headless=*/true);
+  RETURN_IF_ERROR(reader->Read(map_name));
+  ReplayWorld world(reader);
+  world.initialize();
+  ent::EntityManager *entities = world.get_entity_manager();
+  entities->set_job_system(job_system);
+  const float width = static_cast<float>(world.get_terrain()->get_width());
+  const float length = static_cast<float>(world.get_terrain()->get_length());
+
+  // the same seed every time, so that every run is the same battle.
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> random_x(0.0f, width);
+  std::uniform_real_distribution<float> random_z(0.0f, length);
+  std::vector<std::shared_ptr<ent::Entity>> tanks;
+  for (int i = 0; i < num_entities; i++) {
+    auto entity = entities->create_entity("simple-tank", static_cast<ent::entity_id>(i + 1));
+    entity->get_component<ent::PositionComponent>()->set_position(fw::Vector(random_x(random), 0.0f, random_z(random)));
+    ent::MoveableComponent *moveable = entity->get_component<ent::MoveableComponent>();
+    if (moveable != nullptr) {
+      moveable->set_goal(fw::Vector(random_x(random), 0.0f, random_z(random)), /*skip_pathing=*/true);
+    }
+    tanks.push_back(entity);
+  }
+  for (int i = 0; i < num_entities; i++) {
+    ent::WeaponComponent *weapon = tanks[i]->get_component<ent::WeaponComponent>();
+    if (weapon != nullptr) {
+      weapon->set_target(tanks[(i + 1) % num_entities]);
+    }
+  }
+  tanks.clear();
+
+  std::vector<uint64_t> hashes;
+  for (int turn = 0; turn < num_turns; turn++) {
+    entities->simulate(dt);
+    world.get_pathing()->run_queued_requests();
+    hashes.push_back(entities->get_state_hash().get());
+  }
+  LOG(INFO) << "simulated " << num_turns << " turn(s) on " << job_system->get_num_threads() << " worker thread(s), "
+            << entities->get_all_entities().size() << " entities left, final state "
+            << ent::StateHash::to_string(hashes.back());
+
+  entities->set_job_system(nullptr);
+  world.destroy();
+  return hashes;
+}
+
+// Runs the same battle with every job on this thread, then with the framework's JobSystem (see the job-threads
+// setting), and checks that the state hash is the same after every turn. This is the real EntityManager::simulate, so
+// unlike job-test's stand-in, it'll catch a component that changes something in prepare_update.
+fw::Status run_job_check() {
+  if (fw::Settings::get<std::string>("benchmark-map").empty()) {
+    return fw::ErrorStatus("--job-check needs a --benchmark-map to simulate on");
+  }
+  game::SimulationThread::get_instance()->initialize_replay(1, {1});
+
+  fw::JobSystem serial(0);
+  ASSIGN_OR_RETURN(std::vector<uint64_t> serial_hashes, simulate_battle(&serial));
+  fw::JobSystem *parallel = fw::Framework::get_instance()->get_job_system();
+  ASSIGN_OR_RETURN(std::vector<uint64_t> parallel_hashes, simulate_battle(parallel));
+
+  for (std::size_t turn = 0; turn < serial_hashes.size(); turn++) {
+    if (serial_hashes[turn] != parallel_hashes[turn]) {
+      return fw::ErrorStatus("simulating on ") << parallel->get_num_threads() << " worker thread(s) diverged on turn "
+          << turn << ": state " << ent::StateHash::to_string(parallel_hashes[turn]) << ", but on this thread it was "
+          << ent::StateHash::to_string(serial_hashes[turn]);
+    }
+  }
+  LOG(INFO) << "simulating on " << parallel->get_num_threads() << " worker thread(s) matches this thread on all "
+            << serial_hashes.size() << " turn(s)";
+  return fw::OkStatus();
+}
+
+int main(int argc, char** argv) {
+  try {
+    auto status = settings_initialize(argc, argv);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      fw::Settings::print_help();
+      return 1;
+    }
+
+    fw::ToolApplication app;
+    new fw::Framework(&app);
+    auto continue_or_status = fw::Framework::get_instance()->initialize("Replay");
+    if (!continue_or_status.ok()) {
+      LOG(ERR) << continue_or_status.status();
+      return 1;
+    }
+    if (!continue_or_status.value()) {
+      return 0;
+    }
+
+    if (fw::Settings::get<bool>("job-check")) {
+      status = run_job_check();
+    } else if (!fw::Settings::get<std::string>("benchmark-map").empty()) {
+      status = run_state_hash_benchmark();
+    } else {
+      status = run_replay();
+    }
+    if (!status.ok()) {
+      LOG(ERR) << "error replaying game: " << status;
+      return 1;
+    }
+  } catch (std::exception &e) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION!";
+    LOG(ERR) << e.what();
+
+    display_exception(e.what());
+  } catch (...) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION! (unknown exception)";
+  }
+
+  return 0;
+}
+
+void display_exception(std::string const &msg) {
+  std::stringstream ss;
+  ss << "An error has occurred. Please send your log file (below) to dean@codeka.com.au for diagnostics." << std::endl;
+  ss << std::endl;
+  ss << fw::LogFileName() << std::endl;
+  ss << std::endl;
+  ss << msg;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  fw::SettingDefinition extra_settings = game::get_game_settings();
+  extra_settings.add_group("Additional options", "Replay specific settings")
+      .add_setting<std::string>("replay-file", "The command log to replay (see the record-commands setting).", "")
+      .add_setting<int>("extra-turns", "Number of turns to keep going after the last command.", 200)
+      .add_setting<int>("hash-interval", "Log a hash of the game's state every this many turns (0 for none).", 0)
+      .add_setting<std::string>("hash-file", "Also write the hashes to this file, to compare with another run.", "")
+      .add_setting<std::string>("benchmark-map", "Instead of replaying a game, benchmark the state hash on this map.", "")
+      .add_setting<int>("benchmark-entities", "Number of entities to benchmark the state hash with.", 2500)
+      .add_setting<int>("benchmark-turns", "Number of turns to benchmark the state hash for.", 200)
+      .add_setting<bool>("job-check",
+          "Instead of replaying a game, simulate a battle on the benchmark-map with no job threads and then with "
+          "job-threads, and check the state is the same.", false);
+
+  return fw::Settings::initialize(extra_settings, argc, argv, "replay.conf");
+}
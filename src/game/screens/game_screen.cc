@@ -2,6 +2,7 @@
 #include <framework/camera.h>
 #include <framework/framework.h>
 #include <framework/scenegraph.h>
+#include <framework/settings.h>
 
 #include <game/world/terrain.h>
 #include <game/world/world.h>
@@ -53,11 +54,23 @@ void GameScreen::show() {
   // initialize the world
   world_->initialize();
 
+  // if we've been asked to, record the game so that it can be replayed later
+  std::string record_filename = fw::Settings::get<std::string>("record-commands");
+  if (!record_filename.empty()) {
+    status = SimulationThread::get_instance()->start_recording(record_filename, options_->map_name);
+    if (!status.ok()) {
+      LOG(ERR) << "error starting recording: " << status;
+    }
+  }
+
   // notify all of the players that the world is loaded
   for(auto plyr : SimulationThread::get_instance()->get_players()) {
     plyr->world_loaded();
   }
 
+  // and now we can start running turns
+  SimulationThread::get_instance()->start_game();
+
   // show the initial set of windows
 //  hud_chat->show();
   hud_minimap->show();
@@ -78,6 +91,7 @@ void GameScreen::update() {
 }
 
 void GameScreen::hide() {
+  SimulationThread::get_instance()->stop_recording();
   world_->destroy();
 
   hud_minimap->hide();
@@ -5,7 +5,7 @@
 
 namespace game {
 
-fw::Status settings_initialize(int argc, char** argv) {
+fw::SettingDefinition get_game_settings() {
   fw::SettingDefinition extra_settings;
 
   extra_settings.add_group("Game", "Game-specific settings")
@@ -20,6 +20,40 @@ fw::Status settings_initialize(int argc, char** argv) {
       .add_setting<std::string>(
           "auto-login",
           "A string used to automatically log on to the server. The value is obfuscated.",
+          "")
+      .add_setting<int>(
+          "pathing-threads",
+          "The number of threads used for path-finding. 0 means one less than the number of CPU cores.",
+          0)
+      .add_setting<int>(
+          "pathing-cache-size",
+          "The number of recently-found paths to cache, so units going to the same place can share them.",
+          1024)
+      .add_setting<std::string>(
+          "pathing-algorithm",
+          "The search used for short paths: \"jps\" (jump point search) or \"astar\".",
+          "jps")
+      .add_setting<int>(
+          "min-turn-length",
+          "The shortest a simulation turn can be, in milliseconds (rounded to a multiple of 50). Turns get longer on "
+          "slow networks. In a multiplayer game, the host's setting is the one that counts.",
+          50)
+      .add_setting<int>(
+          "max-turn-length",
+          "The longest a simulation turn can be, in milliseconds.",
+          500)
+      .add_setting<int>(
+          "net-encoding",
+          "The newest packet encoding we'll use with other players: 0 is the legacy one, 1 is the compact one.",
+          1)
+      .add_setting<int>(
+          "state-hash-interval",
+          "How often (in turns) we send a hash of the game's state to the other players, to check that we all still "
+          "have the same game. 0 means never.",
+          20)
+      .add_setting<std::string>(
+          "record-commands",
+          "If set, every command in the game is written to this file, so you can replay the game with the replay tool.",
           "");
 
   extra_settings.add_group("Keybindings", "Keybinding settings")
@@ -34,7 +68,11 @@ fw::Status settings_initialize(int argc, char** argv) {
       .add_setting<std::string>(
           "bind.screenshot", "Take a screenshot", "Ctrl+S");
 
-  return fw::Settings::initialize(extra_settings, argc, argv, "default.conf");
+  return extra_settings;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  return fw::Settings::initialize(get_game_settings(), argc, argv, "default.conf");
 }
 
 }
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <framework/settings.h>
 #include <framework/status.h>
 
 namespace game {
+  // The settings that the game's code uses, for tools that run it (e.g. the replay tool) to add to their own.
+  fw::SettingDefinition get_game_settings();
+
   fw::Status settings_initialize(int argc, char** argv);
 }
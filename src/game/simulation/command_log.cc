@@ -0,0 +1,222 @@
+#include <game/simulation/command_log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <framework/logging.h>
+#include <framework/packet_buffer.h>
+#include <framework/status.h>
+
+#include <game/simulation/commands.h>
+#include <game/simulation/player.h>
+
+namespace game {
+namespace {
+
+// The first bytes of every command log, the last one is the version of the format. Version 1 didn't have the number
+// of steps in each turn, they were all one step.
+constexpr char kMagic[] = {'R', 'P', 'C', 'L', 2};
+
+// The types of the frames in the log.
+constexpr uint16_t kHeaderFrame = 1;
+constexpr uint16_t kTurnFrame = 2;
+
+// A frame bigger than this is surely a corrupt file.
+constexpr uint64_t kMaxFrameSize = 16 * 1024 * 1024;
+
+}
+
+CommandLogWriter::CommandLogWriter() : last_turn_(0), last_steps_(1) {
+}
+
+CommandLogWriter::~CommandLogWriter() {
+}
+
+fw::Status CommandLogWriter::open(std::string const &filename, std::string const &map_name, turn_id start_turn,
+    uint8_t local_player_no, std::vector<uint8_t> const &player_nos) {
+  out_.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out_) {
+    return fw::ErrorStatus("error creating command log: ") << filename;
+  }
+  out_.write(kMagic, sizeof(kMagic));
+
+  fw::net::PacketBuffer buffer(kHeaderFrame, fw::net::Encoding::kCompact);
+  buffer << map_name;
+  buffer << start_turn;
+  buffer << local_player_no;
+  buffer << static_cast<uint8_t>(player_nos.size());
+  for (uint8_t player_no : player_nos) {
+    buffer << player_no;
+  }
+  last_turn_ = start_turn;
+  last_steps_ = 1;
+
+  LOG(INFO) << "recording commands to " << filename;
+  return write_frame(buffer);
+}
+
+fw::Status CommandLogWriter::write_turn(
+    turn_id turn, int steps, std::vector<std::shared_ptr<Command>> const &commands) {
+  if (commands.empty() && steps == last_steps_) {
+    return fw::OkStatus();
+  }
+
+  // turns only ever go up, so we just write how many there's been since the last one.
+  fw::net::PacketBuffer buffer(kTurnFrame, fw::net::Encoding::kCompact);
+  buffer << static_cast<uint32_t>(turn - last_turn_);
+  buffer << static_cast<uint8_t>(steps);
+  buffer << static_cast<uint16_t>(commands.size());
+  for (auto const &cmd : commands) {
+    auto const &player = cmd->get_player();
+    buffer << cmd->get_identifier();
+    buffer << static_cast<uint8_t>(player ? player->get_player_no() : 0);
+    cmd->serialize(buffer);
+  }
+  last_turn_ = turn;
+  last_steps_ = steps;
+
+  return write_frame(buffer);
+}
+
+fw::Status CommandLogWriter::write_frame(fw::net::PacketBuffer const &buffer) {
+  // the length is a varint, like the integers inside the frame
+  uint64_t size = buffer.get_size();
+  char length[10];
+  int n = 0;
+  do {
+    length[n] = static_cast<char>(size & 0x7f);
+    size >>= 7;
+    if (size != 0) {
+      length[n] |= 0x80;
+    }
+    n++;
+  } while (size != 0);
+
+  out_.write(length, n);
+  out_.write(buffer.get_buffer(), buffer.get_size());
+  if (!out_) {
+    return fw::ErrorStatus("error writing command log");
+  }
+  return fw::OkStatus();
+}
+
+//-------------------------------------------------------------------------
+
+CommandLogReader::CommandLogReader() : start_turn_(0), last_turn_(0), version_(0), local_player_no_(0) {
+}
+
+CommandLogReader::~CommandLogReader() {
+}
+
+fw::Status CommandLogReader::open(std::string const &filename) {
+  in_.open(filename, std::ios::in | std::ios::binary);
+  if (!in_) {
+    return fw::ErrorStatus("error opening command log: ") << filename;
+  }
+
+  char magic[sizeof(kMagic)];
+  in_.read(magic, sizeof(magic));
+  if (!in_ || std::memcmp(magic, kMagic, sizeof(kMagic) - 1) != 0) {
+    return fw::ErrorStatus("not a command log: ") << filename;
+  }
+  version_ = magic[sizeof(kMagic) - 1];
+  if (version_ < 1 || version_ > kMagic[sizeof(kMagic) - 1]) {
+    return fw::ErrorStatus("unsupported command log version: ") << version_;
+  }
+
+  ASSIGN_OR_RETURN(bool has_header, read_frame());
+  fw::net::PacketBuffer buffer(frame_.data(), frame_.size());
+  if (!has_header || buffer.get_packet_type() != kHeaderFrame) {
+    return fw::ErrorStatus("command log has no header: ") << filename;
+  }
+
+  uint8_t num_players;
+  buffer >> map_name_;
+  buffer >> start_turn_;
+  buffer >> local_player_no_;
+  buffer >> num_players;
+  for (int i = 0; i < num_players; i++) {
+    uint8_t player_no;
+    buffer >> player_no;
+    player_nos_.push_back(player_no);
+  }
+  if (buffer.has_read_error()) {
+    return fw::ErrorStatus("command log header is truncated: ") << filename;
+  }
+
+  last_turn_ = start_turn_;
+  return fw::OkStatus();
+}
+
+fw::StatusOr<bool> CommandLogReader::read_turn(
+    turn_id &turn, int &steps, std::vector<std::shared_ptr<Command>> &commands) {
+  ASSIGN_OR_RETURN(bool has_frame, read_frame());
+  if (!has_frame) {
+    return false;
+  }
+
+  fw::net::PacketBuffer buffer(frame_.data(), frame_.size());
+  if (buffer.get_packet_type() != kTurnFrame) {
+    return fw::ErrorStatus("unexpected frame in command log: ") << buffer.get_packet_type();
+  }
+
+  uint32_t turns;
+  uint8_t turn_steps = 1;
+  uint16_t num_commands;
+  buffer >> turns;
+  if (version_ >= 2) {
+    buffer >> turn_steps;
+  }
+  buffer >> num_commands;
+  steps = std::max<int>(1, turn_steps);
+  turn = last_turn_ + turns;
+  last_turn_ = turn;
+
+  commands.clear();
+  for (int i = 0; i < num_commands; i++) {
+    uint8_t id;
+    uint8_t player_no;
+    buffer >> id;
+    buffer >> player_no;
+    ASSIGN_OR_RETURN(auto cmd, CreateCommand(id, player_no));
+    cmd->deserialize(buffer);
+    commands.push_back(cmd);
+  }
+  if (buffer.has_read_error()) {
+    return fw::ErrorStatus("command log is truncated at turn ") << turn;
+  }
+
+  return true;
+}
+
+fw::StatusOr<bool> CommandLogReader::read_frame() {
+  uint64_t size = 0;
+  for (int shift = 0;; shift += 7) {
+    int b = in_.get();
+    if (b == std::char_traits<char>::eof()) {
+      if (shift == 0) {
+        return false;
+      }
+      return fw::ErrorStatus("command log is truncated");
+    }
+    size |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      break;
+    }
+    if (shift > 56) {
+      return fw::ErrorStatus("command log is corrupt");
+    }
+  }
+  if (size > kMaxFrameSize) {
+    return fw::ErrorStatus("command log is corrupt, frame of ") << size << " bytes";
+  }
+
+  frame_.resize(size);
+  in_.read(frame_.data(), static_cast<std::streamsize>(size));
+  if (!in_) {
+    return fw::ErrorStatus("command log is truncated");
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <framework/status.h>
+
+#include <game/simulation/simulation_thread.h>
+
+namespace fw::net {
+class PacketBuffer;
+}
+
+namespace game {
+class Command;
+
+// A command log is a record of every command that was executed in a game, and the turn it was executed on. Everything
+// that changes the state of the game goes through a command, so that's all we need to play the whole game again (see
+// the replay tool).
+//
+// The file starts with a few "magic" bytes, and then it's a sequence of frames. Each frame is it's length as a varint,
+// then a packet of that many bytes (written with fw::net::PacketBuffer, in the compact encoding). The first frame is
+// the header, which has the map and the players, then there's a frame for each turn that had any commands in it, or
+// that's a different number of steps (see SimulationThread::kTurnStepMs) to the one before. Each command is it's
+// identifier, the player_no of the player who posted it and then whatever Command::serialize writes.
+class CommandLogWriter {
+private:
+  std::ofstream out_;
+  turn_id last_turn_;
+  int last_steps_;
+
+  fw::Status write_frame(fw::net::PacketBuffer const &buffer);
+
+public:
+  CommandLogWriter();
+  ~CommandLogWriter();
+
+  // Creates the file (replacing it if it's already there) and writes the header. start_turn is the last turn that's
+  // already been executed, so the first commands we write will be after it.
+  fw::Status open(std::string const &filename, std::string const &map_name, turn_id start_turn,
+      uint8_t local_player_no, std::vector<uint8_t> const &player_nos);
+
+  // Writes the commands that are about to be executed on the given turn, which is the given number of steps long.
+  // Turns with no commands are skipped, unless the number of steps has changed.
+  fw::Status write_turn(turn_id turn, int steps, std::vector<std::shared_ptr<Command>> const &commands);
+};
+
+// Reads a file written by CommandLogWriter. The commands are created for the players in SimulationThread, so set the
+// players up (see SimulationThread::initialize_replay) before you call read_turn.
+class CommandLogReader {
+private:
+  std::ifstream in_;
+  std::vector<char> frame_;
+  std::string map_name_;
+  turn_id start_turn_;
+  turn_id last_turn_;
+  int version_;
+  uint8_t local_player_no_;
+  std::vector<uint8_t> player_nos_;
+
+  // Reads the next frame into frame_. Returns false if we're at the end of the file.
+  fw::StatusOr<bool> read_frame();
+
+public:
+  CommandLogReader();
+  ~CommandLogReader();
+
+  // Opens the file and reads the header.
+  fw::Status open(std::string const &filename);
+
+  // Reads the next turn in the log. steps is the number of steps it's long, and so is every turn after it until the
+  // next one in the log (turns before the first one are one step). Returns false once there's no more turns.
+  fw::StatusOr<bool> read_turn(turn_id &turn, int &steps, std::vector<std::shared_ptr<Command>> &commands);
+
+  std::string const &get_map_name() const {
+    return map_name_;
+  }
+  turn_id get_start_turn() const {
+    return start_turn_;
+  }
+  uint8_t get_local_player_no() const {
+    return local_player_no_;
+  }
+  std::vector<uint8_t> const &get_player_nos() const {
+    return player_nos_;
+  }
+};
+
+}
@@ -128,14 +128,14 @@ CreateEntityCommand::~CreateEntityCommand() {
 }
 
 void CreateEntityCommand::serialize(fw::net::PacketBuffer &buffer) {
-  buffer << entity_id_;
+  buffer.add_id(entity_id_);
   buffer << template_name;
   buffer << initial_position;
   buffer << initial_goal;
 }
 
 void CreateEntityCommand::deserialize(fw::net::PacketBuffer &buffer) {
-  buffer >> entity_id_;
+  entity_id_ = buffer.get_id();
   buffer >> template_name;
   buffer >> initial_position;
   buffer >> initial_goal;
@@ -172,13 +172,13 @@ OrderCommand::~OrderCommand() {
 }
 
 void OrderCommand::serialize(fw::net::PacketBuffer &buffer) {
-  buffer << Entity;
+  buffer.add_id(Entity);
   buffer << order->get_identifier();
   order->serialize(buffer);
 }
 
 void OrderCommand::deserialize(fw::net::PacketBuffer &buffer) {
-  buffer >> Entity;
+  Entity = buffer.get_id();
 
   uint16_t order_id;
   buffer >> order_id;
@@ -209,11 +209,11 @@ bool AttackOrder::is_complete() {
 }
 
 void AttackOrder::serialize(fw::net::PacketBuffer &buffer) {
-  buffer << target;
+  buffer.add_id(target);
 }
 
 void AttackOrder::deserialize(fw::net::PacketBuffer &buffer) {
-  buffer >> target;
+  target = buffer.get_id();
 }
 
 
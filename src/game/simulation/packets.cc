@@ -1,4 +1,7 @@
 
+#include <algorithm>
+#include <bit>
+
 #include <framework/packet_buffer.h>
 
 #include <game/simulation/packets.h>
@@ -6,16 +9,27 @@
 #include <game/simulation/player.h>
 
 namespace game {
+namespace {
+
+// Anything a CommandPacket has that older versions don't know about goes after the commands, behind a byte of these
+// flags, so that in the legacy encoding the packet starts out exactly the same as it always has (and older versions
+// just ignore the rest).
+constexpr uint8_t kCommandHasStateHash = 0x01;
+constexpr uint8_t kCommandHasTurn = 0x02;
+constexpr uint8_t kCommandHasSchedule = 0x04;
+
+}
 
 PACKET_REGISTER(JoinRequestPacket);
 PACKET_REGISTER(JoinResponsePacket);
 PACKET_REGISTER(ChatPacket);
 PACKET_REGISTER(StartGamePacket);
 PACKET_REGISTER(CommandPacket);
+PACKET_REGISTER(StateDumpPacket);
 
 //-------------------------------------------------------------------------
 
-JoinRequestPacket::JoinRequestPacket() : user_id_(-1) {
+JoinRequestPacket::JoinRequestPacket() : user_id_(-1), max_encoding_(fw::net::Encoding::kLegacy) {
 }
 
 JoinRequestPacket::~JoinRequestPacket() {
@@ -24,16 +38,26 @@ JoinRequestPacket::~JoinRequestPacket() {
 void JoinRequestPacket::serialize(fw::net::PacketBuffer &buffer) {
   buffer << user_id_;
   buffer << color_;
+  buffer << static_cast<uint8_t>(max_encoding_);
 }
 
 void JoinRequestPacket::deserialize(fw::net::PacketBuffer &buffer) {
   buffer >> user_id_;
   buffer >> color_;
+
+  // Older versions stop here.
+  max_encoding_ = fw::net::Encoding::kLegacy;
+  if (buffer.get_bytes_remaining() > 0) {
+    uint8_t max_encoding;
+    buffer >> max_encoding;
+    max_encoding_ = static_cast<fw::net::Encoding>(
+        std::min(max_encoding, static_cast<uint8_t>(fw::net::kLatestEncoding)));
+  }
 }
 
 //-------------------------------------------------------------------------
 
-JoinResponsePacket::JoinResponsePacket() {
+JoinResponsePacket::JoinResponsePacket() : encoding_(fw::net::Encoding::kLegacy) {
 }
 
 JoinResponsePacket::~JoinResponsePacket() {
@@ -47,6 +71,7 @@ void JoinResponsePacket::serialize(fw::net::PacketBuffer &buffer) {
   }
   buffer << my_color_;
   buffer << your_color_;
+  buffer << static_cast<uint8_t>(encoding_);
 }
 
 void JoinResponsePacket::deserialize(fw::net::PacketBuffer &buffer) {
@@ -63,6 +88,14 @@ void JoinResponsePacket::deserialize(fw::net::PacketBuffer &buffer) {
   }
   buffer >> my_color_;
   buffer >> your_color_;
+
+  // Older versions stop here.
+  encoding_ = fw::net::Encoding::kLegacy;
+  if (buffer.get_bytes_remaining() > 0) {
+    uint8_t encoding;
+    buffer >> encoding;
+    encoding_ = static_cast<fw::net::Encoding>(std::min(encoding, static_cast<uint8_t>(fw::net::kLatestEncoding)));
+  }
 }
 
 //-------------------------------------------------------------------------
@@ -97,7 +130,9 @@ void StartGamePacket::deserialize(fw::net::PacketBuffer &) {
 
 //----------------------------------------------------------------------------
 
-CommandPacket::CommandPacket() {
+CommandPacket::CommandPacket() :
+    turn_(0), has_schedule_(false), schedule_turn_(0), schedule_turn_length_ms_(0), schedule_command_delay_(0),
+    has_state_hash_(false), state_hash_turn_(0), state_hash_(0) {
 }
 
 CommandPacket::~CommandPacket() {
@@ -110,14 +145,45 @@ void CommandPacket::serialize(fw::net::PacketBuffer &buffer) {
   for (std::shared_ptr<Command> &cmd : commands_) {
     buffer << cmd->get_identifier();
 
+    // Every version reads the player number as a single byte. (Older versions wrote a four-byte zero when there was
+    // no player, which they couldn't read back themselves.)
     if (cmd->get_player() != nullptr) {
       buffer << cmd->get_player()->get_player_no();
     } else {
-      buffer << 0;
+      buffer << static_cast<uint8_t>(0);
     }
 
     cmd->serialize(buffer);
   }
+
+  uint8_t flags = 0;
+  if (has_state_hash_) {
+    flags |= kCommandHasStateHash;
+  }
+  if (turn_ != 0) {
+    flags |= kCommandHasTurn;
+  }
+  if (has_schedule_) {
+    flags |= kCommandHasSchedule;
+  }
+  if (flags == 0) {
+    return;
+  }
+
+  buffer << flags;
+  if (has_state_hash_) {
+    // the hash is random, so a varint would only make it bigger
+    buffer << state_hash_turn_;
+    buffer.add_fixed(state_hash_, 8);
+  }
+  if (turn_ != 0) {
+    buffer << turn_;
+  }
+  if (has_schedule_) {
+    buffer << schedule_turn_;
+    buffer << schedule_turn_length_ms_;
+    buffer << schedule_command_delay_;
+  }
 }
 
 void CommandPacket::deserialize(fw::net::PacketBuffer &buffer) {
@@ -140,6 +206,63 @@ void CommandPacket::deserialize(fw::net::PacketBuffer &buffer) {
       commands_.push_back(*cmd);
     }
   }
+
+  // Older versions stop here, and so do we if there's nothing else to send.
+  uint8_t flags = 0;
+  if (buffer.get_bytes_remaining() > 0) {
+    buffer >> flags;
+  }
+
+  has_state_hash_ = (flags & kCommandHasStateHash) != 0;
+  if (has_state_hash_) {
+    buffer >> state_hash_turn_;
+    state_hash_ = buffer.get_fixed(8);
+  }
+  turn_ = 0;
+  if ((flags & kCommandHasTurn) != 0) {
+    buffer >> turn_;
+  }
+  has_schedule_ = (flags & kCommandHasSchedule) != 0;
+  if (has_schedule_) {
+    buffer >> schedule_turn_;
+    buffer >> schedule_turn_length_ms_;
+    buffer >> schedule_command_delay_;
+  }
+}
+
+//----------------------------------------------------------------------------
+
+StateDumpPacket::StateDumpPacket() {
+}
+
+StateDumpPacket::~StateDumpPacket() {
+}
+
+void StateDumpPacket::serialize(fw::net::PacketBuffer &buffer) {
+  buffer << static_cast<uint32_t>(entities_.size());
+  for (ent::EntityState const &state : entities_) {
+    buffer.add_id(state.id);
+    buffer << state.name;
+    buffer << state.position;
+    buffer.add_fixed(std::bit_cast<uint32_t>(state.health), 4);
+    buffer.add_fixed(state.hash, 8);
+  }
+}
+
+void StateDumpPacket::deserialize(fw::net::PacketBuffer &buffer) {
+  uint32_t num_entities;
+  buffer >> num_entities;
+
+  entities_.clear();
+  for (uint32_t i = 0; i < num_entities && !buffer.has_read_error(); i++) {
+    ent::EntityState state;
+    state.id = buffer.get_id();
+    buffer >> state.name;
+    buffer >> state.position;
+    state.health = std::bit_cast<float>(static_cast<uint32_t>(buffer.get_fixed(4)));
+    state.hash = buffer.get_fixed(8);
+    entities_.push_back(state);
+  }
 }
 
 }
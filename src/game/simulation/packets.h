@@ -4,8 +4,11 @@
 #pragma once
 
 #include <framework/packet.h>
+#include <framework/packet_buffer.h>
 #include <framework/color.h>
 
+#include <game/entities/state_hash.h>
+
 namespace fw {
 namespace net {
 class PacketBuffer;
@@ -23,6 +26,7 @@ class JoinRequestPacket: public fw::net::Packet {
 private:
   uint32_t user_id_;
   fw::Color color_;
+  fw::net::Encoding max_encoding_;
 
 protected:
   virtual void serialize(fw::net::PacketBuffer &buffer);
@@ -48,6 +52,15 @@ public:
     return color_;
   }
 
+  // gets or sets the newest encoding the connecting player can use. Older versions don't send this, in which case
+  // it's Encoding::kLegacy.
+  void set_max_encoding(fw::net::Encoding value) {
+    max_encoding_ = value;
+  }
+  fw::net::Encoding get_max_encoding() const {
+    return max_encoding_;
+  }
+
   static const int identifier = 1;
   virtual uint16_t get_identifier() const {
     return identifier;
@@ -61,6 +74,7 @@ private:
   std::vector<uint32_t> other_users_;
   fw::Color my_color_;
   fw::Color your_color_;
+  fw::net::Encoding encoding_;
 
 protected:
   virtual void serialize(fw::net::PacketBuffer &buffer);
@@ -98,6 +112,14 @@ public:
     your_color_ = col;
   }
 
+  // gets or sets the encoding we've chosen for packets on this connection (the newest one that we both support)
+  fw::net::Encoding get_encoding() const {
+    return encoding_;
+  }
+  void set_encoding(fw::net::Encoding value) {
+    encoding_ = value;
+  }
+
   static const int identifier = 2;
   virtual uint16_t get_identifier() const {
     return identifier;
@@ -146,11 +168,24 @@ public:
   }
 };
 
-// this Packet is sent at the end of each turn and notifies our Peer
-// of our commands that are queued for the next turn
+// this Packet is sent at the end of each turn and notifies our Peer of the commands we posted during the turn, and
+// the turn that everybody will execute them on. Our Peer won't run that turn until they've got it.
+//
+// The game's host also sends the schedule of turn lengths and command delays (see SimulationThread::TurnSchedule)
+// whenever they decide to change it. Every few turns, it also has the hash of our state (see ent::StateHash) from a
+// recent turn, so that our Peer can check that they've got the same one. Older versions don't send any of these, and
+// in the legacy encoding a packet without them is byte-for-byte what they send.
 class CommandPacket: public fw::net::Packet {
 private:
+  uint32_t turn_;
   std::vector<std::shared_ptr<Command>> commands_;
+  bool has_schedule_;
+  uint32_t schedule_turn_;
+  uint16_t schedule_turn_length_ms_;
+  uint8_t schedule_command_delay_;
+  bool has_state_hash_;
+  uint32_t state_hash_turn_;
+  uint64_t state_hash_;
 
 protected:
   virtual void serialize(fw::net::PacketBuffer &buffer);
@@ -167,10 +202,82 @@ public:
     return commands_;
   }
 
+  // The turn that the commands are to be executed on. It's zero if the packet came from an older version that doesn't
+  // say, in which case we just run them as soon as we can.
+  void set_turn(uint32_t value) {
+    turn_ = value;
+  }
+  uint32_t get_turn() const {
+    return turn_;
+  }
+
+  // Sets the turn length and command delay that everybody switches to from the start of the given turn.
+  void set_schedule(uint32_t turn, uint16_t turn_length_ms, uint8_t command_delay) {
+    has_schedule_ = true;
+    schedule_turn_ = turn;
+    schedule_turn_length_ms_ = turn_length_ms;
+    schedule_command_delay_ = command_delay;
+  }
+  bool has_schedule() const {
+    return has_schedule_;
+  }
+  uint32_t get_schedule_turn() const {
+    return schedule_turn_;
+  }
+  uint16_t get_schedule_turn_length_ms() const {
+    return schedule_turn_length_ms_;
+  }
+  uint8_t get_schedule_command_delay() const {
+    return schedule_command_delay_;
+  }
+
+  // Sets the hash of our state at the end of the given turn.
+  void set_state_hash(uint32_t turn, uint64_t hash) {
+    has_state_hash_ = true;
+    state_hash_turn_ = turn;
+    state_hash_ = hash;
+  }
+  bool has_state_hash() const {
+    return has_state_hash_;
+  }
+  uint32_t get_state_hash_turn() const {
+    return state_hash_turn_;
+  }
+  uint64_t get_state_hash() const {
+    return state_hash_;
+  }
+
   static const int identifier = 5;
   virtual uint16_t get_identifier() const {
     return identifier;
   }
 };
 
+// When our state hash doesn't match our Peer's, we send them the state of all our entities so that they can work out
+// (and log) which ones are different.
+class StateDumpPacket: public fw::net::Packet {
+private:
+  std::vector<ent::EntityState> entities_;
+
+protected:
+  virtual void serialize(fw::net::PacketBuffer &buffer);
+  virtual void deserialize(fw::net::PacketBuffer &buffer);
+
+public:
+  StateDumpPacket();
+  virtual ~StateDumpPacket();
+
+  void set_entities(std::vector<ent::EntityState> const &entities) {
+    entities_ = entities;
+  }
+  std::vector<ent::EntityState> &get_entities() {
+    return entities_;
+  }
+
+  static const int identifier = 6;
+  virtual uint16_t get_identifier() const {
+    return identifier;
+  }
+};
+
 }
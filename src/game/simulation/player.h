@@ -50,6 +50,17 @@ public:
   /** Posts the given commands to this player for the next turn. */
   virtual void post_commands(std::vector<std::shared_ptr<Command>> &commands);
 
+  /**
+   * Gets the round-trip time (and it's variance) to this player, in milliseconds. It's zero for players who aren't
+   * on the other end of a network connection.
+   */
+  virtual int get_round_trip_time() const {
+    return 0;
+  }
+  virtual int get_round_trip_time_variance() const {
+    return 0;
+  }
+
   std::string get_user_name() const;
   uint32_t get_user_id() const {
     return user_id_ == 0 ? player_no_ : user_id_;
@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <functional>
 #include <memory>
 
 #include <framework/net.h>
 #include <framework/logging.h>
 #include <framework/misc.h>
+#include <framework/settings.h>
 
 #include <game/session/session.h>
 #include <game/session/session_request.h>
@@ -17,12 +19,23 @@
 using namespace std::placeholders;
 
 namespace game {
+namespace {
+
+// The newest packet encoding we're willing to use, which is normally the newest one we know about.
+fw::net::Encoding get_max_encoding() {
+  const int max_encoding = std::clamp(
+      fw::Settings::get<int>("net-encoding"), 0, static_cast<int>(fw::net::kLatestEncoding));
+  return static_cast<fw::net::Encoding>(max_encoding);
+}
+
+}
 
 RemotePlayer::RemotePlayer(
     std::shared_ptr<fw::net::Host> const &host,
     std::shared_ptr<fw::net::Peer> const &peer,
     bool connected)
-    : host_(host), peer_(peer), connected_(connected) {
+    : host_(host), peer_(peer), connected_(connected), last_batch_turn_(0), sends_turns_(true), state_dump_sent_(false),
+      state_dump_pending_(false) {
   peer->set_handler(std::bind(&RemotePlayer::packet_handler, this, _1));
 
   // give them a temporary username until the connection process has completed.
@@ -53,10 +66,31 @@ void RemotePlayer::local_player_is_ready() {
 
 void RemotePlayer::post_commands(std::vector<std::shared_ptr<Command>> &commands) {
   CommandPacket pkt;
+  pkt.set_turn(SimulationThread::get_instance()->get_batch_turn());
   pkt.set_commands(commands);
+
+  SimulationThread::TurnSchedule schedule;
+  if (SimulationThread::get_instance()->get_schedule_to_send(schedule)) {
+    pkt.set_schedule(schedule.turn, static_cast<uint16_t>(schedule.turn_length_ms),
+        static_cast<uint8_t>(schedule.command_delay));
+  }
+
+  turn_id state_hash_turn;
+  uint64_t state_hash;
+  if (SimulationThread::get_instance()->get_state_hash_to_send(state_hash_turn, state_hash)) {
+    pkt.set_state_hash(state_hash_turn, state_hash);
+  }
   peer_->send(pkt);
 }
 
+int RemotePlayer::get_round_trip_time() const {
+  return peer_->get_round_trip_time();
+}
+
+int RemotePlayer::get_round_trip_time_variance() const {
+  return peer_->get_round_trip_time_variance();
+}
+
 // this is called whenever we receive a Packet from our Peer, we need to work out
 // what kind of Packet it is and hand it off to the correct handler function.
 void RemotePlayer::packet_handler(std::shared_ptr<fw::net::Packet> const &pkt) {
@@ -76,6 +110,9 @@ void RemotePlayer::packet_handler(std::shared_ptr<fw::net::Packet> const &pkt) {
   case CommandPacket::identifier:
     pkt_command(pkt);
     break;
+  case StateDumpPacket::identifier:
+    pkt_state_dump(pkt);
+    break;
 
   default:
     LOG(WARN) << "  unknown packet type: " << pkt->get_identifier();
@@ -90,6 +127,11 @@ void RemotePlayer::pkt_join_req(std::shared_ptr<fw::net::Packet> pkt) {
   user_id_ = req->get_user_id();
   color_ = req->get_color();
 
+  // From now on, we send them the newest encoding we both understand. They'll find out which one that is in our
+  // response, but they can read it before then anyway (every packet says which encoding it's in).
+  peer_->set_encoding(std::min(req->get_max_encoding(), get_max_encoding()));
+  LOG(INFO) << "using packet encoding " << static_cast<int>(peer_->get_encoding()) << " for this player";
+
   // call the session and confirm the fact that this player is valid and that.
   std::shared_ptr<game::SessionRequest> sess_req = Session::get_instance()->confirm_player(
       SimulationThread::get_instance()->get_game_id(), user_id_);
@@ -102,6 +144,8 @@ void RemotePlayer::pkt_join_resp(std::shared_ptr<fw::net::Packet> pkt) {
   std::shared_ptr<JoinResponsePacket> resp(std::dynamic_pointer_cast<JoinResponsePacket>(pkt));
 
   LOG(INFO) << "connected to host, map is: " << resp->get_map_name();
+  peer_->set_encoding(std::min(resp->get_encoding(), get_max_encoding()));
+  LOG(INFO) << "using packet encoding " << static_cast<int>(peer_->get_encoding()) << " for this player";
   for (uint32_t other_user_id : resp->get_other_users()) {
     // the color that we sent will be echo'd back to us, usually
     color_ = resp->get_my_color();
@@ -158,13 +202,83 @@ void RemotePlayer::pkt_start_game(std::shared_ptr<fw::net::Packet> pkt) {
   is_ready_to_start_ = true;
 }
 
-// this is sent to us at the beginning of the turn, we need to enqueue the commands
-// for the next turn.
+// this is sent to us at the start of each of our Peer's turns, we need to enqueue the commands for the turn they're
+// for (and once we've got it, we can run that turn).
 void RemotePlayer::pkt_command(std::shared_ptr<fw::net::Packet> pkt) {
   std::shared_ptr<CommandPacket> command_pkt(std::dynamic_pointer_cast<CommandPacket>(pkt));
   for (std::shared_ptr<Command> &cmd : command_pkt->get_commands()) {
     LOG(DBG) << "got command, id: " << static_cast<int>(cmd->get_identifier());
-    SimulationThread::get_instance()->enqueue_command(cmd);
+  }
+
+  if (command_pkt->get_turn() == 0 && sends_turns_) {
+    LOG(WARN) << user_name_ << " is running an older version that doesn't say which turn commands are for, we won't "
+              << "wait for their commands (and our games will probably diverge)";
+    sends_turns_ = false;
+  }
+  last_batch_turn_ = std::max(last_batch_turn_, command_pkt->get_turn());
+
+  if (command_pkt->has_schedule()) {
+    SimulationThread::get_instance()->schedule_turn_timing(*this, SimulationThread::TurnSchedule {
+        command_pkt->get_schedule_turn(), command_pkt->get_schedule_turn_length_ms(),
+        command_pkt->get_schedule_command_delay()});
+  }
+  SimulationThread::get_instance()->enqueue_remote_commands(command_pkt->get_commands(), command_pkt->get_turn());
+
+  if (command_pkt->has_state_hash()) {
+    remote_state_hashes_.emplace_back(command_pkt->get_state_hash_turn(), command_pkt->get_state_hash());
+    check_state_hashes();
+  }
+}
+
+void RemotePlayer::check_state_hashes() {
+  const turn_id last_hashed_turn = SimulationThread::get_instance()->get_last_hashed_turn();
+  while (!remote_state_hashes_.empty() && remote_state_hashes_.front().first <= last_hashed_turn) {
+    const auto [turn, hash] = remote_state_hashes_.front();
+    remote_state_hashes_.pop_front();
+
+    uint64_t our_hash;
+    if (!SimulationThread::get_instance()->get_state_hash(turn, our_hash)) {
+      LOG(WARN) << "can't check " << user_name_ << "'s state on turn " << turn << ", we don't have ours any more";
+      continue;
+    }
+    if (our_hash != hash) {
+      LOG(ERR) << "our game has diverged from " << user_name_ << "'s! on turn " << turn << " our state was "
+               << ent::StateHash::to_string(our_hash) << ", theirs was " << ent::StateHash::to_string(hash);
+      send_state_dump();
+    }
+  }
+}
+
+// this is sent to us when our peer's state hash doesn't match ours, it's the state of all their entities. We'll
+// compare them with ours (and send them ours, so they can do the same) once we've got a snapshot of our own.
+void RemotePlayer::pkt_state_dump(std::shared_ptr<fw::net::Packet> pkt) {
+  std::shared_ptr<StateDumpPacket> dump_pkt(std::dynamic_pointer_cast<StateDumpPacket>(pkt));
+  LOG(INFO) << "got the state of " << dump_pkt->get_entities().size() << " entities from " << user_name_;
+  remote_state_ = std::move(dump_pkt->get_entities());
+  send_state_dump();
+  SimulationThread::get_instance()->request_state_snapshot();
+}
+
+void RemotePlayer::send_state_dump() {
+  if (state_dump_sent_) {
+    return;
+  }
+  state_dump_sent_ = true;
+  state_dump_pending_ = true;
+  SimulationThread::get_instance()->request_state_snapshot();
+}
+
+void RemotePlayer::state_snapshot_ready(std::vector<ent::EntityState> const &snapshot) {
+  if (state_dump_pending_) {
+    StateDumpPacket pkt;
+    pkt.set_entities(snapshot);
+    peer_->send(pkt);
+    state_dump_pending_ = false;
+  }
+
+  if (remote_state_) {
+    ent::StateHash::log_differences(snapshot, *remote_state_, user_name_);
+    remote_state_.reset();
   }
 }
 
@@ -212,6 +326,7 @@ void RemotePlayer::join_complete(SessionRequest &req) {
   resp.set_map_name(SimulationThread::get_instance()->get_map_name());
   resp.set_your_color(color_);
   resp.set_my_color(SimulationThread::get_instance()->get_local_player()->get_color());
+  resp.set_encoding(peer_->get_encoding());
   for (auto plyr : SimulationThread::get_instance()->get_players()) {
     if (plyr.get() == this) {
       continue;
@@ -253,10 +368,14 @@ void RemotePlayer::update() {
     JoinRequestPacket pkt;
     pkt.set_user_id(Session::get_instance()->get_user_id());
     pkt.set_color(our_color);
+    pkt.set_max_encoding(get_max_encoding());
     peer_->send(pkt);
 
     connected_ = true;
   }
+
+  // we might have simulated the turns for some of their hashes since we got them
+  check_state_hashes();
 }
 
 }
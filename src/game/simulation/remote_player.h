@@ -1,9 +1,16 @@
 #pragma once
 
+#include <deque>
 #include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
 
 #include <framework/status.h>
 
+#include <game/entities/state_hash.h>
+#include <game/simulation/simulation_thread.h>
+
 #include "player.h"
 
 namespace fw {
@@ -40,10 +47,47 @@ public:
   virtual void update();
   virtual void send_chat_msg(std::string const &msg);
 
+  int get_round_trip_time() const override;
+  int get_round_trip_time_variance() const override;
+
+  // This is called when the snapshot of our entities that we asked for (see send_state_dump) is ready.
+  void state_snapshot_ready(std::vector<ent::EntityState> const &snapshot);
+
+  // Gets the turn that the last batch of commands we got from this player was for. We can't run any turns after it
+  // until we've got their next one.
+  turn_id get_last_batch_turn() const {
+    return last_batch_turn_;
+  }
+
+  // Older versions don't say which turn their commands are for, so we can't wait for them.
+  bool sends_turns() const {
+    return sends_turns_;
+  }
+
   private:
   std::shared_ptr<fw::net::Host> host_;
   std::shared_ptr<fw::net::Peer> peer_;
   bool connected_;
+  turn_id last_batch_turn_;
+  bool sends_turns_;
+
+  // We only send our state to each peer once (it's big, and once we've diverged, we'll stay that way). If we're
+  // waiting for the snapshot to send them, state_dump_pending_ is set.
+  bool state_dump_sent_;
+  bool state_dump_pending_;
+
+  // The state that our peer sent us, which we compare with ours once our snapshot is ready.
+  std::optional<std::vector<ent::EntityState>> remote_state_;
+
+  // The hashes of our peer's state that they've sent us (and the turns they're from) that we haven't simulated the
+  // turn for yet, oldest first.
+  std::deque<std::pair<turn_id, uint64_t>> remote_state_hashes_;
+
+  // Checks the hashes in remote_state_hashes_ against ours, for the turns that we've simulated.
+  void check_state_hashes();
+
+  // Sends our peer the state of all our entities (once we've got a snapshot of them), if we haven't already.
+  void send_state_dump();
 
   /** This is called whenever we receive a Packet from our Peer. */
   void packet_handler(std::shared_ptr<fw::net::Packet> const &pkt);
@@ -55,6 +99,7 @@ public:
   void pkt_chat(std::shared_ptr<fw::net::Packet> pkt);
   void pkt_start_game(std::shared_ptr<fw::net::Packet> pkt);
   void pkt_command(std::shared_ptr<fw::net::Packet> pkt);
+  void pkt_state_dump(std::shared_ptr<fw::net::Packet> pkt);
 
   // when we get a pkt_join, we ask the server to confirm the user. when the server
   // gets back to us, it'll call this method and we can respond to the original
@@ -1,5 +1,8 @@
 #include <game/simulation/simulation_thread.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <memory>
 #include <thread>
 
@@ -14,14 +17,65 @@
 #include <game/simulation/remote_player.h>
 #include <game/simulation/local_player.h>
 #include <game/simulation/commands.h>
+#include <game/simulation/command_log.h>
 #include <game/ai/ai_player.h>
+#include <game/entities/entity_manager.h>
+#include <game/entities/state_hash.h>
+#include <game/world/world.h>
 
 namespace game {
+namespace {
+
+// We want turns to be a few times longer than it takes to process one, so that a slow turn doesn't throw us off.
+constexpr float kProcessingHeadroom = 4.0f;
+
+// The most turns we'll delay commands by. If the network's slow enough that we'd need more, we make turns longer
+// instead (there's no point processing turns that quickly if commands take ages to arrive anyway).
+constexpr int kMaxCommandDelay = 6;
+
+// Everybody starts out with this command delay, so nobody waits for anybody's commands for the first few turns (there
+// aren't any for them). The host changes it once they've seen what the network's like.
+constexpr int kInitialCommandDelay = 1;
+
+// When we're waiting for a peer's commands before we can start a turn, this is how often we check for them.
+constexpr std::chrono::milliseconds kBatchPollInterval(1);
+
+// We don't run a turn while the update thread has more than this many turns left to simulate. If it can't keep up,
+// there's no point piling up turns for it: everything we do would just take longer to show up.
+constexpr turn_id kMaxTurnsBehind = 2;
+
+// We make turns longer and delays bigger as soon as we need to, but only shrink them after this many turns of not
+// needing them, so that the odd fast turn doesn't have us flip-flopping.
+constexpr int kShrinkAfterTurns = 20;
+
+// How quickly the smoothed processing time and turn length move towards their new values.
+constexpr float kSmoothing = 0.1f;
+
+// A player in a game we're replaying. All we know about them is their player_no, which is all the commands need.
+class ReplayPlayer : public Player {
+public:
+  explicit ReplayPlayer(uint8_t player_no) {
+    player_no_ = player_no;
+    color_ = player_colors[player_no % player_colors.size()];
+  }
+
+  void local_player_is_ready() override {
+  }
+};
+
+}
 
 SimulationThread *SimulationThread::instance = new SimulationThread();
 
 SimulationThread::SimulationThread() :
-    turn_(0), game_id_(0), stopped_(false) {
+    turn_(0), game_id_(0), stopped_(false), game_started_(false), running_turns_(false), simulate_ms_(0.0f),
+    turn_length_ms_(50), command_delay_(kInitialCommandDelay), min_turn_length_ms_(50.0f), max_turn_length_ms_(500.0f),
+    target_turn_length_ms_(50.0f), processing_ms_(0.0f), waiting_ms_(0.0f), late_delay_(0),
+    turns_until_shrink_(kShrinkAfterTurns), stats_(), state_hashes_(), last_hashed_turn_(0), state_hash_interval_(0),
+    state_hash_to_send_(), last_sent_hash_turn_(0) {
+}
+
+SimulationThread::~SimulationThread() {
 }
 
 void SimulationThread::initialize() {
@@ -33,10 +87,55 @@ void SimulationThread::initialize() {
   thread_ = std::thread(std::bind(&SimulationThread::thread_proc, this));
 }
 
+void SimulationThread::initialize_replay(uint8_t local_player_no, std::vector<uint8_t> const &player_nos) {
+  local_player_ = std::make_shared<LocalPlayer>();
+  local_player_->set_player_no(local_player_no);
+  players_.push_back(local_player_);
+
+  for (uint8_t player_no : player_nos) {
+    if (player_no != local_player_no) {
+      players_.push_back(std::make_shared<ReplayPlayer>(player_no));
+    }
+  }
+}
+
 void SimulationThread::destroy() {
   stopped_ = true;
   stopped_cond_.notify_all();
   thread_.join();
+  stop_recording();
+}
+
+fw::Status SimulationThread::start_recording(std::string const &filename, std::string const &map_name) {
+  std::vector<uint8_t> player_nos;
+  for (auto &player : players_) {
+    player_nos.push_back(player->get_player_no());
+  }
+
+  auto command_log = std::make_unique<CommandLogWriter>();
+  RETURN_IF_ERROR(command_log->open(filename, map_name, turn_, local_player_->get_player_no(), player_nos));
+
+  std::unique_lock<std::mutex> lock(recording_mutex_);
+  command_log_ = std::move(command_log);
+  return fw::OkStatus();
+}
+
+void SimulationThread::stop_recording() {
+  std::unique_lock<std::mutex> lock(recording_mutex_);
+  command_log_.reset();
+}
+
+void SimulationThread::record_turn(int steps, std::vector<std::shared_ptr<Command>> const &commands) {
+  std::unique_lock<std::mutex> lock(recording_mutex_);
+  if (!command_log_) {
+    return;
+  }
+
+  auto status = command_log_->write_turn(turn_, steps, commands);
+  if (!status.ok()) {
+    LOG(ERR) << "error recording commands, recording stopped: " << status;
+    command_log_.reset();
+  }
 }
 
 fw::Status SimulationThread::connect(uint64_t game_id, std::string address, uint8_t player_no) {
@@ -50,6 +149,7 @@ fw::Status SimulationThread::connect(uint64_t game_id, std::string address, uint
   // create a new remote_player for the Host player and connect to it
   ASSIGN_OR_RETURN(auto player, RemotePlayer::connect(host_, address));
   players_.push_back(player);
+  host_player_ = player;
   return fw::OkStatus();
 }
 
@@ -64,6 +164,10 @@ void SimulationThread::new_game(uint64_t game_id) {
   game_id_ = game_id;
 }
 
+void SimulationThread::start_game() {
+  game_started_ = true;
+}
+
 int SimulationThread::get_listen_port() const {
   return host_->get_listen_port();
 }
@@ -93,32 +197,262 @@ std::shared_ptr<Player> SimulationThread::get_player(uint8_t player_no) const {
 }
 
 void SimulationThread::post_command(std::shared_ptr<Command> &cmd) {
+  std::unique_lock<std::mutex> lock(posted_commands_mutex_);
   posted_commands_.push_back(cmd);
 }
 
 void SimulationThread::enqueue_posted_commands() {
-  for (std::shared_ptr<Command> &cmd : posted_commands_) {
-    enqueue_command(cmd);
+  std::vector<std::shared_ptr<Command>> commands;
+  {
+    std::unique_lock<std::mutex> lock(posted_commands_mutex_);
+    commands.swap(posted_commands_);
+  }
+
+  // Our own commands wait for the command delay just like everybody else's, so that they run on the same turn as
+  // they do for the other players.
+  for (std::shared_ptr<Command> &cmd : commands) {
+    enqueue_command(cmd, get_batch_turn());
+  }
+
+  // If we've simulated a turn that we send the hash of since the last time, it goes with this batch.
+  state_hash_to_send_ = TurnStateHash {0, 0};
+  if (state_hash_interval_ > 0) {
+    std::unique_lock<std::mutex> lock(state_hashes_mutex_);
+    const turn_id turn = last_hashed_turn_ - (last_hashed_turn_ % state_hash_interval_);
+    TurnStateHash const &turn_hash = state_hashes_[turn % kStateHashHistory];
+    if (turn > last_sent_hash_turn_ && turn_hash.turn == turn) {
+      state_hash_to_send_ = turn_hash;
+      last_sent_hash_turn_ = turn;
+    }
+  }
+
+  // We send a batch every turn, even if it's empty.
+  for (auto &player : players_) {
+    player->post_commands(commands);
+  }
+}
+
+void SimulationThread::enqueue_command(std::shared_ptr<Command> &cmd, turn_id turn) {
+  commands_[std::max(turn, turn_ + 1)].push_back(cmd);
+}
+
+void SimulationThread::enqueue_remote_commands(std::vector<std::shared_ptr<Command>> &commands, turn_id turn) {
+  if (turn != 0 && turn <= turn_) {
+    // We don't run a turn until we've got everybody's commands for it, so this shouldn't happen.
+    LOG(ERR) << "got commands for turn " << turn << " after we'd already run it (we're on turn " << turn_ << ")";
+    std::unique_lock<std::mutex> lock(stats_mutex_);
+    stats_.late_batches++;
+  }
+
+  for (std::shared_ptr<Command> &cmd : commands) {
+    enqueue_command(cmd, turn);
+  }
+}
+
+bool SimulationThread::have_all_batches(turn_id turn) const {
+  // Nobody sends anything for the first few turns.
+  if (turn <= kInitialCommandDelay) {
+    return true;
+  }
+
+  // Peers send their batches in order, and the turns they're for never go backwards, so once we've got one for this
+  // turn (or a later one), there's nothing else coming for it.
+  for (auto &peer : lockstep_peers_) {
+    if (peer->sends_turns() && peer->get_last_batch_turn() < turn) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SimulationThread::get_schedule_to_send(TurnSchedule &schedule) const {
+  auto it = schedules_.find(get_batch_turn());
+  if (!is_host() || it == schedules_.end()) {
+    return false;
+  }
+  schedule = it->second;
+  return true;
+}
+
+void SimulationThread::schedule_turn_timing(Player const &sender, TurnSchedule const &schedule) {
+  if (&sender != host_player_.get()) {
+    LOG(WARN) << "ignoring turn timing from " << sender.get_user_name() << ", who isn't the host";
+    return;
+  }
+  if (schedule.turn <= turn_) {
+    LOG(ERR) << "got turn timing for turn " << schedule.turn << " after we'd already run it (we're on turn " << turn_
+             << ")";
   }
+  schedules_[std::max(schedule.turn, turn_ + 1)] = schedule;
+}
+
+SimulationThread::TurnStats SimulationThread::get_turn_stats() const {
+  std::unique_lock<std::mutex> lock(stats_mutex_);
+  return stats_;
+}
 
+void SimulationThread::update_turn_timing(float processing_ms, float waiting_ms) {
+  processing_ms_ += (processing_ms - processing_ms_) * kSmoothing;
+  waiting_ms_ += (waiting_ms - waiting_ms_) * kSmoothing;
+
+  int max_rtt_ms = 0;
+  int max_rtt_variance_ms = 0;
   for (auto &player : players_) {
-    player->post_commands(posted_commands_);
+    max_rtt_ms = std::max(max_rtt_ms, player->get_round_trip_time());
+    max_rtt_variance_ms = std::max(max_rtt_variance_ms, player->get_round_trip_time_variance());
+  }
+
+  // Only the host decides the timing, and only one change at a time: we wait for the last one to start before we
+  // decide on the next.
+  if (is_host() && schedules_.empty()) {
+    // If we had to wait more than half a turn for somebody's commands, the delay isn't long enough for them.
+    if (waiting_ms > turn_length_ms_ * 0.5f) {
+      late_delay_ = std::min(late_delay_ + 1, kMaxCommandDelay);
+    }
+
+    // Commands need to get to the slowest peer (allowing for a bit of jitter) and be processed there before their
+    // turn comes around.
+    const float latency_ms = (max_rtt_ms * 0.5f) + max_rtt_variance_ms + processing_ms_;
+
+    float target_turn_length_ms =
+        std::clamp(processing_ms_ * kProcessingHeadroom, min_turn_length_ms_, max_turn_length_ms_);
+    int target_delay = 1 + static_cast<int>(std::ceil(latency_ms / target_turn_length_ms));
+    if (max_rtt_ms == 0) {
+      // Nobody to wait for, the next turn will do.
+      target_delay = 1;
+    }
+    if (target_delay > kMaxCommandDelay) {
+      target_turn_length_ms = std::min(latency_ms / (kMaxCommandDelay - 1), max_turn_length_ms_);
+      target_delay = kMaxCommandDelay;
+    }
+    target_delay = std::min(target_delay + late_delay_, kMaxCommandDelay);
+
+    if (target_turn_length_ms > target_turn_length_ms_) {
+      target_turn_length_ms_ = target_turn_length_ms;
+    } else {
+      target_turn_length_ms_ += (target_turn_length_ms - target_turn_length_ms_) * kSmoothing;
+    }
+
+    int command_delay = command_delay_;
+    if (target_delay > command_delay_) {
+      command_delay = target_delay;
+      turns_until_shrink_ = kShrinkAfterTurns;
+    } else if (--turns_until_shrink_ <= 0) {
+      // We only ever shrink it by one turn at a time, so that the turns that commands are for never go backwards.
+      if (target_delay < command_delay_) {
+        command_delay = command_delay_ - 1;
+      }
+      if (late_delay_ > 0) {
+        late_delay_--;
+      }
+      turns_until_shrink_ = kShrinkAfterTurns;
+    }
+
+    // Turns are a whole number of steps long (see kTurnStepMs), which also means small changes aren't worth sending.
+    const int turn_length_ms = get_steps_per_turn(static_cast<int>(std::round(target_turn_length_ms_))) * kTurnStepMs;
+    if (command_delay != command_delay_ || turn_length_ms != turn_length_ms_) {
+      // It goes out with our next batch of commands, and starts on the turn that they're for. Nobody can run that
+      // turn until they've got the batch.
+      const turn_id turn = turn_ + 1 + command_delay_;
+      schedules_[turn] = TurnSchedule {turn, turn_length_ms, command_delay};
+      LOG(INFO) << "from turn " << turn << ", command delay will be " << command_delay << " turns and turns will be "
+                << turn_length_ms << "ms (rtt=" << max_rtt_ms << "ms)";
+    }
   }
 
-  posted_commands_.clear();
+  std::unique_lock<std::mutex> lock(stats_mutex_);
+  stats_.turn = turn_;
+  stats_.turn_length_ms = static_cast<float>(turn_length_ms_);
+  stats_.command_delay = command_delay_;
+  stats_.command_latency_ms = static_cast<float>(turn_length_ms_ * command_delay_);
+  stats_.processing_ms = processing_ms_;
+  stats_.max_rtt_ms = static_cast<float>(max_rtt_ms);
+  stats_.max_rtt_variance_ms = static_cast<float>(max_rtt_variance_ms);
+  stats_.pipelined_turns = static_cast<int>(commands_.size());
+  stats_.waiting_ms = waiting_ms_;
 }
 
-void SimulationThread::enqueue_command(std::shared_ptr<Command> &cmd) {
-  turn_id turn = turn_ + 1;
+void SimulationThread::simulate_turns() {
+  World *world = World::get_instance();
+  if (world == nullptr || world->get_entity_manager() == nullptr) {
+    return;
+  }
+  ent::EntityManager *entities = world->get_entity_manager();
+
+  std::deque<TurnCommands> turns;
+  {
+    std::unique_lock<std::mutex> lock(turns_to_simulate_mutex_);
+    turns.swap(turns_to_simulate_);
+  }
 
-  auto it = commands_.find(turn);
-  if (it == commands_.end()) {
-    commands_[turn] = std::vector<std::shared_ptr<Command>>();
-    it = commands_.find(turn);
+  if (turns.empty()) {
+    return;
   }
 
-  auto &command_list = it->second;
-  command_list.push_back(cmd);
+  // This is exactly what the replay tool does with each turn of a recorded game.
+  fw::Clock::time_point start = fw::Clock::now();
+  for (TurnCommands &turn : turns) {
+    for (std::shared_ptr<Command> &cmd : turn.commands) {
+      cmd->execute();
+    }
+    for (int step = 0; step < turn.steps; step++) {
+      entities->simulate(static_cast<float>(kTurnStepMs) / 1000.0f);
+    }
+    entities->start_view_turn(static_cast<float>(turn.steps * kTurnStepMs));
+
+    std::unique_lock<std::mutex> lock(state_hashes_mutex_);
+    state_hashes_[turn.turn % kStateHashHistory] = TurnStateHash {turn.turn, entities->get_state_hash().get()};
+    last_hashed_turn_ = turn.turn;
+  }
+  simulate_ms_ = std::chrono::duration<float, std::milli>(fw::Clock::now() - start).count() / turns.size();
+}
+
+void SimulationThread::send_state_snapshot() {
+  World *world = World::get_instance();
+  if (world == nullptr || world->get_entity_manager() == nullptr) {
+    return;
+  }
+
+  auto snapshot = world->get_entity_manager()->get_state_hash().take_snapshot();
+  if (snapshot) {
+    for (auto &player : players_) {
+      RemotePlayer *remote_player = dynamic_cast<RemotePlayer *>(player.get());
+      if (remote_player != nullptr) {
+        remote_player->state_snapshot_ready(*snapshot);
+      }
+    }
+  }
+}
+
+bool SimulationThread::get_state_hash_to_send(turn_id &turn, uint64_t &hash) const {
+  if (state_hash_to_send_.turn == 0) {
+    return false;
+  }
+  turn = state_hash_to_send_.turn;
+  hash = state_hash_to_send_.hash;
+  return true;
+}
+
+turn_id SimulationThread::get_last_hashed_turn() const {
+  std::unique_lock<std::mutex> lock(state_hashes_mutex_);
+  return last_hashed_turn_;
+}
+
+bool SimulationThread::get_state_hash(turn_id turn, uint64_t &hash) const {
+  std::unique_lock<std::mutex> lock(state_hashes_mutex_);
+  TurnStateHash const &turn_hash = state_hashes_[turn % kStateHashHistory];
+  if (turn_hash.turn != turn || turn == 0) {
+    return false;
+  }
+  hash = turn_hash.hash;
+  return true;
+}
+
+void SimulationThread::request_state_snapshot() {
+  World *world = World::get_instance();
+  if (world != nullptr && world->get_entity_manager() != nullptr) {
+    world->get_entity_manager()->get_state_hash().request_snapshot();
+  }
 }
 
 void SimulationThread::add_ai_player(std::shared_ptr<AIPlayer> const &player) {
@@ -126,6 +460,38 @@ void SimulationThread::add_ai_player(std::shared_ptr<AIPlayer> const &player) {
   sig_players_changed.Emit();
 }
 
+void SimulationThread::run_turn() {
+  turn_++;
+
+  // switch to the host's new turn timing, if it starts this turn
+  auto schedule = schedules_.find(turn_);
+  if (schedule != schedules_.end()) {
+    turn_length_ms_ = schedule->second.turn_length_ms;
+    command_delay_ = schedule->second.command_delay;
+    schedules_.erase(schedule);
+  }
+
+  // at the start of each turn, we post the commands for the *next* turn
+  enqueue_posted_commands();
+
+  // hand the commands that are due this turn over to the update thread, which executes them (see simulate_turns)
+  TurnCommands turn_commands {turn_, get_steps_per_turn(turn_length_ms_), {}};
+  auto it = commands_.find(turn_);
+  if (it != commands_.end()) {
+    turn_commands.commands.swap(it->second);
+
+    // we'll not need this turn again...
+    commands_.erase(it);
+  }
+  record_turn(turn_commands.steps, turn_commands.commands);
+  {
+    std::unique_lock<std::mutex> lock(turns_to_simulate_mutex_);
+    turns_to_simulate_.push_back(std::move(turn_commands));
+  }
+
+  send_state_snapshot();
+}
+
 /** This is the thread procedure for running the simulation thread. */
 void SimulationThread::thread_proc() {
   auto status = host_->listen(fw::Settings::get<std::string> ("listen-port"));
@@ -135,15 +501,21 @@ void SimulationThread::thread_proc() {
     return;
   }
 
+  // both are rounded to a whole number of steps
+  min_turn_length_ms_ =
+      static_cast<float>(get_steps_per_turn(fw::Settings::get<int>("min-turn-length")) * kTurnStepMs);
+  max_turn_length_ms_ = std::max(min_turn_length_ms_,
+      static_cast<float>(get_steps_per_turn(fw::Settings::get<int>("max-turn-length")) * kTurnStepMs));
+  turn_length_ms_ = static_cast<int>(min_turn_length_ms_);
+  target_turn_length_ms_ = min_turn_length_ms_;
+  state_hash_interval_ = std::max(0, fw::Settings::get<int>("state-hash-interval"));
+
   std::mutex mutex;
+  fw::Clock::time_point next_turn_time;
 
   while (!stopped_) {
-    fw::Clock::time_point start(fw::Clock::now());
+    fw::Clock::time_point now(fw::Clock::now());
     host_->update();
-    turn_++;
-
-    // at the start of each turn, we post the commands for the *next* turn
-    enqueue_posted_commands();
 
     // next, check for any new connections that the Host has detected for us, this shouldn't happen
     // once the game is underway, but you never know (in that case, we need to reject them!)
@@ -153,25 +525,58 @@ void SimulationThread::thread_proc() {
       sig_players_changed.Emit();
     }
 
-    // execute all of the commands that are due this turn
-    auto it = commands_.find(turn_);
-    if (it != commands_.end()) {
-      auto &command_list = it->second;
-      for (std::shared_ptr<Command> &cmd : command_list) {
-        cmd->execute();
+    if (!running_turns_ && game_started_) {
+      for (auto &player : players_) {
+        auto remote_player = std::dynamic_pointer_cast<RemotePlayer>(player);
+        if (remote_player) {
+          lockstep_peers_.push_back(remote_player);
+        }
       }
 
-      // we'll not need this turn again...
-      commands_.erase(it);
+      // Everybody else might have different settings to us, so we tell them our turn length to start with.
+      if (is_host() && !lockstep_peers_.empty()) {
+        const turn_id turn = 1 + command_delay_;
+        schedules_[turn] = TurnSchedule {turn, turn_length_ms_, command_delay_};
+      }
+      running_turns_ = true;
+      next_turn_time = now;
     }
 
-    // finally, update each player.
-    for (auto &player : players_) {
-      player->update();
+    fw::Clock::time_point wait_until = now + std::chrono::milliseconds(turn_length_ms_);
+    if (!running_turns_) {
+      // Until the game starts, there's nothing to do except look after the players.
+      for (auto &player : players_) {
+        player->update();
+      }
+    } else if (now < next_turn_time) {
+      wait_until = next_turn_time;
+    } else if (turn_ - get_last_hashed_turn() > kMaxTurnsBehind) {
+      // The update thread's still simulating the last few turns. That's not our peers' fault, so it doesn't count as
+      // waiting for them: we start timing that from when it's caught up.
+      next_turn_time = now;
+      wait_until = now + kBatchPollInterval;
+    } else if (!have_all_batches(turn_ + 1)) {
+      // Somebody's commands for the turn haven't got here yet, they shouldn't be far away.
+      wait_until = now + kBatchPollInterval;
+    } else {
+      const float waiting_ms = std::chrono::duration<float, std::milli>(now - next_turn_time).count();
+      run_turn();
+
+      // finally, update each player.
+      for (auto &player : players_) {
+        player->update();
+      }
+
+      // a turn's processing is the little bit we do here, plus simulating it on the update thread
+      const float processing_ms =
+          std::chrono::duration<float, std::milli>(fw::Clock::now() - now).count() + simulate_ms_;
+      update_turn_timing(processing_ms, waiting_ms);
+      next_turn_time = now + std::chrono::milliseconds(turn_length_ms_);
+      wait_until = next_turn_time;
     }
 
     std::unique_lock<std::mutex> lock(mutex);
-    stopped_cond_.wait_until(lock, start + std::chrono::milliseconds(200));
+    stopped_cond_.wait_until(lock, wait_until);
   }
 }
 
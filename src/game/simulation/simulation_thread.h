@@ -1,8 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string_view>
 #include <thread>
 
@@ -20,22 +26,91 @@ class Player;
 class AIPlayer;
 class LocalPlayer;
 class Command;
+class CommandLogWriter;
+class RemotePlayer;
 
 typedef uint32_t turn_id;
 
 // The main simulation for the game runs in a separate thread, and at a separate rate to the rendering, etc. This
 // class encapsulates the functions of the simulation thread.
+//
+// The simulation runs in "turns", in lockstep with the other players. Commands that the player posts during a turn
+// are scheduled for a later turn (the "command delay") and sent to the other players straight away, along with the
+// number of the turn they're for. Every player sends a batch of commands every turn (even if it's empty), and nobody
+// runs a turn until they've got everybody's batch for it, so everybody executes the same commands on the same turn.
+//
+// Neither the length of a turn nor the command delay is fixed: the game's host measures how long turns take to
+// process and the round-trip time to each peer, and picks the shortest turn and delay we can get away with. On a LAN
+// that's 50ms turns and a turn or two of delay, on a bad link it's longer. The host sends everybody the new timings
+// along with a turn that they start from (see TurnSchedule), and everybody switches on that turn.
 class SimulationThread {
 public:
+  // The entities are always updated in steps of this many milliseconds of game time, so that everybody (and a replay
+  // of the game) does exactly the same thing. The host keeps the length of a turn a multiple of it, and each turn
+  // simulates as many steps as fit in it, so the game runs at the same speed however long the turns are.
+  static constexpr int kTurnStepMs = 50;
+
+  // Gets the number of steps a turn of the given length simulates.
+  static constexpr int get_steps_per_turn(int turn_length_ms) {
+    return std::max(1, (turn_length_ms + (kTurnStepMs / 2)) / kTurnStepMs);
+  }
+
+  // A change to the length of a turn and the command delay, which starts from the given turn.
+  struct TurnSchedule {
+    turn_id turn;
+    int turn_length_ms;
+    int command_delay;
+  };
+
+  // Timings of the turns, for showing in debug views and so on.
+  struct TurnStats {
+    turn_id turn;
+
+    // The current length of a turn, in milliseconds.
+    float turn_length_ms;
+
+    // How many turns after they're posted that commands are executed, and that in milliseconds.
+    int command_delay;
+    float command_latency_ms;
+
+    // The (smoothed) time we spend actually processing each turn, on this thread and simulating it on the update
+    // thread.
+    float processing_ms;
+
+    // The round-trip time (and it's variance) to the slowest of our peers.
+    float max_rtt_ms;
+    float max_rtt_variance_ms;
+
+    // The number of turns we've got commands queued up for.
+    int pipelined_turns;
+
+    // The (smoothed) time we spend at the start of each turn waiting for the other players' commands.
+    float waiting_ms;
+
+    // The total number of batches of commands from peers that arrived after we'd already run the turn they were for.
+    // It should always be zero, anything else means we've diverged.
+    int late_batches;
+  };
+
   // these are the functions we use when various events occur in the simulation.
   typedef std::function<void()> callback_fn;
 
   SimulationThread();
-  ~SimulationThread() = default;
+  ~SimulationThread();
 
   void initialize();
   void destroy();
 
+  // Sets up to replay a recorded game (see CommandLogReader) instead of playing a live one. We're the given player,
+  // and the others are just there for the commands to belong to. There's no networking and no thread, the caller
+  // executes each turn's commands itself.
+  void initialize_replay(uint8_t local_player_no, std::vector<uint8_t> const &player_nos);
+
+  // Starts writing every command we execute to the given file, so that the game can be replayed later. Recording
+  // stops when you call stop_recording() or if there's an error writing the file.
+  fw::Status start_recording(std::string const &filename, std::string const &map_name);
+  void stop_recording();
+
   // Connect to a remote simulation on another computer, the given player_no is our player# for the game.
   fw::Status connect(uint64_t game_id, std::string address, uint8_t player_no);
 
@@ -47,6 +122,15 @@ public:
   // to go, call start_game()
   void new_game(uint64_t game_id);
 
+  // Starts running turns, once the world has loaded. Until then, we only look after the connections to our peers.
+  void start_game();
+
+  // Gets a value which indicates whether we're the game's host, which decides the turn timing. It's us unless we
+  // connected to somebody else's game.
+  bool is_host() const {
+    return host_player_ == nullptr;
+  }
+
   void set_map_name(std::string const &value);
   std::string const &get_map_name() const {
     return map_name_;
@@ -74,8 +158,47 @@ public:
     post_command(real_cmd);
   }
 
-  // Enqueues a command for the next turn. this is called when we receive a command from other players.
-  void enqueue_command(std::shared_ptr<Command> &cmd);
+  // Enqueues a command to be executed on the given turn. Turns that have already been executed are run next turn.
+  void enqueue_command(std::shared_ptr<Command> &cmd, turn_id turn);
+
+  // This is called when we receive a batch of commands from a remote player, which are to be executed on the given
+  // turn. If the sender is too old to say which turn (turn is zero), they're run on our next turn.
+  void enqueue_remote_commands(std::vector<std::shared_ptr<Command>> &commands, turn_id turn);
+
+  // Gets the turn that the commands we send this turn are to be executed on.
+  turn_id get_batch_turn() const {
+    return turn_ + command_delay_;
+  }
+
+  // Gets the change to the turn timing to send along with this turn's commands, if there is one. Only the host
+  // decides them, and sends each one once.
+  bool get_schedule_to_send(TurnSchedule &schedule) const;
+
+  // This is called when the host sends us a change to the turn timing. We ignore them from anybody else.
+  void schedule_turn_timing(Player const &sender, TurnSchedule const &schedule);
+
+  // Gets a copy of the current turn timings.
+  TurnStats get_turn_stats() const;
+
+  // Simulates the turns that the simulation thread has run since we were last called: executes each turn's commands
+  // and then updates the entities by each of the turn's steps (see kTurnStepMs). This is called on the update thread,
+  // which is the only thread that changes the entities.
+  void simulate_turns();
+
+  // Gets the hash of our state (see ent::StateHash) to send to the other players with this turn's commands, and the
+  // turn it's from, if there is one. We send one every state_hash_interval_ turns, once we've simulated the turn.
+  bool get_state_hash_to_send(turn_id &turn, uint64_t &hash) const;
+
+  // Gets the last turn that simulate_turns() has simulated, which is the last one we've got the hash of.
+  turn_id get_last_hashed_turn() const;
+
+  // Gets the hash of our state at the end of the given turn, which has to be one we've simulated. Returns false if it
+  // was too long ago, and we've forgotten it.
+  bool get_state_hash(turn_id turn, uint64_t &hash) const;
+
+  // Asks the EntityManager for a snapshot of our entities, which will be handed to the remote players once it's
+  // ready (see RemotePlayer::state_snapshot_ready).
+  void request_state_snapshot();
 
   // Adds a new AI player to the list of players.
   void add_ai_player(std::shared_ptr<AIPlayer> const &player);
@@ -116,20 +239,104 @@ private:
   std::shared_ptr<fw::net::Host> host_;
   std::shared_ptr<LocalPlayer> local_player_;
   std::vector<std::shared_ptr<Player>> players_;
+
+  // The player whose game we joined, or null if it's our game.
+  std::shared_ptr<Player> host_player_;
+
+  // Set by start_game(). The peers we wait for each turn are the ones that were here when the game started.
+  std::atomic<bool> game_started_;
+  bool running_turns_;
+  std::vector<std::shared_ptr<RemotePlayer>> lockstep_peers_;
+
   std::string map_name_;
   uint64_t game_id_;
   turn_id turn_;
 
+  // Commands are queued here by the turn they're to be executed on. There's usually a few turns in the pipeline.
   std::map<turn_id, std::vector<std::shared_ptr<Command>>> commands_;
 
+  // Turns that we've run, waiting for simulate_turns() to simulate them on the update thread.
+  struct TurnCommands {
+    turn_id turn;
+    int steps;
+    std::vector<std::shared_ptr<Command>> commands;
+  };
+  std::deque<TurnCommands> turns_to_simulate_;
+  std::mutex turns_to_simulate_mutex_;
+
+  // How long simulate_turns() took to simulate each turn, the last time it simulated any. Simulating the entities is
+  // most of the work of a turn, so this is what decides how long turns need to be.
+  std::atomic<float> simulate_ms_;
+
   // This is the list of commands that the player posted to us in this turn. At the end of the current turn, we'll
   // enqueue it to the command queue and also notify other players of it.
   std::vector<std::shared_ptr<Command>> posted_commands_;
+  std::mutex posted_commands_mutex_;
+
+  // The current turn timing, and the changes to it that are coming up, by the turn they start from.
+  int turn_length_ms_;
+  int command_delay_;
+  std::map<turn_id, TurnSchedule> schedules_;
+
+  // The host's adaptive turn timing, see update_turn_timing().
+  float min_turn_length_ms_;
+  float max_turn_length_ms_;
+  float target_turn_length_ms_;
+  float processing_ms_;
+  float waiting_ms_;
+
+  // When we have to wait for a peer's commands, we add extra delay for a while.
+  int late_delay_;
+  int turns_until_shrink_;
+
+  mutable std::mutex stats_mutex_;
+  TurnStats stats_;
+
+  // The hash of our state at the end of each of the last few turns, indexed by turn % kStateHashHistory. We send one
+  // every state_hash_interval_ turns, and keep the rest to check the ones that our peers send us. They're written by
+  // simulate_turns() on the update thread, so they're locked by state_hashes_mutex_.
+  struct TurnStateHash {
+    turn_id turn;
+    uint64_t hash;
+  };
+  static const int kStateHashHistory = 256;
+  std::array<TurnStateHash, kStateHashHistory> state_hashes_;
+  turn_id last_hashed_turn_;
+  mutable std::mutex state_hashes_mutex_;
+  int state_hash_interval_;
+
+  // The hash we're sending with this turn's commands (its turn is zero if we're not sending one), and the turn of the
+  // last one we sent.
+  TurnStateHash state_hash_to_send_;
+  turn_id last_sent_hash_turn_;
+
+  // If we're recording the game, this is where the commands go. Locked by recording_mutex_, since recording is
+  // started and stopped from the update thread.
+  std::unique_ptr<CommandLogWriter> command_log_;
+  std::mutex recording_mutex_;
 
   // At the end of each turn, this is called to enqueue all the commands that were posted and notify other players
   // of them as well.
   void enqueue_posted_commands();
 
+  // Returns true if we've got every peer's batch of commands for the given turn, so we can run it.
+  bool have_all_batches(turn_id turn) const;
+
+  // Runs the next turn: switches to its turn timing, sends out the commands posted during the last one and executes
+  // the ones that are due.
+  void run_turn();
+
+  // Called at the end of each turn with the time we spent processing it, and waiting for our peers before we could
+  // start it. If we're the host, we adjust the turn length and command delay.
+  void update_turn_timing(float processing_ms, float waiting_ms);
+
+  // Writes the commands we're about to execute this turn (and how many steps it is) to the command log, if we're
+  // recording.
+  void record_turn(int steps, std::vector<std::shared_ptr<Command>> const &commands);
+
+  // Passes any snapshot of the entities that's ready on to the remote players.
+  void send_state_snapshot();
+
   void thread_proc();
 };
 
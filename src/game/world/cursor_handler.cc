@@ -3,6 +3,7 @@
 #include <framework/cursor.h>
 #include <framework/input.h>
 #include <framework/framework.h>
+#include <framework/packet_buffer.h>
 
 #include <game/entities/entity.h>
 #include <game/entities/entity_manager.h>
@@ -125,7 +126,7 @@ void CursorHandler::on_key_select(std::string, bool is_down) {
       }
     } else {
       std::shared_ptr<MoveOrder> order(create_order<MoveOrder>());
-      order->goal = terrain_->get_cursor_location();
+      order->goal = fw::net::quantize_position(terrain_->get_cursor_location());
 //      LOG(DBG) << "cursor_location: " << order->goal;
       for (auto it = entities_->get_selection().begin(); it != entities_->get_selection().end(); ++it) {
         std::shared_ptr<ent::Entity> ent = it->lock();
@@ -1,11 +1,15 @@
 #include <game/world/terrain.h>
 
+#include <algorithm>
+
+#include <framework/bounds.h>
 #include <framework/graphics.h>
 #include <framework/misc.h>
 #include <framework/paths.h>
 #include <framework/logging.h>
 #include <framework/camera.h>
 #include <framework/bitmap.h>
+#include <framework/fixed_kernels.h>
 #include <framework/texture.h>
 #include <framework/input.h>
 #include <framework/math.h>
@@ -33,9 +37,11 @@ Terrain::~Terrain() {
 }
 
 fw::Status Terrain::initialize() {
-  // generate indices
-  std::vector<uint16_t> index_data;
-  generate_terrain_indices(index_data, PATCH_SIZE);
+  // generate indices for each LOD
+  std::vector<std::vector<uint16_t>> lod_index_data(get_num_terrain_lods(PATCH_SIZE));
+  for (int lod = 0; lod < static_cast<int>(lod_index_data.size()); lod++) {
+    generate_terrain_lod_indices(lod_index_data[lod], PATCH_SIZE, lod);
+  }
 
   // TODO: this should come from the world_reader
   textures_ = std::make_shared<fw::TextureArray>(512, 512);
@@ -57,7 +63,15 @@ fw::Status Terrain::initialize() {
 
   std::shared_ptr<fw::sg::Node> root_node = root_node_;
   fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
-    [root_node, this, index_data](fw::sg::Scenegraph& scenegraph) {
+    [root_node, this, lod_index_data](fw::sg::Scenegraph& scenegraph) {
+      // work out the errors of all the patches first, so that we know how deep the skirts have to be before we bake any
+      // of them.
+      for (int patch_z = 0; patch_z < get_patches_length(); patch_z++) {
+        for (int patch_x = 0; patch_x < get_patches_width(); patch_x++) {
+          update_patch_lod_info(patch_x, patch_z);
+        }
+      }
+
       // bake the patches into the vertex buffers that'll be used for rendering
       for (int patch_z = 0; patch_z < get_patches_length(); patch_z++) {
         for (int patch_x = 0; patch_x < get_patches_width(); patch_x++) {
@@ -65,8 +79,11 @@ fw::Status Terrain::initialize() {
         }
       }
 
-      ib_ = std::make_shared<fw::IndexBuffer>();
-      ib_->set_data(index_data.size(), &index_data[0], 0);
+      for (auto const &index_data : lod_index_data) {
+        auto ib = std::make_shared<fw::IndexBuffer>();
+        ib->set_data(index_data.size(), &index_data[0], 0);
+        lod_ibs_.push_back(ib);
+      }
 
       // TODO: we should return an error if this is a real error.
       shader_ = fw::Shader::CreateOrEmpty("terrain.shader");
@@ -117,11 +134,15 @@ void Terrain::bake_patch(int patch_x, int patch_z) {
 
   // if we haven't created the vertex buffer for this patch yet, do it now
   if (patches_[index]->vb == std::shared_ptr<fw::VertexBuffer>()) {
-    patches_[index]->vb = fw::VertexBuffer::create<fw::vertex::xyz_n>();
+    patches_[index]->vb = fw::VertexBuffer::create<fw::vertex::xyz_n_uv>();
   }
 
-  fw::vertex::xyz_n *vert_data;
-  int num_verts = generate_terrain_vertices(&vert_data, heights_, width_, length_, PATCH_SIZE, patch_x, patch_z);
+  // the heights might have changed since we last baked this patch, so it's errors might have as well.
+  update_patch_lod_info(patch_x, patch_z);
+
+  fw::vertex::xyz_n_uv *vert_data;
+  int num_verts = generate_terrain_vertices(
+      &vert_data, heights_, width_, length_, PATCH_SIZE, patch_x, patch_z, skirt_depth_);
 
   std::shared_ptr<TerrainPatch> patch(patches_[index]);
   patch->vb->set_data(num_verts, vert_data, 0);
@@ -131,6 +152,23 @@ void Terrain::bake_patch(int patch_x, int patch_z) {
   patch->shader_params->set_texture("textures", textures_);
 }
 
+void Terrain::update_patch_lod_info(int patch_x, int patch_z) {
+  unsigned int index = get_patch_index(patch_x, patch_z, &patch_x, &patch_z);
+  ensure_patches();
+
+  TerrainLodInfo &lod_info = patches_[index]->lod_info;
+  calculate_terrain_lod_info(lod_info, heights_, width_, length_, PATCH_SIZE, patch_x, patch_z);
+
+  // we don't know what the neighbours' errors will be, so assume they're as big as ours (if they're bigger, their
+  // skirts will make ours deeper). Patches that were already baked will still have the shallower skirts, but that only
+  // happens when the heights are edited.
+  skirt_depth_ = std::max(skirt_depth_, (lod_info.errors.back() * 2.0f) + 1.0f);
+
+  // the bounds have to include the skirts as well.
+  lod_info.bounds = fw::Bounds(
+      lod_info.bounds.get_min() - fw::Vector(0.0f, skirt_depth_, 0.0f), lod_info.bounds.get_max());
+}
+
 void Terrain::ensure_patches() {
   unsigned int index = get_patch_index(get_patches_width() - 1,
       get_patches_length() - 1);
@@ -161,44 +199,60 @@ void Terrain::update() {
   }
 
   fw::Vector location = get_cursor_location(camera->get_position(), camera->get_direction());
+  fw::Vector eye = camera->get_position();
+  fw::Frustum frustum(camera->get_view_matrix() * camera->get_projection_matrix());
+  float lod_scale = get_terrain_lod_scale(
+      camera->get_projection_matrix(), fw::Get<fw::Graphics>().get_height(), MAX_PIXEL_ERROR);
   std::shared_ptr<fw::sg::Node> root_node = root_node_;
   fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
-    [location, root_node, &terrain = std::as_const(*this)](fw::sg::Scenegraph& scenegraph) {
+    [location, eye, frustum, lod_scale, root_node, &terrain = std::as_const(*this)](fw::sg::Scenegraph& scenegraph) {
       int centre_patch_x = (int)(location[0] / PATCH_SIZE);
       int centre_patch_z = (int)(location[2] / PATCH_SIZE);
 
+      // on a small map, don't go so far that we wrap around and draw the same patch twice.
+      int range_x = std::min(VIEW_RANGE, (terrain.get_patches_width() - 1) / 2);
+      int range_z = std::min(VIEW_RANGE, (terrain.get_patches_length() - 1) / 2);
+
+      std::vector<SelectedTerrainPatch> selected;
+      select_terrain_patches(selected,
+          [&terrain](int patch_x, int patch_z) -> TerrainLodInfo const & {
+            return terrain.patches_[terrain.get_patch_index(patch_x, patch_z)]->lod_info;
+          },
+          PATCH_SIZE, centre_patch_x, centre_patch_z, range_x, range_z, frustum, eye, lod_scale);
+
       root_node->clear_children();
 
-      for (int patch_z = centre_patch_z - 1; patch_z <= centre_patch_z + 1; patch_z++) {
-        for (int patch_x = centre_patch_x - 1; patch_x <= centre_patch_x + 1; patch_x++) {
-          int patch_index = terrain.get_patch_index(patch_x, patch_z);
-
-          std::shared_ptr<TerrainPatch> patch(terrain.patches_[patch_index]);
-          //if (patch->dirty) {
-         //   bake_patch(patch_x, patch_z);
-         // }
-
-          patch->shader_params->set_texture("splatt", patch->texture);
-
-          std::shared_ptr<fw::sg::Node> node = patch->node_;
-          if (!node) {
-            node = patch->node_ = std::make_shared<fw::sg::Node>();
-
-            // we have to set up the Scenegraph Node with these manually
-            node->set_vertex_buffer(patch->vb);
-            node->set_index_buffer(terrain.ib_);
-            node->set_shader(terrain.shader_);
-            node->set_shader_parameters(patch->shader_params);
-            node->set_primitive_type(fw::sg::PrimitiveType::kTriangleStrip);
-          }
-          fw::Matrix world = fw::translation(
-            static_cast<float>(patch_x * PATCH_SIZE), 0,
-            static_cast<float>(patch_z * PATCH_SIZE));
-          node->set_world_matrix(world);
-
-          // set up the world matrix for this patch so that it's being rendered at the right offset
-          root_node->add_child(patch->node_);
+      for (auto const &selected_patch : selected) {
+        int patch_index = terrain.get_patch_index(selected_patch.patch_x, selected_patch.patch_z);
+
+        std::shared_ptr<TerrainPatch> patch(terrain.patches_[patch_index]);
+        //if (patch->dirty) {
+       //   bake_patch(patch_x, patch_z);
+       // }
+
+        patch->shader_params->set_texture("splatt", patch->texture);
+        patch->shader_params->set_scalar("lod_step", static_cast<float>(1 << selected_patch.lod.lod));
+        patch->shader_params->set_scalar("morph", selected_patch.lod.morph);
+
+        std::shared_ptr<fw::sg::Node> node = patch->node_;
+        if (!node) {
+          node = patch->node_ = std::make_shared<fw::sg::Node>();
+
+          // we have to set up the Scenegraph Node with these manually
+          node->set_vertex_buffer(patch->vb);
+          node->set_shader(terrain.shader_);
+          node->set_shader_parameters(patch->shader_params);
+          node->set_primitive_type(fw::sg::PrimitiveType::kTriangleList);
         }
+        node->set_index_buffer(terrain.lod_ibs_[selected_patch.lod.lod]);
+
+        // set up the world matrix for this patch so that it's being rendered at the right offset
+        fw::Matrix world = fw::translation(
+          static_cast<float>(selected_patch.patch_x * PATCH_SIZE), 0,
+          static_cast<float>(selected_patch.patch_z * PATCH_SIZE));
+        node->set_world_matrix(world);
+
+        root_node->add_child(patch->node_);
       }
     });
 }
@@ -219,25 +273,18 @@ float Terrain::get_vertex_height(int x, int z) {
   return heights_[fw::constrain(z, length_) * width_ + fw::constrain(x, width_)];
 }
 
-// this method is pretty simple. we basically get the height at (x, z) then interpolate that value between (x+1, z+1).
 float Terrain::get_height(float x, float z) {
-  int x0 = (int) floor(x);
-  int x1 = x0 + 1;
-
-  int z0 = (int) floor(z);
-  int z1 = z0 + 1;
-
-  float h00 = get_vertex_height(x0, z0);
-  float h10 = get_vertex_height(x1, z0);
-
-  float h01 = get_vertex_height(x0, z1);
-  float h11 = get_vertex_height(x1, z1);
+  return get_height(fw::Fixed::from_float(x), fw::Fixed::from_float(z)).to_float();
+}
 
-  float dx = x - x0;
-  float dz = z - z0;
-  float dxdz = dx * dz;
+// this method is pretty simple. we basically get the height at (x, z) then interpolate that value between (x+1, z+1).
+// It's all done in fixed-point, so that every player gets exactly the same height.
+fw::Fixed Terrain::get_height(fw::Fixed x, fw::Fixed z) const {
+  return fw::sample_height(heights_, width_, length_, x, z);
+}
 
-  return h00 * (1.0f - dz - dx + dxdz) + h10 * (dx - dxdz) + h11 * dxdz + h01 * (dz - dxdz);
+void Terrain::get_heights(fw::Fixed const *x, fw::Fixed const *z, fw::Fixed *heights, int n) const {
+  fw::sample_heights(heights_, width_, length_, x, z, heights, n);
 }
 
 // gets the point on the terrain that the camera is currently looking at
@@ -5,11 +5,14 @@
 #include <stdint.h>
 
 #include <framework/bitmap.h>
+#include <framework/fixed.h>
 #include <framework/math.h>
 #include <framework/scenegraph.h>
 #include <framework/status.h>
 #include <framework/texture.h>
 
+#include <game/world/terrain_helper.h>
+
 namespace fw {
 class VertexBuffer;
 class IndexBuffer;
@@ -30,6 +33,10 @@ struct TerrainPatch {
 
   std::shared_ptr<fw::sg::Node> node_;
 
+  // The errors of each of the patch's LODs and it's bounds, used to decide what LOD to draw it at. These are only
+  // touched on the render thread (they're updated when the patch is baked).
+  TerrainLodInfo lod_info;
+
   // If true, we know we need to re-bake this patch.
   bool dirty = false;
 };
@@ -38,11 +45,24 @@ class Terrain {
 public:
   static const int PATCH_SIZE = 64;
 
+  // How many patches in each direction from the one the camera's looking at we'll draw (if they're in the frustum).
+  // The camera's far plane is 500 units away, so this is enough to get all the way to it.
+  static constexpr int VIEW_RANGE = 8;
+
+  // We draw each patch at the coarsest LOD whose error is no bigger than this many pixels on screen.
+  static constexpr float MAX_PIXEL_ERROR = 2.0f;
+
 private:
   std::vector<std::shared_ptr<TerrainPatch>> patches_;
-  std::shared_ptr<fw::IndexBuffer> ib_;
+
+  // The index buffer for each LOD, see generate_terrain_lod_indices.
+  std::vector<std::shared_ptr<fw::IndexBuffer>> lod_ibs_;
   std::shared_ptr<fw::Shader> shader_;
 
+  // How far the skirts hang down below the edges of the patches. It has to be enough to cover the biggest crack that
+  // we could get between two patches, which is the sum of their biggest errors. Only touched on the render thread.
+  float skirt_depth_ = 0.0f;
+
   // The root scenegraph node that we add all our nodes to.
   std::shared_ptr<fw::sg::Node> root_node_;
 
@@ -72,6 +92,9 @@ protected:
   // passed to our vertex Shader. cool!
   void bake_patch(int patch_x, int patch_z);
 
+  // recalculates the given patch's lod_info, and makes sure the skirts are deep enough for it.
+  void update_patch_lod_info(int patch_x, int patch_z);
+
   // gets or sets the splatt texture for the given patch
   std::shared_ptr<fw::Texture> get_patch_splatt(int patch_x, int patch_z);
   std::shared_ptr<fw::Texture> create_splatt(fw::Bitmap const& bmp);
@@ -91,8 +114,13 @@ public:
   // gets the height of the terrain vertex at the given integer coordinates.
   float get_vertex_height(int x, int z);
 
-  // gets the height above the terrain at the given (x,z) coordinates.
+  // gets the height above the terrain at the given (x,z) coordinates. The simulation should use the fixed-point
+  // versions, the float one is for drawing and so on (it gives the same answer, just rounded to a float).
   float get_height(float x, float z);
+  fw::Fixed get_height(fw::Fixed x, fw::Fixed z) const;
+
+  // gets the height at each of the n given (x,z) coordinates, see fw::sample_heights.
+  void get_heights(fw::Fixed const *x, fw::Fixed const *z, fw::Fixed *heights, int n) const;
 
   inline int get_width() const {
     return width_;
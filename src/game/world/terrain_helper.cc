@@ -1,10 +1,57 @@
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <framework/misc.h>
 #include <framework/graphics.h>
 
 #include <game/world/terrain_helper.h>
 
 namespace game {
+namespace {
+
+// The coarsest LOD has this many cells across.
+const int kMinLodCells = 4;
+
+// Gets the (x, z) of the index'th vertex along the given edge of a patch. The edges go z = 0, x = patch_size,
+// z = patch_size and then x = 0, and each one has patch_size + 1 vertices.
+void get_edge_vertex(int patch_size, int edge, int index, int *x, int *z) {
+  switch (edge) {
+  case 0:
+    *x = index;
+    *z = 0;
+    break;
+  case 1:
+    *x = patch_size;
+    *z = index;
+    break;
+  case 2:
+    *x = index;
+    *z = patch_size;
+    break;
+  default:
+    *x = 0;
+    *z = index;
+    break;
+  }
+}
+
+// Gets the index in the vertex buffer of the skirt vertex below the index'th vertex of the given edge.
+int get_skirt_vertex_index(int patch_size, int edge, int index) {
+  return ((patch_size + 1) * (patch_size + 1)) + (edge * (patch_size + 1)) + index;
+}
+
+// Gets the coarsest LOD that the vertex at (x, z) in a patch is part of.
+int get_vertex_lod(int x, int z, int num_lods) {
+  int lod = 0;
+  while (lod < num_lods - 1 && ((x | z) & (1 << lod)) == 0) {
+    lod++;
+  }
+  return lod;
+}
+
+}
 
 void generate_terrain_indices(std::vector<uint16_t> &indices, int patch_size) {
   patch_size++;
@@ -42,6 +89,49 @@ void generate_terrain_indices(std::vector<uint16_t> &indices, int patch_size) {
   }
 }
 
+int get_num_terrain_lods(int patch_size) {
+  int num_lods = 1;
+  while ((patch_size >> num_lods) >= kMinLodCells) {
+    num_lods++;
+  }
+  return num_lods;
+}
+
+void generate_terrain_lod_indices(std::vector<uint16_t> &indices, int patch_size, int lod) {
+  const int step = 1 << lod;
+  const int row = patch_size + 1;
+  const int num_cells = patch_size / step;
+  indices.clear();
+  indices.reserve((num_cells * num_cells * 6) + (4 * num_cells * 6));
+
+  // Every cell is split along the same diagonal, from (x, z) to (x + step, z + step), so that each LOD's triangles
+  // are exactly covered by the next LOD's. That's what lets a vertex morph to the next LOD's surface by just changing
+  // it's height.
+  for (int z = 0; z < patch_size; z += step) {
+    for (int x = 0; x < patch_size; x += step) {
+      const uint16_t v00 = static_cast<uint16_t>((z * row) + x);
+      const uint16_t v10 = static_cast<uint16_t>((z * row) + x + step);
+      const uint16_t v01 = static_cast<uint16_t>(((z + step) * row) + x);
+      const uint16_t v11 = static_cast<uint16_t>(((z + step) * row) + x + step);
+      indices.insert(indices.end(), {v00, v01, v11, v00, v11, v10});
+    }
+  }
+
+  // Then a quad for each edge of each cell around the outside, from the edge down to the skirt vertices below it.
+  for (int edge = 0; edge < 4; edge++) {
+    for (int i = 0; i < patch_size; i += step) {
+      int x0, z0, x1, z1;
+      get_edge_vertex(patch_size, edge, i, &x0, &z0);
+      get_edge_vertex(patch_size, edge, i + step, &x1, &z1);
+      const uint16_t top0 = static_cast<uint16_t>((z0 * row) + x0);
+      const uint16_t top1 = static_cast<uint16_t>((z1 * row) + x1);
+      const uint16_t bottom0 = static_cast<uint16_t>(get_skirt_vertex_index(patch_size, edge, i));
+      const uint16_t bottom1 = static_cast<uint16_t>(get_skirt_vertex_index(patch_size, edge, i + step));
+      indices.insert(indices.end(), {top0, bottom0, bottom1, top0, bottom1, top1});
+    }
+  }
+}
+
 void generate_terrain_indices_wireframe(std::vector<uint16_t> &indices, int patch_size) {
   int num_indices = patch_size * patch_size * 4;
   indices.resize(num_indices);
@@ -87,8 +177,28 @@ fw::Vector calculate_normal(float *heights, int width, int length, int x, int z)
   return normal.normalized();
 }
 
-int generate_terrain_vertices(fw::vertex::xyz_n **buffer, float *height, int width, int length,
-    int patch_size /* = 0 */, int patch_x /* = 0 */, int patch_z /* = 0 */) {
+// Gets the height of the surface of the LOD whose vertices are step apart, at the vertex (x, z). (x, z) must not be
+// negative.
+float get_lod_height(float *height, int width, int length, int x, int z, int step) {
+  const int x0 = (x / step) * step;
+  const int z0 = (z / step) * step;
+  const float fx = static_cast<float>(x - x0) / step;
+  const float fz = static_cast<float>(z - z0) / step;
+
+  // Work out which of the cell's two triangles we're in (see generate_terrain_lod_indices), and interpolate in that.
+  const float h00 = get_vertex(x0, z0, height, width, length)[1];
+  const float h11 = get_vertex(x0 + step, z0 + step, height, width, length)[1];
+  if (fz >= fx) {
+    const float h01 = get_vertex(x0, z0 + step, height, width, length)[1];
+    return h00 + (fz * (h01 - h00)) + (fx * (h11 - h01));
+  } else {
+    const float h10 = get_vertex(x0 + step, z0, height, width, length)[1];
+    return h00 + (fx * (h10 - h00)) + (fz * (h11 - h10));
+  }
+}
+
+int generate_terrain_vertices(fw::vertex::xyz_n_uv **buffer, float *height, int width, int length,
+    int patch_size /* = 0 */, int patch_x /* = 0 */, int patch_z /* = 0 */, float skirt_depth /* = 0.0f */) {
   if (patch_size == 0) {
     if (width != length) {
       LOG(ERR) << "if you don't specify a patch_size, width and height must be the same";
@@ -98,7 +208,9 @@ int generate_terrain_vertices(fw::vertex::xyz_n **buffer, float *height, int wid
     patch_size = width;
   }
 
-  (*buffer) = new fw::vertex::xyz_n[(patch_size + 1) * (patch_size + 1)];
+  const int num_lods = get_num_terrain_lods(patch_size);
+  const int num_verts = ((patch_size + 1) * (patch_size + 1)) + (4 * (patch_size + 1));
+  (*buffer) = new fw::vertex::xyz_n_uv[num_verts];
   for (int z = 0; z <= patch_size; z++) {
     for (int x = 0; x <= patch_size; x++) {
       int ix = (patch_x * patch_size) + x;
@@ -106,20 +218,128 @@ int generate_terrain_vertices(fw::vertex::xyz_n **buffer, float *height, int wid
       fw::Vector center = get_vertex(ix, iz, height, width, length);
       fw::Vector normal = calculate_normal(height, width, length, ix, iz);
 
+      // A vertex only ever morphs when it's drawn at the coarsest LOD it's part of, because that's the only time it's
+      // not part of the next LOD as well.
+      int lod = get_vertex_lod(x, z, num_lods);
+      float morph_height = center[1];
+      if (lod < num_lods - 1) {
+        morph_height = get_lod_height(height, width, length, ix, iz, 2 << lod);
+      }
+
       int verts_index = z * (patch_size + 1) + x;
-      (*buffer)[verts_index] = fw::vertex::xyz_n(x, center[1], z, normal[0],
-          normal[1], normal[2]);
+      (*buffer)[verts_index] = fw::vertex::xyz_n_uv(x, center[1], z, normal[0],
+          normal[1], normal[2], morph_height, 0.0f);
+    }
+  }
+
+  for (int edge = 0; edge < 4; edge++) {
+    for (int i = 0; i <= patch_size; i++) {
+      int x, z;
+      get_edge_vertex(patch_size, edge, i, &x, &z);
+      fw::vertex::xyz_n_uv vertex = (*buffer)[z * (patch_size + 1) + x];
+      vertex.y -= skirt_depth;
+      vertex.u -= skirt_depth;
+      (*buffer)[get_skirt_vertex_index(patch_size, edge, i)] = vertex;
+    }
+  }
+
+  return num_verts;
+}
+
+void calculate_terrain_lod_info(TerrainLodInfo &info, float *height, int width, int length, int patch_size,
+    int patch_x, int patch_z) {
+  const int num_lods = get_num_terrain_lods(patch_size);
+  info.errors.assign(num_lods, 0.0f);
+
+  float min_height = std::numeric_limits<float>::max();
+  float max_height = std::numeric_limits<float>::lowest();
+  for (int z = 0; z <= patch_size; z++) {
+    for (int x = 0; x <= patch_size; x++) {
+      int ix = (patch_x * patch_size) + x;
+      int iz = (patch_z * patch_size) + z;
+      float h = get_vertex(ix, iz, height, width, length)[1];
+      min_height = std::min(min_height, h);
+      max_height = std::max(max_height, h);
+
+      for (int lod = 1; lod < num_lods; lod++) {
+        float error = std::abs(h - get_lod_height(height, width, length, ix, iz, 1 << lod));
+        info.errors[lod] = std::max(info.errors[lod], error);
+      }
     }
   }
 
-  return (patch_size + 1) * (patch_size + 1);
+  // A coarser LOD can happen to fit a bit better than the one before it, but we want to be able to assume that the
+  // further away a patch is, the coarser it's LOD.
+  for (int lod = 1; lod < num_lods; lod++) {
+    info.errors[lod] = std::max(info.errors[lod], info.errors[lod - 1]);
+  }
+
+  info.bounds = fw::Bounds(
+      fw::Vector(0.0f, min_height, 0.0f),
+      fw::Vector(static_cast<float>(patch_size), max_height, static_cast<float>(patch_size)));
+}
+
+float get_terrain_lod_scale(fw::Matrix const &projection, int screen_height, float max_pixel_error) {
+  // Something error units big that's distance away covers error * (screen_height / 2) * cot(fov / 2) / distance
+  // pixels, and elem(1, 1) of a perspective projection is cot(fov / 2).
+  return (screen_height * 0.5f * projection.elem(1, 1)) / max_pixel_error;
+}
+
+TerrainLod select_terrain_lod(std::vector<float> const &errors, float distance, float lod_scale) {
+  TerrainLod result;
+  const int num_lods = static_cast<int>(errors.size());
+  int lod = num_lods - 1;
+  while (lod > 0 && distance < errors[lod] * lod_scale) {
+    lod--;
+  }
+  result.lod = lod;
+
+  if (lod < num_lods - 1) {
+    // We switch to this LOD at start and the next one at end. We're fully morphed to the next one by the time we get
+    // to end, and we haven't started at start, so there's no pop either way.
+    const float start = errors[lod] * lod_scale;
+    const float end = errors[lod + 1] * lod_scale;
+    const float middle = (start + end) * 0.5f;
+    if (end > middle) {
+      result.morph = std::clamp((distance - middle) / (end - middle), 0.0f, 1.0f);
+    }
+  }
+  return result;
+}
+
+void select_terrain_patches(std::vector<SelectedTerrainPatch> &selected,
+    std::function<TerrainLodInfo const &(int patch_x, int patch_z)> const &get_lod_info, int patch_size,
+    int centre_patch_x, int centre_patch_z, int range_x, int range_z, fw::Frustum const &frustum,
+    fw::Vector const &eye, float lod_scale) {
+  for (int patch_z = centre_patch_z - range_z; patch_z <= centre_patch_z + range_z; patch_z++) {
+    for (int patch_x = centre_patch_x - range_x; patch_x <= centre_patch_x + range_x; patch_x++) {
+      TerrainLodInfo const &info = get_lod_info(patch_x, patch_z);
+      fw::Bounds bounds = info.bounds.transformed(fw::translation(
+          static_cast<float>(patch_x * patch_size), 0.0f, static_cast<float>(patch_z * patch_size)));
+      if (!frustum.is_visible(bounds)) {
+        continue;
+      }
+
+      SelectedTerrainPatch &patch = selected.emplace_back();
+      patch.patch_x = patch_x;
+      patch.patch_z = patch_z;
+      patch.lod = select_terrain_lod(info.errors, bounds.get_distance(eye), lod_scale);
+    }
+  }
 }
 
 fw::Status BuildCollisionData(std::vector<bool> &vertices, float *heights,  int width, int length) {
+  return BuildCollisionData(vertices, heights, width, length, 0, 0, width, length);
+}
+
+fw::Status BuildCollisionData(std::vector<bool> &vertices, float *heights, int width, int length,
+    int region_x, int region_z, int region_width, int region_length) {
   fw::Vector up(0, 1, 0);
 
-  for (int z = 0; z < length; z++) {
-    for (int x = 0; x < width; x++) {
+  for (int rz = 0; rz < region_length; rz++) {
+    int z = fw::constrain(region_z + rz, length);
+    for (int rx = 0; rx < region_width; rx++) {
+      int x = fw::constrain(region_x + rx, width);
       fw::Vector normal = calculate_normal(heights, width, length, x, z);
       float dot = fw::dot(up, normal);
 
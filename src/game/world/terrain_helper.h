@@ -1,33 +1,99 @@
 #pragma once
 
+#include <functional>
+#include <vector>
+
+#include <framework/bounds.h>
+#include <framework/math.h>
 #include <framework/status.h>
 
 namespace fw {
 namespace vertex {
-struct xyz_n;
+struct xyz_n_uv;
 }
 }
 
 namespace game {
 
+// Everything we need to know about a patch to choose it's LOD: the geometric error of each LOD (see
+// calculate_terrain_lod_info) and the bounds of the patch, relative to the patch's origin.
+struct TerrainLodInfo {
+  std::vector<float> errors;
+  fw::Bounds bounds;
+};
+
+// The LOD we're drawing a patch at, and how far it's morphed towards the next (coarser) one: at 0 it's the LOD's own
+// vertices, at 1 it's exactly the same shape as the next LOD, so we can switch to that without anything popping.
+struct TerrainLod {
+  int lod = 0;
+  float morph = 0.0f;
+};
+
+// A patch that select_terrain_patches has chosen to draw. patch_x, patch_z are where to draw it, which can be off the
+// edge of the map (the terrain wraps around), so you'll need to constrain them to get the actual patch.
+struct SelectedTerrainPatch {
+  int patch_x;
+  int patch_z;
+  TerrainLod lod;
+};
+
 // generates a "patch" of indices for a terrain that's patch_size * patch_size big
 void generate_terrain_indices(std::vector<uint16_t> &indices, int patch_size);
 
+// The number of LODs that a patch of the given size has. LOD 0 is every vertex, and each LOD after that uses every
+// second vertex of the one before, until the patch is only a few cells across.
+int get_num_terrain_lods(int patch_size);
+
+// Generates a triangle list for the given LOD of a patch that's patch_size * patch_size big, followed by the
+// triangles for the skirt around it's edges. The skirt hangs down from the edge of the patch to cover up any cracks
+// between it and it's neighbours, when they're drawn at a different LOD (or morphed by a different amount).
+void generate_terrain_lod_indices(std::vector<uint16_t> &indices, int patch_size, int lod);
+
 // similar to generate_terrain_indices, but we generate indices assuming a wire
 // mesh will be drawn
 void generate_terrain_indices_wireframe(std::vector<uint16_t> &indices, int patch_size);
 
-// generates xyz_n vertices for a patch of terrain the of given size.
+// generates xyz_n_uv vertices for a patch of terrain the of given size.
 //
 // patch_x, patch_y is the patch offset into the given height data that we want to
 // generate data for
 // height is a pointer to the actual height data we're going to generate the terrain for
 // width, height is the width/height of the total terrain data
-int generate_terrain_vertices(fw::vertex::xyz_n **buffer, float *height,
+//
+// u is the height the vertex morphs to (the height of the next LOD's surface at that point) when it's drawn at the
+// coarsest LOD it's part of, v is unused. After the patch's own vertices come the skirt's: a copy of each vertex around
+// the edge (see generate_terrain_lod_indices for the order) that's skirt_depth lower.
+int generate_terrain_vertices(fw::vertex::xyz_n_uv **buffer, float *height,
     int width, int length, int patch_size = 0, int patch_x = 0,
-    int patch_z = 0);
+    int patch_z = 0, float skirt_depth = 0.0f);
+
+// Calculates the geometric error of each LOD of the given patch (how far above or below the actual height of any
+// vertex the LOD's surface is), and the bounds of the patch. The errors never get smaller as the LODs get coarser.
+void calculate_terrain_lod_info(TerrainLodInfo &info, float *height, int width, int length, int patch_size,
+    int patch_x, int patch_z);
+
+// Gets the number we multiply a geometric error by to get the distance at which it's max_pixel_error pixels big on a
+// screen that's screen_height pixels high, with the given projection.
+float get_terrain_lod_scale(fw::Matrix const &projection, int screen_height, float max_pixel_error);
+
+// Chooses the LOD for a patch with the given errors that's distance away from the camera: the coarsest one whose error
+// is small enough at that distance. Over the second half of the distance before we'd switch to the next LOD, we morph
+// towards it.
+TerrainLod select_terrain_lod(std::vector<float> const &errors, float distance, float lod_scale);
+
+// Chooses which of the patches within range_x, range_z of the centre patch are in the frustum, and the LOD to draw
+// each one at. get_lod_info is called with the (unconstrained) coordinates of each patch.
+void select_terrain_patches(std::vector<SelectedTerrainPatch> &selected,
+    std::function<TerrainLodInfo const &(int patch_x, int patch_z)> const &get_lod_info, int patch_size,
+    int centre_patch_x, int centre_patch_z, int range_x, int range_z, fw::Frustum const &frustum,
+    fw::Vector const &eye, float lod_scale);
 
 // see editor_terrain::BuildCollisionData, which we're based off of
 fw::Status BuildCollisionData(std::vector<bool> &vertices, float *heights, int width, int length);
 
+// same as above, but only rebuilds the given region of the collision data (the region wraps around the edges of the
+// map, just like the terrain does)
+fw::Status BuildCollisionData(std::vector<bool> &vertices, float *heights, int width, int length,
+    int region_x, int region_z, int region_width, int region_length);
+
 }
@@ -33,7 +33,7 @@ namespace game {
 World *World::instance_ = nullptr;
 
 World::World(std::shared_ptr<WorldReader> reader) :
-    reader_(reader), entities_(nullptr), pathing_(nullptr), initialized_(false) {
+    reader_(reader), entities_(nullptr), initialized_(false), pathing_(nullptr) {
   cursor_ = new CursorHandler();
 }
 
@@ -56,15 +56,21 @@ void World::initialize() {
     player_starts_[it.first] = it.second;
   }
 
+  World::set_instance(this);
+
+  initialize_entities();
+  initialize_view();
+  initialize_pathing();
+
+  initialized_ = true;
+}
+
+void World::initialize_view() {
   // tell the Particle manager to wrap particles at the world boundary
   fw::Framework::get_instance()->get_particle_mgr()->set_world_wrap(
       terrain_->get_width(), terrain_->get_length());
 
   fw::Input *input = fw::Framework::get_instance()->get_input();
-
-  World::set_instance(this);
-
-  initialize_entities();
   if (entities_ != nullptr) {
     cursor_->initialize();
     keybind_tokens_.push_back(
@@ -72,10 +78,6 @@ void World::initialize() {
   }
   keybind_tokens_.push_back(
       input->bind_function("screenshot", std::bind(&World::on_key_screenshot, this, _1, _2)));
-
-  initialize_pathing();
-
-  initialized_ = true;
 }
 
 void World::destroy() {
@@ -165,6 +167,7 @@ void World::update() {
   terrain_->update();
 
   if (entities_ != nullptr) {
+    SimulationThread::get_instance()->simulate_turns();
     entities_->update();
   }
 }
@@ -32,7 +32,6 @@ private:
   std::shared_ptr<WorldReader> reader_;
   std::shared_ptr<Terrain> terrain_;
   ent::EntityManager *entities_;
-  PathingThread *pathing_;
   std::vector<int> keybind_tokens_;
   CursorHandler *cursor_;
   fw::Bitmap minimap_background_;
@@ -53,10 +52,15 @@ private:
 
 protected:
   fw::Bitmap screenshot_;
+  PathingThread *pathing_;
 
   virtual void initialize_pathing();
   virtual void initialize_entities();
 
+  // Sets up the things that are only there for the player to look at and interact with: particles, the cursor and
+  // key bindings.
+  virtual void initialize_view();
+
 public:
   // constructs a new world using the information from the given world_reader.
   World(std::shared_ptr<WorldReader> reader);
@@ -20,8 +20,8 @@
 
 namespace game {
 
-WorldReader::WorldReader() :
-    terrain_(nullptr) {
+WorldReader::WorldReader(bool headless) :
+    terrain_(nullptr), headless_(headless) {
 }
 
 WorldReader::~WorldReader() {
@@ -49,7 +49,8 @@ fw::Status WorldReader::Read(std::string name) {
   name_ = name;
   ASSIGN_OR_RETURN(terrain_, create_terrain(trn_width, trn_length, height_data));
 
-  for (int patch_z = 0; patch_z < terrain_->get_patches_length(); patch_z++) {
+  // the splatt textures are only for drawing
+  for (int patch_z = 0; patch_z < terrain_->get_patches_length() && !headless_; patch_z++) {
     for (int patch_x = 0; patch_x < terrain_->get_patches_width(); patch_x++) {
       std::string name = absl::StrCat("splatt-", patch_x, "-", patch_z, ".png");
       wfe = wf.get_entry(name, false /* for_write */);
@@ -153,7 +154,9 @@ fw::Status WorldReader::ReadMapdescPlayers(fw::XmlElement players_node) {
 fw::StatusOr<std::shared_ptr<Terrain>> WorldReader::create_terrain(
     int width, int length, float* height_data) {
   auto terrain = std::make_shared<Terrain>(width, length, height_data);
-  RETURN_IF_ERROR(terrain->initialize());
+  if (!headless_) {
+    RETURN_IF_ERROR(terrain->initialize());
+  }
   return terrain;
 }
 
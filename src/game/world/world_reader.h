@@ -29,6 +29,7 @@ protected:
   std::string name_;
   std::string description_;
   std::string author_;
+  bool headless_;
 
   virtual fw::StatusOr<std::shared_ptr<Terrain>> create_terrain(
       int width, int length, float* height_data);
@@ -38,7 +39,9 @@ protected:
   fw::Status ReadCollisionData(WorldFileEntry &wfe);
 
 public:
-  WorldReader();
+  // A headless reader only reads what the simulation needs (the heightfield, collision data, player starts and so on),
+  // and doesn't make any textures, so you can use it without graphics (e.g. in the replay tool).
+  explicit WorldReader(bool headless = false);
   virtual ~WorldReader();
 
   // reads the map with the given name and populates our members
@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <framework/framework.h>
+#include <framework/job_system.h>
+#include <framework/logging.h>
+#include <framework/misc.h>
+#include <framework/settings.h>
+#include <framework/status.h>
+#include <framework/timer.h>
+
+fw::Status settings_initialize(int argc, char** argv);
+void display_exception(std::string const &msg);
+
+//-----------------------------------------------------------------------------
+
+// A stand-in for the entity update: a bunch of "units" moving around a wrapping world, steering away from the nearest
+// other unit. It's updated the same way the EntityManager updates entities: first every unit does it's (read-only)
+// query in parallel, then the results are applied one unit at a time, in order. This only checks the JobSystem and the
+// pattern: the real EntityManager::simulate is checked the same way by "replay --job-check --benchmark-map <map>".
+class Simulation {
+private:
+  static constexpr float kWorldSize = 512.0f;
+  static constexpr int kCellSize = 8;
+  static constexpr int kNumCells = static_cast<int>(kWorldSize) / kCellSize;
+
+  struct Unit {
+    float x;
+    float z;
+    float dir_x;
+    float dir_z;
+  };
+
+  std::vector<Unit> units_;
+
+  // The result of each unit's query, the direction it wants to turn towards.
+  std::vector<Unit> steering_;
+
+  // Units by the cell they're in, rebuilt after the units move.
+  std::vector<std::vector<int>> cells_;
+
+  static float wrap_delta(float delta) {
+    if (delta > kWorldSize * 0.5f) {
+      return delta - kWorldSize;
+    } else if (delta < -kWorldSize * 0.5f) {
+      return delta + kWorldSize;
+    }
+    return delta;
+  }
+
+  void rebuild_cells() {
+    for (auto &cell : cells_) {
+      cell.clear();
+    }
+    for (int i = 0; i < static_cast<int>(units_.size()); i++) {
+      const int cell_x = std::min(static_cast<int>(units_[i].x / kCellSize), kNumCells - 1);
+      const int cell_z = std::min(static_cast<int>(units_[i].z / kCellSize), kNumCells - 1);
+      cells_[(cell_z * kNumCells) + cell_x].push_back(i);
+    }
+  }
+
+  // Works out which way unit i wants to go. This only reads the units, and only writes steering_[i].
+  void prepare(int i) {
+    Unit const &unit = units_[i];
+    const int cell_x = std::min(static_cast<int>(unit.x / kCellSize), kNumCells - 1);
+    const int cell_z = std::min(static_cast<int>(unit.z / kCellSize), kNumCells - 1);
+
+    int nearest = -1;
+    float nearest_distance_sq = 0.0f;
+    for (int z = cell_z - 1; z <= cell_z + 1; z++) {
+      for (int x = cell_x - 1; x <= cell_x + 1; x++) {
+        for (int other : cells_[(fw::constrain(z, kNumCells) * kNumCells) + fw::constrain(x, kNumCells)]) {
+          if (other == i) {
+            continue;
+          }
+          const float dx = wrap_delta(units_[other].x - unit.x);
+          const float dz = wrap_delta(units_[other].z - unit.z);
+          const float distance_sq = (dx * dx) + (dz * dz);
+          if (nearest < 0 || distance_sq < nearest_distance_sq) {
+            nearest = other;
+            nearest_distance_sq = distance_sq;
+          }
+        }
+      }
+    }
+
+    Unit steering = unit;
+    if (nearest >= 0 && nearest_distance_sq > 0.0f) {
+      const float distance = std::sqrt(nearest_distance_sq);
+      steering.dir_x -= wrap_delta(units_[nearest].x - unit.x) / (distance * distance);
+      steering.dir_z -= wrap_delta(units_[nearest].z - unit.z) / (distance * distance);
+      const float length = std::sqrt((steering.dir_x * steering.dir_x) + (steering.dir_z * steering.dir_z));
+      if (length > 0.0f) {
+        steering.dir_x /= length;
+        steering.dir_z /= length;
+      }
+    }
+    steering_[i] = steering;
+  }
+
+  // Applies unit i's steering and moves it.
+  void apply(int i, float dt) {
+    Unit &unit = units_[i];
+    unit.dir_x = steering_[i].dir_x;
+    unit.dir_z = steering_[i].dir_z;
+    unit.x = fw::constrain(unit.x + (unit.dir_x * dt * 3.0f), kWorldSize, 0.0f);
+    unit.z = fw::constrain(unit.z + (unit.dir_z * dt * 3.0f), kWorldSize, 0.0f);
+  }
+
+public:
+  Simulation(int num_units, int seed) : units_(num_units), steering_(num_units), cells_(kNumCells * kNumCells) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pos_dist(0.0f, kWorldSize);
+    std::uniform_real_distribution<float> angle_dist(0.0f, 6.2831853f);
+    for (Unit &unit : units_) {
+      unit.x = pos_dist(rng);
+      unit.z = pos_dist(rng);
+      const float angle = angle_dist(rng);
+      unit.dir_x = std::cos(angle);
+      unit.dir_z = std::sin(angle);
+    }
+    rebuild_cells();
+  }
+
+  void update(fw::JobSystem &job_system, float dt) {
+    job_system.parallel_for(static_cast<int>(units_.size()), 64, [this](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        prepare(i);
+      }
+    });
+
+    for (int i = 0; i < static_cast<int>(units_.size()); i++) {
+      apply(i, dt);
+    }
+    rebuild_cells();
+  }
+
+  // Gets a hash of the exact bits of every unit's state, so we can tell if two runs came out differently.
+  uint64_t get_hash() const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (Unit const &unit : units_) {
+      uint8_t bytes[sizeof(Unit)];
+      std::memcpy(bytes, &unit, sizeof(Unit));
+      for (uint8_t b : bytes) {
+        hash = (hash ^ b) * 1099511628211ULL;
+      }
+    }
+    return hash;
+  }
+};
+
+// Runs the simulation for the given number of ticks on the given JobSystem, returns the hash of the final state.
+uint64_t run_simulation(fw::JobSystem &job_system, float *ms_per_tick) {
+  Simulation sim(fw::Settings::get<int>("units"), fw::Settings::get<int>("seed"));
+  const int num_ticks = fw::Settings::get<int>("ticks");
+
+  fw::Timer timer;
+  timer.start();
+  for (int i = 0; i < num_ticks; i++) {
+    sim.update(job_system, 1.0f / 40.0f);
+  }
+  timer.stop();
+
+  *ms_per_tick = timer.get_total_time() * 1000.0f / num_ticks;
+  return sim.get_hash();
+}
+
+int run_test() {
+  // The serial run has no worker threads, so every job runs on this thread, in order.
+  fw::JobSystem serial(0);
+  float serial_ms;
+  const uint64_t serial_hash = run_simulation(serial, &serial_ms);
+  LOG(INFO) << "serial: " << serial_ms << "ms per tick";
+
+  fw::JobSystem *parallel = fw::Framework::get_instance()->get_job_system();
+  float parallel_ms;
+  const uint64_t parallel_hash = run_simulation(*parallel, &parallel_ms);
+  LOG(INFO) << "parallel (" << parallel->get_num_threads() << " worker thread(s)): " << parallel_ms
+            << "ms per tick, " << (serial_ms / parallel_ms) << "x";
+
+  if (serial_hash != parallel_hash) {
+    LOG(ERR) << "parallel update is not deterministic: final state hash " << std::hex << parallel_hash
+             << " doesn't match serial hash " << serial_hash;
+    return 1;
+  }
+  LOG(INFO) << "parallel update matches serial update exactly";
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  try {
+    auto status = settings_initialize(argc, argv);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      fw::Settings::print_help();
+      return 1;
+    }
+
+    fw::ToolApplication app;
+    new fw::Framework(&app);
+    auto continue_or_status = fw::Framework::get_instance()->initialize("Job Test");
+    if (!continue_or_status.ok()) {
+      LOG(ERR) << continue_or_status.status();
+      return 1;
+    }
+    if (!continue_or_status.value()) {
+      return 0;
+    }
+
+    if (run_test() > 0) {
+      return 1;
+    }
+  } catch (std::exception &e) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION!";
+    LOG(ERR) << e.what();
+
+    display_exception(e.what());
+  } catch (...) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION! (unknown exception)";
+  }
+
+  return 0;
+}
+
+void display_exception(std::string const &msg) {
+  std::stringstream ss;
+  ss << "An error has occurred. Please send your log file (below) to dean@codeka.com.au for diagnostics." << std::endl;
+  ss << std::endl;
+  ss << fw::LogFileName() << std::endl;
+  ss << std::endl;
+  ss << msg;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  fw::SettingDefinition extra_settings;
+  extra_settings.add_group("Additional options", "Job-test specific settings")
+      .add_setting<int>("units", "Number of units in the simulation.", 20000)
+      .add_setting<int>("ticks", "Number of updates to run the simulation for.", 200)
+      .add_setting<int>("seed", "Seed for the random number generator, so runs are repeatable.", 42);
+
+  return fw::Settings::initialize(extra_settings, argc, argv, "job-test.conf");
+}
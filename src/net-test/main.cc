@@ -0,0 +1,859 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <enet/enet.h>
+
+#include <framework/framework.h>
+#include <framework/logging.h>
+#include <framework/math.h>
+#include <framework/misc.h>
+#include <framework/packet_buffer.h>
+#include <framework/settings.h>
+#include <framework/status.h>
+#include <framework/timer.h>
+
+fw::Status settings_initialize(int argc, char** argv);
+void display_exception(std::string const &msg);
+
+//-----------------------------------------------------------------------------
+
+// We count every allocation, so we can see how many each packet costs.
+int64_t g_num_allocations = 0;
+
+void *operator new(std::size_t size) {
+  g_num_allocations++;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+//-----------------------------------------------------------------------------
+
+// This is how PacketBuffer used to work: everything went through a std::stringstream, which got copied into a
+// std::string when you asked for the bytes (and then ENet copied them again). It's here so we've got something to
+// compare against.
+class LegacyPacketBuffer {
+private:
+  bool flushed_;
+  std::string value_;
+  std::stringstream buffer_;
+  uint16_t packet_type_;
+
+  void flush() {
+    if (flushed_) {
+      return;
+    }
+    buffer_.flush();
+    value_ = buffer_.str();
+    flushed_ = true;
+  }
+
+public:
+  LegacyPacketBuffer(uint16_t packet_type) : flushed_(false), packet_type_(packet_type) {
+    add_bytes(reinterpret_cast<char const *>(&packet_type), 0, sizeof(uint16_t));
+  }
+
+  LegacyPacketBuffer(char const *bytes, std::size_t n) : flushed_(false), buffer_(std::string(bytes, n)) {
+    get_bytes(reinterpret_cast<char *>(&packet_type_), 0, sizeof(uint16_t));
+  }
+
+  void add_bytes(char const *bytes, std::size_t offset, std::size_t n) {
+    flushed_ = false;
+    buffer_.write(bytes + offset, n);
+  }
+
+  void get_bytes(char *bytes, std::size_t offset, std::size_t n) {
+    buffer_.read(bytes + offset, n);
+  }
+
+  char const *get_buffer() {
+    flush();
+    return value_.c_str();
+  }
+
+  std::size_t get_bytes_remaining() {
+    return static_cast<std::size_t>(buffer_.rdbuf()->in_avail());
+  }
+
+  bool has_read_error() const {
+    return buffer_.fail();
+  }
+
+  std::size_t get_size() {
+    flush();
+    return value_.length();
+  }
+
+  // Ids were just written as uint32_t's.
+  void add_id(uint32_t id) {
+    add_bytes(reinterpret_cast<char const *>(&id), 0, sizeof(uint32_t));
+  }
+
+  uint32_t get_id() {
+    uint32_t id;
+    get_bytes(reinterpret_cast<char *>(&id), 0, sizeof(uint32_t));
+    return id;
+  }
+};
+
+template<typename T>
+LegacyPacketBuffer &operator <<(LegacyPacketBuffer &lhs, T rhs) {
+  lhs.add_bytes(reinterpret_cast<char const *>(&rhs), 0, sizeof(T));
+  return lhs;
+}
+
+template<typename T>
+LegacyPacketBuffer &operator >>(LegacyPacketBuffer &lhs, T &rhs) {
+  lhs.get_bytes(reinterpret_cast<char *>(&rhs), 0, sizeof(T));
+  return lhs;
+}
+
+LegacyPacketBuffer &operator <<(LegacyPacketBuffer &lhs, fw::Vector const &rhs) {
+  lhs.add_bytes(reinterpret_cast<char const *>(rhs.v), 0, sizeof(float) * 3);
+  return lhs;
+}
+
+LegacyPacketBuffer &operator >>(LegacyPacketBuffer &lhs, fw::Vector &rhs) {
+  lhs.get_bytes(reinterpret_cast<char *>(rhs.v), 0, sizeof(float) * 3);
+  return lhs;
+}
+
+LegacyPacketBuffer &operator <<(LegacyPacketBuffer &lhs, std::string const &rhs) {
+  uint16_t length = static_cast<uint16_t>(rhs.length());
+  lhs << length;
+  lhs.add_bytes(rhs.c_str(), 0, length);
+  return lhs;
+}
+
+LegacyPacketBuffer &operator >>(LegacyPacketBuffer &lhs, std::string &rhs) {
+  uint16_t length;
+  lhs >> length;
+
+  if (length < 80) {
+    char *value = reinterpret_cast<char *>(alloca(length));
+    lhs.get_bytes(value, 0, length);
+    rhs = std::string(value, length);
+  } else {
+    char *value = new char[length];
+    lhs.get_bytes(value, 0, length);
+    rhs = std::string(value, length);
+    delete[] value;
+  }
+  return lhs;
+}
+
+//-----------------------------------------------------------------------------
+
+// The game's commands need the whole simulation to create, so we use these stand-ins instead. They go over the wire
+// exactly the same way game::CommandPacket sends a CreateEntityCommand or an OrderCommand (with a build, move or attack
+// order).
+static const uint16_t kCommandPacketId = 5;
+static const uint8_t kCreateEntityCommandId = 2;
+static const uint8_t kOrderCommandId = 5;
+static const uint16_t kBuildOrderId = 1;
+static const uint16_t kMoveOrderId = 2;
+static const uint16_t kAttackOrderId = 3;
+static const uint8_t kCommandHasTurn = 0x02;
+
+struct StandInCommand {
+  uint8_t id = 0;
+  uint8_t player_no = 0;
+  uint32_t entity_id = 0;
+  uint16_t order_id = 0;
+  std::string template_name;
+  fw::Vector position;
+  fw::Vector goal;
+  uint32_t target = 0;
+
+  bool operator==(StandInCommand const &other) const {
+    return id == other.id && player_no == other.player_no && entity_id == other.entity_id
+        && order_id == other.order_id && template_name == other.template_name
+        && std::memcmp(position.v, other.position.v, sizeof(position.v)) == 0
+        && std::memcmp(goal.v, other.goal.v, sizeof(goal.v)) == 0 && target == other.target;
+  }
+};
+
+struct StandInCommandPacket {
+  uint32_t turn = 0;
+  std::vector<StandInCommand> commands;
+};
+
+// The commands are the part of the packet that every version reads, anything else goes on the end.
+template<typename Buffer>
+void serialize_commands(Buffer &buffer, StandInCommandPacket const &pkt) {
+  buffer << static_cast<uint8_t>(pkt.commands.size());
+  for (auto const &cmd : pkt.commands) {
+    buffer << cmd.id;
+    buffer << cmd.player_no;
+    if (cmd.id == kCreateEntityCommandId) {
+      buffer.add_id(cmd.entity_id);
+      buffer << cmd.template_name;
+      buffer << cmd.position;
+      buffer << cmd.goal;
+    } else {
+      buffer.add_id(cmd.entity_id);
+      buffer << cmd.order_id;
+      if (cmd.order_id == kBuildOrderId) {
+        buffer << cmd.template_name;
+      } else if (cmd.order_id == kMoveOrderId) {
+        buffer << cmd.goal;
+      } else {
+        buffer.add_id(cmd.target);
+      }
+    }
+  }
+}
+
+template<typename Buffer>
+void serialize(Buffer &buffer, StandInCommandPacket const &pkt) {
+  serialize_commands(buffer, pkt);
+  if (pkt.turn != 0) {
+    buffer << kCommandHasTurn;
+    buffer << pkt.turn;
+  }
+}
+
+template<typename Buffer>
+void deserialize_commands(Buffer &buffer, StandInCommandPacket &pkt) {
+  uint8_t num_commands;
+  buffer >> num_commands;
+  pkt.commands.resize(num_commands);
+  for (auto &cmd : pkt.commands) {
+    buffer >> cmd.id;
+    buffer >> cmd.player_no;
+    if (cmd.id == kCreateEntityCommandId) {
+      cmd.entity_id = buffer.get_id();
+      buffer >> cmd.template_name;
+      buffer >> cmd.position;
+      buffer >> cmd.goal;
+    } else {
+      cmd.entity_id = buffer.get_id();
+      buffer >> cmd.order_id;
+      if (cmd.order_id == kBuildOrderId) {
+        buffer >> cmd.template_name;
+      } else if (cmd.order_id == kMoveOrderId) {
+        buffer >> cmd.goal;
+      } else {
+        cmd.target = buffer.get_id();
+      }
+    }
+  }
+}
+
+template<typename Buffer>
+void deserialize(Buffer &buffer, StandInCommandPacket &pkt) {
+  deserialize_commands(buffer, pkt);
+  uint8_t flags = 0;
+  if (buffer.get_bytes_remaining() > 0) {
+    buffer >> flags;
+  }
+  pkt.turn = 0;
+  if ((flags & kCommandHasTurn) != 0) {
+    buffer >> pkt.turn;
+  }
+}
+
+// Makes some packets that look like a game in progress: mostly move and attack orders, with the odd entity being
+// created or built. Positions are snapped to the grid, like the game does before it posts a command.
+std::vector<StandInCommandPacket> generate_packets(std::mt19937 &rng, int num_packets, int max_commands) {
+  static const char *template_names[] = {"factory", "harvester", "light-tank", "heavy-tank", "anti-air-turret"};
+  std::uniform_int_distribution<int> num_commands_dist(1, max_commands);
+  std::uniform_int_distribution<int> kind_dist(0, 9);
+  std::uniform_int_distribution<uint32_t> entity_dist(1, 4000);
+  // Entity ids have the number of the player that created them in the top byte.
+  auto make_entity_id = [](uint32_t player_no, uint32_t n) {
+    return (player_no << 24) | n;
+  };
+  std::uniform_int_distribution<int> template_dist(0, 4);
+  std::uniform_real_distribution<float> pos_dist(0.0f, 512.0f);
+
+  std::vector<StandInCommandPacket> packets(num_packets);
+  uint32_t turn = 1000;
+  for (auto &pkt : packets) {
+    pkt.turn = turn++;
+    pkt.commands.resize(num_commands_dist(rng));
+    for (auto &cmd : pkt.commands) {
+      cmd.player_no = 1;
+      cmd.entity_id = make_entity_id(1, entity_dist(rng));
+      const int kind = kind_dist(rng);
+      if (kind == 0) {
+        cmd.id = kCreateEntityCommandId;
+        cmd.template_name = template_names[template_dist(rng)];
+        cmd.position = fw::net::quantize_position(fw::Vector(pos_dist(rng), 0.0f, pos_dist(rng)));
+        cmd.goal = fw::net::quantize_position(fw::Vector(pos_dist(rng), 0.0f, pos_dist(rng)));
+      } else {
+        cmd.id = kOrderCommandId;
+        if (kind == 1) {
+          cmd.order_id = kBuildOrderId;
+          cmd.template_name = template_names[template_dist(rng)];
+        } else if (kind < 7) {
+          cmd.order_id = kMoveOrderId;
+          cmd.goal = fw::net::quantize_position(fw::Vector(pos_dist(rng), 0.0f, pos_dist(rng)));
+        } else {
+          cmd.order_id = kAttackOrderId;
+          cmd.target = make_entity_id(2, entity_dist(rng));
+        }
+      }
+    }
+  }
+  return packets;
+}
+
+bool packets_equal(StandInCommandPacket const &lhs, StandInCommandPacket const &rhs) {
+  return lhs.turn == rhs.turn && lhs.commands == rhs.commands;
+}
+
+//-----------------------------------------------------------------------------
+
+// Checks the bits of PacketBuffer that the benchmark doesn't: reading past the end, strings as views, and packets
+// that are too big for a pooled block. Returns the number of errors.
+int verify_packet_buffer() {
+  int num_errors = 0;
+
+  for (auto encoding : {fw::net::Encoding::kLegacy, fw::net::Encoding::kCompact}) {
+    fw::net::PacketBuffer buffer(kCommandPacketId, encoding);
+    buffer << static_cast<uint32_t>(1234) << std::string("hello");
+    fw::net::PacketBuffer reader(buffer.get_buffer(), buffer.get_size());
+    uint32_t value;
+    std::string_view str;
+    reader >> value >> str;
+    if (reader.get_packet_type() != kCommandPacketId || reader.get_encoding() != encoding || value != 1234
+        || str != "hello") {
+      LOG(ERR) << "packet didn't read back the same as it was written";
+      num_errors++;
+    }
+    if (str.data() < buffer.get_buffer() || str.data() + str.size() > buffer.get_buffer() + buffer.get_size()) {
+      LOG(ERR) << "string_view doesn't point into the packet";
+      num_errors++;
+    }
+    if (reader.has_read_error()) {
+      LOG(ERR) << "read error reading a whole packet";
+      num_errors++;
+    }
+
+    uint32_t past_end = 1;
+    reader >> past_end;
+    if (!reader.has_read_error() || past_end != 0) {
+      LOG(ERR) << "reading past the end of the packet wasn't an error";
+      num_errors++;
+    }
+  }
+
+  {
+    // Bigger than any of the pooled blocks, so it has to grow a few times and then be freed directly.
+    fw::net::PacketBuffer buffer(kCommandPacketId);
+    const std::string big(60000, 'x');
+    for (int i = 0; i < 4; i++) {
+      buffer << big;
+    }
+    fw::net::PacketBuffer reader(buffer.get_buffer(), buffer.get_size());
+    for (int i = 0; i < 4; i++) {
+      std::string str;
+      reader >> str;
+      if (str != big) {
+        LOG(ERR) << "big string " << i << " didn't read back the same";
+        num_errors++;
+      }
+    }
+
+    ENetPacket *packet = buffer.release_packet(ENET_PACKET_FLAG_RELIABLE);
+    if (packet == nullptr || (packet->flags & ENET_PACKET_FLAG_NO_ALLOCATE) == 0 || buffer.get_size() != 0) {
+      LOG(ERR) << "release_packet didn't hand over the buffer";
+      num_errors++;
+    }
+    enet_packet_destroy(packet);
+  }
+
+  return num_errors;
+}
+
+bool same_bits(fw::Vector const &lhs, fw::Vector const &rhs) {
+  return std::memcmp(lhs.v, rhs.v, sizeof(lhs.v)) == 0;
+}
+
+// Writes the extremes of every type in each encoding and checks they all come back exactly the same, that everything
+// is little-endian, and that we don't try to read packets from the future. Returns the number of errors.
+int verify_encodings() {
+  int num_errors = 0;
+
+  const std::vector<uint32_t> ids = {0x01000001, 0x01000002, 0x01000001, 0x02000005, 0, 0xffffffff, 7};
+  const std::vector<fw::Vector> vectors = {
+      fw::Vector(1.5f, 20.25f, -3.0625f),
+      fw::Vector(0.1f, 2.0f, 3.0f),
+      fw::Vector(-0.0f, 0.0f, 0.0f),
+      fw::Vector(std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(), -1e9f),
+      fw::net::quantize_position(fw::Vector(511.97f, 31.3f, 0.01f)),
+  };
+
+  for (auto encoding : {fw::net::Encoding::kLegacy, fw::net::Encoding::kCompact}) {
+    fw::net::PacketBuffer buffer(kCommandPacketId, encoding);
+    buffer << std::numeric_limits<uint8_t>::max() << std::numeric_limits<uint16_t>::max()
+           << std::numeric_limits<int16_t>::min() << std::numeric_limits<uint32_t>::max()
+           << std::numeric_limits<int32_t>::min() << static_cast<int32_t>(-1) << std::numeric_limits<uint64_t>::max()
+           << std::numeric_limits<int64_t>::min() << fw::Color(0x12345678u) << std::string("hello, world");
+    for (uint32_t id : ids) {
+      buffer.add_id(id);
+    }
+    for (auto const &v : vectors) {
+      buffer << v;
+    }
+
+    fw::net::PacketBuffer reader(buffer.get_buffer(), buffer.get_size());
+    uint8_t u8;
+    uint16_t u16;
+    int16_t i16;
+    uint32_t u32;
+    int32_t i32;
+    int32_t minus_one;
+    uint64_t u64;
+    int64_t i64;
+    fw::Color color;
+    std::string str;
+    reader >> u8 >> u16 >> i16 >> u32 >> i32 >> minus_one >> u64 >> i64 >> color >> str;
+    bool ok = u8 == std::numeric_limits<uint8_t>::max() && u16 == std::numeric_limits<uint16_t>::max()
+        && i16 == std::numeric_limits<int16_t>::min() && u32 == std::numeric_limits<uint32_t>::max()
+        && i32 == std::numeric_limits<int32_t>::min() && minus_one == -1
+        && u64 == std::numeric_limits<uint64_t>::max() && i64 == std::numeric_limits<int64_t>::min()
+        && color.to_rgba() == fw::Color(0x12345678u).to_rgba() && str == "hello, world";
+    for (uint32_t id : ids) {
+      ok = ok && reader.get_id() == id;
+    }
+    for (auto const &v : vectors) {
+      fw::Vector read;
+      reader >> read;
+      ok = ok && same_bits(read, v);
+    }
+    if (!ok || reader.has_read_error() || reader.get_bytes_remaining() != 0) {
+      LOG(ERR) << "values didn't read back the same in encoding " << static_cast<int>(encoding);
+      num_errors++;
+    }
+  }
+
+  {
+    // The packet type and the integers are little-endian, whatever we're running on.
+    fw::net::PacketBuffer buffer(kCommandPacketId);
+    buffer << static_cast<uint32_t>(0x01020304);
+    const uint8_t expected[] = {kCommandPacketId, 0, 4, 3, 2, 1};
+    if (buffer.get_size() != sizeof(expected) || std::memcmp(buffer.get_buffer(), expected, sizeof(expected)) != 0) {
+      LOG(ERR) << "legacy encoding isn't little-endian";
+      num_errors++;
+    }
+
+    fw::net::PacketBuffer compact(kCommandPacketId, fw::net::Encoding::kCompact);
+    compact << static_cast<uint32_t>(300) << static_cast<int32_t>(-2);
+    const uint8_t expected_compact[] = {kCommandPacketId, 0x10, 0xac, 0x02, 0x03};
+    if (compact.get_size() != sizeof(expected_compact)
+        || std::memcmp(compact.get_buffer(), expected_compact, sizeof(expected_compact)) != 0) {
+      LOG(ERR) << "compact encoding isn't LEB128 + zigzag";
+      num_errors++;
+    }
+  }
+
+  {
+    // A packet in an encoding we don't know about yet shouldn't be read at all.
+    const uint8_t future[] = {kCommandPacketId, 0xf0, 1, 2, 3};
+    fw::net::PacketBuffer reader(reinterpret_cast<char const *>(future), sizeof(future));
+    if (!reader.has_read_error()) {
+      LOG(ERR) << "packet in an unknown encoding was read";
+      num_errors++;
+    }
+  }
+
+  return num_errors;
+}
+
+// How long it took to send and receive all of the packets one way, and how many bytes they came to.
+struct ThroughputResult {
+  float send_time = 0.0f;
+  float receive_time = 0.0f;
+  int64_t send_allocations = 0;
+  int64_t receive_allocations = 0;
+  int64_t num_bytes = 0;
+};
+
+// Serializes and "sends" every packet, saving the bytes in wire, then reads them all back. ENet needs a connection to
+// actually send anything, so we stop at creating the ENetPacket and then destroy it like ENet does once it's been
+// acknowledged.
+template<typename Buffer, typename MakeBuffer, typename Send>
+ThroughputResult measure_throughput(std::vector<StandInCommandPacket> const &packets, std::vector<std::string> &wire,
+    MakeBuffer const &make_buffer, Send const &send) {
+  ThroughputResult result;
+  fw::Timer timer;
+
+  int64_t allocations_before = g_num_allocations;
+  timer.start();
+  for (auto const &pkt : packets) {
+    std::optional<Buffer> buffer;
+    make_buffer(buffer);
+    serialize(*buffer, pkt);
+    send(*buffer);
+  }
+  timer.stop();
+  result.send_time = timer.get_total_time();
+  result.send_allocations = g_num_allocations - allocations_before;
+
+  wire.resize(packets.size());
+  for (size_t i = 0; i < packets.size(); i++) {
+    std::optional<Buffer> buffer;
+    make_buffer(buffer);
+    serialize(*buffer, packets[i]);
+    wire[i].assign(buffer->get_buffer(), buffer->get_size());
+    result.num_bytes += wire[i].size();
+  }
+
+  StandInCommandPacket pkt;
+  allocations_before = g_num_allocations;
+  timer.start();
+  for (auto const &bytes : wire) {
+    Buffer buffer(bytes.data(), bytes.size());
+    deserialize(buffer, pkt);
+  }
+  timer.stop();
+  result.receive_time = timer.get_total_time();
+  result.receive_allocations = g_num_allocations - allocations_before;
+  return result;
+}
+
+std::string describe(ThroughputResult const &result, size_t num_packets) {
+  std::stringstream ss;
+  ss << (static_cast<float>(result.num_bytes) / num_packets) << " bytes per packet, "
+     << (num_packets / result.send_time / 1000000.0f) << "M packets per second sent with "
+     << (static_cast<float>(result.send_allocations) / num_packets) << " allocations per packet, "
+     << (num_packets / result.receive_time / 1000000.0f) << "M received with "
+     << (static_cast<float>(result.receive_allocations) / num_packets) << " allocations per packet";
+  return ss.str();
+}
+
+// Reads back each packet in wire and checks it's the same as the one we sent. Returns the number of errors.
+int verify_received(std::vector<StandInCommandPacket> const &packets, std::vector<std::string> const &wire) {
+  int num_errors = 0;
+  for (size_t i = 0; i < packets.size(); i++) {
+    fw::net::PacketBuffer buffer(wire[i].data(), wire[i].size());
+    StandInCommandPacket received;
+    deserialize(buffer, received);
+    if (buffer.has_read_error() || buffer.get_bytes_remaining() != 0 || !packets_equal(received, packets[i])) {
+      LOG(ERR) << "packet " << i << " didn't read back the same as it was written";
+      num_errors++;
+    }
+  }
+  return num_errors;
+}
+
+// Compares sending packets with the old stringstream buffer to the pooled one (in both encodings). Returns the number
+// of errors.
+int run_throughput_benchmark() {
+  std::mt19937 rng(fw::Settings::get<int>("seed"));
+  const int num_packets = fw::Settings::get<int>("packets");
+  const std::vector<StandInCommandPacket> packets =
+      generate_packets(rng, num_packets, fw::Settings::get<int>("max-commands"));
+  int num_errors = 0;
+
+  std::vector<std::string> legacy_wire;
+  const ThroughputResult legacy = measure_throughput<LegacyPacketBuffer>(
+      packets, legacy_wire, [](std::optional<LegacyPacketBuffer> &buffer) {
+        buffer.emplace(kCommandPacketId);
+      }, [](LegacyPacketBuffer &buffer) {
+        ENetPacket *packet = enet_packet_create(buffer.get_buffer(), buffer.get_size(), ENET_PACKET_FLAG_RELIABLE);
+        enet_packet_destroy(packet);
+      });
+
+  auto send_pooled = [](fw::net::PacketBuffer &buffer) {
+    ENetPacket *packet = buffer.release_packet(ENET_PACKET_FLAG_RELIABLE);
+    enet_packet_destroy(packet);
+  };
+  std::vector<std::string> pooled_wire;
+  const ThroughputResult pooled = measure_throughput<fw::net::PacketBuffer>(
+      packets, pooled_wire, [](std::optional<fw::net::PacketBuffer> &buffer) {
+        buffer.emplace(kCommandPacketId, fw::net::Encoding::kLegacy);
+      }, send_pooled);
+  std::vector<std::string> compact_wire;
+  const ThroughputResult compact = measure_throughput<fw::net::PacketBuffer>(
+      packets, compact_wire, [](std::optional<fw::net::PacketBuffer> &buffer) {
+        buffer.emplace(kCommandPacketId, fw::net::Encoding::kCompact);
+      }, send_pooled);
+
+  // The legacy encoding has to put exactly the same bytes on the wire as the old buffer did, so older versions can
+  // still read it.
+  for (int i = 0; i < num_packets; i++) {
+    if (pooled_wire[i] != legacy_wire[i]) {
+      LOG(ERR) << "packet " << i << " is different to the legacy one";
+      num_errors++;
+    }
+  }
+
+  // Older versions only read the commands and ignore anything after them, so they have to get exactly the same
+  // commands out of our legacy packets. A packet with nothing extra has to be exactly what they'd have sent.
+  for (int i = 0; i < num_packets; i++) {
+    LegacyPacketBuffer reader(pooled_wire[i].data(), pooled_wire[i].size());
+    StandInCommandPacket received;
+    deserialize_commands(reader, received);
+    if (reader.has_read_error() || received.commands != packets[i].commands) {
+      LOG(ERR) << "packet " << i << " has different commands when read the way older versions do";
+      num_errors++;
+    }
+  }
+  for (int i = 0; i < std::min(num_packets, 10); i++) {
+    StandInCommandPacket plain = packets[i];
+    plain.turn = 0;
+    LegacyPacketBuffer old_buffer(kCommandPacketId);
+    serialize_commands(old_buffer, plain);
+    fw::net::PacketBuffer buffer(kCommandPacketId, fw::net::Encoding::kLegacy);
+    serialize(buffer, plain);
+    if (std::string(buffer.get_buffer(), buffer.get_size())
+        != std::string(old_buffer.get_buffer(), old_buffer.get_size())) {
+      LOG(ERR) << "packet " << i << " without a turn isn't what older versions send";
+      num_errors++;
+    }
+  }
+  num_errors += verify_received(packets, pooled_wire);
+  num_errors += verify_received(packets, compact_wire);
+
+  LOG(INFO) << num_packets << " command packets";
+  LOG(INFO) << "stringstream: " << describe(legacy, packets.size());
+  LOG(INFO) << "pooled (legacy encoding): " << describe(pooled, packets.size());
+  LOG(INFO) << "pooled (compact encoding): " << describe(compact, packets.size());
+  return num_errors;
+}
+
+//-----------------------------------------------------------------------------
+
+// A game's worth of command packets: every player sends one to every other player each turn (even if it's empty).
+struct CommandLog {
+  int num_players = 0;
+  int turn_length_ms = 0;
+  // packets[turn][player] is the packet the player sent at the end of the turn.
+  std::vector<std::vector<StandInCommandPacket>> packets;
+};
+
+// Plays a game between players that click around like people do: every couple of seconds they select a group of their
+// units and send them somewhere (or at somebody), their factories keep building things, and the new units come out
+// next to the factory.
+CommandLog generate_command_log(std::mt19937 &rng, int num_players, int num_turns, int turn_length_ms) {
+  // the commands each player posts are for a couple of turns later
+  const int kCommandDelay = 2;
+  static const char *unit_names[] = {"harvester", "light-tank", "heavy-tank", "anti-air-turret"};
+  const float actions_per_turn = fw::Settings::get<int>("apm") / 60.0f * (turn_length_ms / 1000.0f);
+  const float builds_per_turn = turn_length_ms / 10000.0f;
+  const float map_size = 512.0f;
+
+  std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+  std::uniform_real_distribution<float> pos_dist(0.0f, map_size);
+  std::uniform_real_distribution<float> height_dist(0.0f, 40.0f);
+
+  struct PlayerState {
+    fw::Vector factory;
+    std::vector<uint32_t> units;
+    uint32_t next_entity = 0;
+  };
+  std::vector<PlayerState> players(num_players);
+  for (int i = 0; i < num_players; i++) {
+    players[i].factory = fw::net::quantize_position(fw::Vector(pos_dist(rng), height_dist(rng), pos_dist(rng)));
+  }
+
+  CommandLog log;
+  log.num_players = num_players;
+  log.turn_length_ms = turn_length_ms;
+  log.packets.resize(num_turns);
+  for (int turn = 0; turn < num_turns; turn++) {
+    log.packets[turn].resize(num_players);
+    for (int i = 0; i < num_players; i++) {
+      PlayerState &player = players[i];
+      const uint8_t player_no = static_cast<uint8_t>(i + 1);
+      StandInCommandPacket &pkt = log.packets[turn][i];
+      pkt.turn = static_cast<uint32_t>(turn + kCommandDelay);
+
+      if (turn == 0 || chance(rng) < builds_per_turn) {
+        StandInCommand cmd;
+        cmd.id = kCreateEntityCommandId;
+        cmd.player_no = player_no;
+        cmd.entity_id = (static_cast<uint32_t>(player_no) << 24) | ++player.next_entity;
+        cmd.template_name = turn == 0 ? "factory" : unit_names[rng() % 4];
+        cmd.position = player.factory;
+        const float angle = chance(rng) * 2.0f * fw::pi();
+        cmd.goal = fw::net::quantize_position(
+            player.factory + fw::Vector(std::cos(angle) * 3.0f, 0.0f, std::sin(angle) * 3.0f));
+        if (turn > 0) {
+          player.units.push_back(cmd.entity_id);
+        }
+        pkt.commands.push_back(cmd);
+      }
+
+      if (player.units.empty() || chance(rng) >= actions_per_turn) {
+        continue;
+      }
+
+      // Groups are usually units that were built around the same time, so their ids are close together.
+      const int group_size = std::min(static_cast<int>(player.units.size()), 1 + static_cast<int>(rng() % 12));
+      const int first = static_cast<int>(rng() % (player.units.size() - group_size + 1));
+      const float action = chance(rng);
+      StandInCommand cmd;
+      cmd.id = kOrderCommandId;
+      cmd.player_no = player_no;
+      if (action < 0.1f) {
+        // Queue something up at the factory.
+        cmd.entity_id = (static_cast<uint32_t>(player_no) << 24) | 1;
+        cmd.order_id = kBuildOrderId;
+        cmd.template_name = unit_names[rng() % 4];
+        pkt.commands.push_back(cmd);
+        continue;
+      }
+      if (action < 0.35f) {
+        PlayerState const &enemy = players[(i + 1 + (rng() % (num_players - 1))) % num_players];
+        if (enemy.units.empty()) {
+          continue;
+        }
+        cmd.order_id = kAttackOrderId;
+        cmd.target = enemy.units[rng() % enemy.units.size()];
+      } else {
+        cmd.order_id = kMoveOrderId;
+        cmd.goal = fw::net::quantize_position(fw::Vector(pos_dist(rng), height_dist(rng), pos_dist(rng)));
+      }
+      for (int unit = first; unit < first + group_size && pkt.commands.size() < 255; unit++) {
+        cmd.entity_id = player.units[unit];
+        pkt.commands.push_back(cmd);
+      }
+    }
+  }
+  return log;
+}
+
+// Works out how much bandwidth a whole game's worth of command packets takes in each encoding. Returns the number of
+// errors.
+int run_bandwidth_benchmark() {
+  std::mt19937 rng(fw::Settings::get<int>("seed"));
+  const int num_players = std::max(2, fw::Settings::get<int>("players"));
+  const int turn_length_ms = fw::Settings::get<int>("turn-length");
+  const int num_turns = fw::Settings::get<int>("minutes") * 60 * 1000 / turn_length_ms;
+  const CommandLog log = generate_command_log(rng, num_players, num_turns, turn_length_ms);
+
+  int num_errors = 0;
+  int64_t num_packets = 0;
+  int64_t num_commands = 0;
+  int64_t num_bytes[2] = {0, 0};
+  for (auto const &turn : log.packets) {
+    for (auto const &pkt : turn) {
+      num_packets++;
+      num_commands += pkt.commands.size();
+      for (auto encoding : {fw::net::Encoding::kLegacy, fw::net::Encoding::kCompact}) {
+        fw::net::PacketBuffer buffer(kCommandPacketId, encoding);
+        serialize(buffer, pkt);
+        num_bytes[static_cast<int>(encoding)] += buffer.get_size();
+
+        fw::net::PacketBuffer reader(buffer.get_buffer(), buffer.get_size());
+        StandInCommandPacket received;
+        deserialize(reader, received);
+        if (reader.has_read_error() || !packets_equal(received, pkt)) {
+          LOG(ERR) << "logged packet didn't read back the same in encoding " << static_cast<int>(encoding);
+          num_errors++;
+        }
+      }
+    }
+  }
+
+  // Every packet goes to every other player.
+  const float seconds = static_cast<float>(num_turns) * turn_length_ms / 1000.0f;
+  LOG(INFO) << (seconds / 60.0f) << " minute game with " << num_players << " players: " << num_packets
+            << " packets, " << num_commands << " commands";
+  for (auto encoding : {fw::net::Encoding::kLegacy, fw::net::Encoding::kCompact}) {
+    const int64_t bytes = num_bytes[static_cast<int>(encoding)];
+    LOG(INFO) << (encoding == fw::net::Encoding::kLegacy ? "legacy: " : "compact: ")
+              << (static_cast<float>(bytes) / num_packets) << " bytes per packet, "
+              << (bytes * 8.0f / seconds / 1000.0f) << " kbit/s upload per connection, "
+              << (bytes * (num_players - 1) / 1024.0f / 1024.0f) << " MB sent by all players in total";
+  }
+  LOG(INFO) << "compact is " << (100.0f * num_bytes[1] / num_bytes[0]) << "% of legacy (not counting ENet's headers)";
+  return num_errors;
+}
+
+int run_benchmark() {
+  int num_errors = verify_packet_buffer();
+  num_errors += verify_encodings();
+  num_errors += run_throughput_benchmark();
+  num_errors += run_bandwidth_benchmark();
+
+  LOG(INFO) << num_errors << " error(s)";
+  return num_errors;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  try {
+    auto status = settings_initialize(argc, argv);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      fw::Settings::print_help();
+      return 1;
+    }
+
+    fw::ToolApplication app;
+    new fw::Framework(&app);
+    auto continue_or_status = fw::Framework::get_instance()->initialize("Net Test");
+    if (!continue_or_status.ok()) {
+      LOG(ERR) << continue_or_status.status();
+      return 1;
+    }
+    if (!continue_or_status.value()) {
+      return 0;
+    }
+
+    if (run_benchmark() > 0) {
+      return 1;
+    }
+  } catch (std::exception &e) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION!";
+    LOG(ERR) << e.what();
+
+    display_exception(e.what());
+  } catch (...) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION! (unknown exception)";
+  }
+
+  return 0;
+}
+
+void display_exception(std::string const &msg) {
+  std::stringstream ss;
+  ss << "An error has occurred. Please send your log file (below) to dean@codeka.com.au for diagnostics." << std::endl;
+  ss << std::endl;
+  ss << fw::LogFileName() << std::endl;
+  ss << std::endl;
+  ss << msg;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  fw::SettingDefinition extra_settings;
+  extra_settings.add_group("Additional options", "Net-test specific settings")
+      .add_setting<int>("packets", "Number of command packets to send and receive.", 1000000)
+      .add_setting<int>("max-commands", "Most commands in a single packet.", 8)
+      .add_setting<int>("minutes", "Length of the game we work out the bandwidth for.", 30)
+      .add_setting<int>("players", "Number of players in the game we work out the bandwidth for.", 8)
+      .add_setting<int>("turn-length", "Length of a turn in that game, in milliseconds.", 200)
+      .add_setting<int>("apm", "Number of orders each player gives per minute in that game.", 120)
+      .add_setting<int>("seed", "Seed for the random number generator, so runs are repeatable.", 42);
+
+  return fw::Settings::initialize(extra_settings, argc, argv, "net-test.conf");
+}
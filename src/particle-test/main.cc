@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <framework/bitmap.h>
 #include <framework/camera.h>
@@ -13,12 +17,17 @@
 #include <framework/gui/window.h>
 #include <framework/logging.h>
 #include <framework/service_locator.h>
+#include <framework/dynamic_ring_buffer.h>
+#include <framework/particle_batcher.h>
+#include <framework/particle_config.h>
 #include <framework/particle_manager.h>
 #include <framework/particle_effect.h>
+#include <framework/particle_store.h>
 #include <framework/math.h>
 #include <framework/misc.h>
 #include <framework/paths.h>
 #include <framework/scenegraph.h>
+#include <framework/timer.h>
 
 fw::Status settings_initialize(int argc, char** argv);
 void display_exception(std::string const &msg);
@@ -43,26 +52,23 @@ void update_effect_position() {
     pos = fw::Vector(0.0f, 0.0f, 0.0f);
   }
 
-  fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
-    [pos](fw::sg::Scenegraph& scenegraph) {
-      g_effect->set_position(pos);
-    });
+  if (g_effect) {
+    g_effect->set_position(pos);
+  }
 }
 
 void restart_effect() {
-  fw::Framework::get_instance()->get_scenegraph_manager()->enqueue(
-    [](fw::sg::Scenegraph& scenegraph) {
-      if (g_effect) {
-        g_effect->destroy();
-      }
-      auto effect = fw::Framework::get_instance()->get_particle_mgr()->CreateEffect(
-          fw::Settings::get<std::string>("particle-file"), fw::Vector(0, 0, 0));
-      if (!effect.ok()) {
-        LOG(ERR) << "error creating effect: " << effect.status();
-      } else {
-        g_effect = *effect;
-      }
-    });
+  if (g_effect) {
+    g_effect->destroy();
+  }
+  auto effect = fw::Framework::get_instance()->get_particle_mgr()->CreateEffect(
+      fw::Settings::get<std::string>("particle-file"), fw::Vector(0, 0, 0));
+  if (!effect.ok()) {
+    LOG(ERR) << "error creating effect: " << effect.status();
+    g_effect.reset();
+  } else {
+    g_effect = *effect;
+  }
   update_effect_position();
 }
 
@@ -149,6 +155,175 @@ void Application::update(float dt) {
   }
 }
 
+//-----------------------------------------------------------------------------
+// The benchmark runs the particle update on it's own, without any graphics, to compare the scalar and SIMD kernels.
+
+// Fills the given store up to count particles, with ages spread out over the particle's lifetime.
+void fill_store(fw::ParticleStore &store, int count) {
+  while (store.get_count() < count) {
+    const float max_age = store.get_config()->max_age.GetValue();
+    store.add(fw::Vector(fw::random() * 10.0f, 0.0f, fw::random() * 10.0f), fw::random() * max_age);
+  }
+}
+
+// Checks that every field of every particle in the two stores is (close enough to) the same.
+bool compare_stores(fw::ParticleStore const &scalar, fw::ParticleStore const &simd) {
+  if (scalar.get_count() != simd.get_count()) {
+    LOG(ERR) << "scalar kernel left " << scalar.get_count() << " particles, SIMD kernel left " << simd.get_count();
+    return false;
+  }
+
+  for (int field = 0; field < fw::ParticleStore::kNumFields; field++) {
+    float const *scalar_values = scalar.get(static_cast<fw::ParticleStore::Field>(field));
+    float const *simd_values = simd.get(static_cast<fw::ParticleStore::Field>(field));
+    for (int i = 0; i < scalar.get_count(); i++) {
+      const float tolerance = 0.001f * std::max(1.0f, std::abs(scalar_values[i]));
+      if (std::abs(scalar_values[i] - simd_values[i]) > tolerance) {
+        LOG(ERR) << "particle " << i << " field " << field << ": scalar kernel gave " << scalar_values[i]
+                 << ", SIMD kernel gave " << simd_values[i];
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Runs the ParticleBatcher over the given particles, into a ring buffer with a mock backend, and checks that the
+// batches cover all of the particles and use the ring buffer the way we expect.
+int run_batch_benchmark(fw::ParticleManager::Snapshot const &snapshot, int num_frames) {
+  const int max_particles = fw::Settings::get<int>("benchmark-particles");
+  auto backend = std::make_unique<fw::MockRingBufferBackend>();
+  fw::MockRingBufferBackend *mock_backend = backend.get();
+  fw::DynamicRingBuffer ring(std::move(backend), sizeof(fw::vertex::xyz_c_uv), max_particles * 4);
+
+  fw::ParticleBatcher batcher;
+  fw::ParticleBatcher::View view;
+  view.camera_position = fw::Vector(5.0f, 10.0f, 5.0f);
+  // Wrap like a small map would, so we're paying for the wrapping like we would in game.
+  view.wrap_x = 128.0f;
+  view.wrap_z = 128.0f;
+  view.alpha = 0.5f;
+  view.color_texture_height = 16;
+
+  float seconds = 0.0f;
+  for (int frame = 0; frame < num_frames; frame++) {
+    fw::Timer timer;
+    timer.start();
+    ring.begin_frame();
+    batcher.build(snapshot, view, ring);
+    ring.end_frame();
+    timer.stop();
+    seconds += timer.get_total_time();
+
+    // The batches should be back-to-back in this frame's region, and cover every particle.
+    const int region_start = (frame % fw::DynamicRingBuffer::kNumRegions) * max_particles * 4;
+    int next_vertex = region_start;
+    int num_quads = 0;
+    for (fw::ParticleBatch const &batch : batcher.get_batches()) {
+      if (batch.first_vertex != next_vertex || batch.num_quads > fw::DynamicRingBuffer::kMaxQuadsPerDraw) {
+        LOG(ERR) << "unexpected batch on frame " << frame << ": first_vertex=" << batch.first_vertex
+                 << " (expected " << next_vertex << "), num_quads=" << batch.num_quads;
+        return 1;
+      }
+      next_vertex += batch.num_quads * 4;
+      num_quads += batch.num_quads;
+    }
+    if (num_quads != std::min(batcher.get_num_particles(), max_particles)) {
+      LOG(ERR) << "batches have " << num_quads << " particles, expected " << batcher.get_num_particles();
+      return 1;
+    }
+  }
+
+  // We only have to wait for a region once we've gone all the way around the ring.
+  const int expected_waits = std::max(0, num_frames - fw::DynamicRingBuffer::kNumRegions);
+  if (mock_backend->get_num_waits() != expected_waits) {
+    LOG(ERR) << "waited for " << mock_backend->get_num_waits() << " fences, expected " << expected_waits;
+    return 1;
+  }
+
+  const float ms = seconds * 1000.0f / num_frames;
+  LOG(INFO) << "batching: " << batcher.get_num_particles() << " particles in " << batcher.get_batches().size()
+            << " batch(es), " << ms << "ms per frame (" << (ms * 100.0f / 16.6f) << "% of a 60fps frame) with "
+            << fw::ParticleStore::get_simd_name() << " billboards";
+  return 0;
+}
+
+int run_benchmark() {
+  auto effect_config = fw::ParticleEffectConfig::Load(fw::Settings::get<std::string>("particle-file"));
+  if (!effect_config.ok()) {
+    LOG(ERR) << "error loading particle file: " << effect_config.status();
+    return 1;
+  }
+
+  // One store per emitter, with the particles split evenly between them. Each frame, both kernels start from a copy
+  // of the same particles so we can compare what they come up with.
+  std::vector<std::unique_ptr<fw::ParticleStore>> stores;
+  std::vector<std::unique_ptr<fw::ParticleStore>> scalar_stores;
+  std::vector<std::unique_ptr<fw::ParticleStore>> simd_stores;
+  for (auto it = (*effect_config)->emitter_config_begin(); it != (*effect_config)->emitter_config_end(); ++it) {
+    stores.push_back(std::make_unique<fw::ParticleStore>(*it));
+    scalar_stores.push_back(std::make_unique<fw::ParticleStore>(*it));
+    simd_stores.push_back(std::make_unique<fw::ParticleStore>(*it));
+  }
+  if (stores.empty()) {
+    LOG(ERR) << "particle file has no emitters";
+    return 1;
+  }
+
+  const int num_particles = fw::Settings::get<int>("benchmark-particles");
+  const int num_frames = fw::Settings::get<int>("benchmark-frames");
+  const int particles_per_store = num_particles / static_cast<int>(stores.size());
+  const float dt = 1.0f / 60.0f;
+
+  float scalar_seconds = 0.0f;
+  float simd_seconds = 0.0f;
+  for (int frame = 0; frame < num_frames; frame++) {
+    for (size_t i = 0; i < stores.size(); i++) {
+      fill_store(*stores[i], particles_per_store);
+      scalar_stores[i]->copy_from(*stores[i]);
+      simd_stores[i]->copy_from(*stores[i]);
+    }
+
+    fw::Timer scalar_timer;
+    scalar_timer.start();
+    for (auto &store : scalar_stores) {
+      store->update(dt, fw::ParticleStore::Kernel::kScalar);
+    }
+    scalar_timer.stop();
+    scalar_seconds += scalar_timer.get_total_time();
+
+    fw::Timer simd_timer;
+    simd_timer.start();
+    for (auto &store : simd_stores) {
+      store->update(dt, fw::ParticleStore::Kernel::kSimd);
+    }
+    simd_timer.stop();
+    simd_seconds += simd_timer.get_total_time();
+
+    for (size_t i = 0; i < stores.size(); i++) {
+      if (!compare_stores(*scalar_stores[i], *simd_stores[i])) {
+        LOG(ERR) << "SIMD kernel doesn't match the scalar kernel on frame " << frame;
+        return 1;
+      }
+
+      // Move the simulation on, dead particles get replaced at the start of the next frame.
+      stores[i]->copy_from(*simd_stores[i]);
+    }
+  }
+
+  const float scalar_ms = scalar_seconds * 1000.0f / num_frames;
+  const float simd_ms = simd_seconds * 1000.0f / num_frames;
+  LOG(INFO) << num_particles << " particles, " << stores.size() << " emitter(s), " << num_frames << " frames";
+  LOG(INFO) << "scalar: " << scalar_ms << "ms per frame (" << (scalar_ms * 100.0f / 16.6f) << "% of a 60fps frame)";
+  LOG(INFO) << fw::ParticleStore::get_simd_name() << ": " << simd_ms << "ms per frame ("
+            << (simd_ms * 100.0f / 16.6f) << "% of a 60fps frame), " << (scalar_ms / simd_ms) << "x";
+  LOG(INFO) << "SIMD kernel matches the scalar kernel";
+
+  fw::ParticleManager::Snapshot snapshot;
+  snapshot.stores = std::move(simd_stores);
+  return run_batch_benchmark(snapshot, num_frames);
+}
+
 //-----------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
@@ -160,8 +335,14 @@ int main(int argc, char** argv) {
       return 1;
     }
 
+    const bool benchmark = fw::Settings::get<bool>("benchmark");
     Application app;
-    new fw::Framework(&app);
+    fw::ToolApplication tool_app;
+    if (benchmark) {
+      new fw::Framework(&tool_app);
+    } else {
+      new fw::Framework(&app);
+    }
     auto continue_or_status = fw::Framework::get_instance()->initialize("Particle Test");
     if (!continue_or_status.ok()) {
       LOG(ERR) << continue_or_status.status();
@@ -171,6 +352,9 @@ int main(int argc, char** argv) {
       return 0;
     }
 
+    if (benchmark) {
+      return run_benchmark();
+    }
     fw::Framework::get_instance()->run();
   } catch (std::exception &e) {
     LOG(ERR) << "--------------------------------------------------------------------------------";
@@ -201,7 +385,14 @@ fw::Status settings_initialize(int argc, char** argv) {
       .add_setting<std::string>(
           "particle-file",
           "Name of the particle file to load, we assume it can be fw::resolve'd.",
-          "explosion-01");
+          "explosion-01")
+      .add_setting<bool>(
+          "benchmark",
+          "Rather than displaying the effect, run the particle update headless and compare the scalar and SIMD "
+          "kernels.",
+          false)
+      .add_setting<int>("benchmark-particles", "Number of live particles to keep in the benchmark.", 100000)
+      .add_setting<int>("benchmark-frames", "Number of frames to run the benchmark for.", 600);
 
   return fw::Settings::initialize(extra_settings, argc, argv, "font-test.conf");
 }
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include <framework/framework.h>
+#include <framework/hierarchical_path_find.h>
+#include <framework/jump_point_path_find.h>
+#include <framework/logging.h>
+#include <framework/misc.h>
+#include <framework/path_find.h>
+#include <framework/settings.h>
+#include <framework/status.h>
+#include <framework/timer.h>
+
+#include "reference_path_find.h"
+
+fw::Status settings_initialize(int argc, char** argv);
+void display_exception(std::string const &msg);
+
+// Our sectors are the same size as the terrain's patches.
+static const int kSectorSize = 64;
+
+//-----------------------------------------------------------------------------
+
+// Generates a map of the given size with a bunch of randomly-placed rectangular obstacles.
+std::vector<bool> generate_map(std::mt19937 &rng, int width, int length, int num_obstacles, int max_obstacle_size) {
+  std::vector<bool> passable(width * length, true);
+  std::uniform_int_distribution<int> x_dist(0, width - 1);
+  std::uniform_int_distribution<int> z_dist(0, length - 1);
+  std::uniform_int_distribution<int> size_dist(2, max_obstacle_size);
+  for (int i = 0; i < num_obstacles; i++) {
+    int x = x_dist(rng);
+    int z = z_dist(rng);
+    int obstacle_width = size_dist(rng);
+    int obstacle_length = size_dist(rng);
+    for (int dz = 0; dz < obstacle_length; dz++) {
+      for (int dx = 0; dx < obstacle_width; dx++) {
+        passable[(fw::constrain(z + dz, length) * width) + fw::constrain(x + dx, width)] = false;
+      }
+    }
+  }
+  return passable;
+}
+
+// Gets the length of the given path, taking into account the fact that it can wrap around the edge of the map.
+float path_length(std::vector<fw::Vector> const &path, int width, int length) {
+  float total = 0.0f;
+  for (size_t i = 1; i < path.size(); i++) {
+    int dx = std::abs(static_cast<int>(path[i][0]) - static_cast<int>(path[i - 1][0]));
+    int dz = std::abs(static_cast<int>(path[i][2]) - static_cast<int>(path[i - 1][2]));
+    dx = std::min(dx, width - dx);
+    dz = std::min(dz, length - dz);
+    total += (dx != 0 && dz != 0) ? 1.41421356f : 1.0f;
+  }
+  return total;
+}
+
+// Checks that JumpPointPathFind finds paths with exactly the same cost as a Dijkstra search (i.e. the optimal cost),
+// on a bunch of small random maps with varying numbers of obstacles. Small maps mean lots of paths wrap around the
+// edges. Returns the number of mismatches.
+int verify_jump_point(std::mt19937 &rng) {
+  const int num_maps = fw::Settings::get<int>("verify-maps");
+  const int width = 96;
+  const int length = 64;
+  int num_paths = 0;
+  int num_mismatches = 0;
+  for (int i = 0; i < num_maps; i++) {
+    std::vector<bool> passable = generate_map(rng, width, length, i % 80, 8);
+    auto grid = std::make_shared<fw::PassabilityGrid>(width, length, passable);
+    fw::JumpPointPathFind jump_point(grid);
+    fw::FlowField dijkstra(grid);
+
+    std::uniform_int_distribution<int> x_dist(0, width - 1);
+    std::uniform_int_distribution<int> z_dist(0, length - 1);
+    for (int j = 0; j < 20; j++) {
+      fw::Vector start(static_cast<float>(x_dist(rng)), 0.0f, static_cast<float>(z_dist(rng)));
+      fw::Vector goal(static_cast<float>(x_dist(rng)), 0.0f, static_cast<float>(z_dist(rng)));
+      if (!passable[(static_cast<int>(start[2]) * width) + static_cast<int>(start[0])]
+          || !passable[(static_cast<int>(goal[2]) * width) + static_cast<int>(goal[0])]) {
+        continue;
+      }
+
+      std::vector<fw::Vector> jump_point_path, dijkstra_path;
+      bool jump_point_found = jump_point.find(jump_point_path, start, goal);
+      dijkstra.build(goal, {start});
+      bool dijkstra_found = dijkstra.get_path(dijkstra_path, start);
+      num_paths++;
+
+      float jump_point_cost = path_length(jump_point_path, width, length);
+      float dijkstra_cost = path_length(dijkstra_path, width, length);
+      if (jump_point_found != dijkstra_found || std::abs(jump_point_cost - dijkstra_cost) > 0.001f) {
+        LOG(ERR) << "map " << i << ": path from (" << start[0] << ", " << start[2] << ") to (" << goal[0] << ", "
+                 << goal[2] << ") costs " << jump_point_cost << " with jump point search, " << dijkstra_cost
+                 << " with dijkstra";
+        num_mismatches++;
+      }
+    }
+  }
+
+  LOG(INFO) << "verified " << num_paths << " jump point path(s) on " << num_maps << " map(s): " << num_mismatches
+            << " mismatch(es)";
+  return num_mismatches;
+}
+
+// Checks that goals off the edge of the map are wrapped around onto it, exactly as if we'd asked for the wrapped goal
+// in the first place. Returns the number of mismatches.
+int verify_out_of_grid_goals(std::mt19937 &rng) {
+  const int width = 128;
+  const int length = 128;
+  std::vector<bool> passable = generate_map(rng, width, length, 20, 8);
+  auto grid = std::make_shared<fw::PassabilityGrid>(width, length, passable);
+  fw::PathFind flat(grid);
+  fw::JumpPointPathFind jump_point(grid);
+
+  // {goal, the same goal wrapped onto the map}
+  const std::vector<std::tuple<fw::Vector, fw::Vector>> goals {
+    {fw::Vector(200.0f, 0.0f, 40.0f), fw::Vector(72.0f, 0.0f, 40.0f)},
+    {fw::Vector(-3.0f, 0.0f, 40.0f), fw::Vector(125.0f, 0.0f, 40.0f)},
+    {fw::Vector(40.0f, 0.0f, 300.0f), fw::Vector(40.0f, 0.0f, 44.0f)},
+    {fw::Vector(40.0f, 0.0f, -3.0f), fw::Vector(40.0f, 0.0f, 125.0f)},
+  };
+
+  std::uniform_int_distribution<int> x_dist(0, width - 1);
+  std::uniform_int_distribution<int> z_dist(0, length - 1);
+  int num_mismatches = 0;
+  for (auto const &goal : goals) {
+    fw::Vector start;
+    do {
+      start = fw::Vector(static_cast<float>(x_dist(rng)), 0.0f, static_cast<float>(z_dist(rng)));
+    } while (!passable[(static_cast<int>(start[2]) * width) + static_cast<int>(start[0])]);
+
+    for (int algorithm = 0; algorithm < 2; algorithm++) {
+      fw::PathFind &pather = (algorithm == 0) ? flat : jump_point;
+      std::vector<fw::Vector> path, wrapped_path;
+      bool found = pather.find(path, start, std::get<0>(goal));
+      bool wrapped_found = pather.find(wrapped_path, start, std::get<1>(goal));
+      if (found != wrapped_found || path.size() != wrapped_path.size()
+          || !std::equal(path.begin(), path.end(), wrapped_path.begin(),
+                [](fw::Vector const &a, fw::Vector const &b) { return a[0] == b[0] && a[2] == b[2]; })) {
+        LOG(ERR) << (algorithm == 0 ? "flat" : "jump point") << " path to (" << std::get<0>(goal)[0] << ", "
+                 << std::get<0>(goal)[2] << ") doesn't match the path to (" << std::get<1>(goal)[0] << ", "
+                 << std::get<1>(goal)[2] << ")";
+        num_mismatches++;
+      }
+    }
+  }
+
+  LOG(INFO) << "verified " << goals.size() << " goal(s) off the edge of the map: " << num_mismatches
+            << " mismatch(es)";
+  return num_mismatches;
+}
+
+int run_benchmark() {
+  const int width = fw::Settings::get<int>("map-size");
+  const int length = width;
+  std::mt19937 rng(fw::Settings::get<int>("seed"));
+  std::vector<bool> passable = generate_map(
+      rng, width, length, fw::Settings::get<int>("obstacles"), fw::Settings::get<int>("max-obstacle-size"));
+  auto grid = std::make_shared<fw::PassabilityGrid>(width, length, passable);
+
+  fw::Timer timer;
+  timer.start();
+  auto graph = std::make_shared<fw::SectorGraph>(grid, kSectorSize);
+  timer.stop();
+  LOG(INFO) << "built sector graph in " << (timer.get_total_time() * 1000.0f) << "ms, " << graph->get_num_nodes()
+            << " node(s)";
+
+  // Pick random start/goal pairs, both of which are passable.
+  const int num_queries = fw::Settings::get<int>("queries");
+  std::uniform_int_distribution<int> x_dist(0, width - 1);
+  std::uniform_int_distribution<int> z_dist(0, length - 1);
+  std::vector<std::tuple<fw::Vector, fw::Vector>> queries;
+  while (static_cast<int>(queries.size()) < num_queries) {
+    int start_x = x_dist(rng), start_z = z_dist(rng);
+    int goal_x = x_dist(rng), goal_z = z_dist(rng);
+    if (passable[(start_z * width) + start_x] && passable[(goal_z * width) + goal_x]) {
+      queries.push_back(std::make_tuple(
+          fw::Vector(static_cast<float>(start_x), 0.0f, static_cast<float>(start_z)),
+          fw::Vector(static_cast<float>(goal_x), 0.0f, static_cast<float>(goal_z))));
+    }
+  }
+
+  fw::PathFind flat(grid);
+  fw::JumpPointPathFind jump_point(grid);
+  fw::HierarchicalPathFind hierarchical(graph);
+  float flat_time = 0.0f, jump_point_time = 0.0f, hierarchical_time = 0.0f, partial_time = 0.0f;
+  float flat_length = 0.0f, hierarchical_length = 0.0f;
+  int flat_found = 0, hierarchical_found = 0;
+  std::vector<fw::Vector> flat_path, jump_point_path, hierarchical_path, partial_path;
+  for (auto const &query : queries) {
+    fw::Vector const &start = std::get<0>(query);
+    fw::Vector const &goal = std::get<1>(query);
+
+    flat_path.clear();
+    timer.start();
+    bool found_flat = flat.find(flat_path, start, goal);
+    timer.stop();
+    flat_time += timer.get_total_time();
+
+    jump_point_path.clear();
+    timer.start();
+    jump_point.find(jump_point_path, start, goal);
+    timer.stop();
+    jump_point_time += timer.get_total_time();
+
+    hierarchical_path.clear();
+    timer.start();
+    bool found_hierarchical = hierarchical.find(hierarchical_path, start, goal);
+    timer.stop();
+    hierarchical_time += timer.get_total_time();
+
+    // This is what the pathing thread does: only refine the first couple of sectors.
+    partial_path.clear();
+    timer.start();
+    hierarchical.find(partial_path, start, goal, 2);
+    timer.stop();
+    partial_time += timer.get_total_time();
+
+    if (found_flat) {
+      flat_found++;
+    }
+    if (found_hierarchical) {
+      hierarchical_found++;
+    }
+    if (found_flat && found_hierarchical) {
+      flat_length += path_length(flat_path, width, length);
+      hierarchical_length += path_length(hierarchical_path, width, length);
+    }
+  }
+
+  LOG(INFO) << "flat: " << flat_found << "/" << num_queries << " found, "
+            << (flat_time * 1000.0f / num_queries) << "ms per path";
+  LOG(INFO) << "jump point: " << (jump_point_time * 1000.0f / num_queries) << "ms per path";
+  LOG(INFO) << "hierarchical: " << hierarchical_found << "/" << num_queries << " found, "
+            << (hierarchical_time * 1000.0f / num_queries) << "ms per path, "
+            << (partial_time * 1000.0f / num_queries) << "ms per path (2 sectors refined)";
+  if (flat_length > 0.0f) {
+    LOG(INFO) << "hierarchical paths are " << (hierarchical_length / flat_length) << "x the length of flat paths";
+  }
+
+  // Finally, time an incremental update of a couple of sectors, like the editor does.
+  std::vector<std::tuple<int, int>> changed_sectors {{0, 0}, {1, 1}};
+  timer.start();
+  graph->update_sectors(grid, changed_sectors);
+  timer.stop();
+  LOG(INFO) << "updated " << changed_sectors.size() << " sector(s) in " << (timer.get_total_time() * 1000.0f) << "ms";
+
+  return verify_jump_point(rng) + verify_out_of_grid_goals(rng);
+}
+
+// Times fw::PathFind against the original implementation (ReferencePathFind) on 512x512 maps with a few different
+// kinds of obstacles, so the speedup can be reproduced on any machine. Each set of queries is run a few times and we
+// keep the fastest, to cut down on noise.
+void run_path_find_benchmark() {
+  const int width = 512;
+  const int length = 512;
+  const int num_queries = fw::Settings::get<int>("queries");
+  const int num_repeats = 5;
+
+  // {number of obstacles, maximum obstacle size}: lots of small obstacles, a mix, and a few big ones.
+  const std::vector<std::tuple<int, int>> configs {{400, 24}, {3000, 12}, {150, 80}};
+  for (auto const &config : configs) {
+    std::mt19937 rng(fw::Settings::get<int>("seed"));
+    std::vector<bool> passable = generate_map(rng, width, length, std::get<0>(config), std::get<1>(config));
+
+    std::uniform_int_distribution<int> x_dist(0, width - 1);
+    std::uniform_int_distribution<int> z_dist(0, length - 1);
+    std::vector<std::tuple<fw::Vector, fw::Vector>> queries;
+    while (static_cast<int>(queries.size()) < num_queries) {
+      int start_x = x_dist(rng), start_z = z_dist(rng);
+      int goal_x = x_dist(rng), goal_z = z_dist(rng);
+      if (passable[(start_z * width) + start_x] && passable[(goal_z * width) + goal_x]) {
+        queries.push_back(std::make_tuple(
+            fw::Vector(static_cast<float>(start_x), 0.0f, static_cast<float>(start_z)),
+            fw::Vector(static_cast<float>(goal_x), 0.0f, static_cast<float>(goal_z))));
+      }
+    }
+
+    ReferencePathFind reference(width, length, passable);
+    fw::PathFind path_find(width, length, passable);
+    float reference_time = 0.0f, path_find_time = 0.0f;
+    float reference_length = 0.0f, path_find_length = 0.0f;
+    int reference_found = 0, path_find_found = 0;
+    std::vector<fw::Vector> path;
+    fw::Timer timer;
+    for (int i = 0; i < num_repeats; i++) {
+      reference_length = path_find_length = 0.0f;
+      reference_found = path_find_found = 0;
+
+      timer.start();
+      for (auto const &query : queries) {
+        path.clear();
+        if (reference.find(path, std::get<0>(query), std::get<1>(query))) {
+          reference_found++;
+          reference_length += path_length(path, width, length);
+        }
+      }
+      timer.stop();
+      reference_time = (i == 0) ? timer.get_total_time() : std::min(reference_time, timer.get_total_time());
+
+      timer.start();
+      for (auto const &query : queries) {
+        path.clear();
+        if (path_find.find(path, std::get<0>(query), std::get<1>(query))) {
+          path_find_found++;
+          path_find_length += path_length(path, width, length);
+        }
+      }
+      timer.stop();
+      path_find_time = (i == 0) ? timer.get_total_time() : std::min(path_find_time, timer.get_total_time());
+    }
+
+    LOG(INFO) << width << "x" << length << ", " << std::get<0>(config) << " obstacle(s) up to " << std::get<1>(config)
+              << ": reference " << (reference_time * 1000.0f / num_queries) << "ms per path (" << reference_found
+              << " found, total length " << reference_length << "), PathFind "
+              << (path_find_time * 1000.0f / num_queries) << "ms per path (" << path_find_found
+              << " found, total length " << path_find_length << "), " << (reference_time / path_find_time)
+              << "x faster";
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  try {
+    auto status = settings_initialize(argc, argv);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      fw::Settings::print_help();
+      return 1;
+    }
+
+    fw::ToolApplication app;
+    new fw::Framework(&app);
+    auto continue_or_status = fw::Framework::get_instance()->initialize("Path Test");
+    if (!continue_or_status.ok()) {
+      LOG(ERR) << continue_or_status.status();
+      return 1;
+    }
+    if (!continue_or_status.value()) {
+      return 0;
+    }
+
+    if (fw::Settings::get<bool>("benchmark")) {
+      run_path_find_benchmark();
+      return 0;
+    }
+
+    if (run_benchmark() > 0) {
+      return 1;
+    }
+  } catch (std::exception &e) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION!";
+    LOG(ERR) << e.what();
+
+    display_exception(e.what());
+  } catch (...) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION! (unknown exception)";
+  }
+
+  return 0;
+}
+
+void display_exception(std::string const &msg) {
+  std::stringstream ss;
+  ss << "An error has occurred. Please send your log file (below) to dean@codeka.com.au for diagnostics." << std::endl;
+  ss << std::endl;
+  ss << fw::LogFileName() << std::endl;
+  ss << std::endl;
+  ss << msg;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  fw::SettingDefinition extra_settings;
+  extra_settings.add_group("Additional options", "Path-test specific settings")
+      .add_setting<bool>(
+          "benchmark",
+          "Rather than the usual run, time PathFind against the original implementation on 512x512 maps.",
+          false)
+      .add_setting<int>("map-size", "Width and length of the generated map.", 1024)
+      .add_setting<int>("obstacles", "Number of random obstacles to place on the map.", 600)
+      .add_setting<int>("max-obstacle-size", "Maximum width/length of each obstacle.", 80)
+      .add_setting<int>("queries", "Number of random paths to find.", 100)
+      .add_setting<int>("seed", "Seed for the random number generator, so runs are repeatable.", 42)
+      .add_setting<int>("verify-maps", "Number of small random maps to check jump point search's paths on.", 200);
+
+  return fw::Settings::initialize(extra_settings, argc, argv, "path-test.conf");
+}
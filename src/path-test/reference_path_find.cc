@@ -0,0 +1,91 @@
+#include "reference_path_find.h"
+
+#include <cmath>
+
+#include <framework/misc.h>
+
+namespace {
+
+float estimate_cost(fw::Vector const &from, fw::Vector const &to) {
+  // we'll use the manhatten distance.
+  return std::abs(from[0] - to[0]) + std::abs(from[2] - to[2]);
+}
+
+}
+
+bool ReferencePathFind::CostComparer::operator()(Node const *lhs, Node const *rhs) const {
+  return (lhs->cost_to_goal + lhs->cost_from_start) < (rhs->cost_to_goal + rhs->cost_from_start);
+}
+
+ReferencePathFind::ReferencePathFind(int width, int length, std::vector<bool> const &passability) :
+    width_(width), length_(length), nodes_(width * length), run_no_(0) {
+  for (int z = 0; z < length_; z++) {
+    for (int x = 0; x < width_; x++) {
+      Node &node = nodes_[(z * width_) + x];
+      node.loc = fw::Vector(static_cast<float>(x), 0.0f, static_cast<float>(z));
+      node.open_run_no = 0;
+      node.closed_run_no = 0;
+      node.passable = passability[(z * width_) + x];
+    }
+  }
+}
+
+ReferencePathFind::Node *ReferencePathFind::get_node(fw::Vector const &loc) {
+  int x = fw::constrain(static_cast<int>(loc[0]), width_);
+  int z = fw::constrain(static_cast<int>(loc[2]), length_);
+  return &nodes_[(z * width_) + x];
+}
+
+bool ReferencePathFind::find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end) {
+  std::multiset<Node *, CostComparer> open_set;
+  run_no_++;
+
+  Node *start_node = get_node(start);
+  start_node->previous = nullptr;
+  start_node->open_run_no = run_no_;
+  start_node->cost_to_goal = estimate_cost(start_node->loc, end);
+  start_node->cost_from_start = 0.0f;
+  start_node->open_it = open_set.insert(start_node);
+
+  while (!open_set.empty()) {
+    Node *curr = *open_set.begin();
+    if (curr->cost_to_goal <= 1.0f) {
+      for (Node const *node = curr; node != nullptr; node = node->previous) {
+        path.insert(path.begin(), node->loc);
+      }
+      return true;
+    }
+
+    curr->closed_run_no = run_no_;
+    curr->open_run_no = 0;
+    open_set.erase(curr->open_it);
+
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        if (dx == 0 && dz == 0)
+          continue;
+
+        Node *n = get_node(fw::Vector(curr->loc[0] + dx, 0.0f, curr->loc[2] + dz));
+        if (n->closed_run_no == run_no_ || !n->passable)
+          continue;
+
+        float new_cost_to_goal = estimate_cost(n->loc, end);
+        float new_cost_from_start = curr->cost_from_start + (dx == 0 || dz == 0 ? 1.0f : 1.41421356f);
+        if (n->open_run_no != run_no_
+            || (new_cost_from_start + new_cost_to_goal) < (n->cost_from_start + n->cost_to_goal)) {
+          n->previous = curr;
+          n->cost_to_goal = new_cost_to_goal;
+          n->cost_from_start = new_cost_from_start;
+          if (n->open_run_no == run_no_) {
+            open_set.erase(n->open_it);
+          } else {
+            n->open_run_no = run_no_;
+          }
+          n->open_it = open_set.insert(n);
+        }
+      }
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <set>
+#include <vector>
+
+#include <framework/math.h>
+
+// The original fw::PathFind: A* with a std::multiset for the open set and a node struct per cell. It's only here so
+// that --benchmark can report how much faster the current fw::PathFind is, on the same machine and the same maps.
+class ReferencePathFind {
+private:
+  struct Node;
+  struct CostComparer {
+    bool operator()(Node const *lhs, Node const *rhs) const;
+  };
+
+  struct Node {
+    Node *previous;
+    float cost_to_goal;
+    float cost_from_start;
+    fw::Vector loc;
+    bool passable;
+
+    std::multiset<Node *, CostComparer>::iterator open_it;
+    int open_run_no;  // the run_no we were last inserted into the open set
+    int closed_run_no;  // the run_no we were last inserted into the closed set
+  };
+
+  int width_;
+  int length_;
+  std::vector<Node> nodes_;
+  int run_no_;
+
+  Node *get_node(fw::Vector const &loc);
+
+public:
+  ReferencePathFind(int width, int length, std::vector<bool> const &passability);
+
+  bool find(std::vector<fw::Vector> &path, fw::Vector const &start, fw::Vector const &end);
+};
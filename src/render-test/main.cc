@@ -0,0 +1,974 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <framework/bounds.h>
+#include <framework/camera.h>
+#include <framework/color.h>
+#include <framework/dynamic_ring_buffer.h>
+#include <framework/framework.h>
+#include <framework/logging.h>
+#include <framework/math.h>
+#include <framework/misc.h>
+#include <framework/model.h>
+#include <framework/model_node.h>
+#include <framework/render_queue.h>
+#include <framework/scenegraph.h>
+#include <framework/settings.h>
+#include <framework/status.h>
+#include <framework/timer.h>
+
+fw::Status settings_initialize(int argc, char** argv);
+void display_exception(std::string const &msg);
+
+//-----------------------------------------------------------------------------
+
+// We count every allocation each thread makes, so the transform channel test can check that it doesn't make any.
+thread_local int64_t g_num_allocations = 0;
+
+void *operator new(std::size_t size) {
+  g_num_allocations++;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+//-----------------------------------------------------------------------------
+
+// The RenderQueue and the RecordingRenderBackend never look at what the programs, parameters and buffers in a command
+// point to, so we can test them without a GL context by pointing them at these instead.
+struct FakeObjects {
+  std::vector<char> programs;
+  std::vector<char> parameters;
+  std::vector<char> buffers;
+
+  FakeObjects(int num_programs, int num_parameters, int num_buffers) :
+      programs(num_programs), parameters(num_parameters), buffers(num_buffers) {
+  }
+
+  fw::ShaderProgram *program(int i) {
+    return reinterpret_cast<fw::ShaderProgram *>(&programs[i]);
+  }
+  fw::ShaderParameters *params(int i) {
+    return reinterpret_cast<fw::ShaderParameters *>(&parameters[i]);
+  }
+  fw::VertexBuffer *vb(int i) {
+    return reinterpret_cast<fw::VertexBuffer *>(&buffers[i]);
+  }
+  fw::IndexBuffer *ib(int i) {
+    return reinterpret_cast<fw::IndexBuffer *>(&buffers[i]);
+  }
+};
+
+// One thing we want to draw. This is roughly what a map full of units looks like: each unit is a few meshes that are
+// shared with every other unit of the same type, all drawn with the same (opaque) program, plus a few terrain patches,
+// and then some blended selection indicators and particles.
+struct Item {
+  int program;
+  bool blended;
+  int params;
+  int texture;
+  int vb;
+  int ib;
+  float depth;
+};
+
+enum Program {
+  kEntityProgram,
+  kTerrainProgram,
+  kSelectionProgram,
+  kParticleProgram,
+  kNumPrograms,
+};
+
+std::vector<Item> build_scene(int num_units, std::mt19937 &rng) {
+  constexpr int kNumUnitTypes = 8;
+  constexpr int kMeshesPerUnit = 3;
+  constexpr int kNumPatches = 9;
+  constexpr int kNumParticleTextures = 4;
+
+  // Buffers are numbered: each unit type's meshes, then the terrain patches, then the particle ring buffer.
+  const int terrain_buffer = kNumUnitTypes * kMeshesPerUnit * 2;
+  const int particle_buffer = terrain_buffer + kNumPatches + 1;
+
+  std::uniform_real_distribution<float> depth_dist(1.0f, 200.0f);
+  std::uniform_int_distribution<int> type_dist(0, kNumUnitTypes - 1);
+  std::vector<Item> items;
+  int next_params = 0;
+  for (int i = 0; i < num_units; i++) {
+    const int type = type_dist(rng);
+    const float depth = depth_dist(rng);
+    for (int mesh = 0; mesh < kMeshesPerUnit; mesh++) {
+      const int buffer = (type * kMeshesPerUnit + mesh) * 2;
+      items.push_back(Item {kEntityProgram, false, next_params++, type, buffer, buffer + 1, depth});
+    }
+    if (i % 10 == 0) {
+      items.push_back(Item {kSelectionProgram, true, next_params++, -1, terrain_buffer, terrain_buffer + kNumPatches,
+          depth});
+    }
+  }
+  for (int i = 0; i < kNumPatches; i++) {
+    items.push_back(Item {kTerrainProgram, false, next_params++, 100, terrain_buffer + i,
+        terrain_buffer + kNumPatches, depth_dist(rng)});
+  }
+  for (int i = 0; i < kNumParticleTextures; i++) {
+    // All the particles are in one buffer, with an identity transform, so they're all the same distance away.
+    items.push_back(Item {kParticleProgram, true, next_params++, 200 + i, particle_buffer, particle_buffer + 1,
+        10.0f});
+  }
+
+  std::shuffle(items.begin(), items.end(), rng);
+  return items;
+}
+
+void add_items(fw::sg::RenderQueue &queue, std::vector<Item> const &items, FakeObjects &objects) {
+  for (int i = 0; i < static_cast<int>(items.size()); i++) {
+    Item const &item = items[i];
+    fw::sg::RenderCommand &cmd = queue.add();
+    cmd.shader = nullptr;
+    cmd.program = objects.program(item.program);
+    cmd.parameters = objects.params(item.params);
+    cmd.vb = objects.vb(item.vb);
+    cmd.ib = objects.ib(item.ib);
+    cmd.primitive_type = fw::sg::kTriangleList;
+    cmd.shadow_map = nullptr;
+
+    // We use the base vertex to remember which item this is.
+    cmd.base_vertex = i;
+    cmd.num_indices = 6;
+    cmd.key = fw::sg::RenderQueue::make_key(
+        item.blended ? fw::sg::RenderQueue::kBlended : fw::sg::RenderQueue::kOpaque, item.program, item.texture,
+        item.vb, item.depth);
+  }
+}
+
+// Checks that the backend drew every item once, in the right order, with the right things bound.
+bool check_draws(std::vector<Item> const &items, fw::sg::RecordingRenderBackend const &backend) {
+  std::vector<bool> drawn(items.size(), false);
+  bool seen_blended = false;
+  float last_blended_depth = 0.0f;
+  for (fw::sg::RenderCommand const &cmd : backend.get_draws()) {
+    Item const &item = items[cmd.base_vertex];
+    if (drawn[cmd.base_vertex]) {
+      LOG(ERR) << "item " << cmd.base_vertex << " was drawn twice";
+      return false;
+    }
+    drawn[cmd.base_vertex] = true;
+
+    if (seen_blended && !item.blended) {
+      LOG(ERR) << "opaque item " << cmd.base_vertex << " was drawn after a blended one";
+      return false;
+    }
+    if (item.blended) {
+      if (seen_blended && item.depth > last_blended_depth) {
+        LOG(ERR) << "blended item " << cmd.base_vertex << " at depth " << item.depth
+                 << " was drawn after one at depth " << last_blended_depth;
+        return false;
+      }
+      seen_blended = true;
+      last_blended_depth = item.depth;
+    }
+  }
+  if (std::find(drawn.begin(), drawn.end(), false) != drawn.end()) {
+    LOG(ERR) << "only " << backend.get_draws().size() << " of " << items.size() << " items were drawn";
+    return false;
+  }
+
+  // Now make sure that whatever was last bound when we drew each item is the right thing. The parameters are set on
+  // the program, so they don't count if they were applied before the program was bound.
+  void const *program = nullptr;
+  void const *params = nullptr;
+  void const *vb = nullptr;
+  void const *ib = nullptr;
+  int draw = 0;
+  for (auto const &call : backend.get_calls()) {
+    switch (call.type) {
+    case fw::sg::RecordingRenderBackend::kBindProgram:
+      program = call.object;
+      params = nullptr;
+      break;
+    case fw::sg::RecordingRenderBackend::kApplyParameters:
+      params = call.object;
+      break;
+    case fw::sg::RecordingRenderBackend::kBindVertexBuffer:
+      vb = call.object;
+      break;
+    case fw::sg::RecordingRenderBackend::kBindIndexBuffer:
+      ib = call.object;
+      break;
+    case fw::sg::RecordingRenderBackend::kDraw: {
+      fw::sg::RenderCommand const &cmd = backend.get_draws()[draw++];
+      if (program != cmd.program || params != cmd.parameters || vb != cmd.vb || ib != cmd.ib) {
+        LOG(ERR) << "item " << cmd.base_vertex << " was drawn with the wrong state bound";
+        return false;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  // And that we only bound each program when we actually changed to it.
+  int num_program_changes = 0;
+  void const *last_program = nullptr;
+  for (fw::sg::RenderCommand const &cmd : backend.get_draws()) {
+    if (cmd.program != last_program) {
+      num_program_changes++;
+      last_program = cmd.program;
+    }
+  }
+  if (backend.count(fw::sg::RecordingRenderBackend::kBindProgram) != num_program_changes) {
+    LOG(ERR) << "bound programs " << backend.count(fw::sg::RecordingRenderBackend::kBindProgram) << " times, but "
+             << "they only changed " << num_program_changes << " times";
+    return false;
+  }
+  return true;
+}
+
+// An army: every unit is an instance of one of a few models, each with a few meshes, in it's player's color. The
+// terrain's drawn normally alongside them.
+bool run_instancing_test(std::mt19937 &rng) {
+  constexpr int kNumUnitTypes = 8;
+  constexpr int kMeshesPerUnit = 3;
+  constexpr int kNumPatches = 9;
+  constexpr int kMaxInstances = 16384;
+  const fw::Color player_colors[] = {
+      fw::Color(1, 0, 0), fw::Color(0, 1, 0), fw::Color(0, 0, 1), fw::Color(1, 1, 0)};
+
+  const int num_units = fw::Settings::get<int>("units");
+  FakeObjects objects(kNumPrograms, num_units, 1024);
+  auto backend_ptr = std::make_unique<fw::MockRingBufferBackend>();
+  fw::MockRingBufferBackend *ring_backend = backend_ptr.get();
+  fw::DynamicRingBuffer instance_buffer(std::move(backend_ptr), sizeof(fw::vertex::instance), kMaxInstances);
+
+  fw::sg::RenderQueue queue;
+  queue.set_instance_buffer(&instance_buffer);
+  fw::sg::RecordingRenderBackend backend;
+
+  std::uniform_int_distribution<int> type_dist(0, kNumUnitTypes - 1);
+  std::uniform_int_distribution<int> player_dist(0, 3);
+  std::uniform_real_distribution<float> pos_dist(0.0f, 256.0f);
+
+  // Two frames, to make sure nothing is left over from the first one.
+  for (int frame = 0; frame < 2; frame++) {
+    instance_buffer.begin_frame();
+    backend.clear();
+    queue.reset_stats();
+
+    // The instances we expect for each mesh, keyed by the mesh's vertex buffer, in the order we added them.
+    std::map<void const *, std::vector<fw::vertex::instance>> expected;
+    std::map<void const *, void const *> expected_params;
+    for (int i = 0; i < num_units; i++) {
+      const int type = type_dist(rng);
+      const fw::Matrix transform = fw::translation(pos_dist(rng), 0.0f, pos_dist(rng));
+      const uint32_t color = player_colors[player_dist(rng)].to_abgr();
+      for (int mesh = 0; mesh < kMeshesPerUnit; mesh++) {
+        const int buffer = (type * kMeshesPerUnit + mesh) * 2;
+        fw::sg::RenderCommand cmd;
+        cmd.shader = nullptr;
+        cmd.program = objects.program(kEntityProgram);
+        cmd.parameters = objects.params(i);
+        cmd.vb = objects.vb(buffer);
+        cmd.ib = objects.ib(buffer + 1);
+        cmd.primitive_type = fw::sg::kTriangleList;
+        cmd.base_vertex = 0;
+        cmd.num_indices = -1;
+        cmd.shadow_map = nullptr;
+        cmd.key = fw::sg::RenderQueue::make_key(fw::sg::RenderQueue::kOpaque, kEntityProgram, type, buffer, 1.0f);
+        queue.add_instance(cmd, type, transform, color);
+
+        fw::vertex::instance instance;
+        std::memcpy(instance.transform, transform.m, sizeof(instance.transform));
+        instance.color = color;
+        expected[cmd.vb].push_back(instance);
+        expected_params.emplace(cmd.vb, cmd.parameters);
+      }
+    }
+    for (int i = 0; i < kNumPatches; i++) {
+      fw::sg::RenderCommand &cmd = queue.add();
+      cmd.shader = nullptr;
+      cmd.program = objects.program(kTerrainProgram);
+      cmd.parameters = objects.params(i);
+      cmd.vb = objects.vb(900 + i);
+      cmd.ib = objects.ib(999);
+      cmd.primitive_type = fw::sg::kTriangleList;
+      cmd.base_vertex = 0;
+      cmd.num_indices = -1;
+      cmd.shadow_map = nullptr;
+      cmd.key = fw::sg::RenderQueue::make_key(fw::sg::RenderQueue::kOpaque, kTerrainProgram, 100, 900 + i, 1.0f);
+    }
+    queue.execute(backend);
+    instance_buffer.end_frame();
+
+    int num_plain_draws = 0;
+    int num_instances = 0;
+    std::map<void const *, int> draws_per_mesh;
+    for (fw::sg::RenderCommand const &cmd : backend.get_draws()) {
+      if (cmd.num_instances == 0) {
+        num_plain_draws++;
+        continue;
+      }
+      draws_per_mesh[cmd.vb]++;
+      num_instances += cmd.num_instances;
+
+      // The instances should have been written into the buffer in the order they were added.
+      auto it = expected.find(cmd.vb);
+      if (it == expected.end() || static_cast<int>(it->second.size()) != cmd.num_instances) {
+        LOG(ERR) << "instanced draw of " << cmd.num_instances << " instances doesn't match any mesh";
+        return false;
+      }
+      fw::vertex::instance const *instances = reinterpret_cast<fw::vertex::instance const *>(
+          ring_backend->get_data() + (cmd.first_instance * sizeof(fw::vertex::instance)));
+      if (std::memcmp(instances, it->second.data(), sizeof(fw::vertex::instance) * cmd.num_instances) != 0) {
+        LOG(ERR) << "instance data for mesh doesn't match what was added";
+        return false;
+      }
+      if (cmd.parameters != expected_params[cmd.vb]) {
+        LOG(ERR) << "instanced draw isn't using the first instance's parameters";
+        return false;
+      }
+    }
+    if (num_plain_draws != kNumPatches) {
+      LOG(ERR) << "expected " << kNumPatches << " normal draws, got " << num_plain_draws;
+      return false;
+    }
+    if (draws_per_mesh.size() != expected.size()) {
+      LOG(ERR) << "expected " << expected.size() << " meshes to be drawn, got " << draws_per_mesh.size();
+      return false;
+    }
+    for (auto const &it : draws_per_mesh) {
+      if (it.second != 1) {
+        LOG(ERR) << "a mesh was drawn in " << it.second << " instanced draws, expected 1";
+        return false;
+      }
+    }
+    if (num_instances != num_units * kMeshesPerUnit) {
+      LOG(ERR) << "drew " << num_instances << " instances, expected " << (num_units * kMeshesPerUnit);
+      return false;
+    }
+
+    fw::sg::RenderQueue::Stats const &stats = queue.get_stats();
+    if (frame == 0) {
+      LOG(INFO) << num_units << " units (" << num_instances << " meshes): " << stats.num_instanced_draws
+                << " instanced draws + " << num_plain_draws << " normal draws, " << stats.num_draws
+                << " draw calls in total (down from " << (num_instances + num_plain_draws) << ")";
+    }
+  }
+  return true;
+}
+
+// Returns true if the given point is inside the view volume of the given view * projection matrix.
+bool is_in_view(fw::Matrix const &viewproj, fw::Vector const &point) {
+  const fw::Vector4 clip = viewproj * fw::Vector4(point);
+  for (int i = 0; i < 3; i++) {
+    if (clip[i] < -clip[3] || clip[i] > clip[3]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks the Frustum against random boxes, by projecting a grid of points in each box: a box can't be outside if any
+// of it's points are in view, and it can't be inside unless all of them are.
+bool run_frustum_test(std::mt19937 &rng) {
+  fw::CameraRenderState camera;
+  camera.view = fw::look_at(fw::Vector(10.0f, 60.0f, -40.0f), fw::Vector(20.0f, 0.0f, 30.0f), fw::Vector(0, 1, 0));
+  camera.projection = fw::projection_perspective(fw::pi() / 3.0f, 1.3f, 1.0f, 500.0f);
+  const fw::Matrix viewproj = camera.view * camera.projection;
+  const fw::Frustum frustum(camera);
+
+  std::uniform_real_distribution<float> pos_dist(-600.0f, 600.0f);
+  std::uniform_real_distribution<float> size_dist(0.1f, 40.0f);
+  constexpr int kNumBoxes = 20000;
+  constexpr int kGrid = 4;
+  int counts[3] = {0, 0, 0};
+  for (int i = 0; i < kNumBoxes; i++) {
+    const fw::Vector center(pos_dist(rng), pos_dist(rng) * 0.1f, pos_dist(rng));
+    const fw::Vector half_size(size_dist(rng), size_dist(rng), size_dist(rng));
+    const fw::Bounds bounds(center - half_size, center + half_size);
+    const fw::Frustum::Result result = frustum.test(bounds);
+    counts[static_cast<int>(result)]++;
+
+    int num_in_view = 0;
+    for (int x = 0; x < kGrid; x++) {
+      for (int y = 0; y < kGrid; y++) {
+        for (int z = 0; z < kGrid; z++) {
+          const fw::Vector t(x / (kGrid - 1.0f), y / (kGrid - 1.0f), z / (kGrid - 1.0f));
+          const fw::Vector point(
+              bounds.get_min()[0] + (bounds.get_max()[0] - bounds.get_min()[0]) * t[0],
+              bounds.get_min()[1] + (bounds.get_max()[1] - bounds.get_min()[1]) * t[1],
+              bounds.get_min()[2] + (bounds.get_max()[2] - bounds.get_min()[2]) * t[2]);
+          if (is_in_view(viewproj, point)) {
+            num_in_view++;
+          }
+        }
+      }
+    }
+
+    if (result == fw::Frustum::Result::kOutside && num_in_view > 0) {
+      LOG(ERR) << "box " << i << " was culled, but " << num_in_view << " of it's points are in view";
+      return false;
+    }
+    if (result == fw::Frustum::Result::kInside && num_in_view != kGrid * kGrid * kGrid) {
+      LOG(ERR) << "box " << i << " is supposed to be inside, but only " << num_in_view << " of it's points are";
+      return false;
+    }
+  }
+
+  LOG(INFO) << kNumBoxes << " random boxes: " << counts[0] << " culled, " << counts[1] << " intersecting, "
+            << counts[2] << " inside";
+  return true;
+}
+
+// Checks that model bounds are propagated up the hierarchy, and that the scenegraph culls with them.
+bool run_model_bounds_test() {
+  // A unit cube.
+  auto mesh = std::make_shared<fw::ModelMeshNoanim>(8, 0);
+  for (int i = 0; i < 8; i++) {
+    mesh->vertices[i].x = (i & 1) ? 1.0f : -1.0f;
+    mesh->vertices[i].y = (i & 2) ? 1.0f : -1.0f;
+    mesh->vertices[i].z = (i & 4) ? 1.0f : -1.0f;
+  }
+  mesh->update_bounds();
+  std::vector<std::shared_ptr<fw::ModelMesh>> meshes = {mesh};
+
+  // The root has the cube, it's child has another cube 10 units along x, and that one's child has one 10 units up
+  // (from it's parent, so 10 along x as well).
+  auto root = std::make_shared<fw::ModelNode>();
+  root->mesh_index = 0;
+  auto child = std::make_shared<fw::ModelNode>();
+  child->mesh_index = 0;
+  child->transform = fw::translation(10.0f, 0.0f, 0.0f);
+  auto grandchild = std::make_shared<fw::ModelNode>();
+  grandchild->mesh_index = 0;
+  grandchild->transform = fw::translation(0.0f, 10.0f, 0.0f);
+  child->add_child(grandchild);
+  root->add_child(child);
+  root->update_bounds(meshes);
+
+  fw::Bounds const &bounds = root->get_bounds();
+  const fw::Vector expected_min(-1.0f, -1.0f, -1.0f);
+  const fw::Vector expected_max(11.0f, 11.0f, 1.0f);
+  if ((bounds.get_min() - expected_min).length() > 0.0001f || (bounds.get_max() - expected_max).length() > 0.0001f) {
+    LOG(ERR) << "root bounds are (" << bounds.get_min()[0] << ", " << bounds.get_min()[1] << ", "
+             << bounds.get_min()[2] << ") - (" << bounds.get_max()[0] << ", " << bounds.get_max()[1] << ", "
+             << bounds.get_max()[2] << ")";
+    return false;
+  }
+  for (fw::Vector const &corner : {fw::Vector(-1, -1, -1), fw::Vector(11, 11, 1), fw::Vector(11, -1, -1)}) {
+    if ((corner - bounds.get_center()).length() > bounds.get_radius() + 0.0001f) {
+      LOG(ERR) << "root bounding sphere doesn't contain all the meshes";
+      return false;
+    }
+  }
+  auto clone = std::dynamic_pointer_cast<fw::ModelNode>(root->clone());
+  if ((clone->get_bounds().get_max() - expected_max).length() > 0.0001f) {
+    LOG(ERR) << "cloned node doesn't have the same bounds";
+    return false;
+  }
+
+  // Now put the model in front of and behind a camera.
+  fw::CameraRenderState camera;
+  camera.view = fw::look_at(fw::Vector(0.0f, 0.0f, -50.0f), fw::Vector(0.0f, 0.0f, 0.0f), fw::Vector(0, 1, 0));
+  camera.projection = fw::projection_perspective(fw::pi() / 3.0f, 1.3f, 1.0f, 500.0f);
+  fw::sg::Scenegraph scenegraph;
+  if (scenegraph.cull(bounds, fw::translation(0.0f, 0.0f, -100.0f))) {
+    LOG(ERR) << "culled a model without a camera";
+    return false;
+  }
+  scenegraph.push_camera(camera);
+  const bool culled_in_front = scenegraph.cull(bounds, fw::translation(0.0f, 0.0f, 20.0f));
+  const bool culled_behind = scenegraph.cull(bounds, fw::translation(0.0f, 0.0f, -100.0f));
+  const bool culled_beside = scenegraph.cull(bounds, fw::translation(200.0f, 0.0f, 0.0f));
+  const bool culled_too_far = scenegraph.cull(bounds, fw::translation(0.0f, 0.0f, 600.0f));
+  scenegraph.pop_camera();
+  if (culled_in_front || !culled_behind || !culled_beside || !culled_too_far) {
+    LOG(ERR) << "culled in front: " << culled_in_front << ", behind: " << culled_behind << ", beside: "
+             << culled_beside << ", too far: " << culled_too_far;
+    return false;
+  }
+  if (scenegraph.get_cull_stats().num_visible != 1 || scenegraph.get_cull_stats().num_culled != 3) {
+    LOG(ERR) << "cull stats are " << scenegraph.get_cull_stats().num_visible << " visible, "
+             << scenegraph.get_cull_stats().num_culled << " culled";
+    return false;
+  }
+  return true;
+}
+
+// Checks that every node ended up where the last update moved it to.
+bool check_node_transforms(std::vector<std::shared_ptr<fw::sg::Node>> const &nodes, int last_update) {
+  for (int i = 0; i < static_cast<int>(nodes.size()); i++) {
+    const fw::Vector pos = nodes[i]->get_world_matrix() * fw::Vector(0.0f, 0.0f, 0.0f);
+    if (pos[0] != static_cast<float>(last_update) || pos[1] != static_cast<float>(i)) {
+      LOG(ERR) << "node " << i << " ended up at (" << pos[0] << ", " << pos[1] << "), expected (" << last_update
+               << ", " << i << ")";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Moves a bunch of nodes around through a TransformChannel. First we time pushing one update's worth of transforms at
+// a time and compare it with enqueuing a closure for each one, like we used to. Then we have an "update" thread push
+// transforms as fast as it can while the "render" thread applies them. Neither of them should allocate anything, and
+// each node should end up where it was last moved to.
+bool run_transform_channel_test() {
+  const int num_nodes = fw::Settings::get<int>("units");
+  const int num_updates = fw::Settings::get<int>("updates");
+  std::vector<std::shared_ptr<fw::sg::Node>> nodes;
+  for (int i = 0; i < num_nodes; i++) {
+    nodes.push_back(std::make_shared<fw::sg::Node>());
+  }
+  const int64_t num_records = static_cast<int64_t>(num_nodes) * num_updates;
+
+  fw::sg::TransformChannel channel;
+  float push_seconds = 0.0f;
+  int64_t allocations_before = g_num_allocations;
+  for (int update = 0; update < num_updates; update++) {
+    fw::Timer timer;
+    timer.start();
+    for (int i = 0; i < num_nodes; i++) {
+      const fw::Matrix transform = fw::translation(static_cast<float>(update), static_cast<float>(i), 1.0f);
+      if (!channel.push(nodes[i].get(), transform)) {
+        LOG(ERR) << "transform channel filled up after " << i << " nodes";
+        return false;
+      }
+    }
+    channel.end_update(fw::Clock::now(), fw::identity(), fw::identity());
+    timer.stop();
+    push_seconds += timer.get_total_time();
+    channel.apply();
+  }
+  const int64_t push_allocations = g_num_allocations - allocations_before;
+  if (push_allocations != 0) {
+    LOG(ERR) << "transform channel allocated " << push_allocations << " times";
+    return false;
+  }
+  if (!check_node_transforms(nodes, num_updates - 1)) {
+    return false;
+  }
+
+  // Things that interpolate on their own (like particles) remember the update they were made in and ask the
+  // scenegraph for it's alpha, so both sides have to agree on the update numbers.
+  if (channel.get_num_updates() != num_updates || channel.get_next_update() != num_updates + 1) {
+    LOG(ERR) << "render thread is at update " << channel.get_num_updates() << ", update thread is at update "
+             << channel.get_next_update() << ", expected " << num_updates << " and " << (num_updates + 1);
+    return false;
+  }
+  fw::sg::Scenegraph interpolation_sg;
+  interpolation_sg.set_interpolation(channel.get_num_updates(), 0.5f);
+  if (interpolation_sg.get_interpolation_alpha(num_updates) != 0.5f
+      || interpolation_sg.get_interpolation_alpha(num_updates - 1) != 1.0f
+      || interpolation_sg.get_interpolation_alpha(num_updates + 1) != 0.0f) {
+    LOG(ERR) << "unexpected interpolation alpha for the last, previous or next update";
+    return false;
+  }
+
+  std::mutex mutex;
+  std::list<std::function<void(fw::sg::Scenegraph &)>> closures;
+  float closure_seconds = 0.0f;
+  allocations_before = g_num_allocations;
+  for (int update = 0; update < num_updates; update++) {
+    fw::Timer timer;
+    timer.start();
+    for (int i = 0; i < num_nodes; i++) {
+      const fw::Matrix transform = fw::translation(static_cast<float>(update), static_cast<float>(i), 1.0f);
+      std::unique_lock<std::mutex> lock(mutex);
+      closures.push_back([transform, node = nodes[i]](fw::sg::Scenegraph &) {
+        node->set_local_transform(transform);
+      });
+    }
+    timer.stop();
+    closure_seconds += timer.get_total_time();
+    closures.clear();
+  }
+  const int64_t closure_allocations = g_num_allocations - allocations_before;
+  LOG(INFO) << num_records << " transforms: " << (num_records / push_seconds / 1000000.0f)
+            << "M per second through the transform channel with no allocations, "
+            << (num_records / closure_seconds / 1000000.0f) << "M per second as closures with "
+            << (closure_allocations / num_updates) << " allocations per update";
+
+  // Now the stress test, with the update and render threads running at the same time.
+  std::atomic<bool> done = false;
+  int64_t update_allocations = 0;
+  int64_t num_full = 0;
+  std::thread update_thread([&]() {
+    const int64_t allocations_before = g_num_allocations;
+    for (int update = 0; update < num_updates; update++) {
+      for (int i = 0; i < num_nodes; i++) {
+        const fw::Matrix transform = fw::translation(static_cast<float>(update), static_cast<float>(i), 1.0f);
+        while (!channel.push(nodes[i].get(), transform)) {
+          // Like ScenegraphManager, we have to let the render thread see what we've pushed so it can make room.
+          num_full++;
+          channel.flush();
+          std::this_thread::yield();
+        }
+      }
+      channel.end_update(fw::Clock::now(), fw::identity(), fw::identity());
+    }
+    update_allocations = g_num_allocations - allocations_before;
+    done = true;
+  });
+
+  allocations_before = g_num_allocations;
+  int64_t num_applied = 0;
+  int num_frames = 0;
+  while (true) {
+    // Check done before we apply, so that we don't miss anything that was pushed just before it was set.
+    const bool finished = done;
+    num_applied += channel.apply();
+    num_frames++;
+    if (finished) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  const int64_t render_allocations = g_num_allocations - allocations_before;
+  update_thread.join();
+
+  if (num_applied != num_records) {
+    LOG(ERR) << "pushed " << num_records << " transforms, but applied " << num_applied;
+    return false;
+  }
+  if (update_allocations != 0 || render_allocations != 0) {
+    LOG(ERR) << "transform channel allocated " << update_allocations << " times on the update thread and "
+             << render_allocations << " times on the render thread";
+    return false;
+  }
+  if (!check_node_transforms(nodes, num_updates - 1)) {
+    return false;
+  }
+  LOG(INFO) << "stress test: " << num_records << " transforms applied over " << num_frames << " frames (the channel "
+            << "was full " << num_full << " times), no allocations";
+  return true;
+}
+
+// Something moving in a straight line and turning at a constant rate, so we know exactly where it should be at any
+// time, and interpolating between any two updates should get it exactly right.
+struct Motion {
+  fw::Vector start;
+  fw::Vector velocity;
+  float turn_rate;
+
+  fw::Matrix at(float time) const {
+    return fw::rotate_axis_angle(fw::Vector(0, 1, 0), turn_rate * time).to_matrix()
+        * fw::translation(start + velocity * time);
+  }
+
+  // A camera that's in the same place and looking the same way as we would be.
+  fw::Matrix view_at(float time) const {
+    const fw::Vector eye = start + velocity * time;
+    const fw::Vector forward = fw::rotate_axis_angle(fw::Vector(0, 1, 0), turn_rate * time) * fw::Vector(0, 0, 1);
+    return fw::look_at(eye, eye + forward, fw::Vector(0, 1, 0));
+  }
+};
+
+float max_difference(fw::Matrix const &lhs, fw::Matrix const &rhs) {
+  float diff = 0.0f;
+  for (int col = 0; col < 4; col++) {
+    for (int row = 0; row < 4; row++) {
+      diff = std::max(diff, std::abs(lhs.m[col][row] - rhs.m[col][row]));
+    }
+  }
+  return diff;
+}
+
+// Plays back some moving nodes and a moving camera at 40 updates per second through a TransformChannel, and renders
+// them at ~144 frames per second (with a bit of jitter, and one long frame), the way the Framework does. Each frame, the
+// nodes and camera should be exactly where their motion says they were one update ago.
+bool run_interpolation_test(std::mt19937 &rng) {
+  constexpr int kNumNodes = 16;
+  constexpr int kNumUpdates = 40;
+  const fw::Clock::duration update_interval = std::chrono::microseconds(1000000 / 40);
+  const float update_seconds = std::chrono::duration<float>(update_interval).count();
+
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<Motion> motions;
+  std::vector<std::shared_ptr<fw::ModelNode>> nodes;
+  for (int i = 0; i < kNumNodes; i++) {
+    motions.push_back(Motion {
+        fw::Vector(dist(rng) * 50.0f, 0.0f, dist(rng) * 50.0f), fw::Vector(dist(rng) * 10.0f, 0.0f, dist(rng) * 10.0f),
+        dist(rng) * 4.0f});
+    nodes.push_back(std::make_shared<fw::ModelNode>());
+  }
+  const Motion camera_motion {fw::Vector(0.0f, 30.0f, -40.0f), fw::Vector(5.0f, 0.0f, 3.0f), 0.5f};
+
+  // This one only moves in the first update, after that it should just stay where it ended up.
+  auto stopped_node = std::make_shared<fw::ModelNode>();
+
+  fw::sg::TransformChannel channel;
+  fw::sg::Scenegraph scenegraph;
+  const fw::Clock::time_point start_time = fw::Clock::now();
+  int num_updates = 0;
+  auto run_updates_until = [&](fw::Clock::time_point now) {
+    // Update n is for time n * update_interval, and we send it when it's due, like the update thread does.
+    while (num_updates < kNumUpdates && start_time + num_updates * update_interval <= now) {
+      const float previous_time = (num_updates - 1) * update_seconds;
+      const float time = num_updates * update_seconds;
+      for (int i = 0; i < kNumNodes; i++) {
+        channel.push(nodes[i].get(), motions[i].at(num_updates == 0 ? time : previous_time), motions[i].at(time));
+      }
+      if (num_updates == 1) {
+        channel.push(stopped_node.get(), motions[0].at(previous_time), motions[0].at(time));
+      }
+      channel.end_update(
+          start_time + num_updates * update_interval,
+          camera_motion.view_at(num_updates == 0 ? time : previous_time), camera_motion.view_at(time));
+      num_updates++;
+    }
+  };
+
+  // The frames start once we've had two updates, so there's something to interpolate between.
+  std::uniform_int_distribution<int> frame_micros(6000, 8000);
+  fw::Clock::time_point now = start_time + update_interval;
+  float max_error = 0.0f;
+  float max_camera_error = 0.0f;
+  float max_error_without_interpolation = 0.0f;
+  int num_frames = 0;
+  while (now < start_time + (kNumUpdates - 1) * update_interval) {
+    run_updates_until(now);
+    channel.apply();
+    const float alpha = channel.get_alpha(now, update_interval);
+    scenegraph.set_interpolation(channel.get_num_updates(), alpha);
+
+    // The last update we've had is for now - alpha updates ago, and we draw one update behind that.
+    const float time = std::chrono::duration<float>(now - start_time).count() - update_seconds;
+    for (int i = 0; i < kNumNodes; i++) {
+      const fw::Matrix expected = motions[i].at(time);
+      max_error = std::max(max_error, max_difference(nodes[i]->get_render_transform(scenegraph), expected));
+      max_error_without_interpolation =
+          std::max(max_error_without_interpolation, max_difference(nodes[i]->get_local_transform(), expected));
+    }
+    max_camera_error =
+        std::max(max_camera_error, max_difference(channel.interpolate_view(alpha), camera_motion.view_at(time)));
+    if (num_updates > 2
+        && max_difference(stopped_node->get_render_transform(scenegraph), motions[0].at(update_seconds)) > 0.0001f) {
+      LOG(ERR) << "a node that stopped moving is still being interpolated";
+      return false;
+    }
+
+    // One long frame in the middle, so that we miss a few updates.
+    num_frames++;
+    now += std::chrono::microseconds(num_frames == 100 ? 110000 : frame_micros(rng));
+  }
+
+  LOG(INFO) << "interpolation: " << num_frames << " frames, max error " << max_error << " (" << max_camera_error
+            << " for the camera), without interpolation it would have been " << max_error_without_interpolation;
+  if (max_error > 0.001f || max_camera_error > 0.001f) {
+    LOG(ERR) << "interpolated transforms are too far from where they should be";
+    return false;
+  }
+  return true;
+}
+
+// Like run_interpolation_test, but the nodes are moved by a simulation that only runs once a turn (every 8 updates,
+// like 200ms turns), and pushed every update through a TurnInterpolator, the way MeshComponent does. They should move
+// smoothly, a turn and an update behind the simulation, rather than moving for one update and stopping for seven.
+bool run_turn_interpolation_test(std::mt19937 &rng) {
+  constexpr int kNumNodes = 16;
+  constexpr int kUpdatesPerTurn = 8;
+  constexpr int kNumUpdates = kUpdatesPerTurn * 10;
+  const fw::Clock::duration update_interval = std::chrono::microseconds(1000000 / 40);
+  const float update_seconds = std::chrono::duration<float>(update_interval).count();
+  const float turn_seconds = update_seconds * kUpdatesPerTurn;
+
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<Motion> motions;
+  std::vector<std::shared_ptr<fw::ModelNode>> nodes;
+  std::vector<fw::sg::TurnInterpolator> interpolators(kNumNodes);
+  std::vector<fw::Matrix> last_transforms(kNumNodes);
+
+  // These are pushed only when the simulation moves them, like MeshComponent used to.
+  std::vector<std::shared_ptr<fw::ModelNode>> turn_only_nodes;
+  for (int i = 0; i < kNumNodes; i++) {
+    motions.push_back(Motion {
+        fw::Vector(dist(rng) * 50.0f, 0.0f, dist(rng) * 50.0f), fw::Vector(dist(rng) * 10.0f, 0.0f, dist(rng) * 10.0f),
+        dist(rng) * 4.0f});
+    nodes.push_back(std::make_shared<fw::ModelNode>());
+    turn_only_nodes.push_back(std::make_shared<fw::ModelNode>());
+  }
+
+  fw::sg::TransformChannel channel;
+  fw::sg::Scenegraph scenegraph;
+  const fw::Clock::time_point start_time = fw::Clock::now();
+  int num_updates = 0;
+  auto run_updates_until = [&](fw::Clock::time_point now) {
+    while (num_updates < kNumUpdates && start_time + num_updates * update_interval <= now) {
+      const int turn = num_updates / kUpdatesPerTurn;
+      const bool new_turn = (num_updates % kUpdatesPerTurn) == 0;
+      const float turn_alpha = static_cast<float>(num_updates % kUpdatesPerTurn) / kUpdatesPerTurn;
+      for (int i = 0; i < kNumNodes; i++) {
+        if (new_turn) {
+          const fw::Matrix simulated = motions[i].at(turn * turn_seconds);
+          interpolators[i].set_target(simulated);
+          channel.push(turn_only_nodes[i].get(), turn == 0 ? simulated : motions[i].at((turn - 1) * turn_seconds),
+              simulated);
+        }
+        const fw::Matrix transform = interpolators[i].get(turn_alpha);
+        channel.push(nodes[i].get(), num_updates == 0 ? transform : last_transforms[i], transform);
+        last_transforms[i] = transform;
+      }
+      channel.end_update(start_time + num_updates * update_interval, fw::identity(), fw::identity());
+      num_updates++;
+    }
+  };
+
+  // The first turn has nothing to move from, so the frames start once we're into the second one.
+  std::uniform_int_distribution<int> frame_micros(6000, 8000);
+  fw::Clock::time_point now = start_time + (kUpdatesPerTurn + 1) * update_interval;
+  float max_error = 0.0f;
+  float max_error_turn_only = 0.0f;
+  int num_frames = 0;
+  while (now < start_time + (kNumUpdates - 1) * update_interval) {
+    run_updates_until(now);
+    channel.apply();
+    scenegraph.set_interpolation(channel.get_num_updates(), channel.get_alpha(now, update_interval));
+
+    const float time = std::chrono::duration<float>(now - start_time).count() - update_seconds - turn_seconds;
+    for (int i = 0; i < kNumNodes; i++) {
+      const fw::Matrix expected = motions[i].at(time);
+      max_error = std::max(max_error, max_difference(nodes[i]->get_render_transform(scenegraph), expected));
+      max_error_turn_only = std::max(
+          max_error_turn_only, max_difference(turn_only_nodes[i]->get_render_transform(scenegraph), expected));
+    }
+
+    num_frames++;
+    now += std::chrono::microseconds(frame_micros(rng));
+  }
+
+  LOG(INFO) << "turn interpolation: " << num_frames << " frames, max error " << max_error
+            << ", only moving them when they're simulated it would have been " << max_error_turn_only;
+  if (max_error > 0.001f) {
+    LOG(ERR) << "nodes moved once a turn are too far from where they should be";
+    return false;
+  }
+  return true;
+}
+
+int run_test() {
+  std::mt19937 rng(fw::Settings::get<int>("seed"));
+  std::vector<Item> items = build_scene(fw::Settings::get<int>("units"), rng);
+  FakeObjects objects(kNumPrograms, static_cast<int>(items.size()), 1024);
+
+  fw::sg::RenderQueue queue;
+  fw::sg::RecordingRenderBackend backend;
+  add_items(queue, items, objects);
+  queue.execute(backend);
+  if (!check_draws(items, backend)) {
+    return 1;
+  }
+
+  // Drawing each item on it's own, like we used to, means binding a program, parameters, and two buffers every time.
+  fw::sg::RenderQueue::Stats const &stats = queue.get_stats();
+  const int num_items = static_cast<int>(items.size());
+  const int binds = stats.num_program_binds + stats.num_parameter_binds + stats.num_buffer_binds;
+  LOG(INFO) << num_items << " draws: " << stats.num_program_binds << " program binds, " << stats.num_parameter_binds
+            << " parameter binds, " << stats.num_buffer_binds << " buffer binds (" << binds << " binds, down from "
+            << (num_items * 4) << ")";
+
+  const int num_frames = fw::Settings::get<int>("frames");
+  float seconds = 0.0f;
+  for (int frame = 0; frame < num_frames; frame++) {
+    backend.clear();
+    fw::Timer timer;
+    timer.start();
+    add_items(queue, items, objects);
+    queue.execute(backend);
+    timer.stop();
+    seconds += timer.get_total_time();
+  }
+  LOG(INFO) << "record, sort and execute: " << (seconds * 1000.0f / num_frames) << "ms per frame";
+
+  if (!run_instancing_test(rng)) {
+    return 1;
+  }
+  if (!run_frustum_test(rng) || !run_model_bounds_test()) {
+    return 1;
+  }
+  if (!run_transform_channel_test() || !run_interpolation_test(rng) || !run_turn_interpolation_test(rng)) {
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  try {
+    auto status = settings_initialize(argc, argv);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      fw::Settings::print_help();
+      return 1;
+    }
+
+    fw::ToolApplication app;
+    new fw::Framework(&app);
+    auto continue_or_status = fw::Framework::get_instance()->initialize("Render Test");
+    if (!continue_or_status.ok()) {
+      LOG(ERR) << continue_or_status.status();
+      return 1;
+    }
+    if (!continue_or_status.value()) {
+      return 0;
+    }
+
+    if (run_test() > 0) {
+      return 1;
+    }
+  } catch (std::exception &e) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION!";
+    LOG(ERR) << e.what();
+
+    display_exception(e.what());
+  } catch (...) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION! (unknown exception)";
+  }
+
+  return 0;
+}
+
+void display_exception(std::string const &msg) {
+  std::stringstream ss;
+  ss << "An error has occurred. Please send your log file (below) to dean@codeka.com.au for diagnostics." << std::endl;
+  ss << std::endl;
+  ss << fw::LogFileName() << std::endl;
+  ss << std::endl;
+  ss << msg;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  fw::SettingDefinition extra_settings;
+  extra_settings.add_group("Additional options", "Render-test specific settings")
+      .add_setting<int>("units", "Number of units in the scene.", 1000)
+      .add_setting<int>("frames", "Number of frames to time.", 100)
+      .add_setting<int>("updates", "Number of updates to push through the transform channel.", 1000)
+      .add_setting<int>("seed", "Seed for the random number generator, so runs are repeatable.", 42);
+
+  return fw::Settings::initialize(extra_settings, argc, argv, "render-test.conf");
+}
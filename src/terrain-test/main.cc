@@ -0,0 +1,489 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include <framework/bounds.h>
+#include <framework/framework.h>
+#include <framework/graphics.h>
+#include <framework/logging.h>
+#include <framework/math.h>
+#include <framework/misc.h>
+#include <framework/settings.h>
+#include <framework/status.h>
+#include <framework/timer.h>
+
+#include <game/world/terrain.h>
+#include <game/world/terrain_helper.h>
+
+fw::Status settings_initialize(int argc, char** argv);
+void display_exception(std::string const &msg);
+
+static const int kPatchSize = game::Terrain::PATCH_SIZE;
+
+//-----------------------------------------------------------------------------
+
+// Generates a height map with some rolling hills, plus a little bit of noise so that no two patches are quite the
+// same (and none of them are perfectly smooth, unlike most of the maps made in the editor).
+std::vector<float> generate_heights(std::mt19937 &rng, int width, int length) {
+  std::uniform_real_distribution<float> phase_dist(0.0f, 2.0f * fw::pi());
+  std::uniform_real_distribution<float> noise_dist(-0.05f, 0.05f);
+  const float phases[] = {phase_dist(rng), phase_dist(rng), phase_dist(rng), phase_dist(rng)};
+
+  std::vector<float> heights(width * length);
+  for (int z = 0; z < length; z++) {
+    for (int x = 0; x < width; x++) {
+      // Whole numbers of waves across the map, so that it wraps around without a seam.
+      const float u = 2.0f * fw::pi() * x / width;
+      const float v = 2.0f * fw::pi() * z / length;
+      heights[(z * width) + x] = 20.0f
+          + (12.0f * std::sin((2.0f * u) + phases[0]) * std::cos((3.0f * v) + phases[1]))
+          + (4.0f * std::sin((9.0f * u) + (7.0f * v) + phases[2]))
+          + (1.5f * std::sin((31.0f * u) + phases[3]) * std::sin(29.0f * v))
+          + noise_dist(rng);
+    }
+  }
+  return heights;
+}
+
+// The height of the triangle under (x, z) in the given grid of vertices, where the cells are step apart and split from
+// (x, z) to (x + step, z + step). This is worked out from the vertices themselves, rather than the height map, so it
+// checks that the morph targets actually land on the next LOD.
+float get_surface_height(fw::vertex::xyz_n_uv const *vertices, int patch_size, int x, int z, int step) {
+  const int row = patch_size + 1;
+  const int x0 = std::min((x / step) * step, patch_size - step);
+  const int z0 = std::min((z / step) * step, patch_size - step);
+  const float fx = static_cast<float>(x - x0) / step;
+  const float fz = static_cast<float>(z - z0) / step;
+  const float h00 = vertices[(z0 * row) + x0].y;
+  const float h10 = vertices[(z0 * row) + x0 + step].y;
+  const float h01 = vertices[((z0 + step) * row) + x0].y;
+  const float h11 = vertices[((z0 + step) * row) + x0 + step].y;
+  if (fz >= fx) {
+    return h00 + (fz * (h01 - h00)) + (fx * (h11 - h01));
+  }
+  return h00 + (fx * (h10 - h00)) + (fz * (h11 - h10));
+}
+
+// The area of the given triangle, looking down from above. It's negative if the triangle is facing down.
+float get_area(fw::Vector const &a, fw::Vector const &b, fw::Vector const &c) {
+  return 0.5f * fw::cross(b - a, c - a)[1];
+}
+
+// Checks the index buffer for each LOD: the triangles have to cover the whole patch exactly once, all facing up, and
+// every edge that's not shared by two triangles has to be on the edge of the patch, with a skirt hanging down from it.
+// Returns the number of errors.
+int verify_indices() {
+  const int num_lods = game::get_num_terrain_lods(kPatchSize);
+  const int row = kPatchSize + 1;
+  const int num_patch_vertices = row * row;
+  const int num_vertices = num_patch_vertices + (4 * row);
+  int num_errors = 0;
+
+  auto get_position = [row](int index) {
+    return fw::Vector(static_cast<float>(index % row), 0.0f, static_cast<float>(index / row));
+  };
+
+  for (int lod = 0; lod < num_lods; lod++) {
+    const int step = 1 << lod;
+    std::vector<uint16_t> indices;
+    game::generate_terrain_lod_indices(indices, kPatchSize, lod);
+
+    float area = 0.0f;
+    int num_patch_triangles = 0;
+    std::map<std::tuple<int, int>, int> edge_counts;
+    std::vector<std::tuple<int, int>> skirt_edges;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      const int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+      if (a >= num_vertices || b >= num_vertices || c >= num_vertices) {
+        LOG(ERR) << "lod " << lod << ": triangle " << (i / 3) << " has an index out of range";
+        num_errors++;
+        continue;
+      }
+
+      if (a < num_patch_vertices && b < num_patch_vertices && c < num_patch_vertices) {
+        const float triangle_area = get_area(get_position(a), get_position(b), get_position(c));
+        if (triangle_area <= 0.0f) {
+          LOG(ERR) << "lod " << lod << ": triangle " << (i / 3) << " isn't facing up";
+          num_errors++;
+        }
+        area += triangle_area;
+        num_patch_triangles++;
+        for (auto edge : {std::make_tuple(a, b), std::make_tuple(b, c), std::make_tuple(c, a)}) {
+          edge_counts[std::make_tuple(std::min(std::get<0>(edge), std::get<1>(edge)),
+              std::max(std::get<0>(edge), std::get<1>(edge)))]++;
+        }
+      } else {
+        // A skirt triangle: the edge along the top is the one between the two vertices that are part of the patch.
+        std::vector<int> top;
+        for (int index : {a, b, c}) {
+          if (index < num_patch_vertices) {
+            top.push_back(index);
+          }
+        }
+        if (top.size() == 2) {
+          skirt_edges.push_back(std::make_tuple(std::min(top[0], top[1]), std::max(top[0], top[1])));
+        }
+      }
+    }
+
+    const int num_cells = kPatchSize / step;
+    if (num_patch_triangles != num_cells * num_cells * 2 || std::abs(area - (kPatchSize * kPatchSize)) > 0.001f) {
+      LOG(ERR) << "lod " << lod << ": " << num_patch_triangles << " triangle(s) covering " << area << " units, "
+               << "expected " << (num_cells * num_cells * 2) << " covering " << (kPatchSize * kPatchSize);
+      num_errors++;
+    }
+
+    for (auto const &entry : edge_counts) {
+      if (entry.second == 2) {
+        continue;
+      }
+      fw::Vector a = get_position(std::get<0>(entry.first));
+      fw::Vector b = get_position(std::get<1>(entry.first));
+      const bool on_edge = (a[0] == b[0] && (a[0] == 0.0f || a[0] == kPatchSize))
+          || (a[2] == b[2] && (a[2] == 0.0f || a[2] == kPatchSize));
+      if (entry.second != 1 || !on_edge) {
+        LOG(ERR) << "lod " << lod << ": edge (" << a[0] << ", " << a[2] << ") - (" << b[0] << ", " << b[2] << ") is "
+                 << "shared by " << entry.second << " triangle(s)";
+        num_errors++;
+      } else if (std::find(skirt_edges.begin(), skirt_edges.end(), entry.first) == skirt_edges.end()) {
+        LOG(ERR) << "lod " << lod << ": edge (" << a[0] << ", " << a[2] << ") - (" << b[0] << ", " << b[2] << ") "
+                 << "doesn't have a skirt";
+        num_errors++;
+      }
+    }
+
+    LOG(INFO) << "lod " << lod << ": " << num_patch_triangles << " triangle(s), " << indices.size() << " indices "
+              << "(including the skirt)";
+  }
+
+  // The original triangle strip should cover the patch exactly the same as LOD 0 does.
+  std::vector<uint16_t> strip;
+  game::generate_terrain_indices(strip, kPatchSize);
+  float strip_area = 0.0f;
+  for (size_t i = 2; i < strip.size(); i++) {
+    const float triangle_area = get_area(get_position(strip[i - 2]), get_position(strip[i - 1]), get_position(strip[i]));
+    // Every second triangle in a strip is wound the other way.
+    strip_area += std::abs(triangle_area);
+  }
+  if (std::abs(strip_area - (kPatchSize * kPatchSize)) > 0.001f) {
+    LOG(ERR) << "triangle strip covers " << strip_area << " units, expected " << (kPatchSize * kPatchSize);
+    num_errors++;
+  }
+
+  return num_errors;
+}
+
+// Checks that when a patch is fully morphed, every one of it's vertices is on the surface of the next LOD, so that
+// switching to that LOD doesn't change anything. Also checks the skirts, and that the errors make sense. Returns the
+// number of errors.
+int verify_morph(std::vector<float> &heights, int width, int length) {
+  const int num_lods = game::get_num_terrain_lods(kPatchSize);
+  const int row = kPatchSize + 1;
+  const float skirt_depth = 5.0f;
+  int num_errors = 0;
+
+  for (int patch_z = 0; patch_z < length / kPatchSize; patch_z += 3) {
+    for (int patch_x = 0; patch_x < width / kPatchSize; patch_x += 3) {
+      fw::vertex::xyz_n_uv *vertices;
+      const int num_vertices = game::generate_terrain_vertices(
+          &vertices, heights.data(), width, length, kPatchSize, patch_x, patch_z, skirt_depth);
+      if (num_vertices != (row * row) + (4 * row)) {
+        LOG(ERR) << "patch (" << patch_x << ", " << patch_z << ") has " << num_vertices << " vertices";
+        num_errors++;
+      }
+
+      for (int lod = 0; lod < num_lods - 1; lod++) {
+        const int step = 1 << lod;
+        for (int z = 0; z <= kPatchSize; z += step) {
+          for (int x = 0; x <= kPatchSize; x += step) {
+            // This is what the shader does with morph = 1.
+            fw::vertex::xyz_n_uv const &vertex = vertices[(z * row) + x];
+            const bool morphs = (x % (2 * step)) != 0 || (z % (2 * step)) != 0;
+            const float morphed = morphs ? vertex.u : vertex.y;
+            const float expected = get_surface_height(vertices, kPatchSize, x, z, 2 * step);
+            if (std::abs(morphed - expected) > 0.0001f) {
+              LOG(ERR) << "patch (" << patch_x << ", " << patch_z << ") lod " << lod << ": vertex (" << x << ", " << z
+                       << ") morphs to " << morphed << ", next lod is " << expected;
+              num_errors++;
+            }
+          }
+        }
+      }
+
+      // The skirt vertices (one set for each edge) have to be right under the edge vertices.
+      for (int i = row * row; i < num_vertices; i++) {
+        fw::vertex::xyz_n_uv const &skirt = vertices[i];
+        fw::vertex::xyz_n_uv const &top = vertices[(static_cast<int>(skirt.z) * row) + static_cast<int>(skirt.x)];
+        const bool on_edge = skirt.x == 0.0f || skirt.x == kPatchSize || skirt.z == 0.0f || skirt.z == kPatchSize;
+        if (!on_edge || std::abs((top.y - skirt.y) - skirt_depth) > 0.0001f
+            || std::abs((top.u - skirt.u) - skirt_depth) > 0.0001f) {
+          LOG(ERR) << "patch (" << patch_x << ", " << patch_z << "): skirt vertex " << i << " isn't under the edge";
+          num_errors++;
+        }
+      }
+      delete[] vertices;
+
+      game::TerrainLodInfo info;
+      game::calculate_terrain_lod_info(info, heights.data(), width, length, kPatchSize, patch_x, patch_z);
+      if (static_cast<int>(info.errors.size()) != num_lods || info.errors[0] != 0.0f
+          || !std::is_sorted(info.errors.begin(), info.errors.end())) {
+        LOG(ERR) << "patch (" << patch_x << ", " << patch_z << ") has bad errors";
+        num_errors++;
+      }
+    }
+  }
+
+  // A flat map and a sloped one are both exactly the same at every LOD, so they should have no error at all, and we
+  // should always pick the coarsest LOD. The map is two patches wide so the first patch doesn't wrap around to the
+  // other side of the slope.
+  for (int slope = 0; slope < 2; slope++) {
+    std::vector<float> plane(4 * kPatchSize * kPatchSize);
+    for (int z = 0; z < 2 * kPatchSize; z++) {
+      for (int x = 0; x < 2 * kPatchSize; x++) {
+        plane[(z * 2 * kPatchSize) + x] = 10.0f + (slope * ((0.3f * x) + (0.1f * z)));
+      }
+    }
+    game::TerrainLodInfo info;
+    game::calculate_terrain_lod_info(info, plane.data(), 2 * kPatchSize, 2 * kPatchSize, kPatchSize, 0, 0);
+    if (info.errors.back() > 0.0001f) {
+      LOG(ERR) << (slope == 0 ? "flat" : "sloped") << " patch has an error of " << info.errors.back();
+      num_errors++;
+    } else if (game::select_terrain_lod(info.errors, 1.0f, 1000.0f).lod != num_lods - 1) {
+      LOG(ERR) << (slope == 0 ? "flat" : "sloped") << " patch right next to the camera isn't at the coarsest lod";
+      num_errors++;
+    }
+  }
+
+  return num_errors;
+}
+
+// Moves the camera away from a patch one small step at a time, and checks that the LOD only ever gets coarser, and that
+// whenever it does, we were fully morphed to it just before and haven't started morphing away from it just after.
+// Returns the number of errors.
+int verify_selection(std::vector<float> &heights, int width, int length, float lod_scale) {
+  int num_errors = 0;
+  int num_switches = 0;
+  for (int patch_z = 0; patch_z < length / kPatchSize; patch_z += 2) {
+    for (int patch_x = 0; patch_x < width / kPatchSize; patch_x += 2) {
+      game::TerrainLodInfo info;
+      game::calculate_terrain_lod_info(info, heights.data(), width, length, kPatchSize, patch_x, patch_z);
+
+      const float max_distance = info.errors.back() * lod_scale * 1.1f;
+      const float step = max_distance / 100000.0f;
+      game::TerrainLod last = game::select_terrain_lod(info.errors, 0.0f, lod_scale);
+      for (float distance = step; distance < max_distance; distance += step) {
+        game::TerrainLod lod = game::select_terrain_lod(info.errors, distance, lod_scale);
+        if (lod.lod < last.lod) {
+          LOG(ERR) << "patch (" << patch_x << ", " << patch_z << "): lod went from " << last.lod << " to " << lod.lod
+                   << " at distance " << distance;
+          num_errors++;
+        } else if (lod.lod > last.lod) {
+          // We morph over the second half of the distance we spend at the last LOD. If that's only a few steps, we
+          // can't expect to have caught it right at the end.
+          const float morph_distance = (info.errors[lod.lod] - info.errors[last.lod]) * lod_scale * 0.5f;
+          num_switches++;
+          if (lod.lod != last.lod + 1) {
+            // We skipped a LOD, which is fine if it had the same error as the next one (we'd never pick it).
+            if (info.errors[last.lod + 1] != info.errors[lod.lod]) {
+              LOG(ERR) << "patch (" << patch_x << ", " << patch_z << "): lod went from " << last.lod << " to "
+                       << lod.lod << " at distance " << distance;
+              num_errors++;
+            }
+          } else if ((last.morph < 0.99f && morph_distance > 100.0f * step) || lod.morph > 0.01f) {
+            LOG(ERR) << "patch (" << patch_x << ", " << patch_z << "): lod went from " << last.lod << " (morph "
+                     << last.morph << ") to " << lod.lod << " (morph " << lod.morph << ") at distance " << distance;
+            num_errors++;
+          }
+        } else if (lod.morph < last.morph) {
+          LOG(ERR) << "patch (" << patch_x << ", " << patch_z << "): morph went backwards at distance " << distance;
+          num_errors++;
+        }
+        last = lod;
+      }
+    }
+  }
+
+  LOG(INFO) << "checked " << num_switches << " lod switch(es)";
+  return num_errors;
+}
+
+// Works out the LOD info for every patch on the map, and then chooses the patches to draw from a camera up on a hill
+// looking out across the map, comparing the number of triangles to the old way (3x3 patches around the point the camera
+// is looking at, at full resolution). Returns the number of errors.
+int run_benchmark() {
+  const int width = fw::Settings::get<int>("map-size");
+  const int length = width;
+  std::mt19937 rng(fw::Settings::get<int>("seed"));
+  std::vector<float> heights = generate_heights(rng, width, length);
+
+  const int patches_width = width / kPatchSize;
+  const int patches_length = length / kPatchSize;
+  std::vector<game::TerrainLodInfo> lod_infos(patches_width * patches_length);
+  fw::Timer timer;
+  timer.start();
+  for (int patch_z = 0; patch_z < patches_length; patch_z++) {
+    for (int patch_x = 0; patch_x < patches_width; patch_x++) {
+      game::calculate_terrain_lod_info(lod_infos[(patch_z * patches_width) + patch_x], heights.data(), width, length,
+          kPatchSize, patch_x, patch_z);
+    }
+  }
+  timer.stop();
+  LOG(INFO) << "calculated lod info for " << lod_infos.size() << " patch(es) in "
+            << (timer.get_total_time() * 1000.0f) << "ms";
+
+  int num_errors = verify_indices();
+  num_errors += verify_morph(heights, width, length);
+
+  // The same projection as fw::Camera.
+  const fw::Matrix projection = fw::projection_perspective(fw::pi() / 3.0f, 1.3f, 1.0f, 500.0f);
+  const float lod_scale = game::get_terrain_lod_scale(
+      projection, fw::Settings::get<int>("screen-height"), game::Terrain::MAX_PIXEL_ERROR);
+  num_errors += verify_selection(heights, width, length, lod_scale);
+
+  const int num_lods = game::get_num_terrain_lods(kPatchSize);
+  std::vector<int> lod_triangles(num_lods);
+  for (int lod = 0; lod < num_lods; lod++) {
+    const int num_cells = kPatchSize >> lod;
+    lod_triangles[lod] = num_cells * num_cells * 2;
+  }
+
+  auto get_lod_info = [&lod_infos, patches_width, patches_length](int patch_x, int patch_z)
+      -> game::TerrainLodInfo const & {
+    return lod_infos[(fw::constrain(patch_z, patches_length) * patches_width) + fw::constrain(patch_x, patches_width)];
+  };
+  const int range_x = std::min(static_cast<int>(game::Terrain::VIEW_RANGE), (patches_width - 1) / 2);
+  const int range_z = std::min(static_cast<int>(game::Terrain::VIEW_RANGE), (patches_length - 1) / 2);
+
+  // Spin the camera around in a circle, looking out at the terrain from above like the game's camera does.
+  const int num_views = fw::Settings::get<int>("views");
+  int num_selected = 0;
+  int num_triangles = 0;
+  int num_behind_camera = 0;
+  float selection_time = 0.0f;
+  std::vector<int> lod_counts(num_lods);
+  std::vector<game::SelectedTerrainPatch> selected;
+  for (int i = 0; i < num_views; i++) {
+    const float angle = (2.0f * fw::pi() * i) / num_views;
+    const fw::Vector lookat(width * 0.5f, 20.0f, length * 0.5f);
+    const fw::Vector eye = lookat + fw::Vector(std::cos(angle) * 60.0f, 60.0f, std::sin(angle) * 60.0f);
+    const fw::Matrix view = fw::look_at(eye, lookat, fw::Vector(0.0f, 1.0f, 0.0f));
+    const fw::Frustum frustum(view * projection);
+
+    selected.clear();
+    timer.start();
+    game::select_terrain_patches(selected, get_lod_info, kPatchSize, static_cast<int>(lookat[0] / kPatchSize),
+        static_cast<int>(lookat[2] / kPatchSize), range_x, range_z, frustum, eye, lod_scale);
+    timer.stop();
+    selection_time += timer.get_total_time();
+
+    const fw::Vector forward = (lookat - eye).normalized();
+    for (auto const &patch : selected) {
+      num_selected++;
+      num_triangles += lod_triangles[patch.lod.lod];
+      lod_counts[patch.lod.lod]++;
+
+      // A patch that's entirely behind the camera should never be drawn.
+      fw::Bounds bounds = get_lod_info(patch.patch_x, patch.patch_z).bounds.transformed(fw::translation(
+          static_cast<float>(patch.patch_x * kPatchSize), 0.0f, static_cast<float>(patch.patch_z * kPatchSize)));
+      bool behind = true;
+      for (int corner = 0; corner < 8; corner++) {
+        fw::Vector p((corner & 1) ? bounds.get_max()[0] : bounds.get_min()[0],
+            (corner & 2) ? bounds.get_max()[1] : bounds.get_min()[1],
+            (corner & 4) ? bounds.get_max()[2] : bounds.get_min()[2]);
+        if (fw::dot(p - eye, forward) > 0.0f) {
+          behind = false;
+        }
+      }
+      if (behind) {
+        num_behind_camera++;
+      }
+    }
+  }
+  if (num_behind_camera > 0) {
+    LOG(ERR) << num_behind_camera << " patch(es) behind the camera were selected";
+    num_errors++;
+  }
+
+  const int old_triangles = 9 * lod_triangles[0];
+  const float old_area = 9.0f * kPatchSize * kPatchSize;
+  const float avg_selected = static_cast<float>(num_selected) / num_views;
+  const float avg_triangles = static_cast<float>(num_triangles) / num_views;
+  LOG(INFO) << "old: 9 patch(es), " << old_triangles << " triangle(s), " << old_area << " square units";
+  LOG(INFO) << "lod: " << avg_selected << " patch(es), " << avg_triangles << " triangle(s), "
+            << (avg_selected * kPatchSize * kPatchSize) << " square units (" << ((2 * range_x) + 1) << "x"
+            << ((2 * range_z) + 1) << " patches in range), "
+            << (selection_time * 1000000.0f / num_views) << "us per selection";
+  std::stringstream ss;
+  for (int lod = 0; lod < num_lods; lod++) {
+    ss << " " << lod << ":" << lod_counts[lod];
+  }
+  LOG(INFO) << "patches drawn at each lod:" << ss.str();
+
+  LOG(INFO) << num_errors << " error(s)";
+  return num_errors;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  try {
+    auto status = settings_initialize(argc, argv);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      fw::Settings::print_help();
+      return 1;
+    }
+
+    fw::ToolApplication app;
+    new fw::Framework(&app);
+    auto continue_or_status = fw::Framework::get_instance()->initialize("Terrain Test");
+    if (!continue_or_status.ok()) {
+      LOG(ERR) << continue_or_status.status();
+      return 1;
+    }
+    if (!continue_or_status.value()) {
+      return 0;
+    }
+
+    if (run_benchmark() > 0) {
+      return 1;
+    }
+  } catch (std::exception &e) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION!";
+    LOG(ERR) << e.what();
+
+    display_exception(e.what());
+  } catch (...) {
+    LOG(ERR) << "--------------------------------------------------------------------------------";
+    LOG(ERR) << "UNHANDLED EXCEPTION! (unknown exception)";
+  }
+
+  return 0;
+}
+
+void display_exception(std::string const &msg) {
+  std::stringstream ss;
+  ss << "An error has occurred. Please send your log file (below) to dean@codeka.com.au for diagnostics." << std::endl;
+  ss << std::endl;
+  ss << fw::LogFileName() << std::endl;
+  ss << std::endl;
+  ss << msg;
+}
+
+fw::Status settings_initialize(int argc, char** argv) {
+  fw::SettingDefinition extra_settings;
+  extra_settings.add_group("Additional options", "Terrain-test specific settings")
+      .add_setting<int>("map-size", "Width and length of the generated map (a multiple of the patch size).", 1024)
+      .add_setting<int>("screen-height", "Height of the screen we're choosing LODs for, in pixels.", 1080)
+      .add_setting<int>("views", "Number of camera positions to choose patches from.", 360)
+      .add_setting<int>("seed", "Seed for the random number generator, so runs are repeatable.", 42);
+
+  return fw::Settings::initialize(extra_settings, argc, argv, "terrain-test.conf");
+}